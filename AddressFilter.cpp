@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "AddressFilter.h"
+
+uint8_t AddressFilter::lookup(uint32_t addr) const {
+  uint8_t lo = 0, hi = this->used;
+  while (lo < hi) {
+    uint8_t mid = (lo + hi) / 2;
+    if (this->addrs[mid] < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+bool AddressFilter::contains(uint32_t addr) const {
+  uint8_t pos = lookup(addr);
+  return pos < this->used && this->addrs[pos] == addr;
+}
+
+bool AddressFilter::accepts(uint32_t from, uint32_t to, uint8_t group_id) const {
+  if (group_id && group_id == this->group_id)
+    return true;
+  return contains(from) || (to && contains(to));
+}
+
+bool AddressFilter::add(uint32_t addr) {
+  if (!addr)
+    return false;
+  uint8_t pos = lookup(addr);
+  if (pos < this->used && this->addrs[pos] == addr) {
+    this->enabled = true;
+    return true;
+  }
+  if (this->used == this->capacity)
+    return false;
+  memmove(&this->addrs[pos + 1], &this->addrs[pos], (this->used - pos) * sizeof(*this->addrs));
+  this->addrs[pos] = addr;
+  this->used++;
+  this->enabled = true;
+  return true;
+}
+
+bool AddressFilter::remove(uint32_t addr) {
+  uint8_t pos = lookup(addr);
+  if (pos == this->used || this->addrs[pos] != addr)
+    return false;
+  memmove(&this->addrs[pos], &this->addrs[pos + 1], (this->used - pos - 1) * sizeof(*this->addrs));
+  this->used--;
+  return true;
+}
+
+#ifdef ADDRESS_FILTER_SIZE
+static uint32_t allowed_addrs[ADDRESS_FILTER_SIZE];
+AddressFilter address_filter(allowed_addrs, ADDRESS_FILTER_SIZE, ADDRESS_FILTER_GROUP);
+#endif // ADDRESS_FILTER_SIZE
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,91 @@
+#ifndef __MAX_ADDRESS_FILTER_H
+#define __MAX_ADDRESS_FILTER_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "Max.h"
+
+/**
+ * Decides which received frames to handle, so frames from other
+ * systems nearby (e.g. a neighbour's) are dropped right after their
+ * header is decoded, before they are parsed, printed or take up a slot
+ * in the device table.
+ *
+ * A frame is accepted when it is from or to one of the allowed
+ * addresses, or for the allowed group. Until something is allowed (or
+ * after clear()), the filter is inactive and accepts every frame.
+ * Removing the last allowed address leaves it active, so then it
+ * rejects every frame (except for the group, if any).
+ *
+ * Addresses are stored sorted in a caller-supplied array, so checking
+ * a frame is two binary searches.
+ */
+class AddressFilter {
+public:
+  /* addrs must have room for size entries, with size at most 255 */
+  AddressFilter(uint32_t *addrs, uint8_t size, uint8_t group_id)
+    : group_id(group_id), rejected(0), addrs(addrs), capacity(size), used(0),
+      enabled(group_id != 0) {}
+
+  /**
+   * Allow frames from or to addr, which makes the filter active.
+   * Returns false when there is no room left (or addr is 0, the
+   * broadcast address).
+   */
+  bool add(uint32_t addr);
+
+  /* Stop allowing addr. Returns false when it was not allowed. */
+  bool remove(uint32_t addr);
+
+  /* Allow nothing, making the filter inactive */
+  void clear() { this->used = 0; this->group_id = 0; this->enabled = false; }
+
+  /* Allow nothing but group_id (if not 0), keeping the filter active */
+  void allowOnly(uint8_t group_id) { this->used = 0; this->group_id = group_id; this->enabled = true; }
+
+  bool contains(uint32_t addr) const;
+
+  /**
+   * Should a frame with this header be handled? Counts the frames
+   * that are not.
+   */
+  bool check(uint32_t from, uint32_t to, uint8_t group_id) {
+    if (!active() || accepts(from, to, group_id))
+      return true;
+    this->rejected++;
+    return false;
+  }
+
+  bool active() const { return this->enabled || this->group_id; }
+
+  uint8_t count() const { return this->used; }
+  uint8_t size() const { return this->capacity; }
+  /* The allowed addresses, sorted */
+  uint32_t at(uint8_t i) const { return this->addrs[i]; }
+
+  /* Frames for this group are allowed as well (0 for none) */
+  uint8_t group_id;
+  /* Number of frames rejected */
+  uint16_t rejected;
+
+private:
+  bool accepts(uint32_t from, uint32_t to, uint8_t group_id) const;
+  /* Position in addrs where addr is or should be inserted */
+  uint8_t lookup(uint32_t addr) const;
+
+  uint32_t *addrs;
+  uint8_t capacity;
+  uint8_t used;
+  /* Something was allowed since the last clear() */
+  bool enabled;
+};
+
+#ifdef ADDRESS_FILTER_SIZE
+/* The filter applied to received frames, see Max.h */
+extern AddressFilter address_filter;
+#endif // ADDRESS_FILTER_SIZE
+
+#endif // __MAX_ADDRESS_FILTER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
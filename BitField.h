@@ -0,0 +1,91 @@
+#ifndef __MAX_BIT_FIELD_H
+#define __MAX_BIT_FIELD_H
+
+#include <stdint.h>
+
+/*
+ * Compile-time descriptions of fields in a message, from which the code
+ * to extract them is generated. Since everything about a field is a
+ * template parameter, get() inlines to a few loads, shifts and masks,
+ * without loops or variable shifts.
+ *
+ * Field layouts are declared as typedefs, for example:
+ *
+ *   typedef BitField<0, 6, 2, Mode> TheMode;
+ *   Mode m = TheMode::get(buf);
+ *   TheMode::set(buf, Mode::AUTO);
+ */
+
+/* Smallest unsigned type that holds the given number of bytes */
+template <uint8_t BYTES> struct BitFieldInt { typedef uint32_t type; };
+template <> struct BitFieldInt<1> { typedef uint8_t type; };
+template <> struct BitFieldInt<2> { typedef uint16_t type; };
+
+/* Load BYTES bytes as a big-endian number */
+template <uint8_t BYTES>
+struct BitFieldLoad {
+  static inline typename BitFieldInt<BYTES>::type load(const uint8_t *buf) {
+    typedef typename BitFieldInt<BYTES>::type Int;
+    return ((Int)BitFieldLoad<BYTES - 1>::load(buf) << 8) | buf[BYTES - 1];
+  }
+};
+
+template <>
+struct BitFieldLoad<1> {
+  static inline uint8_t load(const uint8_t *buf) { return buf[0]; }
+};
+
+/**
+ * A field of WIDTH bits, read from the big-endian number that starts
+ * at byte OFFSET, with its least significant bit at bit SHIFT of that
+ * number (so SHIFT 0 is the lowest bit of the last byte the field
+ * touches). The result is converted to T.
+ */
+template <uint8_t OFFSET, uint8_t SHIFT, uint8_t WIDTH, typename T = uint8_t>
+struct BitField {
+  static_assert(WIDTH > 0 && SHIFT + WIDTH <= 32, "BitField must fit in 32 bits");
+
+  /* Number of bytes read */
+  static const uint8_t BYTES = (SHIFT + WIDTH + 7) / 8;
+  /* Minimum buffer length needed to read this field */
+  static const uint8_t END = OFFSET + BYTES;
+  static const uint8_t BITS = WIDTH;
+
+  static inline T get(const uint8_t *buf) {
+    typedef typename BitFieldInt<BYTES>::type Int;
+    Int value = BitFieldLoad<BYTES>::load(buf + OFFSET) >> SHIFT;
+    /* Masking is not needed when the field ends at the top bit */
+    if (SHIFT + WIDTH < BYTES * 8)
+      value &= (Int)(((uint32_t)1 << (WIDTH % 32)) - 1);
+    return (T)value;
+  }
+
+  /* Store value in the field, leaving the other bits in buf alone */
+  static inline void set(uint8_t *buf, T value) {
+    const uint32_t mask = ((uint32_t)~(uint32_t)0 >> (32 - WIDTH)) << SHIFT;
+    uint32_t bits = ((uint32_t)value << SHIFT) & mask;
+    for (uint8_t i = 0; i < BYTES; ++i) {
+      uint8_t shift = (BYTES - 1 - i) * 8;
+      uint8_t m = mask >> shift;
+      buf[OFFSET + i] = (buf[OFFSET + i] & ~m) | (uint8_t)(bits >> shift);
+    }
+  }
+};
+
+/**
+ * A field whose bits are not adjacent in the message: the bits of HI
+ * followed by the bits of LO.
+ */
+template <typename HI, typename LO, typename T = uint16_t>
+struct BitFieldConcat {
+  static const uint8_t END = HI::END > LO::END ? HI::END : LO::END;
+  static const uint8_t BITS = HI::BITS + LO::BITS;
+
+  static inline T get(const uint8_t *buf) {
+    return (T)(((T)HI::get(buf) << LO::BITS) | LO::get(buf));
+  }
+};
+
+#endif // __MAX_BIT_FIELD_H
+
+/* vim: set sw=2 sts=2 expandtab: */
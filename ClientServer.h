@@ -0,0 +1,210 @@
+#ifndef __MAX_CLIENT_SERVER_H
+#define __MAX_CLIENT_SERVER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Arduino.h>
+#include <TStreaming.h>
+
+#include "Commands.h"
+#include "Output.h"
+
+/**
+ * TCP server that keeps track of up to CLIENTS connected clients, each
+ * with its own output buffer of BUFFER bytes and its own OutputFilter,
+ * so a slow client does not hold up the others and every client only
+ * gets the output it asked for.
+ *
+ * Clients send commands as lines of text, which are passed to the
+ * handler given to poll() along with the client's output and filter.
+ *
+ * Server and Client are EthernetServer and EthernetClient, but are
+ * template parameters to allow testing. Server must have accept()
+ * (Ethernet library 2.0 or later), so clients are known as soon as they
+ * connect.
+ */
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+class ClientServer {
+public:
+  typedef void (*LineHandler)(char *line, Print &reply, OutputFilter *filter);
+
+  ClientServer(Server &server, OutputRouter &router, OverflowPolicy policy, uint8_t levels)
+    : server(server), router(router), default_levels(levels) {
+    for (uint8_t i = 0; i < CLIENTS; ++i)
+      this->clients[i].out.policy = policy;
+  }
+
+  /**
+   * Start listening and add the clients to the router. Call once.
+   */
+  void begin();
+
+  /**
+   * Accept new clients, forget disconnected ones and pass the command
+   * lines received to handler, along with a Print to reply to that
+   * client and its output filter. Replies are written with
+   * OverflowPolicy::BLOCK, so they always arrive complete.
+   */
+  void poll(LineHandler handler);
+
+  /**
+   * Write out up to max buffered bytes to each client, as far as the
+   * client takes them without waiting.
+   */
+  void drain(size_t max);
+
+  void printStats(Print &p) const;
+  void resetStats();
+
+  /* Number of connected clients */
+  uint8_t count() const;
+
+  /* Is there output waiting to be written to any client? */
+  bool pending() const;
+
+private:
+  struct Subscriber {
+    Subscriber() : out(client, OverflowPolicy::BLOCK), active(false) {
+      filter.levels = 0;
+      filter.address = 0;
+    }
+
+    Client client;
+    BufferedPrint<BUFFER> out;
+    OutputFilter filter;
+    LineReader<COMMAND_LINE_LEN> line;
+    bool active;
+  };
+
+  void accept();
+  void disconnect(Subscriber *s);
+
+  Server &server;
+  OutputRouter &router;
+  uint8_t default_levels;
+  Subscriber clients[CLIENTS];
+};
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+void ClientServer<Server, Client, CLIENTS, BUFFER>::begin() {
+  this->server.begin();
+  for (uint8_t i = 0; i < CLIENTS; ++i)
+    this->router.add(&this->clients[i].out, &this->clients[i].filter);
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+void ClientServer<Server, Client, CLIENTS, BUFFER>::accept() {
+  Client c = this->server.accept();
+  if (!c)
+    return;
+
+  for (uint8_t i = 0; i < CLIENTS; ++i) {
+    Subscriber *s = &this->clients[i];
+    if (s->active)
+      continue;
+    s->client = c;
+    s->active = true;
+    s->line = LineReader<COMMAND_LINE_LEN>();
+    s->filter.levels = this->default_levels;
+    s->filter.address = 0;
+    return;
+  }
+
+  c.println(F("Too many clients"));
+  c.stop();
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+void ClientServer<Server, Client, CLIENTS, BUFFER>::disconnect(Subscriber *s) {
+  s->client.stop();
+  s->active = false;
+  s->filter.levels = 0;
+  /* Don't send this to the next client in this slot */
+  s->out.discard();
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+void ClientServer<Server, Client, CLIENTS, BUFFER>::poll(LineHandler handler) {
+  accept();
+
+  for (uint8_t i = 0; i < CLIENTS; ++i) {
+    Subscriber *s = &this->clients[i];
+    if (!s->active)
+      continue;
+
+    if (!s->client.connected()) {
+      disconnect(s);
+      continue;
+    }
+
+    /* Read at most a line at a time, to not spend too long here */
+    for (uint8_t n = 0; n < COMMAND_LINE_LEN && s->client.available(); ++n) {
+      int c = s->client.read();
+      if (c < 0)
+        break;
+      char *line = s->line.feed(c);
+      if (line) {
+        /* A reply may be longer than the buffer, but must not lose
+         * lines, so it waits for the client instead */
+        OverflowPolicy policy = s->out.policy;
+        s->out.policy = OverflowPolicy::BLOCK;
+        handler(line, s->out, &s->filter);
+        s->out.policy = policy;
+        break;
+      }
+    }
+  }
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+void ClientServer<Server, Client, CLIENTS, BUFFER>::drain(size_t max) {
+  for (uint8_t i = 0; i < CLIENTS; ++i) {
+    Subscriber *s = &this->clients[i];
+    if (!s->active)
+      continue;
+    int room = s->client.availableForWrite();
+    if (room > 0)
+      s->out.drain((size_t)room < max ? room : max);
+  }
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+void ClientServer<Server, Client, CLIENTS, BUFFER>::printStats(Print &p) const {
+  for (uint8_t i = 0; i < CLIENTS; ++i) {
+    const Subscriber *s = &this->clients[i];
+    if (!s->active)
+      continue;
+    p << F("Client ") << i << F(" (");
+    print_output_levels(p, s->filter.levels);
+    p << ") ";
+    s->out.printStats(p, F("output"));
+  }
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+void ClientServer<Server, Client, CLIENTS, BUFFER>::resetStats() {
+  for (uint8_t i = 0; i < CLIENTS; ++i)
+    this->clients[i].out.resetStats();
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+uint8_t ClientServer<Server, Client, CLIENTS, BUFFER>::count() const {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < CLIENTS; ++i)
+    if (this->clients[i].active)
+      n++;
+  return n;
+}
+
+template <typename Server, typename Client, uint8_t CLIENTS, size_t BUFFER>
+bool ClientServer<Server, Client, CLIENTS, BUFFER>::pending() const {
+  for (uint8_t i = 0; i < CLIENTS; ++i)
+    if (this->clients[i].active && this->clients[i].out.pending())
+      return true;
+  return false;
+}
+
+#endif // __MAX_CLIENT_SERVER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,111 @@
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+#include <TStreaming.h>
+
+#include "Commands.h"
+
+char *next_word(char **str) {
+  char *s = *str;
+  while (*s == ' ')
+    ++s;
+  char *word = s;
+  while (*s && *s != ' ')
+    ++s;
+  if (*s)
+    *s++ = '\0';
+  while (*s == ' ')
+    ++s;
+  *str = s;
+  return word;
+}
+
+bool run_command(const Command *table, uint8_t count, char *line, CommandContext &ctx) {
+  char *name = next_word(&line);
+  if (!*name)
+    return true;
+
+  for (uint8_t i = 0; i < count; ++i) {
+    if (strcmp_P(name, (const char*)pgm_read_ptr(&table[i].name)) == 0) {
+      void (*handler)(char *, CommandContext &);
+      handler = (void (*)(char *, CommandContext &))pgm_read_ptr(&table[i].handler);
+      handler(line, ctx);
+      return true;
+    }
+  }
+
+  ctx.reply << F("ERR unknown command, try help") << "\r\n";
+  return false;
+}
+
+void print_command_help(const Command *table, uint8_t count, Print &p) {
+  for (uint8_t i = 0; i < count; ++i) {
+    p << (const FlashString*)pgm_read_ptr(&table[i].name);
+    const FlashString *args = (const FlashString*)pgm_read_ptr(&table[i].args);
+    if (args)
+      p << " " << args;
+    p << F(" - ") << (const FlashString*)pgm_read_ptr(&table[i].help) << "\r\n";
+  }
+}
+
+void command_sub(char *args, CommandContext &ctx) {
+  if (*args && !parse_output_levels(args, &ctx.filter->levels)) {
+    ctx.reply << F("ERR unknown level, use any of irmst") << "\r\n";
+    return;
+  }
+  ctx.reply << F("OK ");
+  print_output_levels(ctx.reply, ctx.filter->levels);
+  ctx.reply << "\r\n";
+}
+
+void command_filter(char *args, CommandContext &ctx) {
+  uint32_t addr = 0;
+  if (*args && !parse_address(args, &addr)) {
+    ctx.reply << F("ERR invalid address") << "\r\n";
+    return;
+  }
+  ctx.filter->address = addr;
+  ctx.reply << F("OK") << "\r\n";
+}
+
+bool parse_address(const char *str, uint32_t *addr) {
+  char *end;
+  if (!*str)
+    return false;
+  uint32_t value = strtoul(str, &end, 16);
+  if (*end || value > 0xffffff)
+    return false;
+  *addr = value;
+  return true;
+}
+
+bool parse_number(const char *str, uint16_t max, uint16_t *value) {
+  char *end;
+  if (!*str)
+    return false;
+  unsigned long v = strtoul(str, &end, 10);
+  if (*end || v > max)
+    return false;
+  *value = v;
+  return true;
+}
+
+bool parse_temperature(const char *str, uint8_t max, uint8_t *value) {
+  char *end;
+  if (!*str)
+    return false;
+  unsigned long v = strtoul(str, &end, 10) * 2;
+  if (end[0] == '.') {
+    if (end[1] == '5')
+      v++;
+    else if (end[1] != '0')
+      return false;
+    end += 2;
+  }
+  if (*end || v > max)
+    return false;
+  *value = v;
+  return true;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
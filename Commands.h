@@ -0,0 +1,110 @@
+#ifndef __MAX_COMMANDS_H
+#define __MAX_COMMANDS_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "Max.h"
+#include "Output.h"
+
+/**
+ * Collects received characters into lines. Lines end with \r or \n and
+ * are cut off at SIZE - 1 characters.
+ */
+template <uint8_t SIZE>
+class LineReader {
+public:
+  LineReader() : len(0) {}
+
+  /**
+   * Add a character. When it ends a line, returns that line (without
+   * the line ending, valid until the next call), otherwise NULL.
+   */
+  char *feed(char c) {
+    if (c == '\r' || c == '\n') {
+      this->buf[this->len] = '\0';
+      this->len = 0;
+      return this->buf;
+    }
+    if (this->len < SIZE - 1)
+      this->buf[this->len++] = c;
+    return NULL;
+  }
+
+private:
+  char buf[SIZE];
+  uint8_t len;
+};
+
+/**
+ * Where a command came from: replies go to reply, filter selects the
+ * output this transport gets (and can be changed by commands).
+ */
+struct CommandContext {
+  Print &reply;
+  OutputFilter *filter;
+};
+
+/**
+ * A command, meant to be put in a table in PROGMEM. All strings must be
+ * in PROGMEM too. The handler gets the rest of the line after the
+ * command name (with leading spaces removed).
+ */
+struct Command {
+  const char *name;
+  const char *args; /* Shown by help, NULL when there are none */
+  const char *help;
+  void (*handler)(char *args, CommandContext &ctx);
+};
+
+/**
+ * Run the command on the given line, looking it up in table (in
+ * PROGMEM). Empty lines are ignored. Returns false (after replying so)
+ * when the command is unknown.
+ */
+bool run_command(const Command *table, uint8_t count, char *line, CommandContext &ctx);
+
+/**
+ * Print a line for each command in table, with its arguments and help.
+ */
+void print_command_help(const Command *table, uint8_t count, Print &p);
+
+/**
+ * Commands for any transport, to put in a command table:
+ *
+ * command_sub shows the output levels of the transport, or sets them
+ * from its argument (see parse_output_levels).
+ *
+ * command_filter limits output to the device with the address given
+ * as argument (hex), or all devices without an argument.
+ */
+void command_sub(char *args, CommandContext &ctx);
+void command_filter(char *args, CommandContext &ctx);
+
+/**
+ * Parse a device address (hex). Returns false when str is not a valid
+ * address.
+ */
+bool parse_address(const char *str, uint32_t *addr);
+
+/**
+ * Parse a decimal number up to max. Returns false when str is not a
+ * valid number or too big.
+ */
+bool parse_number(const char *str, uint16_t max, uint16_t *value);
+
+/**
+ * Parse a temperature in degrees, in 0.5° steps (like 21 or 21.5), up
+ * to max (in 0.5° units). Stores it in 0.5° units.
+ */
+bool parse_temperature(const char *str, uint8_t max, uint8_t *value);
+
+/**
+ * Split off the first word in str and return it. str is updated to
+ * point at the next word (or the terminating null byte).
+ */
+char *next_word(char **str);
+
+#endif // __MAX_COMMANDS_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -3,8 +3,51 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <avr/pgmspace.h>
 
-uint16_t calc_crc(uint8_t *buf, size_t len);
+/* Available CRC implementations. They all calculate the same CRC, but
+ * trade flash space for speed. */
+#define CRC_BITWISE 0 /* No table, loops over all bits */
+#define CRC_NIBBLE  1 /* 16-entry table (32 bytes of flash) */
+#define CRC_BYTE    2 /* 256-entry table (512 bytes of flash) */
+
+/* The implementation used by calc_crc and crc_update. Use
+ * host/bench_crc to compare them. */
+#ifndef CRC_IMPL
+#define CRC_IMPL CRC_BYTE
+#endif
+
+/* Initial CRC value, to pass to the first crc_update */
+#define CRC_INIT 0xFFFF
+
+extern const uint16_t crc_table_nibble[16] PROGMEM;
+extern const uint16_t crc_table_byte[256] PROGMEM;
+
+uint16_t crc_update_bitwise(uint16_t crc, uint8_t data);
+
+/**
+ * Update the CRC with a single byte of data.
+ */
+static inline uint16_t crc_update(uint16_t crc, uint8_t data) {
+#if CRC_IMPL == CRC_BYTE
+  return (crc << 8) ^ pgm_read_word(&crc_table_byte[(crc >> 8) ^ data]);
+#elif CRC_IMPL == CRC_NIBBLE
+  crc = (crc << 4) ^ pgm_read_word(&crc_table_nibble[(crc >> 12) ^ (data >> 4)]);
+  return (crc << 4) ^ pgm_read_word(&crc_table_nibble[(crc >> 12) ^ (data & 0xf)]);
+#else
+  return crc_update_bitwise(crc, data);
+#endif
+}
+
+/**
+ * Calculate the CRC over the first len bytes in buf.
+ */
+uint16_t calc_crc(const uint8_t *buf, size_t len);
+
+/* The separate implementations, regardless of CRC_IMPL */
+uint16_t calc_crc_bitwise(const uint8_t *buf, size_t len);
+uint16_t calc_crc_nibble(const uint8_t *buf, size_t len);
+uint16_t calc_crc_byte(const uint8_t *buf, size_t len);
 
 #endif // __MAX_CRC_H
 
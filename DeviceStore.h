@@ -0,0 +1,350 @@
+#ifndef __MAX_DEVICE_STORE_H
+#define __MAX_DEVICE_STORE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <TStreaming.h>
+
+#include "AddressFilter.h"
+#include "Crc.h"
+#include "DeviceTable.h"
+#include "MaxRFProto.h"
+
+/**
+ * Keeps a copy of the device table and the last known state of each
+ * device in EEPROM, so it can be restored after a reset instead of
+ * waiting for every device to report again.
+ *
+ * The EEPROM area is divided into slots that each hold a complete
+ * snapshot. Snapshots go to the slots in turn, so each byte is written
+ * at most once every slots() snapshots, which spreads the wear (an
+ * EEPROM cell lasts about 100,000 writes). Bytes that did not change
+ * are not written at all. Writing a byte takes 3.3 ms, so poll() writes
+ * a snapshot a byte at a time, without waiting for the EEPROM.
+ *
+ * A slot is:
+ *
+ *   crc (2 bytes)      over the bytes below, in the order written
+ *   magic (1 byte)
+ *   seqnum (2 bytes)   counts snapshots, the highest is the newest
+ *   a record of RECORD_LEN bytes for each slot of the device array:
+ *     address (3 bytes), type, set_temp, actual_temp (2 bytes),
+ *     valve_pos, age (2 bytes, in minutes), all zero for an unused
+ *     slot
+ *   with an address filter, its state:
+ *     active (1 byte, 0 or 1), group_id, and 3 bytes for each of its
+ *     size() addresses, zero when unused
+ *
+ * The records are written first and the crc last, so a snapshot cut
+ * short by a reset doesn't check out and the one before it is used.
+ * The filter is read as it is written, so a change while a snapshot is
+ * being written might only be saved completely with the next one.
+ *
+ * Names are not stored, devices in the static list get theirs back
+ * because they are restored into the slot with their address.
+ *
+ * Eeprom is the EEPROM of the MCU (see Max.ino), or a mock on the
+ * host. It needs:
+ *
+ *   uint8_t read(uint16_t addr);
+ *   bool ready();
+ *   void write(uint16_t addr, uint8_t value);
+ *
+ * write() starts writing a byte, ready() tells when that is done.
+ */
+template <typename Eeprom>
+class DeviceStore {
+public:
+  static const uint8_t RECORD_LEN = 10;
+  static const uint8_t HEADER_LEN = 5;
+  /* Changed with the slot layout, so older snapshots are ignored */
+  static const uint8_t MAGIC = 0x4e;
+
+  /**
+   * Keep count devices from the devices array (which table uses) in
+   * size bytes of EEPROM from start, saving them every interval ms.
+   * With filter, its allowed addresses are kept as well.
+   */
+  DeviceStore(Eeprom &eeprom, DeviceTable &table, Device *devices,
+              uint8_t count, uint16_t start, uint16_t size,
+              unsigned long interval, AddressFilter *filter = NULL)
+    : eeprom(eeprom), table(table), devices(devices), filter(filter),
+      count(count), start(start), interval(interval), seqnum(0),
+      next_slot(0), writing(false), last_save(0) {
+    this->data_len = count * RECORD_LEN + (filter ? 2 + filter->size() * 3 : 0);
+    this->slot_len = HEADER_LEN + this->data_len;
+    this->slot_count = size / this->slot_len;
+    resetStats();
+  }
+
+  /**
+   * Add the devices from the newest snapshot to the table, with their
+   * state. Devices restored count as last seen now, but their age
+   * includes the age they were stored with, see age(). The address
+   * filter (if any) gets the state from the snapshot, replacing its
+   * own. Returns the number of devices restored.
+   */
+  uint8_t restore();
+
+  /**
+   * Start a snapshot every interval ms, and write it out a byte at a
+   * time. Call often, with the current millis().
+   */
+  void poll(unsigned long now);
+
+  /* Start a snapshot now, unless one is being written */
+  void save();
+
+  bool busy() const { return this->writing; }
+  uint8_t slots() const { return this->slot_count; }
+  /* Bytes per slot */
+  uint16_t slotLen() const { return this->slot_len; }
+
+  /* Minutes since the device was last heard, also before the reset
+   * when its state was restored */
+  static uint16_t age(const Device *d, unsigned long now);
+
+  void printStats(Print &p);
+  void resetStats();
+
+  /* Snapshots completed */
+  uint16_t snapshots;
+  /* Bytes written, and left alone because they did not change */
+  uint32_t written;
+  uint32_t unchanged;
+
+private:
+  /* Offset in a slot of the byte written at position pos */
+  uint16_t offset(uint16_t pos) const;
+  /* The byte to write at position pos */
+  uint8_t value(uint16_t pos);
+  /* Byte i of the filter state */
+  uint8_t filterValue(uint8_t i) const;
+  /* Set the filter from its state in the slot at base */
+  void restoreFilter(uint16_t base);
+  /* Handle the next byte, returns true when it had to be written */
+  bool step();
+
+  Eeprom &eeprom;
+  DeviceTable &table;
+  Device *devices;
+  AddressFilter *filter;
+  uint8_t count;
+  uint16_t start;
+  /* Records and filter state */
+  uint16_t data_len;
+  uint16_t slot_len;
+  uint8_t slot_count;
+  unsigned long interval;
+
+  /* Of the newest snapshot */
+  uint16_t seqnum;
+  uint8_t next_slot;
+
+  bool writing;
+  /* Position in the slot being written, in the order written */
+  uint16_t pos;
+  uint16_t crc;
+  unsigned long last_save;
+  /* The device being written, copied so its fields belong together */
+  uint8_t record[RECORD_LEN];
+};
+
+template <typename Eeprom>
+uint16_t DeviceStore<Eeprom>::age(const Device *d, unsigned long now) {
+  uint32_t minutes = d->stored_age + (now - d->last_seen) / 60000;
+  return minutes > 0xffff ? 0xffff : minutes;
+}
+
+template <typename Eeprom>
+uint16_t DeviceStore<Eeprom>::offset(uint16_t pos) const {
+  if (pos < this->data_len)
+    return HEADER_LEN + pos;
+  /* Then magic and seqnum, then the crc */
+  pos -= this->data_len;
+  return pos < 3 ? 2 + pos : pos - 3;
+}
+
+template <typename Eeprom>
+uint8_t DeviceStore<Eeprom>::value(uint16_t pos) {
+  uint16_t records = this->count * RECORD_LEN;
+  if (pos < records) {
+    uint8_t i = pos % RECORD_LEN;
+    if (i == 0 && !this->devices[pos / RECORD_LEN].address) {
+      /* Unused, the same every time so it is not written again */
+      memset(this->record, 0, RECORD_LEN);
+    } else if (i == 0) {
+      Device *d = &this->devices[pos / RECORD_LEN];
+      uint8_t *r = this->record;
+      uint16_t age = DeviceStore::age(d, millis());
+      r[0] = d->address >> 16;
+      r[1] = d->address >> 8;
+      r[2] = d->address;
+      r[3] = (uint8_t)d->type;
+      r[4] = d->set_temp;
+      r[5] = d->actual_temp >> 8;
+      r[6] = d->actual_temp;
+      r[7] = d->type == DeviceType::RADIATOR ? d->data.radiator.valve_pos : VALVE_UNKNOWN;
+      r[8] = age >> 8;
+      r[9] = age;
+    }
+    return this->record[i];
+  }
+  if (pos < this->data_len)
+    return filterValue(pos - records);
+
+  switch (pos - this->data_len) {
+    case 0: return MAGIC;
+    case 1: return this->seqnum >> 8;
+    case 2: return this->seqnum;
+    case 3: return this->crc >> 8;
+    default: return this->crc;
+  }
+}
+
+template <typename Eeprom>
+uint8_t DeviceStore<Eeprom>::filterValue(uint8_t i) const {
+  if (i == 0)
+    return this->filter->active();
+  if (i == 1)
+    return this->filter->group_id;
+  uint8_t n = (i - 2) / 3;
+  uint32_t addr = n < this->filter->count() ? this->filter->at(n) : 0;
+  return addr >> (8 * (2 - (i - 2) % 3));
+}
+
+template <typename Eeprom>
+void DeviceStore<Eeprom>::restoreFilter(uint16_t base) {
+  if (!this->eeprom.read(base)) {
+    this->filter->clear();
+    return;
+  }
+  this->filter->allowOnly(this->eeprom.read(base + 1));
+  for (uint8_t n = 0; n < this->filter->size(); ++n) {
+    uint16_t a = base + 2 + n * 3;
+    uint32_t addr = (uint32_t)this->eeprom.read(a) << 16 |
+                    (uint16_t)this->eeprom.read(a + 1) << 8 | this->eeprom.read(a + 2);
+    /* Ignores 0 */
+    this->filter->add(addr);
+  }
+}
+
+template <typename Eeprom>
+bool DeviceStore<Eeprom>::step() {
+  uint8_t b = value(this->pos);
+  if (this->pos < this->slot_len - 2)
+    this->crc = crc_update(this->crc, b);
+
+  uint16_t addr = this->start + this->next_slot * this->slot_len + offset(this->pos);
+  bool write = this->eeprom.read(addr) != b;
+  if (write) {
+    this->eeprom.write(addr, b);
+    this->written++;
+  } else {
+    this->unchanged++;
+  }
+
+  if (++this->pos == this->slot_len) {
+    this->writing = false;
+    this->next_slot = (this->next_slot + 1) % this->slot_count;
+    this->snapshots++;
+  }
+  return write;
+}
+
+template <typename Eeprom>
+void DeviceStore<Eeprom>::save() {
+  if (this->writing || !this->slot_count)
+    return;
+  this->writing = true;
+  this->pos = 0;
+  this->crc = CRC_INIT;
+  this->seqnum++;
+}
+
+template <typename Eeprom>
+void DeviceStore<Eeprom>::poll(unsigned long now) {
+  if (!this->writing && now - this->last_save >= this->interval) {
+    this->last_save = now;
+    if (this->table.count())
+      save();
+  }
+
+  /* Reading is quick, so skip over unchanged bytes until one needs to
+   * be written */
+  while (this->writing && this->eeprom.ready())
+    if (step())
+      break;
+}
+
+template <typename Eeprom>
+uint8_t DeviceStore<Eeprom>::restore() {
+  int16_t newest = -1;
+
+  for (uint8_t s = 0; s < this->slot_count; ++s) {
+    uint16_t base = this->start + s * this->slot_len;
+    uint16_t crc = CRC_INIT;
+    for (uint16_t i = 0; i < this->data_len; ++i)
+      crc = crc_update(crc, this->eeprom.read(base + HEADER_LEN + i));
+    for (uint8_t i = 2; i < HEADER_LEN; ++i)
+      crc = crc_update(crc, this->eeprom.read(base + i));
+    uint16_t stored = (uint16_t)this->eeprom.read(base) << 8 | this->eeprom.read(base + 1);
+    uint16_t seqnum = (uint16_t)this->eeprom.read(base + 3) << 8 | this->eeprom.read(base + 4);
+    if (crc != stored || this->eeprom.read(base + 2) != MAGIC)
+      continue;
+    /* The counter wraps, so compare the difference */
+    if (newest < 0 || (int16_t)(seqnum - this->seqnum) > 0) {
+      newest = s;
+      this->seqnum = seqnum;
+    }
+  }
+
+  if (newest < 0)
+    return 0;
+  this->next_slot = (newest + 1) % this->slot_count;
+
+  uint8_t restored = 0;
+  uint16_t base = this->start + newest * this->slot_len + HEADER_LEN;
+  for (uint8_t i = 0; i < this->count; ++i) {
+    uint8_t r[RECORD_LEN];
+    for (uint8_t j = 0; j < RECORD_LEN; ++j)
+      r[j] = this->eeprom.read(base + i * RECORD_LEN + j);
+
+    uint32_t addr = (uint32_t)r[0] << 16 | (uint16_t)r[1] << 8 | r[2];
+    if (!addr)
+      continue;
+    Device *d = this->table.get(addr, (DeviceType)r[3]);
+    if (!d)
+      continue;
+    d->set_temp = r[4];
+    d->actual_temp = (uint16_t)r[5] << 8 | r[6];
+    if (d->type == DeviceType::RADIATOR)
+      d->data.radiator.valve_pos = r[7];
+    d->stored_age = (uint16_t)r[8] << 8 | r[9];
+    d->last_seen = millis();
+    restored++;
+  }
+  if (this->filter)
+    restoreFilter(base + this->count * RECORD_LEN);
+  return restored;
+}
+
+template <typename Eeprom>
+void DeviceStore<Eeprom>::printStats(Print &p) {
+  p << F("EEPROM snapshots: ") << this->snapshots
+    << F(" (#") << this->seqnum << F(", ") << this->slot_count << F(" slots)")
+    << F(", bytes written: ") << this->written
+    << F(", unchanged: ") << this->unchanged << "\r\n";
+}
+
+template <typename Eeprom>
+void DeviceStore<Eeprom>::resetStats() {
+  this->snapshots = 0;
+  this->written = 0;
+  this->unchanged = 0;
+}
+
+#endif // __MAX_DEVICE_STORE_H
+
+/* vim: set sw=2 sts=2 expandtab: */
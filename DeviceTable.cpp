@@ -0,0 +1,164 @@
+#include <string.h>
+#include <Arduino.h>
+
+#include "DeviceTable.h"
+
+DeviceTable::DeviceTable(Device *devices, uint8_t *index, uint16_t size, bool evict,
+                         uint16_t silent_minutes)
+  : evictions(0), full(0), devices(devices), index(index), capacity(size),
+    used(0), evict_enabled(evict), silent_minutes(silent_minutes), initialized(false) {
+}
+
+void DeviceTable::init() {
+  if (initialized)
+    return;
+  initialized = true;
+
+  /* Index any devices that are already present */
+  while (used < capacity && devices[used].address) {
+    uint16_t pos = lookup(devices[used].address);
+    insert(pos, used);
+    used++;
+  }
+}
+
+uint16_t DeviceTable::lookup(uint32_t addr) {
+  uint16_t lo = 0, hi = used;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    if (devices[index[mid]].address < addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void DeviceTable::insert(uint16_t pos, uint8_t slot) {
+  memmove(&index[pos + 1], &index[pos], used - pos);
+  index[pos] = slot;
+}
+
+void DeviceTable::remove(uint16_t pos) {
+  memmove(&index[pos], &index[pos + 1], used - pos - 1);
+}
+
+Device *DeviceTable::find(uint32_t addr) {
+  init();
+  uint16_t pos = lookup(addr);
+  if (pos < used && devices[index[pos]].address == addr)
+    return &devices[index[pos]];
+  return NULL;
+}
+
+/* Make room for a new device by throwing out the least recently seen
+ * device that was not configured statically. Thermostats have a column
+ * in the STATUS line, which has no addresses, so reusing their slot
+ * switches a column to another device. That is only worth it for a
+ * thermostat that went silent, most likely because it was removed.
+ * Returns the freed slot (already removed from the index) or NULL. */
+Device *DeviceTable::evict(uint32_t addr) {
+  Device *victim = NULL;
+  unsigned long now = millis();
+  for (uint16_t i = 0; i < used; ++i) {
+    Device *d = &devices[i];
+    if (d->name)
+      continue;
+    if (d->type == DeviceType::RADIATOR || d->type == DeviceType::WALL) {
+      unsigned long minutes = (now - d->last_seen) / 60000;
+      #ifdef PERSIST_EEPROM_SIZE
+      /* Including the time before a reset, for restored devices */
+      minutes += d->stored_age;
+      #endif // PERSIST_EEPROM_SIZE
+      if (!silent_minutes || minutes < silent_minutes)
+        continue;
+    }
+    if (!victim || (long)(d->last_seen - victim->last_seen) < 0)
+      victim = d;
+  }
+
+  if (!victim)
+    return NULL;
+
+  remove(lookup(victim->address));
+  /* The slot stays in use, so the list is not left with a hole */
+  used--;
+  evictions++;
+  return victim;
+}
+
+bool DeviceTable::forget(uint32_t addr) {
+  init();
+  uint16_t pos = lookup(addr);
+  if (pos >= used || devices[index[pos]].address != addr || devices[index[pos]].name)
+    return false;
+
+  uint8_t slot = index[pos];
+  remove(pos);
+  used--;
+  /* Close the gap, slots in use are always at the start */
+  memmove(&devices[slot], &devices[slot + 1], (used - slot) * sizeof(*devices));
+  memset(&devices[used], 0, sizeof(*devices));
+  for (uint16_t i = 0; i < used; ++i)
+    if (index[i] > slot)
+      index[i]--;
+  return true;
+}
+
+Device *DeviceTable::get(uint32_t addr, DeviceType type) {
+  if (addr == 0)
+    return NULL;
+
+  init();
+
+  uint16_t pos = lookup(addr);
+  if (pos < used && devices[index[pos]].address == addr) {
+    Device *d = &devices[index[pos]];
+    /* We might have seen it before without knowing the type */
+    if (d->type == DeviceType::UNKNOWN)
+      d->type = type;
+    d->last_seen = millis();
+    #ifdef PERSIST_EEPROM_SIZE
+    d->stored_age = 0;
+    #endif // PERSIST_EEPROM_SIZE
+    return d;
+  }
+
+  Device *d;
+  if (used < capacity) {
+    d = &devices[used];
+  } else if (evict_enabled && (d = evict(addr))) {
+    /* Evicting changed the index, so look up the position again */
+    pos = lookup(addr);
+  } else {
+    full++;
+    return NULL;
+  }
+
+  memset(d, 0, sizeof(*d));
+  d->address = addr;
+  d->type = type;
+  d->name = NULL;
+  d->set_temp = SET_TEMP_UNKNOWN;
+  d->actual_temp = ACTUAL_TEMP_UNKNOWN;
+  /* Also when the type is unknown, it might turn out to be a radiator */
+  d->data.radiator.mode = Mode::UNKNOWN;
+  d->data.radiator.valve_pos = VALVE_UNKNOWN;
+  d->last_seen = millis();
+  d->dirty = DIRTY_NEW;
+
+  insert(pos, d - devices);
+  used++;
+  return d;
+}
+
+static uint8_t device_index[MAX_DEVICES];
+#if defined(EVICT_DEVICES) && defined(EVICT_SILENT_MINUTES)
+DeviceTable device_table(devices, device_index, MAX_DEVICES, true, EVICT_SILENT_MINUTES);
+#elif defined(EVICT_DEVICES)
+DeviceTable device_table(devices, device_index, MAX_DEVICES, true);
+#else
+DeviceTable device_table(devices, device_index, MAX_DEVICES, false);
+#endif
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,87 @@
+#ifndef __MAX_DEVICE_TABLE_H
+#define __MAX_DEVICE_TABLE_H
+
+#include <stdint.h>
+
+#include "MaxRFProto.h"
+
+/**
+ * Keeps track of devices by their address.
+ *
+ * Devices are stored in a caller-supplied array, in the order they were
+ * added (so printing them gives a stable order). An index of slot
+ * numbers, sorted by address, makes lookups a binary search. Slots in
+ * use are always at the start of the array, and the first slot with
+ * address 0 ends the list.
+ *
+ * Devices already present in the array (e.g. from a static list of
+ * known devices) are picked up on first use.
+ */
+class DeviceTable {
+public:
+  /**
+   * devices and index must both have room for size entries, with size
+   * at most 256. Thermostats are only evicted after silent_minutes
+   * without a message from or to them, or never for 0.
+   */
+  DeviceTable(Device *devices, uint8_t *index, uint16_t size, bool evict,
+              uint16_t silent_minutes = 0);
+
+  /**
+   * Returns the device with the given address, or NULL when it is not
+   * in the table.
+   */
+  Device *find(uint32_t addr);
+
+  /**
+   * Returns the device with the given address, adding it to the table
+   * when needed. When the table is full, the least recently seen
+   * device that was not statically configured (i.e. has no name) is
+   * evicted to make room, if eviction is enabled. Thermostats are only
+   * evicted once they were not seen for silent_minutes.
+   *
+   * Returns NULL for address 0 (broadcast) and when the device could
+   * not be added.
+   */
+  Device *get(uint32_t addr, DeviceType type);
+
+  /**
+   * Removes the device with the given address from the table, unless it
+   * was statically configured. The devices after it move up a slot, so
+   * they stay in the order they were added.
+   *
+   * Returns false when the device is not in the table or configured.
+   */
+  bool forget(uint32_t addr);
+
+  uint16_t count() { init(); return used; }
+  uint16_t size() const { return capacity; }
+
+  /* Number of devices evicted to make room for new ones */
+  uint16_t evictions;
+  /* Number of times a device could not be added */
+  uint16_t full;
+
+private:
+  void init();
+  /* Position in index where addr is or should be inserted */
+  uint16_t lookup(uint32_t addr);
+  void insert(uint16_t pos, uint8_t slot);
+  void remove(uint16_t pos);
+  Device *evict(uint32_t addr);
+
+  Device *devices;
+  uint8_t *index;
+  uint16_t capacity;
+  uint16_t used;
+  bool evict_enabled;
+  uint16_t silent_minutes;
+  bool initialized;
+};
+
+/* The table of all devices we know about, using the devices array */
+extern DeviceTable device_table;
+
+#endif // __MAX_DEVICE_TABLE_H
+
+/* vim: set sw=2 sts=2 expandtab: */
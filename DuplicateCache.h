@@ -0,0 +1,88 @@
+#ifndef __MAX_DUPLICATE_CACHE_H
+#define __MAX_DUPLICATE_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "MaxRFProto.h"
+
+/**
+ * Remembers the last SIZE messages received, to recognize
+ * retransmissions: devices resend a message when they miss the ack,
+ * which gives an identical copy (same sender, sequence number, type and
+ * contents, so also the same CRC).
+ */
+template <uint8_t SIZE>
+class DuplicateCache {
+public:
+  /**
+   * window is the time (in ms) after which a copy of a message is no
+   * longer considered a duplicate.
+   */
+  DuplicateCache(unsigned long window)
+    : duplicates(0), window(window), next(0) {
+    for (uint8_t i = 0; i < SIZE; ++i)
+      entries[i].used = false;
+  }
+
+  /**
+   * Check a (dewhitened, CRC checked) message, without length byte and
+   * CRC, received at time now. Returns true when it is a copy of a
+   * message seen less than window ms before. Otherwise, the message is
+   * remembered and false is returned.
+   */
+  bool check(const uint8_t *buf, size_t len, uint16_t crc, unsigned long now);
+
+  /* Number of duplicates seen */
+  uint32_t duplicates;
+
+private:
+  struct Entry {
+    uint32_t addr_from;
+    uint16_t crc;
+    uint8_t seqnum;
+    MessageType type;
+    bool used;
+    unsigned long time;
+  };
+
+  Entry entries[SIZE];
+  unsigned long window;
+  /* Entry to replace next (the oldest one) */
+  uint8_t next;
+};
+
+template <uint8_t SIZE>
+bool DuplicateCache<SIZE>::check(const uint8_t *buf, size_t len, uint16_t crc, unsigned long now) {
+  if (len < HeaderLayout::LEN)
+    return false;
+
+  uint32_t addr_from = HeaderLayout::addr_from::get(buf);
+  uint8_t seqnum = HeaderLayout::seqnum::get(buf);
+  MessageType type = HeaderLayout::type::get(buf);
+
+  for (uint8_t i = 0; i < SIZE; ++i) {
+    Entry *e = &entries[i];
+    /* Compare the CRC first, it is the most likely to differ */
+    if (e->used && e->crc == crc && e->seqnum == seqnum &&
+        e->addr_from == addr_from && e->type == type &&
+        now - e->time < window) {
+      duplicates++;
+      return true;
+    }
+  }
+
+  Entry *e = &entries[next];
+  e->addr_from = addr_from;
+  e->crc = crc;
+  e->seqnum = seqnum;
+  e->type = type;
+  e->used = true;
+  e->time = now;
+  next = (next + 1) % SIZE;
+  return false;
+}
+
+#endif // __MAX_DUPLICATE_CACHE_H
+
+/* vim: set sw=2 sts=2 expandtab: */
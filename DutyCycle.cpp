@@ -0,0 +1,41 @@
+#include "DutyCycle.h"
+
+void DutyCycle::reset(unsigned long now) {
+  for (uint8_t i = 0; i < SLOTS; ++i)
+    this->slots[i] = 0;
+  this->current = 0;
+  this->slot_start = now;
+}
+
+void DutyCycle::advance(unsigned long now) {
+  if (now - this->slot_start >= SLOTS * SLOT_MS) {
+    /* Everything is outside the window */
+    reset(now);
+    return;
+  }
+
+  while (now - this->slot_start >= SLOT_MS) {
+    this->slot_start += SLOT_MS;
+    this->current = (this->current + 1) % SLOTS;
+    this->slots[this->current] = 0;
+  }
+}
+
+uint16_t DutyCycle::used(unsigned long now) {
+  advance(now);
+  uint16_t total = 0;
+  for (uint8_t i = 0; i < SLOTS; ++i)
+    total += this->slots[i];
+  return total;
+}
+
+bool DutyCycle::allowed(unsigned long now, uint16_t airtime) {
+  return (uint32_t)used(now) + airtime <= this->limit;
+}
+
+void DutyCycle::add(unsigned long now, uint16_t airtime) {
+  advance(now);
+  this->slots[this->current] += airtime;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,48 @@
+#ifndef __MAX_DUTY_CYCLE_H
+#define __MAX_DUTY_CYCLE_H
+
+#include <stdint.h>
+
+/**
+ * Keeps track of the time spent transmitting, to stay within a duty
+ * cycle limit. The 868 MHz band allows 1%, so 36 seconds of airtime in
+ * any hour.
+ *
+ * Airtime is counted in SLOTS slots of SLOT_MS each. When a new slot
+ * starts, the oldest one is forgotten. The slots cover at least the
+ * last hour (the current, partial, slot plus ten full ones), so keeping
+ * their total within the limit keeps every hour within it.
+ */
+class DutyCycle {
+public:
+  static const uint8_t SLOTS = 11;
+  static const unsigned long SLOT_MS = 6 * 60 * 1000UL;
+
+  /* limit is the airtime allowed per hour, in ms */
+  DutyCycle(uint16_t limit) : limit(limit) { reset(0); }
+
+  /* Can a transmission of airtime ms start at now? */
+  bool allowed(unsigned long now, uint16_t airtime);
+
+  /* Account a transmission of airtime ms started at now */
+  void add(unsigned long now, uint16_t airtime);
+
+  /* Airtime used in the last hour (or a bit more), in ms */
+  uint16_t used(unsigned long now);
+
+  void reset(unsigned long now);
+
+  const uint16_t limit;
+
+private:
+  void advance(unsigned long now);
+
+  uint16_t slots[SLOTS];
+  uint8_t current;
+  /* When the current slot started */
+  unsigned long slot_start;
+};
+
+#endif // __MAX_DUTY_CYCLE_H
+
+/* vim: set sw=2 sts=2 expandtab: */
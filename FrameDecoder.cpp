@@ -0,0 +1,33 @@
+#include "FrameDecoder.h"
+
+void FrameDecoder::feed(uint8_t n) {
+  uint8_t *p = this->buf + this->len;
+  uint8_t *end = p + n;
+  /* Local copies, which the compiler can keep in registers */
+  uint16_t checksum = this->crc;
+  uint16_t crc_end = this->expected ? this->expected - 2 : 0xffff;
+  uint8_t pos = this->len;
+
+  for (; p < end; ++p, ++pos) {
+    *p ^= this->pn9.next();
+    if (pos == 0) {
+      /* The length byte does not count itself */
+      this->expected = *p + 1;
+      crc_end = this->expected - 2;
+    }
+    if (pos < crc_end)
+      checksum = crc_update(checksum, *p);
+  }
+
+  this->crc = checksum;
+  this->len = pos;
+}
+
+bool FrameDecoder::crcOk() const {
+  if (!complete() || this->expected < 3)
+    return false;
+  return this->buf[this->expected - 2] == (this->crc >> 8)
+      && this->buf[this->expected - 1] == (this->crc & 0xff);
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
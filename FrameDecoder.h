@@ -0,0 +1,63 @@
+#ifndef __MAX_FRAME_DECODER_H
+#define __MAX_FRAME_DECODER_H
+
+#include <stdint.h>
+
+#include "Crc.h"
+#include "MaxRFProto.h"
+#include "Pn9.h"
+
+/**
+ * Decodes a frame while it is being received: each chunk of bytes is
+ * dewhitened and added to the CRC as soon as it arrives, so the frame
+ * is checked as soon as its last byte is in. The header can be looked
+ * at as soon as headerComplete() is true.
+ *
+ * The decoder works in place, on the buffer the frame is received in.
+ */
+class FrameDecoder {
+public:
+  FrameDecoder() { start(NULL); }
+
+  /* Start decoding a new frame, that will be stored in buf */
+  void start(uint8_t *buf) {
+    this->buf = buf;
+    this->len = 0;
+    this->expected = 0;
+    this->crc = CRC_INIT;
+    this->pn9 = Pn9();
+  }
+
+  /**
+   * Decode the next n bytes of the frame, which should be stored in the
+   * buffer at offset length() already.
+   */
+  void feed(uint8_t n);
+
+  /* Bytes decoded so far */
+  uint8_t length() const { return this->len; }
+
+  /* Length of the complete frame (including length byte and CRC), as
+   * given by its length byte. 0 until that is decoded. */
+  uint16_t frameLength() const { return this->expected; }
+
+  /* Is the header (see HeaderLayout, it starts at buf + 1) decoded? */
+  bool headerComplete() const { return this->len >= 1 + HeaderLayout::LEN; }
+
+  bool complete() const { return this->expected && this->len >= this->expected; }
+
+  /* Is the frame complete and its CRC correct? */
+  bool crcOk() const;
+
+private:
+  uint8_t *buf;
+  uint8_t len;
+  uint16_t expected;
+  /* CRC over the bytes decoded so far, excluding the CRC itself */
+  uint16_t crc;
+  Pn9 pn9;
+};
+
+#endif // __MAX_FRAME_DECODER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
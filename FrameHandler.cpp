@@ -0,0 +1,112 @@
+#include <Arduino.h>
+#include <TStreaming.h>
+
+#include "FrameHandler.h"
+#include "AddressFilter.h"
+#include "DeviceTable.h"
+#include "Pn9.h"
+#include "Util.h"
+
+RxResult FrameHandler::handle(MaxRFFrame *frame) {
+  OutputRouter &output = this->output;
+  Print &p = output;
+  uint8_t *buf = frame->data;
+  uint8_t len = frame->len;
+  this->stats.frames++;
+
+  /* The interrupt handler already dewhitened the frame, so the header
+   * can be used to filter output right away */
+  uint32_t from = 0, to = 0;
+  if (len >= 1 + HeaderLayout::LEN) {
+    from = HeaderLayout::addr_from::get(buf + 1);
+    to = HeaderLayout::addr_to::get(buf + 1);
+  }
+  output.select(OUTPUT_RAW, from, to);
+
+  #ifdef ADDRESS_FILTER_SIZE
+  /* Frames for other systems nearby are only counted. A frame with a
+   * CRC error might have a garbled header, so leave those to the
+   * checks below. */
+  if (frame->crc_ok && len >= 1 + HeaderLayout::LEN &&
+      !address_filter.check(from, to, HeaderLayout::group_id::get(buf + 1)))
+    return RxResult::REJECTED;
+  #endif // ADDRESS_FILTER_SIZE
+
+  /* Dumps are the bulk of the output, skip them when nobody wants
+   * them */
+  if (output.wanted(OUTPUT_RAW)) {
+    p << F("Received ") << len << F(" bytes at ") << frame->time
+      << F(" (RSSI ") << frame->rssi << ")" << "\r\n";
+
+    /* Show the frame as it was on the air as well */
+    xor_pn9(buf, len);
+    dump_buffer(p, buf, len);
+    xor_pn9(buf, len);
+
+    p << F("Dewhitened:") << "\r\n";
+    dump_buffer(p, buf, len);
+  }
+  this->stats.done(STAGE_DUMP);
+
+  if (len < 3) {
+    p << F("Invalid packet length (") << len << ")" << "\r\n";
+    this->stats.invalid_length++;
+    return RxResult::INVALID_LENGTH;
+  }
+
+  if (!frame->crc_ok) {
+    p << F("CRC error") << "\r\n";
+    this->stats.crc_errors++;
+    return RxResult::CRC_ERROR;
+  }
+
+  /* Before parsing, since some acks are too short to parse */
+  if (this->hook)
+    this->hook(buf + 1, len - 3);
+
+  #ifdef DUPLICATE_CACHE
+  /* Retransmissions change nothing, so skip the rest */
+  uint16_t crc = (uint16_t)buf[len - 2] << 8 | buf[len - 1];
+  if (this->duplicates.check(buf + 1, len - 3, crc, frame->time)) {
+    Device *d = device_table.find(from);
+    if (d) {
+      d->duplicates++;
+      #ifdef LINK_STATS
+      d->link.retransmitted(frame->rssi);
+      #endif // LINK_STATS
+    }
+    p << F("Duplicate, ignored") << "\r\n\r\n";
+    this->stats.done(STAGE_DUPLICATE);
+    return RxResult::DUPLICATE;
+  }
+  #endif // DUPLICATE_CACHE
+  this->stats.done(STAGE_DUPLICATE);
+
+  /* Parse the message (without length byte and CRC) */
+  MaxRFMessage *rfm = MaxRFMessage::parse(buf + 1, len - 3, &this->storage);
+  this->stats.done(STAGE_PARSE);
+
+  output.select(OUTPUT_MESSAGES, from, to);
+  if (rfm == NULL) {
+    p << F("Packet is invalid") << "\r\n";
+    this->stats.parse_failures++;
+    this->stats.done(STAGE_PRINT);
+    return RxResult::PARSE_FAILURE;
+  }
+
+  if (output.wanted(OUTPUT_MESSAGES))
+    p << *rfm << "\r\n";
+  this->stats.done(STAGE_PRINT);
+  #ifdef LINK_STATS
+  /* Replies have the seqnum of the message they answer */
+  if (rfm->from && rfm->type != MessageType::ACK && rfm->type != MessageType::PAIR_PONG)
+    this->stats.lost += rfm->from->link.received(rfm->seqnum, frame->time, frame->rssi);
+  #endif // LINK_STATS
+  rfm->updateState();
+  /* rfm lives in storage, so don't delete it */
+  rfm->~MaxRFMessage();
+  this->stats.done(STAGE_UPDATE_STATE);
+  return RxResult::HANDLED;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
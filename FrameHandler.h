@@ -0,0 +1,74 @@
+#ifndef __MAX_FRAME_HANDLER_H
+#define __MAX_FRAME_HANDLER_H
+
+#include <stdint.h>
+
+#include "Max.h"
+#include "DuplicateCache.h"
+#include "LoopStats.h"
+#include "MaxRF22.h"
+#include "MaxRFProto.h"
+#include "Output.h"
+
+/**
+ * What became of a received frame.
+ */
+enum class RxResult : uint8_t {
+  /* From or to another system, see AddressFilter */
+  REJECTED,
+  INVALID_LENGTH,
+  CRC_ERROR,
+  /* A retransmission of a message handled already */
+  DUPLICATE,
+  PARSE_FAILURE,
+  /* Parsed, printed and applied to the device state */
+  HANDLED,
+};
+
+/**
+ * The receive pipeline: takes a frame from the radio's queue through
+ * the address filter, the raw dump, the length and CRC checks, the
+ * duplicate check, parsing, printing and updating the device state.
+ * This is what loop() does with every frame, and the benchmarks run
+ * frames through the same code.
+ *
+ * Output goes to output, with the kind of output selected for each
+ * part. The frames are counted in stats, which also times each stage
+ * from the last start() or done() before handle() (see LoopStats).
+ */
+class FrameHandler {
+public:
+  /* Called with each message (header and payload, without length byte
+   * and CRC) that has a correct CRC, before the duplicate check */
+  typedef void (*MessageHook)(const uint8_t *msg, uint8_t len);
+
+  FrameHandler(OutputRouter &output, LoopStats &stats, MessageHook hook = NULL)
+    : hook(hook),
+      #ifdef DUPLICATE_CACHE
+      duplicates(DUPLICATE_WINDOW),
+      #endif // DUPLICATE_CACHE
+      output(output), stats(stats) {}
+
+  /**
+   * Handle a frame taken from the radio. The frame is left dewhitened,
+   * but its dump might have whitened it for a moment.
+   */
+  RxResult handle(MaxRFFrame *frame);
+
+  MessageHook hook;
+
+  #ifdef DUPLICATE_CACHE
+  DuplicateCache<DUPLICATE_CACHE> duplicates;
+  #endif // DUPLICATE_CACHE
+
+private:
+  OutputRouter &output;
+  LoopStats &stats;
+  /* Storage for the message being handled, so parsing never needs the
+   * heap */
+  MaxRFMessageBuffer storage;
+};
+
+#endif // __MAX_FRAME_HANDLER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,221 @@
+#ifndef __MAX_HISTORY_H
+#define __MAX_HISTORY_H
+
+#include <stdint.h>
+
+/**
+ * One sample of a device's state, see Device for the units.
+ */
+struct HistorySample {
+  uint16_t actual_temp;
+  uint8_t set_temp;
+  uint8_t valve_pos;
+
+  bool operator==(const HistorySample &other) const {
+    return this->actual_temp == other.actual_temp
+        && this->set_temp == other.set_temp
+        && this->valve_pos == other.valve_pos;
+  }
+};
+
+/**
+ * Position while reading a HistoryRing, see HistoryRing::next().
+ */
+struct HistoryCursor {
+  /* Offset of the next token, from the oldest */
+  uint8_t offset;
+  /* Times the current sample is still repeated */
+  uint8_t repeat;
+  bool started;
+  HistorySample sample;
+};
+
+/**
+ * Time series of samples taken at a fixed interval, compressed into a
+ * ring of SIZE bytes. When the ring is full, the oldest samples are
+ * dropped.
+ *
+ * The oldest sample is kept as is, each following sample is stored as
+ * a token describing how it differs from the one before:
+ *
+ *   00nnnnnn          the same as the one before, n + 1 times
+ *   01aaavvv          actual_temp and valve_pos changed by a and v
+ *                     (-4 to 3 each)
+ *   10aaaaaa <v>      actual_temp changed by a (-32 to 31), valve_pos
+ *                     by v (a signed byte)
+ *   11000000 <a> <a> <s> <v>
+ *                     any other change, the complete sample
+ *
+ * Temperatures change slowly and valves often stay put, so most samples
+ * take a single byte, and a stable device takes a byte per 64 samples.
+ *
+ * An all-zero HistoryRing is empty, so clearing a Device clears its
+ * history as well.
+ */
+template <uint8_t SIZE>
+class HistoryRing {
+  static_assert(SIZE >= 5, "HistoryRing needs room for a complete sample");
+public:
+  void add(const HistorySample &s);
+  void clear() { this->count = 0; this->used = 0; }
+
+  /* Number of samples stored */
+  uint16_t samples() const { return this->count; }
+  /* Bytes of the ring in use */
+  uint8_t bytes() const { return this->used; }
+
+  /**
+   * Get the next sample, oldest first. Start with a zeroed cursor.
+   * Returns false when there are no more samples.
+   */
+  bool next(HistoryCursor &c) const;
+
+private:
+  static const uint8_t REPEAT = 0x00;
+  static const uint8_t SMALL = 0x40;
+  static const uint8_t MEDIUM = 0x80;
+  static const uint8_t FULL = 0xc0;
+  static const uint8_t TYPE_MASK = 0xc0;
+  static const uint8_t MAX_REPEAT = 0x3f;
+
+  uint8_t at(uint8_t offset) const { return this->data[(this->start + offset) % SIZE]; }
+  /* Length of the token starting at offset */
+  uint8_t tokenLen(uint8_t offset) const;
+  /* Apply the token at offset to s */
+  void apply(uint8_t offset, HistorySample &s) const;
+  void append(const uint8_t *token, uint8_t len);
+  void dropOldest();
+
+  /* The oldest sample */
+  HistorySample first;
+  /* The newest sample */
+  HistorySample last;
+  uint16_t count;
+  /* Tokens for the samples after first */
+  uint8_t data[SIZE];
+  uint8_t start;
+  uint8_t used;
+  /* Offset of the newest token (from data, not start) */
+  uint8_t last_token;
+};
+
+template <uint8_t SIZE>
+uint8_t HistoryRing<SIZE>::tokenLen(uint8_t offset) const {
+  switch (at(offset) & TYPE_MASK) {
+    case MEDIUM: return 2;
+    case FULL: return 5;
+    default: return 1;
+  }
+}
+
+template <uint8_t SIZE>
+void HistoryRing<SIZE>::apply(uint8_t offset, HistorySample &s) const {
+  uint8_t t = at(offset);
+  switch (t & TYPE_MASK) {
+    case SMALL:
+      /* Sign extend the 3-bit fields */
+      s.actual_temp += (int8_t)((t << 2) & 0xe0) >> 5;
+      s.valve_pos += (int8_t)(t << 5) >> 5;
+      break;
+    case MEDIUM:
+      s.actual_temp += (int8_t)(t << 2) >> 2;
+      s.valve_pos += (int8_t)at(offset + 1);
+      break;
+    case FULL:
+      s.actual_temp = (uint16_t)at(offset + 1) << 8 | at(offset + 2);
+      s.set_temp = at(offset + 3);
+      s.valve_pos = at(offset + 4);
+      break;
+  }
+}
+
+template <uint8_t SIZE>
+void HistoryRing<SIZE>::dropOldest() {
+  uint8_t t = at(0);
+  if ((t & TYPE_MASK) == REPEAT && t) {
+    /* Still repeated after dropping one */
+    this->data[this->start]--;
+  } else {
+    apply(0, this->first);
+    uint8_t len = tokenLen(0);
+    this->start = (this->start + len) % SIZE;
+    this->used -= len;
+  }
+  this->count--;
+}
+
+template <uint8_t SIZE>
+void HistoryRing<SIZE>::append(const uint8_t *token, uint8_t len) {
+  while (SIZE - this->used < len)
+    dropOldest();
+  this->last_token = (this->start + this->used) % SIZE;
+  for (uint8_t i = 0; i < len; ++i)
+    this->data[(this->start + this->used++) % SIZE] = token[i];
+}
+
+template <uint8_t SIZE>
+void HistoryRing<SIZE>::add(const HistorySample &s) {
+  if (!this->count) {
+    this->first = this->last = s;
+    this->start = this->used = 0;
+    this->count = 1;
+    return;
+  }
+
+  int16_t da = s.actual_temp - this->last.actual_temp;
+  int16_t dv = (int16_t)s.valve_pos - this->last.valve_pos;
+  uint8_t token[5];
+
+  if (s == this->last) {
+    uint8_t *t = &this->data[this->last_token];
+    if (this->used && (*t & TYPE_MASK) == REPEAT && *t < MAX_REPEAT) {
+      ++*t;
+      this->count++;
+      return;
+    }
+    token[0] = REPEAT;
+    append(token, 1);
+  } else if (s.set_temp == this->last.set_temp && da >= -4 && da <= 3 && dv >= -4 && dv <= 3) {
+    token[0] = SMALL | (da & 0x7) << 3 | (dv & 0x7);
+    append(token, 1);
+  } else if (s.set_temp == this->last.set_temp && da >= -32 && da <= 31 && dv >= -128 && dv <= 127) {
+    token[0] = MEDIUM | (da & 0x3f);
+    token[1] = dv;
+    append(token, 2);
+  } else {
+    token[0] = FULL;
+    token[1] = s.actual_temp >> 8;
+    token[2] = s.actual_temp;
+    token[3] = s.set_temp;
+    token[4] = s.valve_pos;
+    append(token, 5);
+  }
+  this->last = s;
+  this->count++;
+}
+
+template <uint8_t SIZE>
+bool HistoryRing<SIZE>::next(HistoryCursor &c) const {
+  if (!c.started) {
+    c.started = true;
+    c.sample = this->first;
+    return this->count;
+  }
+  if (c.repeat) {
+    c.repeat--;
+    return true;
+  }
+  if (c.offset >= this->used)
+    return false;
+  uint8_t t = at(c.offset);
+  if ((t & TYPE_MASK) == REPEAT)
+    c.repeat = t;
+  else
+    apply(c.offset, c.sample);
+  c.offset += tokenLen(c.offset);
+  return true;
+}
+
+#endif // __MAX_HISTORY_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,120 @@
+#ifndef __MAX_LCD_BUFFER_H
+#define __MAX_LCD_BUFFER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <Print.h>
+
+/**
+ * Remembers what a character LCD shows, so the display can be redrawn
+ * completely (using the same clear / setCursor / print calls as the
+ * LCD itself) while only the characters that differ from what it
+ * already shows are sent to it. Characters that were not drawn since
+ * clear() are blanked by flush().
+ *
+ * Every byte sent to an I2C LCD (character or command) takes a few I2C
+ * transactions, so this turns a redraw of the whole display into a
+ * handful of bytes when only a value or two changed. Changes are sent
+ * right away instead of being kept in a second buffer until flush(),
+ * since RAM is tight.
+ *
+ * The display must be cleared when the LcdBuffer is created (or after
+ * calling forget()), and the LCD should not be written to other than
+ * through the LcdBuffer (or forget() should be called afterwards).
+ */
+template <typename LCD, uint8_t COLS, uint8_t ROWS>
+class LcdBuffer : public Print {
+public:
+  LcdBuffer(LCD &lcd) : lcd(lcd) {
+    clear();
+    forget();
+  }
+
+  /* Start a redraw and move the cursor home */
+  void clear() {
+    memset(drawn, 0, sizeof(drawn));
+    home();
+  }
+
+  void home() {
+    setCursor(0, 0);
+  }
+
+  void setCursor(uint8_t col, uint8_t row) {
+    this->col = col;
+    this->row = row;
+  }
+
+  /* Characters past the end of a row are dropped */
+  virtual size_t write(uint8_t c) {
+    if (row >= ROWS || col >= COLS)
+      return 0;
+    uint8_t i = row * COLS + col;
+    drawn[i / 8] |= 1 << (i % 8);
+    show(col++, row, c);
+    return 1;
+  }
+
+  /* Assume the display was just cleared */
+  void forget() {
+    memset(shown, ' ', sizeof(shown));
+    lcd_row = ROWS;
+  }
+
+  /* Blank everything that was not drawn since clear() */
+  void flush();
+
+private:
+  /**
+   * Put c on the display at col, row if it is not there already. The
+   * cursor is only moved when needed, gaps of up to MAX_GAP unchanged
+   * characters are rewritten instead, since moving the cursor costs a
+   * command byte as well.
+   */
+  void show(uint8_t col, uint8_t row, uint8_t c);
+
+  static const uint8_t MAX_GAP = 1;
+
+  LCD &lcd;
+  uint8_t shown[ROWS][COLS];
+  /* Bit per character, set when drawn since clear() */
+  uint8_t drawn[(ROWS * COLS + 7) / 8];
+  uint8_t col, row;
+  /* Where the display cursor is, lcd_row is ROWS when unknown. The
+   * cursor does not wrap into the next row. */
+  uint8_t lcd_col, lcd_row;
+};
+
+template <typename LCD, uint8_t COLS, uint8_t ROWS>
+void LcdBuffer<LCD, COLS, ROWS>::flush() {
+  for (uint8_t r = 0; r < ROWS; ++r) {
+    for (uint8_t c = 0; c < COLS; ++c) {
+      uint8_t i = r * COLS + c;
+      if (!(drawn[i / 8] & (1 << (i % 8))))
+        show(c, r, ' ');
+    }
+  }
+}
+
+template <typename LCD, uint8_t COLS, uint8_t ROWS>
+void LcdBuffer<LCD, COLS, ROWS>::show(uint8_t col, uint8_t row, uint8_t c) {
+  if (shown[row][col] == c)
+    return;
+
+  if (lcd_row == row && col > lcd_col && col - lcd_col <= MAX_GAP) {
+    /* Rewrite the (unchanged) gap rather than moving the cursor */
+    while (lcd_col < col)
+      lcd.write(shown[row][lcd_col++]);
+  } else if (lcd_row != row || lcd_col != col) {
+    lcd.setCursor(col, row);
+  }
+
+  lcd.write(c);
+  shown[row][col] = c;
+  lcd_col = col + 1;
+  lcd_row = row;
+}
+
+#endif // __MAX_LCD_BUFFER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
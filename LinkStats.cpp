@@ -0,0 +1,54 @@
+#include "LinkStats.h"
+
+uint8_t LinkStats::received(uint8_t seqnum, unsigned long time, uint8_t rssi) {
+  addRssi(rssi);
+
+  uint8_t lost = 0;
+  bool consecutive = false;
+  if (this->frames) {
+    uint8_t gap = seqnum - this->seqnum;
+    /* A retransmission of the last message, nothing new */
+    if (gap == 0)
+      return 0;
+    if (gap <= MAX_GAP)
+      lost = gap - 1;
+    consecutive = (gap == 1);
+  }
+
+  /* Only compare intervals between consecutive messages, one with
+   * frames missing in between would look like a lot of jitter */
+  if (consecutive) {
+    unsigned long interval = time - this->last_time;
+    if (this->interval) {
+      unsigned long d = interval > this->interval ? interval - this->interval
+                                                  : this->interval - interval;
+      if (d > 0xffff)
+        d = 0xffff;
+      /* J += (|D| - J) / 16, as in RFC 3550 */
+      this->jitter += ((int32_t)d - this->jitter) / 16;
+    }
+    this->interval = interval;
+  }
+
+  if (this->frames < 0xffff)
+    this->frames++;
+  this->lost = (uint32_t)this->lost + lost > 0xffff ? 0xffff : this->lost + lost;
+  this->seqnum = seqnum;
+  this->last_time = time;
+  return lost;
+}
+
+uint16_t LinkStats::lossPermille() const {
+  uint32_t total = (uint32_t)this->frames + this->lost;
+  return total ? (uint32_t)this->lost * 1000 / total : 0;
+}
+
+void LinkStats::addRssi(uint8_t rssi) {
+  /* Average over the last few frames, starting with the first */
+  if (!this->rssi)
+    this->rssi = rssi;
+  else
+    this->rssi += ((int16_t)rssi - this->rssi) / 4;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,65 @@
+#ifndef __MAX_LINK_STATS_H
+#define __MAX_LINK_STATS_H
+
+#include <stdint.h>
+
+/**
+ * How well the frames from one device come through, to tell whether
+ * frames are missed (because loop() was busy and the RX queue
+ * overflowed, or because the device is too far away) and how far the
+ * radio is from its limits.
+ *
+ * Each device numbers the messages it sends, so a jump in the seqnum
+ * shows how many of its frames never arrived. The same seqnum again is
+ * a retransmission that got past the duplicate cache. A jump of more
+ * than MAX_GAP is taken as the device restarting (or numbering its
+ * messages differently) and not counted, so this is an estimate.
+ *
+ * Jitter is the smoothed difference between consecutive intervals
+ * between its frames, like the interarrival jitter of RFC 3550. For
+ * devices that report at a fixed interval, it shows how much frames
+ * are delayed, by retransmissions from the device or by loop(), as
+ * frame times are taken when loop() handles the frame.
+ *
+ * An all-zero LinkStats has seen nothing yet, so clearing a Device
+ * clears its link stats as well.
+ */
+struct LinkStats {
+  static const uint8_t MAX_GAP = 16;
+
+  /**
+   * A new message (not a reply like an ack, which has the seqnum of
+   * the message it answers) arrived at time (in ms) with the given
+   * RSSI. Returns the number of frames estimated lost since the
+   * previous one.
+   */
+  uint8_t received(uint8_t seqnum, unsigned long time, uint8_t rssi);
+
+  /* A frame the duplicate cache recognized as a retransmission */
+  void retransmitted(uint8_t rssi) { addRssi(rssi); }
+
+  /* Estimated lost frames per thousand */
+  uint16_t lossPermille() const;
+
+  /* Messages received */
+  uint16_t frames;
+  /* Frames that never arrived, from gaps in the seqnum */
+  uint16_t lost;
+  /* The seqnum of the last message */
+  uint8_t seqnum;
+  /* Average RSSI register value of its frames, so 0.5 dB steps */
+  uint8_t rssi;
+  /* Time between its last two frames, in ms */
+  unsigned long interval;
+  /* In ms, capped to 65535 */
+  uint16_t jitter;
+  /* When its last frame arrived */
+  unsigned long last_time;
+
+private:
+  void addRssi(uint8_t rssi);
+};
+
+#endif // __MAX_LINK_STATS_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,73 @@
+#include <Arduino.h>
+#include <TStreaming.h>
+
+#include "LoopStats.h"
+
+void StageTiming::add(uint32_t us) {
+  if (this->count == 0 || us < this->min)
+    this->min = us;
+  if (us > this->max)
+    this->max = us;
+  this->total += us;
+  this->count++;
+}
+
+void StageTiming::reset() {
+  this->count = 0;
+  this->total = 0;
+  this->min = 0;
+  this->max = 0;
+}
+
+const FlashString *LoopStats::stage_to_str(Stage stage) {
+  switch (stage) {
+    case STAGE_RECV:         return F("recv");
+    case STAGE_DUMP:         return F("dump");
+    case STAGE_DUPLICATE:    return F("duplicate check");
+    case STAGE_PARSE:        return F("parse");
+    case STAGE_PRINT:        return F("print");
+    case STAGE_UPDATE_STATE: return F("updateState");
+    case STAGE_KETTLE:       return F("switchKettle");
+    case STAGE_STATUS:       return F("status");
+    case STAGE_LCD:          return F("lcd");
+    default:                 return F("");
+  }
+}
+
+void LoopStats::print(Print &p) const {
+  p << F("Frames: ") << this->frames
+    << F(", invalid length: ") << this->invalid_length
+    << F(", CRC errors: ") << this->crc_errors
+    << F(", parse failures: ") << this->parse_failures;
+  #ifdef LINK_STATS
+  p << F(", lost: ") << this->lost;
+  #endif // LINK_STATS
+  p << "\r\n";
+
+  #ifdef STAGE_TIMING
+  for (uint8_t i = 0; i < NUM_STAGES; ++i) {
+    const StageTiming *t = &this->timing[i];
+    p << stage_to_str((Stage)i) << F(": count ") << t->count
+      << F(", min ") << t->min
+      << F("us, mean ") << (t->count ? t->total / t->count : 0)
+      << F("us, max ") << t->max << F("us") << "\r\n";
+  }
+  #endif // STAGE_TIMING
+}
+
+void LoopStats::reset() {
+  this->frames = 0;
+  this->invalid_length = 0;
+  this->crc_errors = 0;
+  this->parse_failures = 0;
+  #ifdef LINK_STATS
+  this->lost = 0;
+  #endif // LINK_STATS
+
+  #ifdef STAGE_TIMING
+  for (uint8_t i = 0; i < NUM_STAGES; ++i)
+    this->timing[i].reset();
+  #endif // STAGE_TIMING
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
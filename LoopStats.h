@@ -0,0 +1,92 @@
+#ifndef __MAX_LOOP_STATS_H
+#define __MAX_LOOP_STATS_H
+
+#include <stdint.h>
+#include <Arduino.h>
+
+#include "Max.h"
+
+/**
+ * The stages of handling a received frame in loop(), and the other
+ * work it does.
+ */
+enum Stage {
+  STAGE_RECV,
+  STAGE_DUMP,
+  STAGE_DUPLICATE,
+  STAGE_PARSE,
+  STAGE_PRINT,
+  STAGE_UPDATE_STATE,
+  STAGE_KETTLE,
+  STAGE_STATUS,
+  STAGE_LCD,
+  NUM_STAGES,
+};
+
+/**
+ * Timing of a single stage, in microseconds.
+ */
+struct StageTiming {
+  uint32_t count;
+  uint32_t total;
+  uint32_t min;
+  uint32_t max;
+
+  void add(uint32_t us);
+  void reset();
+};
+
+/**
+ * Counts what happens to received frames and, when STAGE_TIMING is
+ * enabled, how long each stage takes. Without STAGE_TIMING, start() and
+ * done() compile to nothing.
+ */
+class LoopStats {
+public:
+  LoopStats() { reset(); }
+
+  /* Start timing the first of a sequence of stages */
+  void start() {
+    #ifdef STAGE_TIMING
+    last = micros();
+    #endif
+  }
+
+  /* The given stage has completed, it took the time since the previous
+   * start() or done() */
+  void done(Stage stage) {
+    #ifdef STAGE_TIMING
+    unsigned long now = micros();
+    timing[stage].add(now - last);
+    last = now;
+    #endif
+  }
+
+  void print(Print &p) const;
+  void reset();
+
+  static const FlashString *stage_to_str(Stage stage);
+
+  /* Frames received */
+  uint32_t frames;
+  /* Frames dropped for being too short */
+  uint32_t invalid_length;
+  uint32_t crc_errors;
+  /* Frames with a valid CRC that could not be parsed */
+  uint32_t parse_failures;
+  #ifdef LINK_STATS
+  /* Frames from known devices estimated lost, see LinkStats */
+  uint32_t lost;
+  #endif // LINK_STATS
+
+  #ifdef STAGE_TIMING
+  StageTiming timing[NUM_STAGES];
+
+private:
+  unsigned long last;
+  #endif
+};
+
+#endif // __MAX_LOOP_STATS_H
+
+/* vim: set sw=2 sts=2 expandtab: */
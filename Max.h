@@ -1,8 +1,20 @@
 #ifndef __MAX_H
 #define __MAX_H
 
+// The ATmega328 has 2048 bytes of RAM, which the defaults below share
+// with the libraries (Ethernet, Wire for the LCD, Serial and RF22) and
+// the stack. With these defaults, the sketch's own variables take about
+// 960 bytes, see the README for what the optional features add. "stats"
+// shows the stack headroom: the RAM the stack never reached. Before
+// raising a size or enabling a feature, check that enough of it is left.
+
 // Control a relay on this pin (undef to disable)
 #define KETTLE_RELAY_PIN 4
+// Switch on the kettle when one valve is open more than KETTLE_MAX_VALVE
+// percent, or all valves together more than KETTLE_TOTAL_VALVE. Can be
+// changed with the "kettle" command.
+#define KETTLE_MAX_VALVE 30
+#define KETTLE_TOTAL_VALVE 40
 
 // Enable the LCD display (undef to disable)
 #define LCD_I2C
@@ -12,6 +24,139 @@
 
 #define ETHERNET_MAC  { 0x90, 0xA2, 0xDA, 0x0D, 0xb5, 0x82 }
 
+// Maximum number of devices to keep state for (at most 256)
+#define MAX_DEVICES 8
+
+// When the device table is full, forget the least recently seen device
+// to make room for a new one (undef to ignore new devices instead).
+// Devices with a name in the static list are never forgotten.
+// Thermostats have a column in the STATUS line, so they are only
+// forgotten after nothing was heard from or about them for
+// EVICT_SILENT_MINUTES minutes, like when they were removed. Their
+// column then switches to another device (undef to never forget them).
+// The "forget" command removes a device right away.
+#define EVICT_DEVICES
+#define EVICT_SILENT_MINUTES 60
+
+// Remember the last DUPLICATE_CACHE messages received, to recognize
+// retransmissions of the same message within DUPLICATE_WINDOW ms. These
+// are counted (per device), but not processed again (undef to disable).
+#define DUPLICATE_CACHE 4
+#define DUPLICATE_WINDOW 3000
+
+// Only handle frames from or to our own devices, or for group
+// ADDRESS_FILTER_GROUP (0 for none), so frames from other systems
+// nearby are dropped early and don't take up device table slots.
+// Devices in the static list (see MaxRFProto.cpp) and RF_TX_ADDRESS are
+// allowed from the start, the "allow" and "deny" commands change the
+// list. With PERSIST_EEPROM_SIZE, the list is saved with the device
+// table and replaces the initial one at startup. When nothing was
+// allowed (or after "allow all"), all frames are handled. Denying the
+// last allowed address does not do that, then no frames are handled.
+// The list has room for ADDRESS_FILTER_SIZE addresses, 4 bytes of RAM
+// each (undef to disable).
+#define ADDRESS_FILTER_SIZE 8
+#define ADDRESS_FILTER_GROUP 0
+
+// Send messages with this address (undef to disable sending). Devices
+// only accept commands from the cube they are paired with, so this
+// should be the cube's address. Use the "set" command to send.
+//#define RF_TX_ADDRESS 0x00b825
+// Messages that can wait to be sent (a power of two)
+#define TX_QUEUE 2
+// Send a message again up to TX_RETRIES times when no ack arrives
+// within TX_ACK_TIMEOUT ms
+#define TX_RETRIES 3
+#define TX_ACK_TIMEOUT 500
+// Airtime allowed per hour, in ms. 868.3 MHz allows a 1% duty cycle.
+#define TX_DUTY_CYCLE 36000
+
+// Output is buffered and written out a bit at a time from loop(), so
+// printing does not delay handling received packets. Buffer sizes must
+// be a power of two. When a buffer is full, OverflowPolicy::BLOCK waits
+// for it to drain, OverflowPolicy::DROP throws away the lines that
+// don't fit (whole lines, so no partial lines are written out). Serial
+// has a 64 byte transmit buffer of its own behind SERIAL_OUTPUT_BUFFER.
+#define SERIAL_OUTPUT_BUFFER 32
+#define SERIAL_OUTPUT_POLICY OverflowPolicy::BLOCK
+// Each ethernet client has its own buffer, so with DROP a slow client
+// loses output instead of holding up the others.
+#define ETHERNET_OUTPUT_BUFFER 64
+#define ETHERNET_OUTPUT_POLICY OverflowPolicy::DROP
+// Bytes written to each ethernet client per loop() iteration (at most
+// as many as the W5100 takes without waiting)
+#define ETHERNET_DRAIN_BYTES 64
+
+// Number of TCP clients that can be connected at the same time (the
+// W5100 has four sockets, one is needed to accept new connections, so
+// at most 3). Each takes about ETHERNET_OUTPUT_BUFFER + 64 bytes of RAM.
+#define ETHERNET_CLIENTS 1
+
+// Longest command line accepted over serial or TCP
+#define COMMAND_LINE_LEN 24
+
+// Output sent to serial and, until they send "sub", to new TCP
+// clients (see Output.h for the levels). The raw and message dumps
+// come in bursts bigger than ETHERNET_OUTPUT_BUFFER, so new clients
+// only get info and status.
+#define SERIAL_OUTPUT_LEVELS OUTPUT_ALL
+#define ETHERNET_OUTPUT_LEVELS (OUTPUT_INFO | OUTPUT_STATUS)
+
+// After each packet, only print devices whose state changed (undef to
+// print the full status every time). A full status is still printed
+// every STATUS_FULL_INTERVAL ms (0 to disable) and on request.
+#define STATUS_INCREMENTAL
+#define STATUS_FULL_INTERVAL (10 * 60 * 1000UL)
+
+// Also send the status as compact binary telemetry frames, mixed with
+// the text output (define to enable). See Telemetry.h for the format
+// and host/telemetry_decode to turn them back into STATUS lines. Frames
+// only contain changes, except for a keyframe with everything that is
+// sent every TELEMETRY_KEYFRAME_INTERVAL ms and on request.
+//#define TELEMETRY
+#define TELEMETRY_KEYFRAME_INTERVAL (60 * 1000UL)
+
+// Keep a history of the state of each thermostat, sampled every
+// HISTORY_INTERVAL ms and compressed into HISTORY_BYTES bytes per device
+// (at most 255, see History.h for the format). A stable device needs
+// only a byte per 64 samples, a busy one about a byte per sample. The
+// "history" command prints it, HISTORY_PAGE samples at a time (define
+// to enable).
+//#define HISTORY_BYTES 32
+#define HISTORY_INTERVAL (5 * 60 * 1000UL)
+#define HISTORY_PAGE 16
+
+// Save the device table and the last known state of each device to
+// EEPROM every PERSIST_INTERVAL ms, and restore it at startup, so the
+// status and the kettle are right straight after a reset instead of
+// once every device has reported again. Snapshots take turns in
+// PERSIST_EEPROM_SIZE bytes from PERSIST_EEPROM_START, to spread the wear
+// (each takes 5 + 10 * MAX_DEVICES bytes, plus 2 + 3 *
+// ADDRESS_FILTER_SIZE for the address filter; the ATmega328 has 1024
+// bytes of EEPROM). See DeviceStore.h (undef to disable).
+#define PERSIST_EEPROM_START 0
+#define PERSIST_EEPROM_SIZE 1024
+#define PERSIST_INTERVAL (10 * 60 * 1000UL)
+
+// Keep track of how well frames from each device come through: frames
+// lost (from gaps in their sequence numbers), retransmissions, the
+// jitter of their arrival times and their RSSI. Takes 16 bytes of RAM
+// per device. "link" shows them, "stats" the total lost. See
+// LinkStats.h (define to enable).
+//#define LINK_STATS
+
+// Sleep (in idle mode) whenever loop() has nothing to do, to save
+// power. The RF22 interrupt, received serial data and the timer
+// interrupt behind millis() wake it up again, so Ethernet (whose
+// interrupt line is not connected on the shield) is still polled every
+// millisecond. "stats" shows the time spent asleep (undef to disable).
+#define LOW_POWER
+
+// Measure how long each stage of handling a packet takes. Takes 16
+// bytes of RAM per stage (nine stages). Send "stats" over serial or TCP
+// to see the results, "stats reset" to reset them (define to enable).
+//#define STAGE_TIMING
+
 /* String stored in Flash. Type helps the Print class to autoload the
  * string during printing. */
 typedef __FlashStringHelper FlashString;
@@ -3,27 +3,54 @@
 #include <TStreaming.h>
 #ifdef ETHERNET
 #include <Ethernet.h>
+#include "ClientServer.h"
 #endif
 
 #ifdef LCD_I2C
 #include <LiquidCrystal_I2C.h>
+#include "LcdBuffer.h"
 #endif // LCD_I2C
 
+#include "AddressFilter.h"
+#include "Commands.h"
 #include "Crc.h"
+#include "DeviceTable.h"
+#include "FrameHandler.h"
+#include "LoopStats.h"
+#include "Output.h"
 #include "Util.h"
 #include "MaxRF22.h"
 #include "MaxRFProto.h"
 #include "Pn9.h"
-
-static_assert(PN9_LEN >= RF22_MAX_MESSAGE_LEN, "Not enough pn9 bytes defined");
+#ifdef RF_TX_ADDRESS
+#include "MaxRFSender.h"
+#endif // RF_TX_ADDRESS
+#ifdef TELEMETRY
+#include "Telemetry.h"
+#endif // TELEMETRY
+#ifdef LOW_POWER
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "Sleeper.h"
+#endif // LOW_POWER
+#ifdef PERSIST_EEPROM_SIZE
+#include <avr/eeprom.h>
+#include "DeviceStore.h"
+#endif // PERSIST_EEPROM_SIZE
 
 MaxRF22 rf(9);
 
+#ifdef RF_TX_ADDRESS
+MaxRFSender<MaxRF22, TX_QUEUE> sender(rf, RF_TX_ADDRESS, TX_DUTY_CYCLE, TX_RETRIES, TX_ACK_TIMEOUT);
+#endif // RF_TX_ADDRESS
+
 #ifdef LCD_I2C
 #define LCD_ADDR 0x20
 #define LCD_COLS 20
 #define LCD_ROWS 4
 LiquidCrystal_I2C lcd(LCD_ADDR, LCD_COLS, LCD_ROWS); // set the LCD address to 0x27 for a 20 chars and 4 line display
+/* Drawn into by updateLcd, only changes are sent to the lcd */
+LcdBuffer<LiquidCrystal_I2C, LCD_COLS, LCD_ROWS> lcd_buf(lcd);
 #else
 /* Define the lcd object as a bottomless pit for prints. */
 Null lcd;
@@ -31,73 +58,290 @@ Null lcd;
 
 #ifdef KETTLE_RELAY_PIN
 bool kettle_status;
+/* Valve positions (in percent) above which the kettle is switched on */
+uint16_t kettle_max_valve = KETTLE_MAX_VALVE;
+uint16_t kettle_total_valve = KETTLE_TOTAL_VALVE;
 #endif // KETTLE_RELAY_PIN
 
+/* Set when the LCD should be redrawn */
+bool lcd_dirty;
+
+#ifdef STATUS_INCREMENTAL
+/* Kettle status as last printed, to print only changes */
+bool printed_kettle_status;
+/* When the last full status was printed */
+unsigned long last_full_status;
+#endif // STATUS_INCREMENTAL
+
+#ifdef TELEMETRY
+TelemetryEncoder telemetry;
+/* When the last telemetry keyframe was sent */
+unsigned long last_keyframe;
+#endif // TELEMETRY
+
+#ifdef HISTORY_BYTES
+/* When the newest history samples were taken */
+unsigned long last_history;
+#endif // HISTORY_BYTES
+
+LoopStats loop_stats;
+
+#ifdef LOW_POWER
+/* Idle mode stops only the CPU, so every interrupt wakes it up */
+struct IdleMode {
+  void noInterrupts() { cli(); }
+  void interrupts() { sei(); }
+  void sleep() {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+  }
+  unsigned long micros() { return ::micros(); }
+  unsigned long millis() { return ::millis(); }
+};
+
+IdleMode idle_mode;
+Sleeper<IdleMode> sleeper(idle_mode);
+#endif // LOW_POWER
+
+#ifdef PERSIST_EEPROM_SIZE
+struct AvrEeprom {
+  uint8_t read(uint16_t addr) { return eeprom_read_byte((uint8_t*)(uintptr_t)addr); }
+  bool ready() { return eeprom_is_ready(); }
+  /* Only waits when not ready, which DeviceStore checks first */
+  void write(uint16_t addr, uint8_t value) { eeprom_write_byte((uint8_t*)(uintptr_t)addr, value); }
+};
+
+AvrEeprom eeprom;
+DeviceStore<AvrEeprom> device_store(eeprom, device_table, devices, MAX_DEVICES,
+                                    PERSIST_EEPROM_START, PERSIST_EEPROM_SIZE,
+                                    PERSIST_INTERVAL
+                                    #ifdef ADDRESS_FILTER_SIZE
+                                    , &address_filter
+                                    #endif // ADDRESS_FILTER_SIZE
+                                    );
+#endif // PERSIST_EEPROM_SIZE
+
+/* Everything is printed through p, which passes it on to the outputs
+ * that want it. Select the kind of output with output.select() before
+ * printing. */
+OutputRouter output;
+Print &p = output;
+
+#ifdef RF_TX_ADDRESS
+/* Acks can be too short to parse, so the sender looks at every
+ * message */
+void messageReceived(const uint8_t *msg, uint8_t len) {
+  sender.messageReceived(msg, len);
+}
+
+FrameHandler frame_handler(output, loop_stats, messageReceived);
+#else
+FrameHandler frame_handler(output, loop_stats);
+#endif // RF_TX_ADDRESS
+
+BufferedPrint<SERIAL_OUTPUT_BUFFER> serial_out(Serial, SERIAL_OUTPUT_POLICY);
+OutputFilter serial_filter = {SERIAL_OUTPUT_LEVELS, 0};
+LineReader<COMMAND_LINE_LEN> serial_line;
 
 #ifdef ETHERNET
 EthernetServer server = EthernetServer(1234); //port 80
-
-DoublePrint p = (Serial & server);
-#else
-Print &p = Serial;
+ClientServer<EthernetServer, EthernetClient, ETHERNET_CLIENTS, ETHERNET_OUTPUT_BUFFER>
+  clients(server, output, ETHERNET_OUTPUT_POLICY, ETHERNET_OUTPUT_LEVELS);
 #endif
 
-void printStatus() {
+/* Write out some buffered output, without blocking */
+void drainOutput() {
+  serial_out.drain(Serial.availableForWrite());
+  #ifdef ETHERNET
+  clients.drain(ETHERNET_DRAIN_BYTES);
+  #endif
+}
+
+void printOutputStats(Print &out) {
+  serial_out.printStats(out, F("Serial"));
+  #ifdef ETHERNET
+  clients.printStats(out);
+  #endif
+}
+
+/* Redraw the LCD. Each character written costs a few I2C transactions,
+ * so this is not done for every packet, but only when no packets are
+ * waiting. Everything is drawn into lcd_buf, which only sends the
+ * characters that changed. */
+void updateLcd() {
   #ifdef LCD_I2C
   int row = LCD_ROWS - 1;
-  lcd.clear();
-  #endif
-  for (int i = 0; i < lengthof(devices); ++i) {
+  #ifdef KETTLE_RELAY_PIN
+  /* The top row shows the kettle, drawing a device there as well would
+   * send both to the display on every redraw */
+  const int top = 1;
+  #else
+  const int top = 0;
+  #endif // KETTLE_RELAY_PIN
+  lcd_buf.clear();
+  for (int i = 0; i < lengthof(devices) && row >= top; ++i) {
     Device *d = &devices[i];
     if (!d->address) break;
     if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
 
-    #ifdef LCD_I2C
-    lcd.setCursor(0, row--);
-    #endif
+    lcd_buf.setCursor(0, row--);
 
-    if (d->name) {
-      (p & lcd) << d->name;
-    } else {
+    if (d->name)
+      lcd_buf << d->name;
+    else
       /* Only print two bytes on the lcd to save space */
-      lcd << V<HexBits<16>>(d->address);
-      p << V<Address>(d->address);
-    }
+      lcd_buf << V<HexBits<16>>(d->address);
+
+    lcd_buf << " " << V<ActualTemp>(d->actual_temp)
+            << "/" << V<SetTemp>(d->set_temp);
+    if (d->type == DeviceType::RADIATOR)
+      lcd_buf << " " << V<ValvePos>(d->data.radiator.valve_pos);
+  }
+
+  #ifdef KETTLE_RELAY_PIN
+  lcd_buf.home();
+  lcd_buf << F("Kettle: ") << (kettle_status ? F("On") : F("Off"));
+  #endif // KETTLE_RELAY_PIN
+
+  lcd_buf.flush();
+  #endif // LCD_I2C
+
+  lcd_dirty = false;
+}
+
+/* Print the state of a single device in human readable form */
+void printDevice(Print &out, Device *d) {
+  if (d->name)
+    out << d->name;
+  else
+    out << V<Address>(d->address);
+
+  out << " " << V<ActualTemp>(d->actual_temp)
+      << "/" << V<SetTemp>(d->set_temp);
+  if (d->type == DeviceType::RADIATOR)
+    out << " " << V<ValvePos>(d->data.radiator.valve_pos);
+  if (d->duplicates)
+    out << F(" (") << d->duplicates << F(" retransmits)");
+  #ifdef LINK_STATS
+  if (d->link.lost)
+    out << F(" (") << d->link.lost << F(" lost)");
+  #endif // LINK_STATS
+  out << endl;
+}
+
+/* Print the machine-parseable state of a single device:
+ *
+ * UPDATE <millis> <address> <actual temp> <set temp> <valve pos>
+ */
+void printUpdateLine(Print &out, Device *d) {
+  out << "UPDATE\t" << millis() << "\t" << V<Address>(d->address) << "\t"
+      << V<ActualTemp>(d->actual_temp) << "\t" << V<SetTemp>(d->set_temp) << "\t";
+  if (d->type == DeviceType::RADIATOR)
+    out << V<ValvePos>(d->data.radiator.valve_pos);
+  else
+    out << "NA";
+  out << endl;
+}
+
+/* Print machine-parseable status line (to draw pretty graphs) */
+void printStatusLine(Print &out) {
+  out << "STATUS\t" << millis() << "\t";
+  for (int i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
 
-    (p & lcd) << " " << V<ActualTemp>(d->actual_temp)
-              << "/" << V<SetTemp>(d->set_temp);
+    out << V<ActualTemp>(d->actual_temp) << "\t" << V<SetTemp>(d->set_temp) << "\t";
     if (d->type == DeviceType::RADIATOR)
-      (p & lcd) << " " << V<ValvePos>(d->data.radiator.valve_pos);
-    p << endl;
+      out << V<ValvePos>(d->data.radiator.valve_pos);
+    else
+      out << "NA";
+    out << "\t";
+  }
+  out << (kettle_status ? "1" : "0") << endl;
+}
+
+/* Print the status of all devices */
+void printStatus() {
+  for (int i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    d->dirty = 0;
+    if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
+
+    output.select(OUTPUT_STATUS, d->address);
+    printDevice(p, d);
   }
+  output.select(OUTPUT_STATUS);
   p << endl;
 
   #ifdef LCD_I2C
   #ifdef KETTLE_RELAY_PIN
-  lcd.home();
-
-  (p & lcd) << F("Kettle: ") << (kettle_status ? F("On") : F("Off"));
+  p << F("Kettle: ") << (kettle_status ? F("On") : F("Off"));
   #endif // KETTLE_RELAY_PIN
   #endif // LCD_I2C
 
   p << endl;
 
-  /* Print machine-parseable status line (to draw pretty graphs) */
-  p << "STATUS\t" << millis() << "\t";
+  printStatusLine(p);
+
+  #ifdef STATUS_INCREMENTAL
+  printed_kettle_status = kettle_status;
+  last_full_status = millis();
+  #endif // STATUS_INCREMENTAL
+
+  lcd_dirty = true;
+}
+
+#ifdef STATUS_INCREMENTAL
+/* Print only the devices whose state changed since it was last
+ * printed. For each device, this prints a human readable line and an
+ * UPDATE line (see printUpdateLine). And if the kettle status changed:
+ *
+ * KETTLE <millis> <0 or 1>
+ */
+void printStatusChanges() {
+  bool changed = false;
   for (int i = 0; i < lengthof(devices); ++i) {
     Device *d = &devices[i];
     if (!d->address) break;
+    if (!d->dirty) continue;
+    d->dirty = 0;
     if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
 
-    p << V<ActualTemp>(d->actual_temp) << "\t" << V<SetTemp>(d->set_temp) << "\t";
-    if (d->type == DeviceType::RADIATOR)
-      p << V<ValvePos>(d->data.radiator.valve_pos);
-    else
-      p << "NA";
-    p << "\t";
+    output.select(OUTPUT_STATUS, d->address);
+    printDevice(p, d);
+    printUpdateLine(p, d);
+    changed = true;
   }
-  p << (kettle_status ? "1" : "0") << endl;
+
+  if (kettle_status != printed_kettle_status) {
+    output.select(OUTPUT_STATUS);
+    p << "KETTLE\t" << millis() << "\t" << (kettle_status ? "1" : "0") << endl;
+    printed_kettle_status = kettle_status;
+    changed = true;
+  }
+
+  if (changed)
+    lcd_dirty = true;
 }
+#endif // STATUS_INCREMENTAL
+
+#ifdef TELEMETRY
+/* Send a telemetry frame with the changes since the previous one, or
+ * with everything when a keyframe is requested or due */
+void sendTelemetry(bool keyframe) {
+  if (millis() - last_keyframe >= TELEMETRY_KEYFRAME_INTERVAL)
+    keyframe = true;
+  if (keyframe)
+    last_keyframe = millis();
+  output.select(OUTPUT_TELEMETRY);
+  telemetry.update(p, kettle_status, keyframe);
+}
+#endif // TELEMETRY
 
 #ifdef KETTLE_RELAY_PIN
 void switchKettle() {
@@ -115,36 +359,17 @@ void switchKettle() {
 
   /* One radiator opened fairly far can turn the kettle on by itself, or
    * a few radiators opened a little bit. */
-  kettle_status = (max > 30 || total > 40);
+  kettle_status = (max > kettle_max_valve || total > kettle_total_valve);
   digitalWrite(KETTLE_RELAY_PIN, kettle_status ? HIGH : LOW);
 }
 #endif // KETTLE_RELAY_PIN
 
-void dump_buffer(Print &p, uint8_t *buf, uint8_t len) {
-  /* Dump the raw received data */
-  int i, j;
-  for (i = 0; i < len; i += 16)
-  {
-    // Hex
-    for (j = 0; j < 16 && i+j < len; j++)
-    {
-      p << V<Hex>(buf[i+j]) << " ";
-    }
-    // Padding on last block
-    while (j++ < 16)
-      p << "   ";
-
-    p << "   ";
-    // ASCII
-    for (j = 0; j < 16 && i+j < len; j++)
-      p << (isprint(buf[i+j]) ? (char)buf[i+j] : '.');
-    p << "\r\n";
-  }
-  p << "\r\n";
-}
-
 void setup()
 {
+  #ifdef __AVR__
+  paint_stack();
+  #endif // __AVR__
+
   Serial.begin(115200);
 
   if (rf.init())
@@ -165,6 +390,27 @@ void setup()
   pinMode(KETTLE_RELAY_PIN, OUTPUT);
   #endif // KETTLE_RELAY_PIN
 
+  output.add(&serial_out, &serial_filter);
+
+  #ifdef ADDRESS_FILTER_SIZE
+  /* Our own devices are the ones we know about */
+  for (int i = 0; i < lengthof(devices) && devices[i].address; ++i)
+    address_filter.add(devices[i].address);
+  #ifdef RF_TX_ADDRESS
+  address_filter.add(RF_TX_ADDRESS);
+  #endif // RF_TX_ADDRESS
+  #endif // ADDRESS_FILTER_SIZE
+
+  #ifdef PERSIST_EEPROM_SIZE
+  /* Pick up the state from before the reset, so the kettle is right
+   * straight away. This includes the address filter, as changed by
+   * allow and deny. */
+  p << F("Restored ") << device_store.restore() << F(" devices from EEPROM") << "\r\n";
+  #ifdef KETTLE_RELAY_PIN
+  switchKettle();
+  #endif // KETTLE_RELAY_PIN
+  #endif // PERSIST_EEPROM_SIZE
+
   #ifdef ETHERNET
   byte mac[] = ETHERNET_MAC;
   if (Ethernet.begin(mac))
@@ -172,78 +418,503 @@ void setup()
   else
     p << F("DHCP Failure") << "\r\n";
 
-  server.begin();
+  clients.begin();
   #endif
 
   p << F("Initialized") << "\r\n";
   printStatus();
+  #ifdef TELEMETRY
+  sendTelemetry(true);
+  #endif // TELEMETRY
 }
 
-void loop()
-{
-  uint8_t buf[RF22_MAX_MESSAGE_LEN];
-  uint8_t len = sizeof(buf);
+#ifdef HISTORY_BYTES
+/* Add a sample to the history of each thermostat */
+void recordHistory() {
+  /* Keep to the interval, the sample times are derived from it */
+  last_history += HISTORY_INTERVAL;
+  for (int i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
 
-  if (Serial.read() != -1) {
-    Serial.println("OK");
-    printStatus();
+    HistorySample s;
+    s.actual_temp = d->actual_temp;
+    s.set_temp = d->set_temp;
+    s.valve_pos = d->type == DeviceType::RADIATOR ? d->data.radiator.valve_pos : VALVE_UNKNOWN;
+    d->history.add(s);
   }
+}
+#endif // HISTORY_BYTES
+
+#ifdef LOW_POWER
+/* Is there anything for loop() to do right away? Called by the sleeper,
+ * with interrupts disabled. */
+bool workPending() {
+  if (rf.rxPending() || lcd_dirty || Serial.available() || serial_out.pending())
+    return true;
+  #ifdef ETHERNET
+  if (clients.pending())
+    return true;
+  #endif
+  return false;
+}
+#endif // LOW_POWER
+
+void printRxStats(Print &out) {
+  out << F("RX queue max: ") << rf.rxQueueMax() << "/" << MAX_RF_RX_QUEUE
+      << F(", overflows: ") << rf.rxOverflows() << "\r\n";
+  #ifdef DUPLICATE_CACHE
+  out << F("Duplicates: ") << frame_handler.duplicates.duplicates << "\r\n";
+  #endif // DUPLICATE_CACHE
+  #ifdef ADDRESS_FILTER_SIZE
+  out << F("Rejected by address: ") << address_filter.rejected << "\r\n";
+  #endif // ADDRESS_FILTER_SIZE
+}
+
+void printStats(Print &out) {
+  printRxStats(out);
+  #ifdef RF_TX_ADDRESS
+  sender.printStats(out);
+  out << F("TX timeouts: ") << rf.txTimeouts() << "\r\n";
+  #endif // RF_TX_ADDRESS
+  loop_stats.print(out);
+  printOutputStats(out);
+  #ifdef LOW_POWER
+  sleeper.printStats(out);
+  #endif // LOW_POWER
+  #ifdef PERSIST_EEPROM_SIZE
+  device_store.printStats(out);
+  #endif // PERSIST_EEPROM_SIZE
+  #ifdef __AVR__
+  out << F("Stack headroom: ") << stack_headroom() << F(" bytes") << "\r\n";
+  #endif // __AVR__
+}
 
+void resetStats() {
+  rf.resetRxStats();
+  #ifdef DUPLICATE_CACHE
+  frame_handler.duplicates.duplicates = 0;
+  #endif // DUPLICATE_CACHE
+  #ifdef ADDRESS_FILTER_SIZE
+  address_filter.rejected = 0;
+  #endif // ADDRESS_FILTER_SIZE
+  loop_stats.reset();
+  #ifdef RF_TX_ADDRESS
+  sender.resetStats();
+  rf.resetTxStats();
+  #endif // RF_TX_ADDRESS
+  serial_out.resetStats();
   #ifdef ETHERNET
-  EthernetClient c = server.available();
-  if (c && c.read() != -1) {
-    c.println("OK");
-    printStatus();
-  }
+  clients.resetStats();
   #endif
+  #ifdef LOW_POWER
+  sleeper.resetStats();
+  #endif // LOW_POWER
+  #ifdef PERSIST_EEPROM_SIZE
+  device_store.resetStats();
+  #endif // PERSIST_EEPROM_SIZE
+}
 
-  if (rf.recv(buf, &len))
-  {
-    /* Enable reception right away again, so we won't miss the next
-     * message while processing this one. */
-    rf.setModeRx();
+/* Commands accepted over serial and TCP, see print_command_help for
+ * the list. Each replies with only the data asked for. */
+void cmdHelp(char *args, CommandContext &ctx);
+
+void cmdDev(char *args, CommandContext &ctx) {
+  uint32_t addr;
+  Device *d = NULL;
+  if (parse_address(args, &addr))
+    d = device_table.find(addr);
+  if (!d) {
+    ctx.reply << F("ERR unknown device") << "\r\n";
+    return;
+  }
+  printDevice(ctx.reply, d);
+  printUpdateLine(ctx.reply, d);
+}
 
-    p << F("Received ") << len << F(" bytes") << "\r\n";
+/* Print the device table, a line per device:
+ *
+ * DEVICE <address> <type> <name or -> <ms since last seen>
+ */
+void cmdList(char *args, CommandContext &ctx) {
+  for (int i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    ctx.reply << "DEVICE\t" << V<Address>(d->address) << "\t"
+              << MaxRFMessage::device_type_to_str(d->type) << "\t"
+              << (d->name ? d->name : "-") << "\t";
+    #ifdef PERSIST_EEPROM_SIZE
+    /* Including the time before a reset, for restored devices */
+    ctx.reply << (millis() - d->last_seen + d->stored_age * 60000UL) << "\r\n";
+    #else
+    ctx.reply << (millis() - d->last_seen) << "\r\n";
+    #endif // PERSIST_EEPROM_SIZE
+  }
+  ctx.reply << F("OK ") << device_table.count() << "/" << device_table.size() << "\r\n";
+}
 
-    dump_buffer(p, buf, len);
+/* Remove a device from the device table, e.g. one that was removed from
+ * the system, to free its slot (and STATUS columns) right away */
+void cmdForget(char *args, CommandContext &ctx) {
+  uint32_t addr;
+  Device *d = NULL;
+  if (parse_address(args, &addr))
+    d = device_table.find(addr);
+  if (!d) {
+    ctx.reply << F("ERR unknown device") << "\r\n";
+    return;
+  }
+  if (!device_table.forget(addr)) {
+    ctx.reply << F("ERR configured device") << "\r\n";
+    return;
+  }
+  #ifdef PERSIST_EEPROM_SIZE
+  /* Or it comes back with the next reset */
+  device_store.save();
+  #endif // PERSIST_EEPROM_SIZE
+  ctx.reply << F("OK ") << device_table.count() << "/" << device_table.size() << "\r\n";
+}
 
-    if (len < 3) {
-      p << F("Invalid packet length (") << len << ")" << "\r\n";
-      return;
-    }
+#ifdef LINK_STATS
+/* Print how well frames from each device come through, a line per
+ * device that sent anything:
+ *
+ * LINK <address> <messages> <lost> <loss per mille> <retransmits> <rssi> <interval ms> <jitter ms>
+ */
+void cmdLink(char *args, CommandContext &ctx) {
+  for (int i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    const LinkStats &l = d->link;
+    if (!l.frames) continue;
+    ctx.reply << "LINK\t" << V<Address>(d->address) << "\t"
+              << l.frames << "\t" << l.lost << "\t" << l.lossPermille() << "\t"
+              << d->duplicates << "\t" << l.rssi << "\t"
+              << l.interval << "\t" << l.jitter << "\r\n";
+  }
+  ctx.reply << F("OK") << "\r\n";
+}
+#endif // LINK_STATS
+
+void cmdStats(char *args, CommandContext &ctx) {
+  if (!strcmp(args, "reset")) {
+    resetStats();
+    ctx.reply << F("OK") << "\r\n";
+  } else if (!*args) {
+    printStats(ctx.reply);
+  } else {
+    ctx.reply << F("ERR use stats or stats reset") << "\r\n";
+  }
+}
 
-    /* Dewhiten data */
-    if (xor_pn9(buf, len) < 0) {
-      p << F("Invalid packet length (") << len << ")" << "\r\n";
+#ifdef KETTLE_RELAY_PIN
+void cmdKettle(char *args, CommandContext &ctx) {
+  if (*args) {
+    uint16_t max, total;
+    char *max_str = next_word(&args);
+    if (!parse_number(max_str, 100, &max) || !parse_number(args, 0xffff, &total)) {
+      ctx.reply << F("ERR use kettle <max> <total>") << "\r\n";
       return;
     }
+    kettle_max_valve = max;
+    kettle_total_valve = total;
+    switchKettle();
+  }
+  ctx.reply << F("OK ") << kettle_max_valve << " " << kettle_total_valve
+            << " " << (kettle_status ? "1" : "0") << "\r\n";
+}
+#endif // KETTLE_RELAY_PIN
 
-    p << F("Dewhitened:") << "\r\n";
-    dump_buffer(p, buf, len);
+#ifdef HISTORY_BYTES
+/* Print up to HISTORY_PAGE samples of the history of a device, oldest
+ * first, starting offset samples after the oldest:
+ *
+ * HISTORY <ms ago> <actual temp> <set temp> <valve pos>
+ * ...
+ * OK <samples> <bytes used>/<bytes> <offset of the next page>
+ *
+ * The next page starts at the given offset, until it reaches the
+ * number of samples. A new sample moves the oldest one out of a full
+ * history, so ms ago is what identifies a sample across pages.
+ */
+void cmdHistory(char *args, CommandContext &ctx) {
+  uint32_t addr;
+  uint16_t offset = 0;
+  char *addr_str = next_word(&args);
+  if (!parse_address(addr_str, &addr) ||
+      (*args && !parse_number(args, 0xffff - HISTORY_PAGE, &offset))) {
+    ctx.reply << F("ERR use history <address> [offset]") << "\r\n";
+    return;
+  }
+  Device *d = device_table.find(addr);
+  if (!d) {
+    ctx.reply << F("ERR unknown device") << "\r\n";
+    return;
+  }
 
-    /* Calculate CRC (but don't include the CRC itself) */
-    uint16_t crc = calc_crc(buf, len - 2);
-    if (buf[len - 1] != (crc & 0xff) || buf[len - 2] != (crc >> 8)) {
-      p << F("CRC error") << "\r\n";
-      return;
-    }
+  uint16_t samples = d->history.samples();
+  unsigned long age = millis() - last_history + (samples - 1) * HISTORY_INTERVAL;
+  uint16_t i = 0;
+  HistoryCursor c = {};
+  /* The samples are compressed, so the ones before offset are decoded
+   * as well */
+  while (i < offset + HISTORY_PAGE && d->history.next(c)) {
+    if (i++ >= offset)
+      ctx.reply << "HISTORY\t" << age << "\t"
+                << V<ActualTemp>(c.sample.actual_temp) << "\t"
+                << V<SetTemp>(c.sample.set_temp) << "\t"
+                << V<ValvePos>(c.sample.valve_pos) << "\r\n";
+    age -= HISTORY_INTERVAL;
+  }
+  ctx.reply << F("OK ") << samples << " " << d->history.bytes()
+            << "/" << HISTORY_BYTES << " " << i << "\r\n";
+}
+#endif // HISTORY_BYTES
+
+#ifdef ADDRESS_FILTER_SIZE
+/* Save a changed filter soon, rather than with the next snapshot */
+void filterChanged() {
+  #ifdef PERSIST_EEPROM_SIZE
+  device_store.save();
+  #endif // PERSIST_EEPROM_SIZE
+}
+
+/* Print the allowed addresses, or change them:
+ *
+ * ALLOW <address>
+ * ...
+ * OK <count>/<size> <group id> <rejected frames>
+ */
+void cmdAllow(char *args, CommandContext &ctx) {
+  uint32_t addr;
+  if (!strcmp(args, "all")) {
+    address_filter.clear();
+  } else if (*args && (!parse_address(args, &addr) || !address_filter.add(addr))) {
+    ctx.reply << F("ERR use allow [<address>|all], at most ")
+              << address_filter.size() << "\r\n";
+    return;
+  }
+  if (*args)
+    filterChanged();
+  for (uint8_t i = 0; i < address_filter.count(); ++i)
+    ctx.reply << "ALLOW\t" << V<Address>(address_filter.at(i)) << "\r\n";
+  ctx.reply << F("OK ") << address_filter.count() << "/" << address_filter.size()
+            << " " << address_filter.group_id
+            << " " << address_filter.rejected << "\r\n";
+}
 
-    /* Parse the message (without length byte and CRC) */
-    MaxRFMessage *rfm = MaxRFMessage::parse(buf + 1, len - 3);
+void cmdDeny(char *args, CommandContext &ctx) {
+  uint32_t addr;
+  if (!parse_address(args, &addr) || !address_filter.remove(addr)) {
+    ctx.reply << F("ERR not allowed") << "\r\n";
+    return;
+  }
+  filterChanged();
+  ctx.reply << F("OK ") << address_filter.count() << "/" << address_filter.size() << "\r\n";
+}
+#endif // ADDRESS_FILTER_SIZE
+
+#ifdef RF_TX_ADDRESS
+/* Set a device to manual mode with the given temperature */
+void cmdSet(char *args, CommandContext &ctx) {
+  uint32_t addr;
+  uint8_t set_temp;
+  char *addr_str = next_word(&args);
+  if (!parse_address(addr_str, &addr) || !addr || !parse_temperature(args, 63, &set_temp)) {
+    ctx.reply << F("ERR use set <address> <temperature>") << "\r\n";
+    return;
+  }
+
+  uint8_t payload[SetTemperatureMessage::PAYLOAD_LEN];
+  SetTemperatureMessage::build_payload(payload, set_temp, Mode::MANUAL);
+  /* Only the cube is always listening */
+  Device *d = device_table.find(addr);
+  bool burst = !d || d->type != DeviceType::CUBE;
+  if (sender.send(MessageType::SET_TEMPERATURE, addr, payload, sizeof(payload), burst))
+    ctx.reply << F("OK") << "\r\n";
+  else
+    ctx.reply << F("ERR queue full") << "\r\n";
+}
+#endif // RF_TX_ADDRESS
+
+/* Print the full status to the requester only */
+void cmdSnapshot(char *args, CommandContext &ctx) {
+  for (int i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
+    printDevice(ctx.reply, d);
+  }
+  printStatusLine(ctx.reply);
+  #ifdef TELEMETRY
+  /* For telemetry subscribers, which need a keyframe to start from */
+  telemetry.requestKeyframe();
+  #endif // TELEMETRY
+  ctx.reply << F("OK") << "\r\n";
+}
+
+const char cmd_help[] PROGMEM = "help";
+const char cmd_help_help[] PROGMEM = "show this list";
+const char cmd_dev[] PROGMEM = "dev";
+const char cmd_dev_args[] PROGMEM = "<address>";
+const char cmd_dev_help[] PROGMEM = "show one device";
+const char cmd_list[] PROGMEM = "list";
+const char cmd_list_help[] PROGMEM = "list known devices";
+const char cmd_forget[] PROGMEM = "forget";
+const char cmd_forget_args[] PROGMEM = "<address>";
+const char cmd_forget_help[] PROGMEM = "remove a device from the list";
+const char cmd_stats[] PROGMEM = "stats";
+const char cmd_stats_args[] PROGMEM = "[reset]";
+const char cmd_stats_help[] PROGMEM = "show or reset statistics";
+const char cmd_sub[] PROGMEM = "sub";
+const char cmd_sub_args[] PROGMEM = "[irmst]";
+const char cmd_sub_help[] PROGMEM = "show or set output levels";
+const char cmd_filter[] PROGMEM = "filter";
+const char cmd_filter_args[] PROGMEM = "[address]";
+const char cmd_filter_help[] PROGMEM = "only output about one device";
+#ifdef LINK_STATS
+const char cmd_link[] PROGMEM = "link";
+const char cmd_link_help[] PROGMEM = "show frames lost per device";
+#endif // LINK_STATS
+#ifdef KETTLE_RELAY_PIN
+const char cmd_kettle[] PROGMEM = "kettle";
+const char cmd_kettle_args[] PROGMEM = "[<max> <total>]";
+const char cmd_kettle_help[] PROGMEM = "show or set valve thresholds";
+#endif // KETTLE_RELAY_PIN
+#ifdef HISTORY_BYTES
+const char cmd_history[] PROGMEM = "history";
+const char cmd_history_args[] PROGMEM = "<address> [offset]";
+const char cmd_history_help[] PROGMEM = "show the history of a device";
+#endif // HISTORY_BYTES
+#ifdef ADDRESS_FILTER_SIZE
+const char cmd_allow[] PROGMEM = "allow";
+const char cmd_allow_args[] PROGMEM = "[<address>|all]";
+const char cmd_allow_help[] PROGMEM = "show or add handled devices";
+const char cmd_deny[] PROGMEM = "deny";
+const char cmd_deny_args[] PROGMEM = "<address>";
+const char cmd_deny_help[] PROGMEM = "stop handling a device";
+#endif // ADDRESS_FILTER_SIZE
+#ifdef RF_TX_ADDRESS
+const char cmd_set[] PROGMEM = "set";
+const char cmd_set_args[] PROGMEM = "<address> <temperature>";
+const char cmd_set_help[] PROGMEM = "set a device to manual mode";
+#endif // RF_TX_ADDRESS
+const char cmd_snapshot[] PROGMEM = "snapshot";
+const char cmd_snapshot_help[] PROGMEM = "show all devices";
+
+const Command commands[] PROGMEM = {
+  {cmd_help, NULL, cmd_help_help, cmdHelp},
+  {cmd_dev, cmd_dev_args, cmd_dev_help, cmdDev},
+  {cmd_list, NULL, cmd_list_help, cmdList},
+  {cmd_forget, cmd_forget_args, cmd_forget_help, cmdForget},
+  #ifdef LINK_STATS
+  {cmd_link, NULL, cmd_link_help, cmdLink},
+  #endif // LINK_STATS
+  {cmd_stats, cmd_stats_args, cmd_stats_help, cmdStats},
+  {cmd_sub, cmd_sub_args, cmd_sub_help, command_sub},
+  {cmd_filter, cmd_filter_args, cmd_filter_help, command_filter},
+  #ifdef KETTLE_RELAY_PIN
+  {cmd_kettle, cmd_kettle_args, cmd_kettle_help, cmdKettle},
+  #endif // KETTLE_RELAY_PIN
+  #ifdef HISTORY_BYTES
+  {cmd_history, cmd_history_args, cmd_history_help, cmdHistory},
+  #endif // HISTORY_BYTES
+  #ifdef ADDRESS_FILTER_SIZE
+  {cmd_allow, cmd_allow_args, cmd_allow_help, cmdAllow},
+  {cmd_deny, cmd_deny_args, cmd_deny_help, cmdDeny},
+  #endif // ADDRESS_FILTER_SIZE
+  #ifdef RF_TX_ADDRESS
+  {cmd_set, cmd_set_args, cmd_set_help, cmdSet},
+  #endif // RF_TX_ADDRESS
+  {cmd_snapshot, NULL, cmd_snapshot_help, cmdSnapshot},
+};
+
+void cmdHelp(char *args, CommandContext &ctx) {
+  print_command_help(commands, lengthof(commands), ctx.reply);
+}
+
+/* Handle a command line received over serial or TCP */
+void handleLine(char *line, Print &reply, OutputFilter *filter) {
+  CommandContext ctx = {reply, filter};
+  run_command(commands, lengthof(commands), line, ctx);
+}
+
+void loop()
+{
+  MaxRFFrame frame;
+
+  #ifdef LOW_POWER
+  /* Frames are received by the interrupt handler, so sleeping never
+   * loses one, it only delays handling it until after the wakeup */
+  sleeper.sleep(workPending);
+  #endif // LOW_POWER
 
-    if (rfm == NULL) {
-      p << F("Packet is invalid") << "\r\n";
-    } else {
-      p << *rfm << "\r\n";
-      rfm->updateState();
-      delete rfm;
+  drainOutput();
+
+  #ifdef RF_TX_ADDRESS
+  sender.poll(millis());
+  #endif // RF_TX_ADDRESS
+
+  while (Serial.available()) {
+    char *line = serial_line.feed(Serial.read());
+    if (line) {
+      handleLine(line, serial_out, &serial_filter);
+      break;
     }
+  }
+
+  #ifdef ETHERNET
+  clients.poll(handleLine);
+  #endif
+
+  if (lcd_dirty && !rf.rxPending()) {
+    loop_stats.start();
+    updateLcd();
+    loop_stats.done(STAGE_LCD);
+  }
+
+  #if defined(STATUS_INCREMENTAL) && STATUS_FULL_INTERVAL
+  if (millis() - last_full_status >= STATUS_FULL_INTERVAL)
+    printStatus();
+  #endif
+
+  #ifdef HISTORY_BYTES
+  if (millis() - last_history >= HISTORY_INTERVAL)
+    recordHistory();
+  #endif // HISTORY_BYTES
+
+  #ifdef PERSIST_EEPROM_SIZE
+  device_store.poll(millis());
+  #endif // PERSIST_EEPROM_SIZE
+
+  /* Frames are queued by the radio interrupt handler, which also
+   * re-enables reception right away, so we won't miss the next message
+   * while processing this one. */
+  loop_stats.start();
+  if (rf.recvFrame(&frame))
+  {
+    loop_stats.done(STAGE_RECV);
+
+    RxResult result = frame_handler.handle(&frame);
+    if (result != RxResult::HANDLED && result != RxResult::PARSE_FAILURE)
+      return;
 
     #ifdef KETTLE_RELAY_PIN
     switchKettle();
+    loop_stats.done(STAGE_KETTLE);
     #endif // KETTLE_RELAY_PIN
 
+    #ifdef STATUS_INCREMENTAL
+    printStatusChanges();
+    #else
     printStatus();
+    #endif // STATUS_INCREMENTAL
+
+    #ifdef TELEMETRY
+    sendTelemetry(false);
+    #endif // TELEMETRY
+    loop_stats.done(STAGE_STATUS);
 
     #if 0
     #ifdef LCD_I2C
@@ -256,6 +927,12 @@ void loop()
     #endif // LCD_I2C
     #endif
 
+    uint32_t from = 0, to = 0;
+    if (frame.len >= 1 + HeaderLayout::LEN) {
+      from = HeaderLayout::addr_from::get(frame.data + 1);
+      to = HeaderLayout::addr_to::get(frame.data + 1);
+    }
+    output.select(OUTPUT_MESSAGES, from, to);
     p << "\r\n";
   }
 }
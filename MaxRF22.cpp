@@ -1,4 +1,8 @@
+#include <util/atomic.h>
+
 #include "MaxRF22.h"
+#include "MaxRFProto.h"
+#include "Pn9.h"
 #include "Util.h"
 
 const RF22::ModemConfig config =
@@ -33,26 +37,221 @@ const uint8_t sync_words[] = {
   0x26,
 };
 
+/* Size of the RF22 TX FIFO, frames to send must fit in it */
+const uint8_t TX_FIFO_SIZE = 64;
+
+/* Time on top of the airtime of a frame that sending it may take (to
+ * get the synthesizer going and the like), in ms */
+const uint8_t TX_SLACK = 10;
+
+/* Set the preamble length to send. The RF22 takes up to 511 nibbles,
+ * the highest bit is in the header control register. */
+void MaxRF22::setTxPreamble(uint16_t nibbles) {
+  spiWrite(RF22_REG_33_HEADER_CONTROL2, RF22_HDLEN_0 | RF22_FIXPKLEN | RF22_SYNCLEN_4 | (nibbles >> 8));
+  spiWrite(RF22_REG_34_PREAMBLE_LENGTH, nibbles & 0xff);
+}
+
 bool MaxRF22::init() {
   if (!RF22::init())
     return false;
   setModemRegisters(&config);
   setFrequency(868.3, 0.035);
   /* Disable TX packet control, since the RF22 doesn't do proper
-   * whitening so can't read the length header or CRC. We need RX packet
-   * control so the RF22 actually sends pkvalid interrupts when the
-   * manually set packet length is reached. */
+   * whitening so can't read the length header or CRC (sendFrame only
+   * enables it while sending). We need RX packet control so the RF22
+   * actually sends pkvalid interrupts when the manually set packet
+   * length is reached. */
   spiWrite(RF22_REG_30_DATA_ACCESS_CONTROL, RF22_MSBFRST | RF22_ENPACRX);
   /* No packet headers, 4 sync words, fixed packet length */
   spiWrite(RF22_REG_32_HEADER_CONTROL1, RF22_BCEN_NONE | RF22_HDCH_NONE);
-  spiWrite(RF22_REG_33_HEADER_CONTROL2, RF22_HDLEN_0 | RF22_FIXPKLEN | RF22_SYNCLEN_4);
   setSyncWords(sync_words, lengthof(sync_words));
   /* Detect preamble after 4 nibbles */
   spiWrite(RF22_REG_35_PREAMBLE_DETECTION_CONTROL1, (0x4 << 3));
-  /* Send 8 bytes of preamble */
-  setPreambleLength(8); // in nibbles
-  spiWrite(RF22_REG_3E_PACKET_LENGTH, 20);
+  setTxPreamble(RF_PREAMBLE_NIBBLES);
+  /* The interrupt handler below replaces the one from RF22 */
+  spiWrite(RF22_REG_05_INTERRUPT_ENABLE1, RF22_ENRXFFAFULL | RF22_ENPKVALID | RF22_ENPKSENT);
+  spiWrite(RF22_REG_06_INTERRUPT_ENABLE2, RF22_ENSWDET);
+  /* Start receiving right away, the interrupt handler keeps receive
+   * mode enabled from now on */
+  startRx();
+  return true;
+}
+
+/* Get ready to receive the next frame. The packet length is not known
+ * until its first byte arrives, so interrupt on the first byte. */
+void MaxRF22::startRx() {
+  rx_frame = rx_queue.full() ? NULL : rx_queue.back();
+  if (rx_frame)
+    rx_decoder.start(rx_frame->data);
+  rx_len = 0;
+  rx_expected = 0;
+  spiWrite(RF22_REG_3E_PACKET_LENGTH, RF22_MAX_MESSAGE_LEN);
+  spiWrite(RF22_REG_7E_RX_FIFO_CONTROL, 1);
+  resetRxFifo();
+  /* The radio goes to idle after each packet by itself, without RF22
+   * knowing, so make sure setModeRx() does not skip anything */
+  _mode = RF22_MODE_IDLE;
+  setModeRx();
+}
+
+/* Read len bytes of the current frame from the FIFO, or throw them away
+ * when there is no room for the frame. */
+void MaxRF22::readFifo(uint8_t len) {
+  if (rx_frame && rx_len + len <= sizeof(rx_frame->data)) {
+    spiBurstRead(RF22_REG_7F_FIFO_ACCESS, rx_frame->data + rx_len, len);
+    rx_decoder.feed(len);
+  } else {
+    rx_frame = NULL;
+    for (uint8_t i = 0; i < len; ++i)
+      spiRead(RF22_REG_7F_FIFO_ACCESS);
+  }
+  rx_len += len;
+}
+
+/* Called with the first byte of a frame: tell the radio how long the
+ * frame is, so it stops receiving right after the last byte. A frame
+ * longer than MaxRFFrame holds is cut off there, the decoder then
+ * finds it incomplete. */
+void MaxRF22::setRxLength(uint8_t len_byte) {
+  /* The length byte is whitened like the rest and does not count
+   * itself */
+  uint16_t len = (uint8_t)(len_byte ^ pgm_read_byte(&pn9_table[0])) + 1;
+  if (len < 3)
+    len = 3;
+  if (len > sizeof(MaxRFFrame::data))
+    len = sizeof(MaxRFFrame::data);
+  rx_expected = len;
+  spiWrite(RF22_REG_3E_PACKET_LENGTH, len);
+  spiWrite(RF22_REG_7E_RX_FIFO_CONTROL, RX_CHUNK);
+}
+
+void MaxRF22::handleInterrupt() {
+  /* Reading the status clears it */
+  uint8_t status[2];
+  spiBurstRead(RF22_REG_03_INTERRUPT_STATUS1, status, sizeof(status));
+
+  if (tx_active) {
+    if (status[0] & RF22_IPKSENT)
+      stopTx();
+    return;
+  }
+
+  if (status[1] & RF22_ISWDET) {
+    /* A frame starts, the queue might have room again by now */
+    if (!rx_len && !rx_frame && !rx_queue.full()) {
+      rx_frame = rx_queue.back();
+      rx_decoder.start(rx_frame->data);
+    }
+    if (rx_frame)
+      rx_frame->rssi = spiRead(RF22_REG_26_RSSI);
+  }
+
+  if (status[0] & RF22_IRXFFAFULL) {
+    if (!rx_expected) {
+      /* Keep the length byte, even when dropping the frame */
+      uint8_t len_byte = spiRead(RF22_REG_7F_FIFO_ACCESS);
+      if (rx_frame) {
+        rx_frame->data[0] = len_byte;
+        rx_decoder.feed(1);
+      }
+      rx_len = 1;
+      setRxLength(len_byte);
+    } else if (rx_len + RX_CHUNK <= rx_expected) {
+      readFifo(RX_CHUNK);
+    }
+  }
+
+  if (!(status[0] & RF22_IPKVALID))
+    return;
+
+  /* The last bytes are still in the FIFO */
+  if (rx_expected > rx_len)
+    readFifo(rx_expected - rx_len);
+
+  if (rx_frame) {
+    rx_frame->len = rx_len;
+    rx_frame->crc_ok = rx_decoder.crcOk();
+    rx_frame->time = millis();
+    rx_queue.push();
+
+    if (rx_queue.count() > rx_queue_max)
+      rx_queue_max = rx_queue.count();
+  } else {
+    /* Dropped, so the frames already queued stay intact */
+    rx_overflows++;
+  }
+
+  startRx();
+}
+
+/* The frame was sent, back to receiving */
+void MaxRF22::stopTx() {
+  spiWrite(RF22_REG_30_DATA_ACCESS_CONTROL, RF22_MSBFRST | RF22_ENPACRX);
+  setTxPreamble(RF_PREAMBLE_NIBBLES);
+  tx_active = false;
+  startRx();
+}
+
+bool MaxRF22::sendFrame(const uint8_t *buf, uint8_t len, bool burst) {
+  if (txBusy() || len > TX_FIFO_SIZE)
+    return false;
+
+  /* Frames are built and whitened by build_frame already, so the RF22
+   * only needs to add preamble and sync words. Its TX packet handler
+   * sends exactly the packet length set, without headers or CRC. A
+   * frame being received is lost: once tx_active is set, the interrupt
+   * handler leaves the radio alone, so it must be set before the radio
+   * stops receiving. */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    tx_active = true;
+    setModeIdle();
+  }
+  spiWrite(RF22_REG_30_DATA_ACCESS_CONTROL, RF22_MSBFRST | RF22_ENPACRX | RF22_ENPACTX);
+  setTxPreamble(burst ? RF_BURST_PREAMBLE_NIBBLES : RF_PREAMBLE_NIBBLES);
+  resetTxFifo();
+  spiWrite(RF22_REG_3E_PACKET_LENGTH, len);
+  spiBurstWrite(RF22_REG_7F_FIFO_ACCESS, buf, len);
+  setModeTx();
+  tx_deadline = millis() + airtime(len, burst) + TX_SLACK;
   return true;
 }
 
+bool MaxRF22::txBusy() {
+  if (!tx_active)
+    return false;
+  if ((long)(millis() - tx_deadline) < 0)
+    return true;
+  /* The packet sent interrupt did not come */
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (tx_active) {
+      tx_timeouts++;
+      stopTx();
+    }
+  }
+  return false;
+}
+
+uint16_t MaxRF22::airtime(uint8_t len, bool burst) {
+  return frame_airtime(len, burst ? RF_BURST_PREAMBLE_NIBBLES : RF_PREAMBLE_NIBBLES);
+}
+
+bool MaxRF22::recvFrame(MaxRFFrame *frame) {
+  return rx_queue.pop(frame);
+}
+
+uint16_t MaxRF22::rxOverflows() {
+  uint16_t res;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    res = rx_overflows;
+  }
+  return res;
+}
+
+void MaxRF22::resetRxStats() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    rx_overflows = 0;
+    rx_queue_max = rx_queue.count();
+  }
+}
+
 /* vim: set sw=2 sts=2 expandtab: */
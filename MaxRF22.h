@@ -1,12 +1,111 @@
 #ifndef __MAX_RF_22_H
-#define __MAX_RF_22_h
+#define __MAX_RF_22_H
 
 #include <RF22.h>
 
+#include "FrameDecoder.h"
+#include "MaxRFProto.h"
+#include "Ring.h"
+
+/* Number of received frames that can be queued until the main loop
+ * picks them up. Must be a power of two. Each takes RF_MAX_FRAME_LEN +
+ * 7 bytes of RAM. */
+#define MAX_RF_RX_QUEUE 2
+
+/**
+ * A received frame. It is dewhitened and its CRC checked while it is
+ * being received. A frame longer than any message type is cut off at
+ * RF_MAX_FRAME_LEN bytes, and then has crc_ok false.
+ */
+struct MaxRFFrame {
+  unsigned long time; /* millis() when the frame was completed */
+  uint8_t rssi; /* RSSI register value at the start of the frame */
+  bool crc_ok;
+  uint8_t len;
+  uint8_t data[RF_MAX_FRAME_LEN];
+};
+
 class MaxRF22 : public RF22 {
 public:
-  MaxRF22(uint8_t ss = SS, uint8_t interrupt = 0) : RF22(ss, interrupt) {}
+  MaxRF22(uint8_t ss = SS, uint8_t interrupt = 0) : RF22(ss, interrupt), rx_overflows(0), rx_queue_max(0), tx_active(false), tx_timeouts(0) {}
+  /**
+   * Set up the radio. Frames are received with the length given by
+   * their first byte: the interrupt handler reads that byte as soon as
+   * it arrives and sets the packet length to match. The rest is read
+   * in chunks, each of which is decoded right away.
+   */
   bool init();
+
+  /**
+   * Take the oldest frame from the receive queue. Frames are put into
+   * the queue from the interrupt handler as soon as they are
+   * complete, and reception is re-enabled right away, so frames are
+   * not lost while the main loop is busy.
+   *
+   * Returns false if no frame was received.
+   */
+  bool recvFrame(MaxRFFrame *frame);
+
+  /* Are there received frames waiting? */
+  bool rxPending() { return !rx_queue.empty(); }
+
+  /* Number of frames dropped because the receive queue was full */
+  uint16_t rxOverflows();
+  /* Highest number of frames that were queued at the same time */
+  uint8_t rxQueueMax() { return rx_queue_max; }
+  void resetRxStats();
+
+  /**
+   * Start sending a frame (whitened, including length byte and CRC, see
+   * build_frame), with a long preamble when burst is set. Reception is
+   * off until it is sent. Returns false when still sending the previous
+   * frame.
+   */
+  bool sendFrame(const uint8_t *buf, uint8_t len, bool burst);
+
+  /**
+   * Is a frame being sent? When the radio did not report the frame
+   * sent by its airtime (plus some slack), this gives up on it and
+   * goes back to receiving, so a missed interrupt does not leave the
+   * radio deaf.
+   */
+  bool txBusy();
+
+  /* Number of frames txBusy() gave up on */
+  uint16_t txTimeouts() { return tx_timeouts; }
+  void resetTxStats() { tx_timeouts = 0; }
+
+  /* Time it takes to send a frame of len bytes, in ms */
+  uint16_t airtime(uint8_t len, bool burst);
+
+  /* The rest of a frame is read from the FIFO in chunks of this size,
+   * once its length is known */
+  static const uint8_t RX_CHUNK = 16;
+
+protected:
+  virtual void handleInterrupt();
+  void setTxPreamble(uint16_t nibbles);
+  void startRx();
+  void readFifo(uint8_t len);
+  void setRxLength(uint8_t len_byte);
+  void stopTx();
+
+private:
+  Ring<MaxRFFrame, MAX_RF_RX_QUEUE> rx_queue;
+  /* Frame being received, NULL when it is dropped */
+  MaxRFFrame *rx_frame;
+  /* Dewhitens and checks rx_frame while it comes in */
+  FrameDecoder rx_decoder;
+  /* Bytes of it received so far */
+  uint8_t rx_len;
+  /* Its length, taken from its first byte (0 until then) */
+  uint8_t rx_expected;
+  volatile uint16_t rx_overflows;
+  volatile uint8_t rx_queue_max;
+  volatile bool tx_active;
+  /* millis() by which the frame being sent should be done */
+  unsigned long tx_deadline;
+  uint16_t tx_timeouts;
 };
 
 #endif // __MAX_RF_22_H
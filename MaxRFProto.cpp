@@ -1,4 +1,7 @@
 #include "MaxRFProto.h"
+#include "DeviceTable.h"
+#include "Crc.h"
+#include "Pn9.h"
 #include "Arduino.h"
 
 /* TStreaming Formatting type to use for the field titles in print
@@ -6,9 +9,10 @@
 typedef Align<16> Title;
 
 /**
- * Static list of known devices.
+ * Static list of known devices. Devices not in this list are added when
+ * a message from or to them is received.
  */
-Device devices[] = {
+Device devices[MAX_DEVICES] = {
   /* Add your devices here, for example: */
   //{0x00b825, DeviceType::CUBE, "cube", SET_TEMP_UNKNOWN, ACTUAL_TEMP_UNKNOWN, 0},
   //{0x0298e5, DeviceType::WALL, "wall", SET_TEMP_UNKNOWN, ACTUAL_TEMP_UNKNOWN, 0},
@@ -16,21 +20,82 @@ Device devices[] = {
   //{0x0131b4, DeviceType::RADIATOR, "down", SET_TEMP_UNKNOWN, ACTUAL_TEMP_UNKNOWN, 0, {.radiator = {Mode::UNKNOWN, VALVE_UNKNOWN}}},
 };
 
-/* Find or assign a device struct based on the address */
-static Device *get_device(uint32_t addr, DeviceType type) {
-  for (int i = 0; i < lengthof(devices); ++i) {
-    /* The address is not in the list yet, assign this empty slot. */
-    if (devices[i].address == 0 && addr != 0) {
-      devices[i].address = addr;
-      devices[i].type = type;
-      devices[i].name = NULL;
-    }
-    /* Found it */
-    if (devices[i].address == addr)
-      return &devices[i];
+/* Update a field of a device, marking it dirty when the value changed */
+template <typename T>
+static void update_field(Device *d, T &field, T value, uint8_t flag) {
+  if (field != value) {
+    field = value;
+    d->dirty |= flag;
   }
-  /* Not found and no slots left */
-  return NULL;
+}
+
+/*
+ * Payload layouts, see HeaderLayout in MaxRFProto.h. Offsets are
+ * relative to the start of the payload.
+ */
+namespace SetTemperatureLayout {
+  typedef BitField<0, 0, 6> set_temp;
+  typedef BitField<0, 6, 2, Mode> mode;
+  /* Until time in bytes 1-3 */
+}
+
+namespace WallThermostatStateLayout {
+  typedef BitField<0, 0, 7> set_temp;
+  /* Bit 8 of the actual temp is stored in front of the set temp */
+  typedef BitFieldConcat<BitField<0, 7, 1>, BitField<1, 0, 8>> actual_temp;
+}
+
+/* Used by ThermostatState and (shifted one byte) by Ack */
+template <uint8_t OFFSET>
+struct RadiatorStateLayout {
+  typedef BitField<OFFSET, 0, 2, Mode> mode;
+  typedef BitField<OFFSET, 2, 1, bool> dst;
+  typedef BitField<OFFSET, 5, 1, bool> locked;
+  typedef BitField<OFFSET, 7, 1, bool> battery_low;
+  typedef BitField<OFFSET + 1, 0, 8> valve_pos;
+  typedef BitField<OFFSET + 2, 0, 8> set_temp;
+  /* Either actual temp or until time follows */
+  typedef BitField<OFFSET + 3, 0, 9, uint16_t> actual_temp;
+};
+
+namespace SetDisplayActualTemperatureLayout {
+  typedef BitField<0, 2, 1, DisplayMode> display_mode;
+}
+
+namespace UntilTimeLayout {
+  typedef BitField<0, 0, 5> day;
+  typedef BitFieldConcat<BitField<0, 5, 3>, BitField<1, 7, 1>, uint8_t> month;
+  typedef BitField<1, 0, 6> year;
+  typedef BitField<2, 0, 6> time;
+}
+
+uint16_t frame_airtime(uint8_t len, uint16_t preamble_nibbles) {
+  uint32_t bits = preamble_nibbles * 4UL + (RF_SYNC_LEN + len) * 8UL;
+  return (bits * 1000 + RF_BITRATE - 1) / RF_BITRATE;
+}
+
+uint8_t build_frame(uint8_t *buf, uint8_t seqnum, uint8_t flags,
+                    MessageType type, uint32_t from, uint32_t to,
+                    uint8_t group_id, const uint8_t *payload,
+                    uint8_t payload_len) {
+  uint8_t *header = buf + 1;
+  /* The length byte does not count itself */
+  uint8_t len = HeaderLayout::LEN + payload_len + 2;
+  buf[0] = len;
+  HeaderLayout::seqnum::set(header, seqnum);
+  HeaderLayout::flags::set(header, flags);
+  HeaderLayout::type::set(header, type);
+  HeaderLayout::addr_from::set(header, from);
+  HeaderLayout::addr_to::set(header, to);
+  HeaderLayout::group_id::set(header, group_id);
+  memcpy(header + HeaderLayout::LEN, payload, payload_len);
+
+  uint16_t crc = calc_crc(buf, len - 1);
+  buf[len - 1] = crc >> 8;
+  buf[len] = crc & 0xff;
+
+  xor_pn9(buf, len + 1);
+  return len + 1;
 }
 
 /* MaxRFMessage */
@@ -52,76 +117,136 @@ const FlashString *MaxRFMessage::display_mode_to_str(DisplayMode display_mode) {
   }
 };
 
-const FlashString *MaxRFMessage::type_to_str(MessageType type) {
+const FlashString *MaxRFMessage::device_type_to_str(DeviceType type) {
   switch(type) {
-    case MessageType::PAIR_PING:                      return F("PairPing");
-    case MessageType::PAIR_PONG:                      return F("PairPong");
-    case MessageType::ACK:                            return F("Ack");
-    case MessageType::TIME_INFORMATION:               return F("TimeInformation");
-    case MessageType::CONFIG_WEEK_PROFILE:            return F("ConfigWeekProfile");
-    case MessageType::CONFIG_TEMPERATURES:            return F("ConfigTemperatures");
-    case MessageType::CONFIG_VALVE:                   return F("ConfigValve");
-    case MessageType::ADD_LINK_PARTNER:               return F("AddLinkPartner");
-    case MessageType::REMOVE_LINK_PARTNER:            return F("RemoveLinkPartner");
-    case MessageType::SET_GROUP_ID:                   return F("SetGroupId");
-    case MessageType::REMOVE_GROUP_ID:                return F("RemoveGroupId");
-    case MessageType::SHUTTER_CONTACT_STATE:          return F("ShutterContactState");
-    case MessageType::SET_TEMPERATURE:                return F("SetTemperature");
-    case MessageType::WALL_THERMOSTAT_STATE:          return F("WallThermostatState");
-    case MessageType::SET_COMFORT_TEMPERATURE:        return F("SetComfortTemperature");
-    case MessageType::SET_ECO_TEMPERATURE:            return F("SetEcoTemperature");
-    case MessageType::PUSH_BUTTON_STATE:              return F("PushButtonState");
-    case MessageType::THERMOSTAT_STATE:               return F("ThermostatState");
-    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: return F("SetDisplayActualTemperature");
-    case MessageType::WAKE_UP:                        return F("WakeUp");
-    case MessageType::RESET:                          return F("Reset");
-    default:                             return F("Unknown");
+    case DeviceType::CUBE: return F("cube");
+    case DeviceType::WALL: return F("wall");
+    case DeviceType::RADIATOR: return F("radiator");
+    default: return F("unknown");
   }
+};
+
+/* Construct a message of the given class in storage */
+template <typename T>
+static MaxRFMessage *construct(MaxRFMessageBuffer *storage) {
+  return new (storage->bytes) T();
 }
 
-DeviceType MaxRFMessage::message_type_to_sender_type(MessageType type) {
-  switch(type) {
-    case MessageType::WALL_THERMOSTAT_STATE:          return DeviceType::WALL;
-    case MessageType::THERMOSTAT_STATE:               return DeviceType::RADIATOR;
-    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: return DeviceType::CUBE;
-    default:                             return DeviceType::UNKNOWN;
-  }
+const char type_pair_ping[] PROGMEM = "PairPing";
+const char type_pair_pong[] PROGMEM = "PairPong";
+const char type_ack[] PROGMEM = "Ack";
+const char type_time_information[] PROGMEM = "TimeInformation";
+const char type_config_week_profile[] PROGMEM = "ConfigWeekProfile";
+const char type_config_temperatures[] PROGMEM = "ConfigTemperatures";
+const char type_config_valve[] PROGMEM = "ConfigValve";
+const char type_add_link_partner[] PROGMEM = "AddLinkPartner";
+const char type_remove_link_partner[] PROGMEM = "RemoveLinkPartner";
+const char type_set_group_id[] PROGMEM = "SetGroupId";
+const char type_remove_group_id[] PROGMEM = "RemoveGroupId";
+const char type_shutter_contact_state[] PROGMEM = "ShutterContactState";
+const char type_set_temperature[] PROGMEM = "SetTemperature";
+const char type_wall_thermostat_state[] PROGMEM = "WallThermostatState";
+const char type_set_comfort_temperature[] PROGMEM = "SetComfortTemperature";
+const char type_set_eco_temperature[] PROGMEM = "SetEcoTemperature";
+const char type_push_button_state[] PROGMEM = "PushButtonState";
+const char type_thermostat_state[] PROGMEM = "ThermostatState";
+const char type_set_display_actual_temperature[] PROGMEM = "SetDisplayActualTemperature";
+const char type_reset[] PROGMEM = "Reset";
+const char type_wake_up[] PROGMEM = "WakeUp";
+
+/* Types without a class of their own are parsed as UnknownMessage. This
+ * is constexpr, so message_type_index can be built from it. */
+constexpr MessageTypeInfo message_types[] PROGMEM = {
+  {MessageType::PAIR_PING,                      DeviceType::UNKNOWN,  0, type_pair_ping,                      construct<UnknownMessage>},
+  {MessageType::PAIR_PONG,                      DeviceType::UNKNOWN,  0, type_pair_pong,                      construct<UnknownMessage>},
+  {MessageType::ACK,                            DeviceType::UNKNOWN,  4, type_ack,                            construct<AckMessage>},
+  {MessageType::TIME_INFORMATION,               DeviceType::UNKNOWN,  0, type_time_information,               construct<UnknownMessage>},
+  {MessageType::CONFIG_WEEK_PROFILE,            DeviceType::UNKNOWN,  0, type_config_week_profile,            construct<UnknownMessage>},
+  {MessageType::CONFIG_TEMPERATURES,            DeviceType::UNKNOWN,  0, type_config_temperatures,            construct<UnknownMessage>},
+  {MessageType::CONFIG_VALVE,                   DeviceType::UNKNOWN,  0, type_config_valve,                   construct<UnknownMessage>},
+  {MessageType::ADD_LINK_PARTNER,               DeviceType::UNKNOWN,  0, type_add_link_partner,               construct<UnknownMessage>},
+  {MessageType::REMOVE_LINK_PARTNER,            DeviceType::UNKNOWN,  0, type_remove_link_partner,            construct<UnknownMessage>},
+  {MessageType::SET_GROUP_ID,                   DeviceType::UNKNOWN,  0, type_set_group_id,                   construct<UnknownMessage>},
+  {MessageType::REMOVE_GROUP_ID,                DeviceType::UNKNOWN,  0, type_remove_group_id,                construct<UnknownMessage>},
+  {MessageType::SHUTTER_CONTACT_STATE,          DeviceType::UNKNOWN,  0, type_shutter_contact_state,          construct<UnknownMessage>},
+  {MessageType::SET_TEMPERATURE,                DeviceType::UNKNOWN,  1, type_set_temperature,                construct<SetTemperatureMessage>},
+  {MessageType::WALL_THERMOSTAT_STATE,          DeviceType::WALL,     2, type_wall_thermostat_state,          construct<WallThermostatStateMessage>},
+  {MessageType::SET_COMFORT_TEMPERATURE,        DeviceType::UNKNOWN,  0, type_set_comfort_temperature,        construct<UnknownMessage>},
+  {MessageType::SET_ECO_TEMPERATURE,            DeviceType::UNKNOWN,  0, type_set_eco_temperature,            construct<UnknownMessage>},
+  {MessageType::PUSH_BUTTON_STATE,              DeviceType::UNKNOWN,  0, type_push_button_state,              construct<UnknownMessage>},
+  {MessageType::THERMOSTAT_STATE,               DeviceType::RADIATOR, 3, type_thermostat_state,               construct<ThermostatStateMessage>},
+  {MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE, DeviceType::CUBE,     1, type_set_display_actual_temperature, construct<SetDisplayActualTemperatureMessage>},
+  {MessageType::RESET,                          DeviceType::UNKNOWN,  0, type_reset,                          construct<UnknownMessage>},
+  {MessageType::WAKE_UP,                        DeviceType::UNKNOWN,  0, type_wake_up,                        construct<UnknownMessage>},
+};
+
+const uint8_t message_types_count = lengthof(message_types);
+
+/* Index in message_types plus one of the entry for type, or 0 when
+ * there is none, looking from entry i onwards */
+static constexpr uint8_t type_index(uint8_t type, uint8_t i = 0) {
+  return i == lengthof(message_types) ? 0
+       : (uint8_t)message_types[i].type == type ? i + 1
+       : type_index(type, i + 1);
 }
 
-MaxRFMessage *MaxRFMessage::create_message_from_type(MessageType type) {
-  switch(type) {
-    case MessageType::SET_TEMPERATURE:                return new SetTemperatureMessage();
-    case MessageType::WALL_THERMOSTAT_STATE:          return new WallThermostatStateMessage();
-    case MessageType::THERMOSTAT_STATE:               return new ThermostatStateMessage();
-    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: return new SetDisplayActualTemperatureMessage();
-    case MessageType::ACK:                            return new AckMessage();
-    default:                             return new UnknownMessage();
-  }
+#define TYPE_INDEX_4(t) type_index(t), type_index(t + 1), type_index(t + 2), type_index(t + 3)
+#define TYPE_INDEX_16(t) TYPE_INDEX_4(t), TYPE_INDEX_4(t + 4), TYPE_INDEX_4(t + 8), TYPE_INDEX_4(t + 12)
+#define TYPE_INDEX_64(t) TYPE_INDEX_16(t), TYPE_INDEX_16(t + 16), TYPE_INDEX_16(t + 32), TYPE_INDEX_16(t + 48)
+
+/* type_index() of every type byte, computed at compile time */
+const uint8_t message_type_index[256] PROGMEM = {
+  TYPE_INDEX_64(0x00), TYPE_INDEX_64(0x40), TYPE_INDEX_64(0x80), TYPE_INDEX_64(0xc0),
+};
+
+bool find_message_type(MessageType type, MessageTypeInfo *info) {
+  uint8_t i = pgm_read_byte(&message_type_index[(uint8_t)type]);
+  if (!i)
+    return false;
+  memcpy_P(info, &message_types[i - 1], sizeof(*info));
+  return true;
 }
 
-MaxRFMessage *MaxRFMessage::parse(const uint8_t *buf, size_t len) {
-  if (len < 10)
+const FlashString *MaxRFMessage::type_to_str(MessageType type) {
+  MessageTypeInfo info;
+  if (!find_message_type(type, &info))
+    return F("Unknown");
+  return (const FlashString*)info.name;
+}
+
+MaxRFMessage *MaxRFMessage::parse(const uint8_t *buf, size_t len, MaxRFMessageBuffer *storage) {
+  if (len < HeaderLayout::LEN)
     return NULL;
 
-  MessageType type = (MessageType)buf[2];
-  MaxRFMessage *m = create_message_from_type(type);
+  uint32_t addr_from = HeaderLayout::addr_from::get(buf);
+  uint32_t addr_to = HeaderLayout::addr_to::get(buf);
+  uint8_t group_id = HeaderLayout::group_id::get(buf);
+
+  MessageType type = HeaderLayout::type::get(buf);
+  MessageTypeInfo info;
+  if (!find_message_type(type, &info)) {
+    info.sender = DeviceType::UNKNOWN;
+    info.construct = construct<UnknownMessage>;
+  } else if (len - HeaderLayout::LEN < info.min_payload_len) {
+    return NULL;
+  }
+  MaxRFMessage *m = info.construct(storage);
 
-  m->seqnum = buf[0];
-  m->flags = buf[1];
+  m->seqnum = HeaderLayout::seqnum::get(buf);
+  m->flags = HeaderLayout::flags::get(buf);
   m->type = type;
-  m->addr_from = getBits(buf + 3, 0, RF_ADDR_SIZE);
-  m->addr_to = getBits(buf + 6, 0, RF_ADDR_SIZE);
-  m->group_id = buf[9];
+  m->addr_from = addr_from;
+  m->addr_to = addr_to;
+  m->group_id = group_id;
 
-  m->from = get_device(m->addr_from, message_type_to_sender_type(type));
-  m->to = get_device(m->addr_to, DeviceType::UNKNOWN);
+  m->from = device_table.get(m->addr_from, info.sender);
+  m->to = device_table.get(m->addr_to, DeviceType::UNKNOWN);
 
-  if (m->parse_payload(buf + 10, len - 10))
+  if (m->parse_payload(buf + HeaderLayout::LEN, len - HeaderLayout::LEN))
     return m;
-  else {
-  	delete m;
-    return NULL;
-  }
+
+  m->~MaxRFMessage();
+  return NULL;
 }
 
 size_t MaxRFMessage::printTo(Print &p) const {
@@ -158,21 +283,19 @@ size_t UnknownMessage::printTo(Print &p) const{
   p << V<Title>(F("Payload:"))
     << V<Array<Hex, TChar<' '>>>(this->payload, this->payload_len)
     << "\r\n";
+
+  return 0; /* XXX */
 }
 
 /* SetTemperatureMessage */
 
 bool SetTemperatureMessage::parse_payload(const uint8_t *buf, size_t len) {
-  if (len < 1)
-    return false;
+  this->set_temp = SetTemperatureLayout::set_temp::get(buf);
+  this->mode = SetTemperatureLayout::mode::get(buf);
 
-  this->set_temp = buf[0] & 0x3f;
-  this->mode = (Mode) ((buf[0] >> 6) & 0x3);
-
-  if (len >= 4)
-    this->until = new UntilTime(buf + 1);
-  else
-    this->until = NULL;
+  this->has_until = (len >= 4);
+  if (this->has_until)
+    this->until = UntilTime(buf + 1);
 
   return true;
 }
@@ -181,21 +304,23 @@ size_t SetTemperatureMessage::printTo(Print &p) const{
   MaxRFMessage::printTo(p);
   p << V<Title>(F("Mode:")) << mode_to_str(this->mode) << "\r\n";
   p << V<Title>(F("Set temp:")) << V<SetTemp>(this->set_temp) << "\r\n";
-  if (this->until) {
-    p << V<Title>(F("Until:")) << *(this->until) << "\r\n";
+  if (this->has_until) {
+    p << V<Title>(F("Until:")) << this->until << "\r\n";
   }
 
   return 0; /* XXX */
 }
 
+void SetTemperatureMessage::build_payload(uint8_t *buf, uint8_t set_temp, Mode mode) {
+  SetTemperatureLayout::set_temp::set(buf, set_temp);
+  SetTemperatureLayout::mode::set(buf, mode);
+}
+
 /* WallThermostatStateMessage */
 
 bool WallThermostatStateMessage::parse_payload(const uint8_t *buf, size_t len) {
-  if (len < 2)
-    return false;
-
-  this->set_temp = buf[0] & 0x7f;
-  this->actual_temp = ((buf[0] & 0x80) << 1) |  buf[1];
+  this->set_temp = WallThermostatStateLayout::set_temp::get(buf);
+  this->actual_temp = WallThermostatStateLayout::actual_temp::get(buf);
   /* Note that mode and until time are not in this message */
 
   return true;
@@ -211,31 +336,33 @@ size_t WallThermostatStateMessage::printTo(Print &p) const {
 
 void WallThermostatStateMessage::updateState() {
   MaxRFMessage::updateState();
-  this->from->set_temp = this->set_temp;
-  this->from->actual_temp = this->actual_temp;
+  /* Device table full */
+  if (!this->from)
+    return;
+  update_field(this->from, this->from->set_temp, this->set_temp, DIRTY_SET_TEMP);
+  update_field(this->from, this->from->actual_temp, this->actual_temp, DIRTY_ACTUAL_TEMP);
   this->from->actual_temp_time = millis();
 }
 
 /* ThermostatStateMessage */
 
 bool ThermostatStateMessage::parse_payload(const uint8_t *buf, size_t len) {
-  if (len < 3)
-    return false;
+  typedef RadiatorStateLayout<0> Layout;
 
-  this->mode = (Mode) (buf[0] & 0x3);
-  this->dst = (buf[0] >> 2) & 0x1;
-  this->locked = (buf[0] >> 5) & 0x1;
-  this->battery_low = (buf[0] >> 7) & 0x1;
-  this->valve_pos = buf[1];
-  this->set_temp = buf[2];
+  this->mode = Layout::mode::get(buf);
+  this->dst = Layout::dst::get(buf);
+  this->locked = Layout::locked::get(buf);
+  this->battery_low = Layout::battery_low::get(buf);
+  this->valve_pos = Layout::valve_pos::get(buf);
+  this->set_temp = Layout::set_temp::get(buf);
 
   this->actual_temp = 0;
   if (this->mode != Mode::TEMPORARY && len >= 5)
-    this->actual_temp = ((buf[3] & 0x1) << 8) + buf[4];
+    this->actual_temp = Layout::actual_temp::get(buf);
 
-  this->until = NULL;
-  if (this->mode == Mode::TEMPORARY && len >= 6)
-    this->until = new UntilTime(buf + 3);
+  this->has_until = (this->mode == Mode::TEMPORARY && len >= 6);
+  if (this->has_until)
+    this->until = UntilTime(buf + 3);
 
   return true;
 }
@@ -252,55 +379,57 @@ size_t ThermostatStateMessage::printTo(Print &p) const {
   if (this->actual_temp)
     p << V<Title>(F("Actual temp:")) << V<ActualTemp>(this->actual_temp) << "\r\n";
 
-  if (this->until)
-    p << V<Title>(F("Until:")) << *(this->until) << "\r\n";
+  if (this->has_until)
+    p << V<Title>(F("Until:")) << this->until << "\r\n";
 
   return 0; /* XXX */
 }
 
 void ThermostatStateMessage::updateState() {
-  this->from->set_temp = this->set_temp;
-  this->from->data.radiator.valve_pos = this->valve_pos;
+  /* Device table full */
+  if (!this->from)
+    return;
+  update_field(this->from, this->from->set_temp, this->set_temp, DIRTY_SET_TEMP);
+  update_field(this->from, this->from->data.radiator.valve_pos, this->valve_pos, DIRTY_VALVE_POS);
   if (this->actual_temp) {
-    this->from->actual_temp = this->actual_temp;
+    update_field(this->from, this->from->actual_temp, this->actual_temp, DIRTY_ACTUAL_TEMP);
     this->from->actual_temp_time = millis();
   }
 }
 
 /* SetDisplayActualTemperatureMessage */
 bool SetDisplayActualTemperatureMessage::parse_payload(const uint8_t *buf, size_t len) {
-  if (len < 1)
-    return NULL;
-  this->display_mode = (DisplayMode) ((buf[0] >> 2) & 0x1);
+  this->display_mode = SetDisplayActualTemperatureLayout::display_mode::get(buf);
   return true;
 }
 
 size_t SetDisplayActualTemperatureMessage::printTo(Print &p) const{
   MaxRFMessage::printTo(p);
   p << V<Title>(F("Display mode:")) << display_mode_to_str(this->display_mode) << "\r\n";
+
+  return 0; /* XXX */
 }
 
 /* AckMessage */
 bool AckMessage::parse_payload(const uint8_t *buf, size_t len) {
-  if (len < 4)
-    return false;
+  typedef RadiatorStateLayout<1> Layout;
 
   /* XXX: Perhaps buf[0] == 0x01 can be used here instead? */
   if (this->from && this->from->type == DeviceType::RADIATOR) {
     /* We only know about packet formats sent by radiators yet */
 
-    this->mode = (Mode) (buf[1] & 0x3);
-    this->dst = (buf[1] >> 2) & 0x1;
+    this->mode = Layout::mode::get(buf);
+    this->dst = Layout::dst::get(buf);
     /* The locked and battery_low bits are unconfirmed, but they probably
      * match the RadiatorThermostateStateMessage. */
-    this->locked = (buf[1] >> 5) & 0x1;
-    this->battery_low = (buf[1] >> 7) & 0x1;
-    this->valve_pos = buf[2];
-    this->set_temp = buf[3];
-
-    this->until = NULL;
-    if (this->mode == Mode::TEMPORARY && len >= 7)
-      this->until = new UntilTime(buf + 4);
+    this->locked = Layout::locked::get(buf);
+    this->battery_low = Layout::battery_low::get(buf);
+    this->valve_pos = Layout::valve_pos::get(buf);
+    this->set_temp = Layout::set_temp::get(buf);
+
+    this->has_until = (this->mode == Mode::TEMPORARY && len >= 7);
+    if (this->has_until)
+      this->until = UntilTime(buf + 4);
   }
 
   return true;
@@ -316,8 +445,8 @@ size_t AckMessage::printTo(Print &p) const {
     p << V<Title>(F("Valve position:")) << this->valve_pos << "%" << "\r\n";
     p << V<Title>(F("Set temp:")) << V<SetTemp>(this->set_temp) << "\r\n";
 
-    if (this->until)
-      p << V<Title>(F("Until:")) << *(this->until) << "\r\n";
+    if (this->has_until)
+      p << V<Title>(F("Until:")) << this->until << "\r\n";
   }
 
   return 0; /* XXX */
@@ -325,23 +454,25 @@ size_t AckMessage::printTo(Print &p) const {
 
 void AckMessage::updateState() {
   if (this->from && this->from->type == DeviceType::RADIATOR) {
-    this->from->set_temp = this->set_temp;
-    this->from->data.radiator.valve_pos = this->valve_pos;
+    update_field(this->from, this->from->set_temp, this->set_temp, DIRTY_SET_TEMP);
+    update_field(this->from, this->from->data.radiator.valve_pos, this->valve_pos, DIRTY_VALVE_POS);
   }
 }
 
 /* UntilTime */
 
 UntilTime::UntilTime(const uint8_t *buf) {
-  this->year = buf[1] & 0x3f;
-  this->month = ((buf[0] & 0xE0) >> 4) | (buf[1] >> 7);
-  this->day = buf[0] & 0x1f;
-  this->time = buf[2] & 0x3f;
+  this->year = UntilTimeLayout::year::get(buf);
+  this->month = UntilTimeLayout::month::get(buf);
+  this->day = UntilTimeLayout::day::get(buf);
+  this->time = UntilTimeLayout::time::get(buf);
 }
 
 size_t UntilTime::printTo(Print &p) const {
   p << "20" << V<Number<2>>(this->year) << "." << V<Number<2>>(this->month) << "." << V<Number<2>>(this->day);
   p << " " << V<Number<2>>(this->time / 2) << (this->time % 2 ? ":30" : ":00");
+
+  return 0; /* XXX */
 }
 
 
@@ -2,17 +2,32 @@
 #define __MAX_RF_PROTO_H
 
 #include <stdint.h>
+#include <avr/pgmspace.h>
 #include <Print.h>
 #include <TStreaming.h>
 
 #include "Max.h"
 #include "Util.h"
+#include "BitField.h"
+#include "History.h"
+#include "LinkStats.h"
 
 const size_t RF_ADDR_SIZE = 24;
 const uint16_t ACTUAL_TEMP_UNKNOWN = 0xffff;
 const uint8_t SET_TEMP_UNKNOWN = 0xff;
 const uint8_t VALVE_UNKNOWN = 0xff;
 
+/* Over the air, a frame is preceded by a preamble and sync words */
+const uint16_t RF_BITRATE = 10000; /* bits per second */
+const uint8_t RF_SYNC_LEN = 4; /* bytes */
+const uint16_t RF_PREAMBLE_NIBBLES = 8;
+/* Battery powered devices only listen now and then, so messages to
+ * them are sent with a long preamble to wake them up. This is the
+ * longest the RF22 can send, about 200 ms, while a cube sends about a
+ * second of preamble, so a device might sleep through it and only get
+ * a resend. */
+const uint16_t RF_BURST_PREAMBLE_NIBBLES = 511;
+
 // Constant string with external linkage, so it can be passed as a
 // template param
 constexpr const char na[] = "NA";
@@ -60,6 +75,49 @@ enum class MessageType : uint8_t {
   RESET                          = 0xF0,
 };
 
+/*
+ * Layout of the message header (see BitField.h), which starts right
+ * after the length byte.
+ */
+namespace HeaderLayout {
+  typedef BitField<0, 0, 8> seqnum;
+  typedef BitField<1, 0, 8> flags;
+  typedef BitField<2, 0, 8, MessageType> type;
+  typedef BitField<3, 0, RF_ADDR_SIZE, uint32_t> addr_from;
+  typedef BitField<6, 0, RF_ADDR_SIZE, uint32_t> addr_to;
+  typedef BitField<9, 0, 8> group_id;
+  /* The payload follows the header */
+  const uint8_t LEN = group_id::END;
+}
+
+/* Longest frame (including length byte and CRC) of any message type:
+ * a ConfigWeekProfile, with a day and 13 switch points of two bytes as
+ * payload. */
+const uint8_t RF_MAX_FRAME_LEN = 1 + HeaderLayout::LEN + 27 + 2;
+
+/**
+ * Time (in ms, rounded up) it takes to send a frame of len bytes
+ * (including length byte and CRC) with the given preamble length.
+ */
+uint16_t frame_airtime(uint8_t len, uint16_t preamble_nibbles);
+
+/**
+ * Build a frame to send: length byte, header, payload and CRC, whitened
+ * like received frames are. buf must have room for HeaderLayout::LEN +
+ * payload_len + 3 bytes. Returns the length of the frame.
+ */
+uint8_t build_frame(uint8_t *buf, uint8_t seqnum, uint8_t flags,
+                    MessageType type, uint32_t from, uint32_t to,
+                    uint8_t group_id, const uint8_t *payload,
+                    uint8_t payload_len);
+
+/* Bits in Device::dirty, set when the corresponding field changed */
+const uint8_t DIRTY_SET_TEMP    = 0x01;
+const uint8_t DIRTY_ACTUAL_TEMP = 0x02;
+const uint8_t DIRTY_VALVE_POS   = 0x04;
+/* The device was just added */
+const uint8_t DIRTY_NEW         = 0x08;
+
 /**
  * Current state for a specific device.
  */
@@ -80,15 +138,34 @@ public:
     struct {
     } wall;
   } data;
+  unsigned long last_seen; /* When was a message from or to it last seen */
+  uint8_t dirty; /* DIRTY_* bits, cleared once the change was reported */
+  uint16_t duplicates; /* Retransmitted messages received from it */
+  #ifdef PERSIST_EEPROM_SIZE
+  /* How old (in minutes) its state was when restored from EEPROM, 0 once
+   * it is seen again. See DeviceStore::age(). */
+  uint16_t stored_age;
+  #endif // PERSIST_EEPROM_SIZE
+  #ifdef LINK_STATS
+  LinkStats link;
+  #endif // LINK_STATS
+  #ifdef HISTORY_BYTES
+  /* Its state every HISTORY_INTERVAL ms, the newest sample taken at
+   * last_history */
+  HistoryRing<HISTORY_BYTES> history;
+  #endif // HISTORY_BYTES
 };
 
+static_assert(MAX_DEVICES <= 256, "DeviceTable supports at most 256 devices");
+
 /*
  * Known devices, terminated with a NULL entry.
  */
-extern Device devices[6];
+extern Device devices[MAX_DEVICES];
 
 class UntilTime : public Printable {
 public:
+  UntilTime() {}
   /* Parse an until time from three bytes from an RF packet */
   UntilTime(const uint8_t *buf);
 
@@ -101,16 +178,25 @@ public:
 };
 
 
+union MaxRFMessageBuffer;
+
 class MaxRFMessage : public Printable {
 public:
   /**
    * Parse a RF message. Buffer should contain only headers and
    * payload (so no length byte and no CRC).
    *
+   * The message is constructed inside storage, without touching the
+   * heap. It is only valid until storage is reused, and should be
+   * destroyed by calling its destructor directly (not through delete).
+   *
    * Note that the message might keep a reference to the buffer around
    * to prevent unnecessary copies!
+   *
+   * Returns NULL when the message is invalid. Frames are checked
+   * against address_filter before (see loop()), not here.
    */
-  static MaxRFMessage *parse(const uint8_t *buf, size_t len);
+  static MaxRFMessage *parse(const uint8_t *buf, size_t len, MaxRFMessageBuffer *storage);
 
   /**
    * Returns a string describing a given message type.
@@ -118,6 +204,7 @@ public:
   static const FlashString *type_to_str(MessageType type);
   static const FlashString *mode_to_str(Mode mode);
   static const FlashString *display_mode_to_str(DisplayMode display_mode);
+  static const FlashString *device_type_to_str(DeviceType type);
 
   virtual size_t printTo(Print &p) const;
 
@@ -140,9 +227,16 @@ public:
   Device *to;
 
   virtual ~MaxRFMessage() {}
+
+  /* Placement new, to construct messages inside a MaxRFMessageBuffer.
+   * This is defined here instead of using <new>, which is not available
+   * on all Arduino versions. Since this hides the global operator new,
+   * messages can not end up on the heap by accident. The virtual
+   * destructor still needs a delete. */
+  static void *operator new(size_t size, void *place) { return place; }
+  static void operator delete(void *p) { ::operator delete(p); }
 private:
-  static MaxRFMessage *create_message_from_type(MessageType type);
-  static DeviceType message_type_to_sender_type(MessageType type);
+  /* len is at least the min_payload_len for the type */
   virtual bool parse_payload(const uint8_t *buf, size_t len) = 0;
 };
 
@@ -165,12 +259,18 @@ public:
   virtual bool parse_payload(const uint8_t *buf, size_t len);
   virtual size_t printTo(Print &p) const;
 
+  /**
+   * Build the payload for a message without until time into buf (which
+   * needs room for PAYLOAD_LEN bytes).
+   */
+  static void build_payload(uint8_t *buf, uint8_t set_temp, Mode mode);
+  static const uint8_t PAYLOAD_LEN = 1;
+
   uint8_t set_temp; /* In 0.5° units */
   Mode mode;
 
-  UntilTime *until; /* Only when mode is MODE_TEMPORARY */
-
-  virtual ~SetTemperatureMessage() {delete this->until; }
+  bool has_until; /* Only when mode is MODE_TEMPORARY */
+  UntilTime until; /* Only when has_until is set */
 };
 
 class WallThermostatStateMessage : public MaxRFMessage {
@@ -195,9 +295,9 @@ public:
   Mode mode;
   uint8_t valve_pos; /* In percent */
   uint8_t set_temp; /* In 0.5° units */
-  uint8_t actual_temp; /* In 0.1° units, 0 when not present */
-  UntilTime *until; /* Only when mode is MODE_TEMPORARY */
-  virtual ~ThermostatStateMessage() {delete this->until; }
+  uint16_t actual_temp; /* In 0.1° units, 0 when not present */
+  bool has_until; /* Only when mode is MODE_TEMPORARY */
+  UntilTime until; /* Only when has_until is set */
 };
 
 class SetDisplayActualTemperatureMessage : public MaxRFMessage {
@@ -220,10 +320,63 @@ public:
   Mode mode;
   uint8_t valve_pos; /* In percent */
   uint8_t set_temp; /* In 0.5° units */
-  UntilTime *until; /* Only when mode is MODE_TEMPORARY */
-  virtual ~AckMessage() {delete this->until; }
+  bool has_until; /* Only when mode is MODE_TEMPORARY */
+  UntilTime until; /* Only when has_until is set */
+};
+
+/**
+ * Storage big enough for any of the message types above, to let
+ * MaxRFMessage::parse work without allocating memory. When adding a
+ * message type, add it here too.
+ */
+union MaxRFMessageBuffer {
+  uint8_t bytes[max_sizeof<UnknownMessage,
+                           SetTemperatureMessage,
+                           WallThermostatStateMessage,
+                           ThermostatStateMessage,
+                           SetDisplayActualTemperatureMessage,
+                           AckMessage>::value];
+  /* Only to get the right alignment */
+  void *align_ptr;
+  uint32_t align_int;
+};
+
+/**
+ * What is known about a message type. All message type specific
+ * handling in MaxRFMessage::parse and type_to_str comes from the
+ * message_types table, so adding a type is adding an entry there (and
+ * to MaxRFMessageBuffer, when it gets its own class).
+ *
+ * A lookup goes through message_type_index, so it is a read from
+ * PROGMEM and a copy of the entry, a bit faster than the switches the
+ * table replaced (see host/bench_registry). On the AVR, an entry takes
+ * 7 bytes of flash and the index another 256 bytes.
+ */
+struct MessageTypeInfo {
+  MessageType type;
+  /* Type of device that sends messages of this type, if known */
+  DeviceType sender;
+  /* Messages with a shorter payload are invalid */
+  uint8_t min_payload_len;
+  /* In PROGMEM */
+  const char *name;
+  /* Constructs the message in storage */
+  MaxRFMessage *(*construct)(MaxRFMessageBuffer *storage);
 };
 
+/* Known message types, in PROGMEM, sorted by type */
+extern const MessageTypeInfo message_types[] PROGMEM;
+extern const uint8_t message_types_count;
+/* For every type byte, its index in message_types plus one, or 0 for
+ * unknown types. In PROGMEM. */
+extern const uint8_t message_type_index[256] PROGMEM;
+
+/**
+ * Look up a message type in message_types, copying its entry into
+ * info. Returns false when the type is unknown.
+ */
+bool find_message_type(MessageType type, MessageTypeInfo *info);
+
 #endif // __MAX_RF_PROTO_H
 
 /* vim: set sw=2 sts=2 expandtab: */
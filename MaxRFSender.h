@@ -0,0 +1,271 @@
+#ifndef __MAX_RF_SENDER_H
+#define __MAX_RF_SENDER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+#include <TStreaming.h>
+
+#include "DutyCycle.h"
+#include "MaxRFProto.h"
+#include "Ring.h"
+
+/* Longest payload that can be sent */
+const uint8_t MAX_TX_PAYLOAD = 16;
+
+/**
+ * Sends messages from a queue of up to QUEUE messages (a power of
+ * two), one at a time:
+ *
+ *  - Messages to a device are sent again when no ack arrives within
+ *    ack_timeout ms (up to retries times), messages to address 0
+ *    (broadcasts) are not acked.
+ *  - A message is only sent when its airtime fits in the duty cycle
+ *    budget (see DutyCycle), otherwise it waits.
+ *  - Messages to battery powered devices can be sent as a burst, with a
+ *    long preamble to wake them up.
+ *
+ * Radio is MaxRF22, or a mock on the host. It needs:
+ *
+ *   bool sendFrame(const uint8_t *buf, uint8_t len, bool burst);
+ *   bool txBusy();
+ *   uint16_t airtime(uint8_t len, bool burst);
+ *
+ * sendFrame() starts sending a frame (returning false when it can't)
+ * and txBusy() tells when it is done. The frame buffer stays valid
+ * until then.
+ */
+template <typename Radio, uint8_t QUEUE>
+class MaxRFSender {
+public:
+  /**
+   * Messages are sent from address. duty_limit is the airtime allowed
+   * per hour (in ms).
+   */
+  MaxRFSender(Radio &radio, uint32_t address, uint16_t duty_limit,
+              uint8_t retries, uint16_t ack_timeout)
+    : duty(duty_limit), radio(radio), address(address), retries(retries),
+      ack_timeout(ack_timeout), state(IDLE), seqnum(0) {
+    resetStats();
+  }
+
+  /**
+   * Queue a message. Returns false when the queue is full or the
+   * payload too long.
+   */
+  bool send(MessageType type, uint32_t to, const uint8_t *payload,
+            uint8_t len, bool burst, uint8_t flags = 0, uint8_t group_id = 0);
+
+  /**
+   * Tell about an ack received (from a device, to our address), which
+   * ends the retries of the message it acks. That is the first queued
+   * message, once it was sent, also when the ack arrives late (while a
+   * resend waits for the duty cycle budget).
+   */
+  void ackReceived(uint32_t from, uint8_t seqnum);
+
+  /**
+   * Look at a received message (header and payload, without length
+   * byte and CRC) and call ackReceived() when it is an ack to our
+   * address. Only the header is used, so acks with a payload too short
+   * to parse count as well.
+   */
+  void messageReceived(const uint8_t *msg, uint8_t len);
+
+  /**
+   * Send, resend or drop the first message in the queue when it is
+   * time. Call often, with the current millis().
+   */
+  void poll(unsigned long now);
+
+  /* Nothing queued or being sent */
+  bool idle() const { return this->queue.empty(); }
+
+  void printStats(Print &p);
+  void resetStats();
+
+  /* Messages queued */
+  uint16_t queued;
+  /* Messages not queued because the queue was full */
+  uint16_t rejected;
+  /* Transmissions, including retries */
+  uint16_t sent;
+  uint16_t retried;
+  uint16_t acked;
+  /* Messages dropped after the last retry */
+  uint16_t failed;
+  /* Transmissions that had to wait for the duty cycle budget */
+  uint16_t deferred;
+
+  DutyCycle duty;
+
+private:
+  enum State : uint8_t {
+    IDLE, /* Nothing in the air, send the first queued message if any */
+    SENDING, /* The first queued message is being sent */
+    WAIT_ACK, /* Waiting for an ack to the first queued message */
+  };
+
+  struct Entry {
+    uint8_t data[HeaderLayout::LEN + MAX_TX_PAYLOAD + 3];
+    uint8_t len;
+    uint8_t seqnum;
+    uint8_t tries;
+    bool burst;
+    /* Set when this message waited for the duty cycle budget */
+    bool deferred;
+    /* Set when acked while still being sent */
+    bool acked;
+    uint32_t to;
+  };
+
+  void done();
+
+  Radio &radio;
+  uint32_t address;
+  uint8_t retries;
+  uint16_t ack_timeout;
+  State state;
+  uint8_t seqnum;
+  /* When the ack is due */
+  unsigned long deadline;
+  Ring<Entry, QUEUE> queue;
+};
+
+template <typename Radio, uint8_t QUEUE>
+bool MaxRFSender<Radio, QUEUE>::send(MessageType type, uint32_t to,
+                                     const uint8_t *payload, uint8_t len,
+                                     bool burst, uint8_t flags, uint8_t group_id) {
+  if (this->queue.full() || len > MAX_TX_PAYLOAD) {
+    this->rejected++;
+    return false;
+  }
+
+  Entry *e = this->queue.back();
+  e->seqnum = this->seqnum++;
+  e->len = build_frame(e->data, e->seqnum, flags, type, this->address, to,
+                       group_id, payload, len);
+  e->tries = 0;
+  e->burst = burst;
+  e->deferred = false;
+  e->acked = false;
+  e->to = to;
+  this->queue.push();
+  this->queued++;
+  return true;
+}
+
+template <typename Radio, uint8_t QUEUE>
+void MaxRFSender<Radio, QUEUE>::done() {
+  this->queue.pop();
+  this->state = IDLE;
+}
+
+template <typename Radio, uint8_t QUEUE>
+void MaxRFSender<Radio, QUEUE>::ackReceived(uint32_t from, uint8_t seqnum) {
+  if (this->queue.empty())
+    return;
+
+  Entry *e = this->queue.front();
+  if (!e->tries || e->to != from || e->seqnum != seqnum)
+    return;
+
+  /* An ack while still sending can only be for an earlier try, but
+   * the message arrived all the same */
+  this->acked++;
+  if (this->state == SENDING)
+    e->acked = true;
+  else
+    done();
+}
+
+template <typename Radio, uint8_t QUEUE>
+void MaxRFSender<Radio, QUEUE>::messageReceived(const uint8_t *msg, uint8_t len) {
+  if (len < HeaderLayout::LEN || HeaderLayout::type::get(msg) != MessageType::ACK ||
+      HeaderLayout::addr_to::get(msg) != this->address)
+    return;
+  ackReceived(HeaderLayout::addr_from::get(msg), HeaderLayout::seqnum::get(msg));
+}
+
+template <typename Radio, uint8_t QUEUE>
+void MaxRFSender<Radio, QUEUE>::poll(unsigned long now) {
+  if (this->queue.empty())
+    return;
+
+  Entry *e = this->queue.front();
+
+  switch (this->state) {
+    case SENDING:
+      if (this->radio.txBusy())
+        return;
+      if (!e->to || e->acked) {
+        /* Broadcast, or acked while sending */
+        done();
+        return;
+      }
+      this->deadline = now + this->ack_timeout;
+      this->state = WAIT_ACK;
+      return;
+
+    case WAIT_ACK:
+      if ((long)(now - this->deadline) < 0)
+        return;
+      if (e->tries > this->retries) {
+        this->failed++;
+        done();
+        return;
+      }
+      this->state = IDLE;
+      /* Resend below */
+      break;
+
+    case IDLE:
+      break;
+  }
+
+  uint16_t airtime = this->radio.airtime(e->len, e->burst);
+  if (!this->duty.allowed(now, airtime)) {
+    if (!e->deferred)
+      this->deferred++;
+    e->deferred = true;
+    return;
+  }
+
+  if (!this->radio.sendFrame(e->data, e->len, e->burst))
+    return;
+
+  this->duty.add(now, airtime);
+  if (e->tries)
+    this->retried++;
+  e->tries++;
+  this->sent++;
+  this->state = SENDING;
+}
+
+template <typename Radio, uint8_t QUEUE>
+void MaxRFSender<Radio, QUEUE>::printStats(Print &p) {
+  p << F("TX queued: ") << this->queued
+    << F(", rejected: ") << this->rejected
+    << F(", sent: ") << this->sent
+    << F(", retried: ") << this->retried
+    << F(", acked: ") << this->acked
+    << F(", failed: ") << this->failed
+    << F(", deferred: ") << this->deferred
+    << F(", airtime: ") << this->duty.used(millis()) << "/" << this->duty.limit
+    << F(" ms") << "\r\n";
+}
+
+template <typename Radio, uint8_t QUEUE>
+void MaxRFSender<Radio, QUEUE>::resetStats() {
+  this->queued = 0;
+  this->rejected = 0;
+  this->sent = 0;
+  this->retried = 0;
+  this->acked = 0;
+  this->failed = 0;
+  this->deferred = 0;
+}
+
+#endif // __MAX_RF_SENDER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,75 @@
+#include <Arduino.h>
+#include <string.h>
+#include <TStreaming.h>
+
+#include "Output.h"
+
+/* Letters for the OUTPUT_* bits, lowest bit first */
+static const char output_level_chars[] = "irmst";
+
+bool parse_output_levels(const char *str, uint8_t *levels) {
+  uint8_t result = 0;
+  for (; *str; ++str) {
+    const char *c = strchr(output_level_chars, *str);
+    if (!c)
+      return false;
+    result |= 1 << (c - output_level_chars);
+  }
+  *levels = result;
+  return true;
+}
+
+void print_output_levels(Print &p, uint8_t levels) {
+  for (uint8_t i = 0; output_level_chars[i]; ++i)
+    if (levels & (1 << i))
+      p << output_level_chars[i];
+}
+
+void OutputSink::printStats(Print &p, const FlashString *name) const {
+  p << name << F(": queued ") << this->queued
+    << F(", dropped ") << this->dropped
+    << F(", blocked ") << this->blocked
+    << F(", max latency ") << this->max_latency << F("ms")
+    << F(", pending ") << pending() << "\r\n";
+}
+
+void OutputSink::resetStats() {
+  this->queued = 0;
+  this->dropped = 0;
+  this->blocked = 0;
+  this->max_latency = 0;
+}
+
+bool OutputRouter::add(Print *out, const OutputFilter *filter) {
+  if (this->routes == MAX_ROUTES)
+    return false;
+  this->route[this->routes].out = out;
+  this->route[this->routes].filter = filter;
+  this->routes++;
+  return true;
+}
+
+bool OutputRouter::matches(const OutputFilter *filter) const {
+  if (!(filter->levels & this->level))
+    return false;
+  /* Output not about a device passes any address filter */
+  if (!filter->address || (!this->addr1 && !this->addr2))
+    return true;
+  return filter->address == this->addr1 || filter->address == this->addr2;
+}
+
+bool OutputRouter::wanted(uint8_t level) const {
+  for (uint8_t i = 0; i < this->routes; ++i)
+    if (this->route[i].filter->levels & level)
+      return true;
+  return false;
+}
+
+size_t OutputRouter::write(const uint8_t *buf, size_t size) {
+  for (uint8_t i = 0; i < this->routes; ++i)
+    if (matches(this->route[i].filter))
+      this->route[i].out->write(buf, size);
+  return size;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,341 @@
+#ifndef __MAX_OUTPUT_H
+#define __MAX_OUTPUT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <Arduino.h>
+
+#include "Max.h"
+#include "Ring.h"
+
+/**
+ * What a BufferedPrint does when its buffer is full.
+ */
+enum class OverflowPolicy : uint8_t {
+  /* Drop the lines that don't fit, so a slow output never delays the
+   * caller (but output is lost on bursts bigger than the buffer). A
+   * line is dropped as a whole, so no partial lines are written out. */
+  DROP,
+  /* Write out buffered data synchronously until there is room again
+   * (backpressure on the caller, no output is lost) */
+  BLOCK,
+};
+
+/* Kinds of output, outputs can be subscribed to any combination */
+const uint8_t OUTPUT_INFO      = 0x01; /* Replies, statistics, etc. */
+const uint8_t OUTPUT_RAW       = 0x02; /* Dumps of received frames */
+const uint8_t OUTPUT_MESSAGES  = 0x04; /* Decoded messages */
+const uint8_t OUTPUT_STATUS    = 0x08; /* Device status */
+const uint8_t OUTPUT_TELEMETRY = 0x10; /* Binary telemetry frames */
+const uint8_t OUTPUT_TEXT = OUTPUT_INFO | OUTPUT_RAW | OUTPUT_MESSAGES | OUTPUT_STATUS;
+const uint8_t OUTPUT_ALL = OUTPUT_TEXT | OUTPUT_TELEMETRY;
+
+/* Upper bound on the length of a line of output. The longest is a
+ * STATUS line, with at most 16 bytes per device. */
+const size_t MAX_LINE_LEN = 24 + 16 * MAX_DEVICES;
+
+/**
+ * Parse a set of output levels from letters (i, r, m, s and t, for
+ * info, raw, messages, status and telemetry). Returns false when str
+ * contains anything else.
+ */
+bool parse_output_levels(const char *str, uint8_t *levels);
+
+/**
+ * Print a set of output levels as letters, like parse_output_levels
+ * takes them.
+ */
+void print_output_levels(Print &p, uint8_t levels);
+
+/**
+ * Selects which output an output wants to receive.
+ */
+struct OutputFilter {
+  /* OUTPUT_* bits, 0 to receive nothing */
+  uint8_t levels;
+  /* When non-zero, only output about this device (and output not about
+   * any device in particular) is received */
+  uint32_t address;
+};
+
+/**
+ * Output that buffers data written to it, to be written out in small
+ * steps from the main loop by calling drain(). Keeps statistics about
+ * how well the output keeps up.
+ */
+class OutputSink : public Print {
+public:
+  OutputSink(OverflowPolicy policy)
+    : policy(policy), queued(0), dropped(0), blocked(0),
+      max_latency(0), pending_since(0) {}
+
+  /**
+   * Write out at most max bytes of buffered data. Returns the number of
+   * bytes written.
+   */
+  virtual size_t drain(size_t max) = 0;
+  virtual size_t pending() const = 0;
+
+  /**
+   * Print a line with the statistics for this output.
+   */
+  void printStats(Print &p, const FlashString *name) const;
+  void resetStats();
+
+  OverflowPolicy policy;
+
+  /* Bytes written to this output (including dropped bytes) */
+  uint32_t queued;
+  /* Bytes dropped because the buffer was full */
+  uint32_t dropped;
+  /* Number of writes that had to wait for the buffer to drain */
+  uint16_t blocked;
+  /* Longest time (in ms) that data was pending in the buffer. This is
+   * an upper bound, measured from when the buffer last became
+   * non-empty. */
+  unsigned long max_latency;
+
+protected:
+  /* millis() when the buffer last became non-empty */
+  unsigned long pending_since;
+};
+
+/**
+ * OutputSink that buffers up to SIZE bytes before writing them to
+ * another Print. SIZE must be a power of two.
+ *
+ * With OverflowPolicy::DROP, only complete lines are drained, and a
+ * line that doesn't fit is dropped along with what is buffered of it.
+ * A line longer than the buffer is written straight through instead,
+ * when out has room for MAX_LINE_LEN bytes (per availableForWrite()),
+ * so it never has to wait halfway. Binary telemetry frames have no
+ * lines, but carry a CRC, so a cut off frame is recognized.
+ */
+template <size_t SIZE>
+class BufferedPrint : public OutputSink {
+public:
+  BufferedPrint(Print &out, OverflowPolicy policy)
+    : OutputSink(policy), out(out), line_len(0), committed(false),
+      dropping(false) {}
+
+  virtual size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+
+  virtual size_t write(const uint8_t *buf, size_t size);
+  virtual size_t drain(size_t max);
+  virtual size_t pending() const { return ring.count(); }
+
+  /* Throw away all buffered data */
+  void discard() {
+    ring.clear();
+    this->line_len = 0;
+    this->committed = this->dropping = false;
+  }
+
+private:
+  size_t writeLine(const uint8_t *buf, size_t size);
+  void store(const uint8_t *buf, size_t size);
+  void writeOut(const uint8_t *buf, size_t size);
+  size_t flush(size_t max);
+
+  Print &out;
+  Ring<uint8_t, SIZE, uint16_t> ring;
+  /* Bytes of the unfinished last line that are in the buffer */
+  uint16_t line_len;
+  /* Part of the unfinished last line was written out already */
+  bool committed;
+  /* The rest of the current line is dropped */
+  bool dropping;
+};
+
+template <size_t SIZE>
+size_t BufferedPrint<SIZE>::write(const uint8_t *buf, size_t size) {
+  this->queued += size;
+
+  if (this->policy == OverflowPolicy::DROP) {
+    /* Keep or drop a line at a time */
+    size_t done = 0, written = 0;
+    while (done < size) {
+      const uint8_t *nl = (const uint8_t *)memchr(buf + done, '\n', size - done);
+      size_t n = nl ? nl - (buf + done) + 1 : size - done;
+      written += writeLine(buf + done, n);
+      done += n;
+    }
+    return written;
+  }
+
+  if (size > SIZE - ring.count()) {
+    this->blocked++;
+    /* Bigger than the entire buffer, so bypass the buffer, after
+     * writing out what is already buffered. */
+    if (size > SIZE) {
+      flush(SIZE);
+      writeOut(buf, size);
+      return size;
+    }
+    flush(size - (SIZE - ring.count()));
+  }
+
+  store(buf, size);
+  return size;
+}
+
+/* Write (part of) one line, ending at its '\n' if any, for DROP */
+template <size_t SIZE>
+size_t BufferedPrint<SIZE>::writeLine(const uint8_t *buf, size_t size) {
+  bool ends = buf[size - 1] == '\n';
+
+  if (this->dropping) {
+    this->dropped += size;
+    this->dropping = !ends;
+    return 0;
+  }
+
+  /* The start of this line was written out already, so the rest must
+   * follow it */
+  if (this->committed) {
+    flush(ring.count());
+    writeOut(buf, size);
+    return size;
+  }
+
+  /* Make room by writing out complete lines, as far as out takes them
+   * without waiting */
+  if (size > SIZE - ring.count()) {
+    int room = out.availableForWrite();
+    if (room > 0)
+      drain(room);
+  }
+
+  if (size <= SIZE - ring.count()) {
+    store(buf, size);
+    return size;
+  }
+
+  /* A line longer than the buffer */
+  if (ring.count() == this->line_len && out.availableForWrite() >= (int)MAX_LINE_LEN) {
+    flush(this->line_len);
+    writeOut(buf, size);
+    return size;
+  }
+
+  this->dropped += this->line_len + size;
+  ring.unpush(this->line_len);
+  this->line_len = 0;
+  this->dropping = !ends;
+  return 0;
+}
+
+template <size_t SIZE>
+void BufferedPrint<SIZE>::store(const uint8_t *buf, size_t size) {
+  if (ring.empty())
+    this->pending_since = millis();
+
+  for (size_t i = 0; i < size; ++i) {
+    *ring.back() = buf[i];
+    ring.push();
+    if (buf[i] == '\n') {
+      this->line_len = 0;
+      this->committed = false;
+    } else {
+      this->line_len++;
+    }
+  }
+}
+
+/* Write straight to out, with nothing of the current line buffered */
+template <size_t SIZE>
+void BufferedPrint<SIZE>::writeOut(const uint8_t *buf, size_t size) {
+  out.write(buf, size);
+  this->committed = buf[size - 1] != '\n';
+}
+
+template <size_t SIZE>
+size_t BufferedPrint<SIZE>::drain(size_t max) {
+  /* Keep an unfinished line, it might still be dropped */
+  if (this->policy == OverflowPolicy::DROP && max > (size_t)(ring.count() - this->line_len))
+    max = ring.count() - this->line_len;
+  return flush(max);
+}
+
+template <size_t SIZE>
+size_t BufferedPrint<SIZE>::flush(size_t max) {
+  size_t done = 0;
+  while (done < max && !ring.empty()) {
+    size_t n = ring.frontSpan();
+    if (n > max - done)
+      n = max - done;
+    out.write(ring.front(), n);
+    ring.pop(n);
+    done += n;
+  }
+
+  if (ring.count() < this->line_len) {
+    this->line_len = ring.count();
+    this->committed = true;
+  }
+
+  if (done) {
+    unsigned long latency = millis() - this->pending_since;
+    if (latency > this->max_latency)
+      this->max_latency = latency;
+    /* The remaining data was written later than pending_since, but we
+     * don't keep track of when exactly, so keep the old value. */
+  }
+  return done;
+}
+
+/**
+ * Print that passes everything written to it on to the outputs whose
+ * filter matches the kind of output selected with select().
+ */
+class OutputRouter : public Print {
+public:
+  OutputRouter() : routes(0), level(OUTPUT_INFO), addr1(0), addr2(0) {}
+
+  /**
+   * Add an output. The filter can be changed afterwards. Returns false
+   * when there are already MAX_ROUTES outputs.
+   */
+  bool add(Print *out, const OutputFilter *filter);
+
+  /**
+   * Select the kind of output written next, and the device(s) it is
+   * about (0 when not about a specific device). This stays in effect
+   * until the next select().
+   */
+  void select(uint8_t level, uint32_t addr1 = 0, uint32_t addr2 = 0) {
+    this->level = level;
+    this->addr1 = addr1;
+    this->addr2 = addr2;
+  }
+
+  /* Is anyone interested in output of the given level? */
+  bool wanted(uint8_t level) const;
+
+  virtual size_t write(uint8_t c) {
+    return write(&c, 1);
+  }
+
+  virtual size_t write(const uint8_t *buf, size_t size);
+
+  static const uint8_t MAX_ROUTES = 5;
+
+private:
+  bool matches(const OutputFilter *filter) const;
+
+  struct Route {
+    Print *out;
+    const OutputFilter *filter;
+  };
+
+  Route route[MAX_ROUTES];
+  uint8_t routes;
+  uint8_t level;
+  uint32_t addr1, addr2;
+};
+
+#endif // __MAX_OUTPUT_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -3,9 +3,9 @@
 #include <avr/pgmspace.h>
 
 #include "Pn9.h"
-#include "Util.h"
+#include "Crc.h"
 
-/* First 255 bytes of PN9 sequence used for data whitening by the CC1101
+/* First bytes of PN9 sequence used for data whitening by the CC1101
  * chip. The RF22 chip is documented to support the same data whitening
  * algorithm, but in practice seems to use a different sequence.
  *
@@ -20,8 +20,13 @@ def pn9(state):
         for i in range(8):
             state = (state >> 1) + (((state & 1) ^ (state >> 5) & 1) << 8)
 print(list(itertools.islice(pn9(0x1ff), 255)))
+ *
+ * Only the first PN9_TABLE_LEN bytes are used (which covers most
+ * messages), the rest is kept for reference. Beyond the table, the
+ * sequence is generated by Pn9 (which is a bit slower), starting from
+ * PN9_TABLE_END_STATE.
  */
-static const uint8_t PROGMEM pn9_table[] = {
+const uint8_t PROGMEM pn9_table[PN9_TABLE_LEN] = {
   0xff, 0xe1, 0x1d, 0x9a, 0xed, 0x85, 0x33, 0x24,
   0xea, 0x7a, 0xd2, 0x39, 0x70, 0x97, 0x57, 0x0a,
   0x54, 0x7d, 0x2d, 0xd8, 0x6d, 0x0d, 0xba, 0x8f,
@@ -57,16 +62,53 @@ static const uint8_t PROGMEM pn9_table[] = {
   */
 };
 
-static_assert(lengthof(pn9_table) == PN9_LEN, "Not exactly PN9_LEN pn9 bytes defined");
+void Pn9::apply(uint8_t *buf, size_t len) {
+  /* Work on copies of pos and state, since the compiler can't tell
+   * that writing to buf does not change them */
+  uint8_t from_table = PN9_TABLE_LEN - pos;
+  if (from_table > len)
+    from_table = len;
+
+  const uint8_t *table = &pn9_table[pos];
+  for (uint8_t i = 0; i < from_table; ++i)
+    buf[i] ^= pgm_read_byte(&table[i]);
+  pos += from_table;
+
+  uint16_t s = state;
+  for (size_t i = from_table; i < len; ++i) {
+    buf[i] ^= s;
+    s = pn9_next(s);
+  }
+  state = s;
+}
 
 int xor_pn9(uint8_t *buf, size_t len) {
-  if (len > sizeof(pn9_table))
+  Pn9 pn9;
+  pn9.apply(buf, len);
+  return 0;
+}
+
+int xor_pn9_crc(uint8_t *buf, size_t len, uint16_t *crc) {
+  if (len < 2)
     return -1;
 
-  for (int i = 0; i < len; ++i)
-    buf[i] ^= pgm_read_byte(&pn9_table[i]);
+  /* Like Pn9, but with everything in local variables */
+  uint16_t state = PN9_TABLE_END_STATE;
+  uint16_t checksum = CRC_INIT;
+  for (size_t i = 0; i < len; ++i) {
+    if (i < PN9_TABLE_LEN) {
+      buf[i] ^= pgm_read_byte(&pn9_table[i]);
+    } else {
+      buf[i] ^= state;
+      state = pn9_next(state);
+    }
+    /* Don't include the CRC itself */
+    if (i < len - 2)
+      checksum = crc_update(checksum, buf[i]);
+  }
 
+  *crc = checksum;
   return 0;
 }
 
-/* vim: set sw=2 sts=2 expandtab filetype=cpp: */
+/* vim: set sw=2 sts=2 expandtab: */
@@ -1,13 +1,84 @@
+#ifndef __MAX_PN9_H
+#define __MAX_PN9_H
 
-/* How many PN9 bytes are included in the lookuptable. When changing
- * this, also add the extra bytes in Pn9.cpp. */
-#define PN9_LEN 50
+#include <stdint.h>
+#include <stddef.h>
+#include <avr/pgmspace.h>
+
+/* How many PN9 bytes are included in the lookup table. After these,
+ * the sequence is generated on the fly. When changing this, also
+ * update pn9_table and PN9_TABLE_END_STATE in Pn9.cpp (host/bench_pn9
+ * checks them). */
+#define PN9_TABLE_LEN 50
+/* The PN9 state after generating the bytes in pn9_table */
+#define PN9_TABLE_END_STATE 0x1c4
+
+/* Initial PN9 generator state. The low byte of the state is the next
+ * byte of the sequence. */
+#define PN9_INIT 0x1ff
+
+extern const uint8_t pn9_table[PN9_TABLE_LEN] PROGMEM;
+
+/**
+ * Advance the 9-bit PN9 state by one byte (8 clocks of the LFSR). The
+ * LFSR shifts right, shifting in bit0 ^ bit5 at the top. Eight clocks
+ * shift in eight such bits, the first four from bits of the current
+ * state and the last four also depending on the first four.
+ */
+static inline uint16_t pn9_next(uint16_t state) {
+  uint8_t low = (state ^ (state >> 5)) & 0x0f;
+  uint8_t bits = low | ((state ^ (low << 4)) & 0xf0);
+  return ((uint16_t)bits << 1) | (state >> 8);
+}
+
+/**
+ * Generates the PN9 sequence one byte at a time, for data that is not
+ * available all at once. The first bytes come from pn9_table, after
+ * which the LFSR takes over.
+ */
+class Pn9 {
+public:
+  Pn9() : pos(0), state(PN9_TABLE_END_STATE) {}
+
+  uint8_t next() {
+    if (pos < PN9_TABLE_LEN)
+      return pgm_read_byte(&pn9_table[pos++]);
+    uint8_t b = state;
+    state = pn9_next(state);
+    return b;
+  }
+
+  /**
+   * Xor the next len bytes of the sequence into buf.
+   */
+  void apply(uint8_t *buf, size_t len);
+
+private:
+  /* Position in pn9_table, stops at PN9_TABLE_LEN */
+  uint8_t pos;
+  /* Generator state, only used after the table */
+  uint16_t state;
+};
 
 /**
  * Xor the first len bytes in buf with the PN9 sequence.
  *
- * Returns 0 if succesful or -1 if the buffer is longer than PN9_LEN.
+ * Always returns 0 (frames of any length are supported now).
  */
 int xor_pn9(uint8_t *buf, size_t len);
 
+/**
+ * Xor the first len bytes in buf with the PN9 sequence (like xor_pn9)
+ * and at the same time calculate the CRC over the dewhitened bytes,
+ * except for the last two (which should contain the CRC itself). This
+ * walks the buffer only once, instead of separate xor_pn9 and calc_crc
+ * calls.
+ *
+ * Returns 0 and stores the CRC in *crc if succesful, or -1 if the
+ * buffer is shorter than 2 bytes.
+ */
+int xor_pn9_crc(uint8_t *buf, size_t len, uint16_t *crc);
+
+#endif // __MAX_PN9_H
+
 /* vim: set sw=2 sts=2 expandtab: */
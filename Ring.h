@@ -0,0 +1,95 @@
+#ifndef __MAX_RING_H
+#define __MAX_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Fixed size ring buffer (FIFO queue) of SIZE items.
+ *
+ * This is safe to use with one producer and one consumer running in
+ * different contexts (e.g. an interrupt handler and the main loop),
+ * provided that reading and writing an Index is atomic (true for
+ * uint8_t on AVR). Each side only ever writes its own index.
+ *
+ * The indices run freely and wrap around, which makes SIZE a power of
+ * two and at most half the range of Index.
+ */
+template <typename T, size_t SIZE, typename Index = uint8_t>
+class Ring {
+public:
+  static_assert((SIZE & (SIZE - 1)) == 0, "Ring size must be a power of two");
+  static_assert(SIZE <= (((Index)~(Index)0) >> 1) + 1, "Ring size too big for index type");
+
+  Ring() : head(0), tail(0) {}
+
+  Index count() const { return (Index)(head - tail); }
+  bool empty() const { return head == tail; }
+  bool full() const { return count() == SIZE; }
+  static Index size() { return SIZE; }
+
+  /* Producer side */
+
+  /**
+   * Returns the slot the next item should be written to. Only valid
+   * when the ring is not full. Call push() to make the item available
+   * to the consumer.
+   */
+  T *back() { return &items[head & (SIZE - 1)]; }
+  void push() { head = head + 1; }
+
+  bool push(const T &item) {
+    if (full())
+      return false;
+    *back() = item;
+    push();
+    return true;
+  }
+
+  /**
+   * Take back the last n items pushed, n at most count(). Only safe
+   * when the consumer does not run concurrently.
+   */
+  void unpush(Index n) { head = head - n; }
+
+  /* Consumer side */
+
+  /**
+   * Returns the oldest item. Only valid when the ring is not empty.
+   * Call pop() to release the slot once done with it.
+   */
+  T *front() { return &items[tail & (SIZE - 1)]; }
+  void pop() { tail = tail + 1; }
+
+  /**
+   * Returns how many items from front() onwards are stored
+   * contiguously, so they can be processed in one go before calling
+   * pop(n).
+   */
+  Index frontSpan() const {
+    Index n = count();
+    Index until_end = SIZE - (tail & (SIZE - 1));
+    return n < until_end ? n : until_end;
+  }
+  void pop(Index n) { tail = tail + n; }
+
+  bool pop(T *item) {
+    if (empty())
+      return false;
+    *item = *front();
+    pop();
+    return true;
+  }
+
+  /* Drop all items. Should only be called from the consumer side. */
+  void clear() { tail = head; }
+
+private:
+  volatile Index head;
+  volatile Index tail;
+  T items[SIZE];
+};
+
+#endif // __MAX_RING_H
+
+/* vim: set sw=2 sts=2 expandtab: */
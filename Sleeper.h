@@ -0,0 +1,98 @@
+#ifndef __MAX_SLEEPER_H
+#define __MAX_SLEEPER_H
+
+#include <stdint.h>
+#include <Arduino.h>
+#include <TStreaming.h>
+
+/**
+ * Puts the MCU to sleep from loop() when there is nothing to do, until
+ * an interrupt wakes it up, and keeps track of the time spent asleep.
+ *
+ * Platform is the MCU (see Max.ino), or a mock on the host. It needs:
+ *
+ *   void noInterrupts();
+ *   void interrupts();
+ *   void sleep();
+ *   unsigned long micros();
+ *   unsigned long millis();
+ *
+ * sleep() is called with interrupts disabled. It must enable them and
+ * sleep in one go, so that an interrupt that happens in between still
+ * wakes it up (on the AVR, the instruction after sei always runs before
+ * any interrupt, so sei followed by sleep does this).
+ */
+template <typename Platform>
+class Sleeper {
+public:
+  Sleeper(Platform &platform) : platform(platform) { resetStats(); }
+
+  /**
+   * Sleep until the next interrupt, unless pending() says there is
+   * something to do already. pending() is called with interrupts
+   * disabled, so an interrupt that makes work pending either happens
+   * before the check, or wakes up the sleep. Returns true when it
+   * slept.
+   */
+  bool sleep(bool (*pending)());
+
+  void printStats(Print &p);
+  void resetStats();
+
+  /* Number of times it slept */
+  uint32_t sleeps;
+  /* Time spent asleep, in ms and the us left over */
+  uint32_t asleep_ms;
+  uint16_t asleep_us;
+  /* Longest sleep, in us */
+  unsigned long max_sleep;
+
+private:
+  Platform &platform;
+  /* millis() when the statistics were reset */
+  unsigned long since;
+};
+
+template <typename Platform>
+bool Sleeper<Platform>::sleep(bool (*pending)()) {
+  this->platform.noInterrupts();
+  if (pending()) {
+    this->platform.interrupts();
+    return false;
+  }
+
+  unsigned long start = this->platform.micros();
+  this->platform.sleep();
+  unsigned long slept = this->platform.micros() - start;
+
+  this->sleeps++;
+  if (slept > this->max_sleep)
+    this->max_sleep = slept;
+  slept += this->asleep_us;
+  this->asleep_ms += slept / 1000;
+  this->asleep_us = slept % 1000;
+  return true;
+}
+
+template <typename Platform>
+void Sleeper<Platform>::printStats(Print &p) {
+  unsigned long total = this->platform.millis() - this->since;
+  p << F("Asleep: ") << this->asleep_ms << "/" << total << F(" ms");
+  if (total >= 100)
+    p << " (" << this->asleep_ms / (total / 100) << "%)";
+  p << F(", sleeps: ") << this->sleeps
+    << F(", longest: ") << this->max_sleep << F(" us") << "\r\n";
+}
+
+template <typename Platform>
+void Sleeper<Platform>::resetStats() {
+  this->sleeps = 0;
+  this->asleep_ms = 0;
+  this->asleep_us = 0;
+  this->max_sleep = 0;
+  this->since = this->platform.millis();
+}
+
+#endif // __MAX_SLEEPER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,116 @@
+#include <Arduino.h>
+
+#include "Telemetry.h"
+#include "Crc.h"
+#include "Util.h"
+
+/* Forget everything sent, as a decoder does when it sees a keyframe */
+void TelemetryEncoder::reset() {
+  for (uint16_t i = 0; i < lengthof(shadow); ++i) {
+    shadow[i].address = 0;
+    shadow[i].type = DeviceType::UNKNOWN;
+    shadow[i].actual_temp = ACTUAL_TEMP_UNKNOWN;
+    shadow[i].set_temp = SET_TEMP_UNKNOWN;
+    shadow[i].valve_pos = VALVE_UNKNOWN;
+  }
+  kettle = 0;
+}
+
+void TelemetryEncoder::write(Print &p, uint8_t b) {
+  crc = crc_update(crc, b);
+  p.write(b);
+}
+
+void TelemetryEncoder::writeVarint(Print &p, uint32_t v) {
+  while (v >= 0x80) {
+    write(p, (v & 0x7f) | 0x80);
+    v >>= 7;
+  }
+  write(p, v);
+}
+
+/* Send the frame header, if not done already. Frames without any
+ * records are not sent at all (except for keyframes), so this happens
+ * on the first record. */
+void TelemetryEncoder::start(Print &p) {
+  if (started)
+    return;
+  started = true;
+
+  unsigned long now = millis();
+  crc = CRC_INIT;
+  p.write(TELEMETRY_SYNC1);
+  p.write(TELEMETRY_SYNC2);
+  write(p, seq++);
+  write(p, keyframe ? TELEMETRY_KEYFRAME : 0);
+  writeVarint(p, keyframe ? now : now - last_time);
+  last_time = now;
+}
+
+void TelemetryEncoder::writeRecord(Print &p, uint8_t index, uint8_t field, uint32_t value) {
+  start(p);
+  write(p, index);
+  write(p, field);
+  writeVarint(p, value);
+}
+
+template <typename T>
+void TelemetryEncoder::writeField(Print &p, uint8_t index, uint8_t field, T value, T *old) {
+  if (value == *old)
+    return;
+  if (keyframe)
+    writeRecord(p, index, field, value);
+  else if (sizeof(T) == 1)
+    writeRecord(p, index, field, zigzag_encode((int8_t)(value - *old)));
+  else
+    writeRecord(p, index, field, zigzag_encode((int16_t)(value - *old)));
+  *old = value;
+}
+
+void TelemetryEncoder::update(Print &p, bool kettle_status, bool force_keyframe) {
+  keyframe = force_keyframe || keyframe_due;
+  started = false;
+  if (keyframe) {
+    reset();
+    start(p);
+    keyframe_due = false;
+  }
+
+  for (uint16_t i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    Shadow *s = &shadow[i];
+
+    if (d->address != s->address) {
+      writeRecord(p, i, TELEMETRY_FIELD_ADDRESS, d->address);
+      s->address = d->address;
+      s->type = DeviceType::UNKNOWN;
+      s->actual_temp = ACTUAL_TEMP_UNKNOWN;
+      s->set_temp = SET_TEMP_UNKNOWN;
+      s->valve_pos = VALVE_UNKNOWN;
+    }
+    if (!d->address)
+      continue;
+
+    if (d->type != s->type) {
+      writeRecord(p, i, TELEMETRY_FIELD_TYPE, (uint8_t)d->type);
+      s->type = d->type;
+    }
+    writeField(p, i, TELEMETRY_FIELD_ACTUAL_TEMP, d->actual_temp, &s->actual_temp);
+    writeField(p, i, TELEMETRY_FIELD_SET_TEMP, d->set_temp, &s->set_temp);
+    if (d->type == DeviceType::RADIATOR)
+      writeField(p, i, TELEMETRY_FIELD_VALVE_POS, d->data.radiator.valve_pos, &s->valve_pos);
+  }
+
+  writeField(p, TELEMETRY_GLOBAL, TELEMETRY_FIELD_KETTLE, (uint8_t)kettle_status, &kettle);
+
+  if (!started)
+    return;
+
+  write(p, TELEMETRY_END);
+  /* Don't use write(), the CRC should not include itself */
+  uint16_t frame_crc = crc;
+  p.write(frame_crc >> 8);
+  p.write(frame_crc & 0xff);
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,121 @@
+#ifndef __MAX_TELEMETRY_H
+#define __MAX_TELEMETRY_H
+
+#include <stdint.h>
+#include <Print.h>
+
+#include "MaxRFProto.h"
+
+/*
+ * Compact binary alternative to the STATUS line, for collectors.
+ *
+ * Each frame looks like:
+ *
+ *   0xA5 0x5A        sync
+ *   seq              frame sequence number, increments by one per frame
+ *   flags            TELEMETRY_KEYFRAME when values are absolute
+ *   time             varint: millis() in a keyframe, otherwise the
+ *                    milliseconds since the previous frame
+ *   records...       see below
+ *   0xFE             end of records
+ *   crc              CRC16 (see Crc.h) over seq up to and including the
+ *                    end marker, most significant byte first
+ *
+ * Each record is:
+ *
+ *   index            device index (position in the devices array), or
+ *                    TELEMETRY_GLOBAL for fields not tied to a device
+ *   field            one of the TELEMETRY_FIELD_* values
+ *   value            varint: in keyframes the value itself, otherwise
+ *                    the zigzag encoded difference from the previous
+ *                    value (wrapping at the field width)
+ *
+ * A varint stores 7 bits per byte, least significant first, with the
+ * top bit set on all but the last byte.
+ *
+ * A device (re)appearing at an index is announced with an ADDRESS
+ * record, after which its type and values count as unknown again (see
+ * the *_UNKNOWN constants), so the following deltas are relative to
+ * that. ADDRESS and TYPE values are always sent as-is, never as deltas.
+ * A keyframe makes all devices unknown before its records are applied.
+ * Values that are unknown are not sent.
+ * Since deltas build on previous frames, a decoder that misses a frame
+ * (a gap in seq) should ignore frames until the next keyframe.
+ *
+ * host/telemetry_decode converts a stream of these frames (possibly
+ * mixed with other output) back into STATUS lines.
+ */
+
+const uint8_t TELEMETRY_SYNC1 = 0xA5;
+const uint8_t TELEMETRY_SYNC2 = 0x5A;
+const uint8_t TELEMETRY_END = 0xFE;
+const uint8_t TELEMETRY_GLOBAL = 0xFF;
+
+const uint8_t TELEMETRY_KEYFRAME = 0x01;
+
+const uint8_t TELEMETRY_FIELD_ADDRESS = 0;
+const uint8_t TELEMETRY_FIELD_TYPE = 1;
+const uint8_t TELEMETRY_FIELD_ACTUAL_TEMP = 2;
+const uint8_t TELEMETRY_FIELD_SET_TEMP = 3;
+const uint8_t TELEMETRY_FIELD_VALVE_POS = 4;
+/* Global field */
+const uint8_t TELEMETRY_FIELD_KETTLE = 5;
+
+static_assert(MAX_DEVICES <= TELEMETRY_END, "Device indices must not clash with TELEMETRY_END");
+
+/* Map signed values to unsigned ones, so small negative values become
+ * small positive values: 0, -1, 1, -2, ... become 0, 1, 2, 3, ... */
+inline uint16_t zigzag_encode(int16_t v) { return ((uint16_t)v << 1) ^ (uint16_t)(v >> 15); }
+inline int16_t zigzag_decode(uint16_t v) { return (int16_t)((v >> 1) ^ -(int16_t)(v & 1)); }
+
+/**
+ * Sends telemetry frames with the changes to the devices array since
+ * the previous frame.
+ */
+class TelemetryEncoder {
+public:
+  TelemetryEncoder() : seq(0), last_time(0), keyframe_due(true) { reset(); }
+
+  /**
+   * Send a frame containing everything that changed since the previous
+   * frame, if anything did. A keyframe is sent when requested with
+   * requestKeyframe(), or when forced.
+   */
+  void update(Print &p, bool kettle_status, bool force_keyframe = false);
+
+  /* Make the next update send a keyframe */
+  void requestKeyframe() { keyframe_due = true; }
+
+private:
+  /* Values as last sent, per device */
+  struct Shadow {
+    uint32_t address;
+    DeviceType type;
+    uint16_t actual_temp;
+    uint8_t set_temp;
+    uint8_t valve_pos;
+  };
+
+  void reset();
+  void start(Print &p);
+  void write(Print &p, uint8_t b);
+  void writeVarint(Print &p, uint32_t v);
+  void writeRecord(Print &p, uint8_t index, uint8_t field, uint32_t value);
+  template <typename T>
+  void writeField(Print &p, uint8_t index, uint8_t field, T value, T *old);
+
+  Shadow shadow[MAX_DEVICES];
+  uint8_t seq;
+  unsigned long last_time;
+  uint8_t kettle;
+  bool keyframe_due;
+
+  /* State of the frame being sent */
+  bool started;
+  bool keyframe;
+  uint16_t crc;
+};
+
+#endif // __MAX_TELEMETRY_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -1,3 +1,6 @@
+#include <ctype.h>
+#include <TStreaming.h>
+
 #include "Util.h"
 
 uint32_t getBits(const uint8_t *buf, uint8_t start_bit, uint8_t num_bits) {
@@ -28,4 +31,54 @@ uint32_t getBits(const uint8_t *buf, uint8_t start_bit, uint8_t num_bits) {
   return res;
 }
 
+void dump_buffer(Print &p, const uint8_t *buf, uint8_t len) {
+  /* Dump the raw received data */
+  int i, j;
+  for (i = 0; i < len; i += 16)
+  {
+    // Hex
+    for (j = 0; j < 16 && i+j < len; j++)
+    {
+      p << V<Hex>(buf[i+j]) << " ";
+    }
+    // Padding on last block
+    while (j++ < 16)
+      p << "   ";
+
+    p << "   ";
+    // ASCII
+    for (j = 0; j < 16 && i+j < len; j++)
+      p << (isprint(buf[i+j]) ? (char)buf[i+j] : '.');
+    p << "\r\n";
+  }
+  p << "\r\n";
+}
+
+#ifdef __AVR__
+/* From avr-libc's malloc, the end of the heap is __brkval once
+ * something was allocated */
+extern char __heap_start, *__brkval;
+
+static const uint8_t STACK_PAINT = 0xa5;
+
+static uint8_t *heap_end() {
+  return (uint8_t*)(__brkval ? __brkval : &__heap_start);
+}
+
+void paint_stack() {
+  uint8_t here;
+  /* Stay clear of this function's own stack frame */
+  for (uint8_t *p = heap_end(); p < &here - 16; ++p)
+    *p = STACK_PAINT;
+}
+
+uint16_t stack_headroom() {
+  uint8_t here;
+  uint8_t *p = heap_end();
+  while (p < &here && *p == STACK_PAINT)
+    ++p;
+  return p - heap_end();
+}
+#endif // __AVR__
+
 /* vim: set sw=2 sts=2 expandtab: */
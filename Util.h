@@ -2,15 +2,52 @@
 #define __MAX_UTIL_H
 
 #include <stdint.h>
+#include <stddef.h>
+#include <Print.h>
 
 /**
  * Get a number of bits from the given buffer, optionally skipping a few
- * bits at the start.
+ * bits at the start. The bits taken must end at a byte boundary
+ * (start_bit + num_bits a multiple of 8), otherwise this reads past
+ * the field. BitField.h is faster when the field is known at compile
+ * time.
  */
 uint32_t getBits(const uint8_t *buf, uint8_t start_bit, uint8_t num_bits);
 
+/**
+ * Print a hex and ascii dump of the given buffer.
+ */
+void dump_buffer(Print &p, const uint8_t *buf, uint8_t len);
+
 #define lengthof(x) (sizeof(x) / sizeof(*x))
 
+#ifdef __AVR__
+/**
+ * Fill the free RAM between the heap and the stack with a pattern, so
+ * stack_headroom() can tell how deep the stack got. Call at the start
+ * of setup().
+ */
+void paint_stack();
+
+/* Bytes of free RAM the stack has not reached since paint_stack() */
+uint16_t stack_headroom();
+#endif // __AVR__
+
+/**
+ * The size of the biggest of the given types, as a compile time
+ * constant.
+ */
+template <typename T, typename... Ts>
+struct max_sizeof {
+  static const size_t value = sizeof(T) > max_sizeof<Ts...>::value
+                            ? sizeof(T) : max_sizeof<Ts...>::value;
+};
+
+template <typename T>
+struct max_sizeof<T> {
+  static const size_t value = sizeof(T);
+};
+
 #endif // __MAX_UTIL_H
 
 /* vim: set sw=2 sts=2 expandtab: */
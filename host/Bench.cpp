@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "Bench.h"
+#include "Crc.h"
+#include "Pn9.h"
+
+size_t StdoutPrint::write(uint8_t c) {
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t StdoutPrint::write(const uint8_t *buf, size_t size) {
+  return fwrite(buf, 1, size, stdout);
+}
+
+Frame make_frame(const uint8_t *msg, size_t len) {
+  Frame f;
+  f.len = len + 3;
+  f.data[0] = len + 2;
+  memcpy(f.data + 1, msg, len);
+  uint16_t crc = calc_crc(f.data, len + 1);
+  f.data[len + 1] = crc >> 8;
+  f.data[len + 2] = crc & 0xff;
+  xor_pn9(f.data, f.len);
+  return f;
+}
+
+/* Messages (header and payload) based on captures from real devices.
+ * Order matters: the ack from the radiator is only decoded once the
+ * radiator is known as such from its state message. */
+static const char *builtin_messages[] = {
+  /* ThermostatState, radiator 04C8DD, auto, valve 32%, 20.0°, 20.5° */
+  "2C 04 60 04C8DD 000000 00 18 20 28 00 CD",
+  /* ThermostatState, temporary mode with until time */
+  "2D 04 60 04C8DD 000000 00 1A 00 24 48 0D 1B",
+  /* WallThermostatState, 20.0° set, 20.5° actual */
+  "E4 04 42 0298E5 000000 00 28 CD",
+  /* SetTemperature from cube, auto 20.0° */
+  "4F 00 40 00B825 0298E5 00 28",
+  /* SetTemperature from cube, temporary 18.0° until */
+  "50 00 40 00B825 0298E5 00 A4 48 0D 1B",
+  /* Ack from radiator */
+  "2C 02 02 04C8DD 00B825 00 01 11 00 28",
+  /* Ack from radiator, temporary mode with until time */
+  "1B 02 02 04C8DD 00B825 00 01 12 04 24 48 0D 1B",
+  /* Ack from wall thermostat (too short to decode) */
+  "4F 00 02 0298E5 00B825 00 00",
+  /* SetDisplayActualTemperature */
+  "E6 00 82 00B825 0298E5 00 04",
+  /* Unknown type 0x70 from wall thermostat */
+  "9C 04 70 0298E5 000000 00 12 04 24 48 0D 1B",
+  /* TimeInformation (decoded as unknown) */
+  "01 04 03 00B825 04C8DD 00 0D 0C 1E 05 2A",
+  /* WakeUp */
+  "02 00 F1 00B825 04C8DD 00 3F",
+};
+
+static int hexval(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/* Parse hex bytes from a string, returns the number of bytes or -1 on
+ * a syntax error. */
+static int parse_hex(const char *s, uint8_t *buf, size_t max) {
+  size_t n = 0;
+  while (*s && *s != '#' && *s != '\n') {
+    if (isspace(*s)) {
+      ++s;
+      continue;
+    }
+    int hi = hexval(s[0]);
+    int lo = hexval(s[1]);
+    if (hi < 0 || lo < 0 || n == max)
+      return -1;
+    buf[n++] = hi << 4 | lo;
+    s += 2;
+  }
+  return n;
+}
+
+std::vector<Frame> builtin_corpus() {
+  std::vector<Frame> frames;
+  for (size_t i = 0; i < sizeof(builtin_messages) / sizeof(*builtin_messages); ++i) {
+    uint8_t msg[MAX_FRAME_LEN];
+    int len = parse_hex(builtin_messages[i], msg, MAX_FRAME_LEN - 3);
+    frames.push_back(make_frame(msg, len));
+  }
+  return frames;
+}
+
+bool load_corpus(const char *filename, std::vector<Frame> *frames) {
+  FILE *f = fopen(filename, "r");
+  if (!f)
+    return false;
+
+  char line[1024];
+  unsigned lineno = 0;
+  while (fgets(line, sizeof(line), f)) {
+    ++lineno;
+    Frame frame;
+    int len = parse_hex(line, frame.data, MAX_FRAME_LEN);
+    if (len < 0)
+      fprintf(stderr, "%s:%u: invalid hex, skipping\n", filename, lineno);
+    if (len <= 0)
+      continue;
+    frame.len = len;
+    frames->push_back(frame);
+  }
+  fclose(f);
+  return true;
+}
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint32_t random_addr() {
+  return (rand() & 0xffffff) | 1;
+}
+
+int failures = 0;
+
+void check(bool ok, const char *what) {
+  if (!ok) {
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+  }
+}
+
+int check_result() {
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
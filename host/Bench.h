@@ -0,0 +1,89 @@
+#ifndef __MAX_HOST_BENCH_H
+#define __MAX_HOST_BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+#include <Print.h>
+
+/* Maximum size of a raw frame, including length byte and CRC */
+const size_t MAX_FRAME_LEN = 256;
+
+/**
+ * A raw frame, as it would be returned by MaxRF22::recv (so including
+ * length byte and CRC, still whitened).
+ */
+struct Frame {
+  uint8_t len;
+  uint8_t data[MAX_FRAME_LEN];
+};
+
+/**
+ * Print that just counts the bytes written, to measure formatting
+ * without being limited by terminal speed.
+ */
+class CountingPrint : public Print {
+public:
+  CountingPrint() : count(0) {}
+  virtual size_t write(uint8_t) { ++count; return 1; }
+  virtual size_t write(const uint8_t *, size_t size) { count += size; return size; }
+
+  uint64_t count;
+};
+
+/**
+ * Print that writes to stdout.
+ */
+class StdoutPrint : public Print {
+public:
+  virtual size_t write(uint8_t c);
+  virtual size_t write(const uint8_t *buf, size_t size);
+};
+
+/**
+ * Build a raw frame from a message (headers and payload). Prepends the
+ * length byte, appends the CRC and whitens the result.
+ */
+Frame make_frame(const uint8_t *msg, size_t len);
+
+/**
+ * Return a small built-in corpus of frames covering every message
+ * class the parser knows.
+ */
+std::vector<Frame> builtin_corpus();
+
+/**
+ * Load raw (whitened) frames from a file, one frame per line as hex
+ * bytes (whitespace between bytes is optional, # starts a comment).
+ * Returns false when the file could not be read.
+ */
+bool load_corpus(const char *filename, std::vector<Frame> *frames);
+
+/**
+ * Monotonic timestamp in nanoseconds.
+ */
+uint64_t now_ns();
+
+/**
+ * A random device address, never 0 (which is the broadcast address).
+ */
+uint32_t random_addr();
+
+/* Number of checks that failed so far */
+extern int failures;
+
+/**
+ * Count a failed check and report it on stderr.
+ */
+void check(bool ok, const char *what);
+
+/**
+ * Report how many checks failed, if any. Returns the exit status for
+ * main(): 1 when a check failed, 0 otherwise.
+ */
+int check_result();
+
+#endif // __MAX_HOST_BENCH_H
+
+/* vim: set sw=2 sts=2 expandtab: */
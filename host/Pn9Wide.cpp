@@ -0,0 +1,49 @@
+#include <string.h>
+
+#include "Pn9Wide.h"
+#include "Pn9.h"
+
+/* One period of the sequence, plus room to read a full word past the
+ * end of a period */
+static uint8_t sequence[PN9_PERIOD + sizeof(uint64_t)];
+
+static void init_sequence() {
+  static bool done = false;
+  if (done)
+    return;
+
+  uint16_t state = PN9_INIT;
+  for (size_t i = 0; i < sizeof(sequence); ++i) {
+    sequence[i] = state;
+    state = pn9_next(state);
+  }
+  done = true;
+}
+
+void xor_pn9_wide(uint8_t *buf, size_t len) {
+  init_sequence();
+
+  /* Frames longer than a period wrap around to the start */
+  size_t pos = 0;
+  while (len >= sizeof(uint64_t)) {
+    uint64_t data, key;
+    memcpy(&data, buf, sizeof(data));
+    memcpy(&key, sequence + pos, sizeof(key));
+    data ^= key;
+    memcpy(buf, &data, sizeof(data));
+
+    buf += sizeof(data);
+    len -= sizeof(data);
+    pos += sizeof(data);
+    if (pos >= PN9_PERIOD)
+      pos -= PN9_PERIOD;
+  }
+
+  while (len--) {
+    *buf++ ^= sequence[pos++];
+    if (pos == PN9_PERIOD)
+      pos = 0;
+  }
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,20 @@
+#ifndef __MAX_HOST_PN9_WIDE_H
+#define __MAX_HOST_PN9_WIDE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* The PN9 sequence repeats after this many bytes */
+const size_t PN9_PERIOD = 511;
+
+/**
+ * Xor the first len bytes in buf with the PN9 sequence, like xor_pn9,
+ * but 64 bits at a time using a precomputed copy of the full sequence.
+ * Meant for offline decoding of captured frames, where memory is not a
+ * concern.
+ */
+void xor_pn9_wide(uint8_t *buf, size_t len);
+
+#endif // __MAX_HOST_PN9_WIDE_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,210 @@
+#include <string.h>
+#include <TStreaming.h>
+
+#include "TelemetryDecoder.h"
+#include "Crc.h"
+
+TelemetryDecoder::TelemetryDecoder()
+  : kettle(0), time(0), synced(false), frames(0), keyframes(0), invalid(0),
+    gaps(0), skipped(0), junk(0), len(0), next_seq(0) {
+  reset();
+}
+
+void TelemetryDecoder::reset() {
+  for (size_t i = 0; i < TELEMETRY_END; ++i) {
+    devices[i].address = 0;
+    devices[i].type = DeviceType::UNKNOWN;
+    devices[i].actual_temp = ACTUAL_TEMP_UNKNOWN;
+    devices[i].set_temp = SET_TEMP_UNKNOWN;
+    devices[i].valve_pos = VALVE_UNKNOWN;
+  }
+  kettle = 0;
+}
+
+/* Read a varint at *pos, returns false when it runs past end or does
+ * not fit in 32 bits */
+static bool read_varint(const uint8_t *buf, size_t end, size_t *pos, uint32_t *value) {
+  *value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (*pos >= end)
+      return false;
+    uint8_t b = buf[(*pos)++];
+    *value |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+/* Check the frame at the start of buf, and apply it to the state when
+ * apply is set. Only call with apply set after a check returned
+ * COMPLETE. On COMPLETE, *frame_len is set to the length of the frame. */
+TelemetryDecoder::Result TelemetryDecoder::parse(bool apply, size_t *frame_len) {
+  /* Skip sync bytes */
+  size_t pos = 2;
+  uint32_t value;
+
+  if (len < pos + 2)
+    return Result::INCOMPLETE;
+  uint8_t flags = buf[pos + 1];
+  pos += 2;
+  size_t start = pos;
+  if (!read_varint(buf, len, &pos, &value))
+    return len - start >= 5 ? Result::INVALID : Result::INCOMPLETE;
+
+  if (apply) {
+    if (flags & TELEMETRY_KEYFRAME) {
+      reset();
+      time = value;
+    } else {
+      time += value;
+    }
+  }
+
+  while (true) {
+    if (pos >= len)
+      return Result::INCOMPLETE;
+    uint8_t index = buf[pos++];
+    if (index == TELEMETRY_END)
+      break;
+
+    if (pos >= len)
+      return Result::INCOMPLETE;
+    uint8_t field = buf[pos++];
+    if ((index == TELEMETRY_GLOBAL) != (field == TELEMETRY_FIELD_KETTLE))
+      return Result::INVALID;
+    if (field > TELEMETRY_FIELD_KETTLE)
+      return Result::INVALID;
+
+    start = pos;
+    if (!read_varint(buf, len, &pos, &value))
+      return len - start >= 5 ? Result::INVALID : Result::INCOMPLETE;
+
+    if (!apply)
+      continue;
+
+    /* In keyframes, everything is absolute */
+    bool absolute = (flags & TELEMETRY_KEYFRAME);
+    int16_t delta = zigzag_decode(value);
+    if (field == TELEMETRY_FIELD_KETTLE) {
+      kettle = absolute ? value : kettle + delta;
+      continue;
+    }
+
+    DeviceState *d = &devices[index];
+    switch (field) {
+      case TELEMETRY_FIELD_ADDRESS:
+        d->address = value;
+        d->type = DeviceType::UNKNOWN;
+        d->actual_temp = ACTUAL_TEMP_UNKNOWN;
+        d->set_temp = SET_TEMP_UNKNOWN;
+        d->valve_pos = VALVE_UNKNOWN;
+        break;
+      case TELEMETRY_FIELD_TYPE:
+        d->type = (DeviceType)value;
+        break;
+      case TELEMETRY_FIELD_ACTUAL_TEMP:
+        d->actual_temp = absolute ? value : d->actual_temp + delta;
+        break;
+      case TELEMETRY_FIELD_SET_TEMP:
+        d->set_temp = absolute ? value : d->set_temp + delta;
+        break;
+      case TELEMETRY_FIELD_VALVE_POS:
+        d->valve_pos = absolute ? value : d->valve_pos + delta;
+        break;
+    }
+  }
+
+  if (len < pos + 2)
+    return Result::INCOMPLETE;
+
+  uint16_t crc = CRC_INIT;
+  for (size_t i = 2; i < pos; ++i)
+    crc = crc_update(crc, buf[i]);
+  if (buf[pos] != (crc >> 8) || buf[pos + 1] != (crc & 0xff))
+    return Result::INVALID;
+
+  *frame_len = pos + 2;
+  return Result::COMPLETE;
+}
+
+/* Remove the first n bytes from buf */
+void TelemetryDecoder::drop(size_t n) {
+  memmove(buf, buf + n, len - n);
+  len -= n;
+}
+
+/* Apply the complete frame at the start of buf, unless it follows a
+ * gap */
+bool TelemetryDecoder::apply() {
+  size_t frame_len;
+  uint8_t seq = buf[2];
+  bool keyframe = buf[3] & TELEMETRY_KEYFRAME;
+
+  if (synced && seq != next_seq) {
+    gaps++;
+    synced = false;
+  }
+  next_seq = seq + 1;
+
+  if (!keyframe && !synced) {
+    skipped++;
+    return false;
+  }
+
+  parse(true, &frame_len);
+  synced = true;
+  frames++;
+  if (keyframe)
+    keyframes++;
+  return true;
+}
+
+bool TelemetryDecoder::feed(uint8_t b) {
+  bool applied = false;
+  buf[len++] = b;
+
+  while (len) {
+    /* Look for the sync bytes, anything before them is junk */
+    if (buf[0] != TELEMETRY_SYNC1 || (len > 1 && buf[1] != TELEMETRY_SYNC2)) {
+      junk++;
+      drop(1);
+      continue;
+    }
+
+    size_t frame_len;
+    Result res = len > 2 ? parse(false, &frame_len) : Result::INCOMPLETE;
+    if (res == Result::INCOMPLETE && len < sizeof(buf))
+      break;
+
+    if (res == Result::COMPLETE) {
+      applied |= apply();
+      drop(frame_len);
+    } else {
+      /* Bad or overlong frame, try again at the next sync */
+      invalid++;
+      junk++;
+      drop(1);
+    }
+  }
+  return applied;
+}
+
+void TelemetryDecoder::printStatus(Print &p) const {
+  p << "STATUS\t" << time << "\t";
+  for (size_t i = 0; i < TELEMETRY_END; ++i) {
+    const DeviceState *d = &devices[i];
+    if (!d->address) break;
+    if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
+
+    p << V<ActualTemp>(d->actual_temp) << "\t" << V<SetTemp>(d->set_temp) << "\t";
+    if (d->type == DeviceType::RADIATOR)
+      p << V<ValvePos>(d->valve_pos);
+    else
+      p << "NA";
+    p << "\t";
+  }
+  p << (kettle ? "1" : "0") << endl;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,72 @@
+#ifndef __MAX_HOST_TELEMETRY_DECODER_H
+#define __MAX_HOST_TELEMETRY_DECODER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <Print.h>
+
+#include "Telemetry.h"
+
+/* Largest frame accepted, anything longer is taken to be garbage */
+const size_t TELEMETRY_MAX_FRAME = 4096;
+
+/**
+ * Decodes a stream of telemetry frames (see Telemetry.h), which may be
+ * mixed with other output, and keeps the device state they describe.
+ */
+class TelemetryDecoder {
+public:
+  TelemetryDecoder();
+
+  /**
+   * Process a single byte of input. Returns true when this completed a
+   * frame that was applied to the state. Frames after a gap in the
+   * sequence numbers are not applied, until the next keyframe.
+   */
+  bool feed(uint8_t b);
+
+  /**
+   * Print the state as the sketch prints its STATUS line.
+   */
+  void printStatus(Print &p) const;
+
+  struct DeviceState {
+    uint32_t address;
+    DeviceType type;
+    uint16_t actual_temp;
+    uint8_t set_temp;
+    uint8_t valve_pos;
+  };
+
+  /* State as of the last applied frame */
+  DeviceState devices[TELEMETRY_END];
+  uint8_t kettle;
+  unsigned long time;
+  /* Set once a keyframe was applied, cleared on a gap */
+  bool synced;
+
+  /* Statistics */
+  uint32_t frames; /* Frames applied */
+  uint32_t keyframes; /* Keyframes applied */
+  uint32_t invalid; /* Frames with a CRC error or bad contents */
+  uint32_t gaps; /* Missing sequence numbers detected */
+  uint32_t skipped; /* Valid frames not applied while out of sync */
+  uint32_t junk; /* Bytes outside of frames */
+
+private:
+  enum class Result { INCOMPLETE, COMPLETE, INVALID };
+
+  Result parse(bool apply, size_t *frame_len);
+  bool apply();
+  void drop(size_t n);
+  void reset();
+
+  uint8_t buf[TELEMETRY_MAX_FRAME];
+  size_t len;
+  uint8_t next_seq;
+};
+
+#endif // __MAX_HOST_TELEMETRY_DECODER_H
+
+/* vim: set sw=2 sts=2 expandtab: */
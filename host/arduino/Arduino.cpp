@@ -0,0 +1,55 @@
+#include <time.h>
+
+#include "Arduino.h"
+#include "avr/eeprom.h"
+
+static uint64_t now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Like on the Arduino, time starts counting at startup */
+static const uint64_t start_us = now_us();
+
+static bool simulated = false;
+static unsigned long simulated_us;
+
+unsigned long millis() {
+  return micros() / 1000;
+}
+
+unsigned long micros() {
+  if (simulated)
+    return simulated_us;
+  return now_us() - start_us;
+}
+
+void set_simulated_time(unsigned long us) {
+  simulated = true;
+  simulated_us = us;
+}
+
+HardwareSerial Serial;
+
+uint8_t host_eeprom[1024];
+
+/* Erased, like a new chip */
+static struct EraseEeprom {
+  EraseEeprom() { memset(host_eeprom, 0xff, sizeof(host_eeprom)); }
+} erase_eeprom;
+
+int HardwareSerial::read() {
+  if (input.empty())
+    return -1;
+  int c = (uint8_t)input[0];
+  input.erase(0, 1);
+  return c;
+}
+
+void delay(unsigned long ms) {
+  struct timespec ts = {(time_t)(ms / 1000), (long)(ms % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,74 @@
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+/* Host stand-in for the Arduino core, just enough to compile the
+ * protocol parts of the sketch on a regular Linux machine. */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <avr/pgmspace.h>
+#include <string>
+
+#include "Print.h"
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+/* SPI slave select pin, as on the ATmega328 */
+#define SS 10
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+/* Host only: from now on, millis() and micros() return the simulated
+ * time us (in microseconds) instead of the real time, until it is set
+ * again. For benchmarks that simulate hours of traffic. */
+void set_simulated_time(unsigned long us);
+
+/* Pin functions do nothing on the host */
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+
+/**
+ * The serial port. On the host, output collects in output and the
+ * sketch reads from input, so a benchmark can play the other side.
+ */
+class HardwareSerial : public Print {
+public:
+  HardwareSerial() : room(64) {}
+
+  void begin(unsigned long) {}
+  int available() { return input.size(); }
+  int read();
+  virtual int availableForWrite() { return room; }
+
+  using Print::write;
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t *buf, size_t size) {
+    output.append((const char*)buf, size);
+    return size;
+  }
+
+  /* Host only */
+  std::string input;
+  std::string output;
+  /* Reported by availableForWrite() */
+  int room;
+};
+
+extern HardwareSerial Serial;
+
+#endif // __HOST_ARDUINO_H
+
+/* vim: set sw=2 sts=2 expandtab: */
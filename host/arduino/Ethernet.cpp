@@ -0,0 +1,15 @@
+#include "Ethernet.h"
+
+EthernetClass Ethernet;
+
+size_t IPAddress::printTo(Print &p) const {
+  size_t n = 0;
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (i)
+      n += p.print('.');
+    n += p.print(addr[i]);
+  }
+  return n;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
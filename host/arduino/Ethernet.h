@@ -0,0 +1,52 @@
+#ifndef __HOST_ETHERNET_H
+#define __HOST_ETHERNET_H
+
+/* Host stand-in for the Ethernet library. There is no network: DHCP
+ * always gets the same address and no client ever connects. ClientServer
+ * is tested with its own mock clients in bench_clients. */
+
+#include "Arduino.h"
+
+class IPAddress : public Printable {
+public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) {
+    addr[0] = a; addr[1] = b; addr[2] = c; addr[3] = d;
+  }
+  virtual size_t printTo(Print &p) const;
+
+private:
+  uint8_t addr[4];
+};
+
+class EthernetClient : public Print {
+public:
+  using Print::write;
+  virtual size_t write(uint8_t) { return 0; }
+  virtual size_t write(const uint8_t *, size_t) { return 0; }
+  virtual int availableForWrite() { return 0; }
+
+  int available() { return 0; }
+  int read() { return -1; }
+  uint8_t connected() { return 0; }
+  void stop() {}
+  explicit operator bool() { return false; }
+};
+
+class EthernetServer {
+public:
+  EthernetServer(uint16_t) {}
+  void begin() {}
+  EthernetClient accept() { return EthernetClient(); }
+};
+
+class EthernetClass {
+public:
+  int begin(uint8_t *) { return 1; }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 177); }
+};
+
+extern EthernetClass Ethernet;
+
+#endif // __HOST_ETHERNET_H
+
+/* vim: set sw=2 sts=2 expandtab: */
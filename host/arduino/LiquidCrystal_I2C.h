@@ -0,0 +1,25 @@
+#ifndef __HOST_LIQUIDCRYSTAL_I2C_H
+#define __HOST_LIQUIDCRYSTAL_I2C_H
+
+/* Host stand-in for the LiquidCrystal_I2C library: a display that
+ * shows nothing. LcdBuffer is tested in bench_lcd. */
+
+#include "Arduino.h"
+
+class LiquidCrystal_I2C : public Print {
+public:
+  LiquidCrystal_I2C(uint8_t, uint8_t, uint8_t) {}
+
+  void init() {}
+  void backlight() {}
+  void home() {}
+  void clear() {}
+  void setCursor(uint8_t, uint8_t) {}
+
+  using Print::write;
+  virtual size_t write(uint8_t) { return 1; }
+};
+
+#endif // __HOST_LIQUIDCRYSTAL_I2C_H
+
+/* vim: set sw=2 sts=2 expandtab: */
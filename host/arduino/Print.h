@@ -0,0 +1,63 @@
+#ifndef __HOST_PRINT_H
+#define __HOST_PRINT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "WString.h"
+#include "Printable.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+/**
+ * Host stand-in for the Arduino core Print class, implementing the
+ * same interface so the sketch code and TStreaming can print to it.
+ */
+class Print {
+public:
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) {
+    if (str == NULL) return 0;
+    return write((const uint8_t *)str, strlen(str));
+  }
+  size_t write(const char *buffer, size_t size) {
+    return write((const uint8_t *)buffer, size);
+  }
+  virtual int availableForWrite() { return 0; }
+
+  size_t print(const __FlashStringHelper *s);
+  size_t print(const char s[]);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+  size_t print(const Printable &x);
+
+  size_t println(const __FlashStringHelper *s);
+  size_t println(const char s[]);
+  size_t println(char c);
+  size_t println(unsigned char n, int base = DEC);
+  size_t println(int n, int base = DEC);
+  size_t println(unsigned int n, int base = DEC);
+  size_t println(long n, int base = DEC);
+  size_t println(unsigned long n, int base = DEC);
+  size_t println(double n, int digits = 2);
+  size_t println(const Printable &x);
+  size_t println();
+
+  virtual ~Print() {}
+private:
+  size_t printNumber(unsigned long n, uint8_t base);
+};
+
+#endif // __HOST_PRINT_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,17 @@
+#ifndef __HOST_PRINTABLE_H
+#define __HOST_PRINTABLE_H
+
+#include <stddef.h>
+
+class Print;
+
+/* Host stand-in for the Arduino core Printable.h */
+class Printable {
+public:
+  virtual size_t printTo(Print &p) const = 0;
+  virtual ~Printable() {}
+};
+
+#endif // __HOST_PRINTABLE_H
+
+/* vim: set sw=2 sts=2 expandtab: */
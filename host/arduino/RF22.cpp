@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "RF22.h"
+
+RF22::RF22(uint8_t, uint8_t)
+  : rx_fifo_max(0), rx_fifo_overflow(false), interrupts(0), _mode(RF22_MODE_IDLE),
+    _idleMode(RF22_XTON), rx_count(0) {
+  memset(this->regs, 0, sizeof(this->regs));
+  memset(this->status, 0, sizeof(this->status));
+}
+
+boolean RF22::init() {
+  memset(this->regs, 0, sizeof(this->regs));
+  memset(this->status, 0, sizeof(this->status));
+  this->regs[RF22_REG_07_OPERATING_MODE1] = this->_idleMode;
+  this->regs[RF22_REG_3E_PACKET_LENGTH] = RF22_MAX_MESSAGE_LEN;
+  this->regs[RF22_REG_7E_RX_FIFO_CONTROL] = 0x37;
+  this->_mode = RF22_MODE_IDLE;
+  resetFifos();
+  return true;
+}
+
+void RF22::setModemRegisters(const ModemConfig *config) {
+  this->regs[0x1c] = config->reg_1c;
+  this->regs[0x1f] = config->reg_1f;
+  spiBurstWrite(0x20, &config->reg_20, 6);
+  spiBurstWrite(0x2c, &config->reg_2c, 3);
+  this->regs[0x58] = config->reg_58;
+  this->regs[0x69] = config->reg_69;
+  spiBurstWrite(0x6e, &config->reg_6e, 5);
+}
+
+boolean RF22::setFrequency(float, float) {
+  return true;
+}
+
+void RF22::setSyncWords(const uint8_t *syncWords, uint8_t len) {
+  spiBurstWrite(RF22_REG_36_SYNC_WORD3, syncWords, len);
+}
+
+uint8_t RF22::spiRead(uint8_t reg) {
+  reg &= 0x7f;
+  switch (reg) {
+    case RF22_REG_03_INTERRUPT_STATUS1:
+    case RF22_REG_04_INTERRUPT_STATUS2: {
+      /* Reading the status clears it */
+      uint8_t res = this->status[reg - RF22_REG_03_INTERRUPT_STATUS1];
+      this->status[reg - RF22_REG_03_INTERRUPT_STATUS1] = 0;
+      return res;
+    }
+    case RF22_REG_7F_FIFO_ACCESS: {
+      if (this->rx_fifo.empty())
+        return 0;
+      uint8_t res = this->rx_fifo.front();
+      this->rx_fifo.erase(this->rx_fifo.begin());
+      return res;
+    }
+    default:
+      return this->regs[reg];
+  }
+}
+
+void RF22::spiWrite(uint8_t reg, uint8_t val) {
+  reg &= 0x7f;
+  switch (reg) {
+    case RF22_REG_07_OPERATING_MODE1:
+      this->regs[reg] = val;
+      if (val & RF22_TXON)
+        this->sent = this->tx_fifo;
+      if (val & RF22_RXON)
+        this->rx_count = 0;
+      break;
+    case RF22_REG_08_OPERATING_MODE2:
+      if (val & RF22_FFCLRRX)
+        this->rx_fifo.clear();
+      if (val & RF22_FFCLRTX)
+        this->tx_fifo.clear();
+      this->regs[reg] = val;
+      break;
+    case RF22_REG_7F_FIFO_ACCESS:
+      if (this->tx_fifo.size() < RF22_FIFO_SIZE)
+        this->tx_fifo.push_back(val);
+      break;
+    default:
+      this->regs[reg] = val;
+  }
+}
+
+/* Bursts auto-increment the register address, except for the FIFO */
+void RF22::spiBurstRead(uint8_t reg, uint8_t *dest, uint8_t len) {
+  for (uint8_t i = 0; i < len; ++i)
+    dest[i] = spiRead((reg & 0x7f) == RF22_REG_7F_FIFO_ACCESS ? reg : reg + i);
+}
+
+void RF22::spiBurstWrite(uint8_t reg, const uint8_t *src, uint8_t len) {
+  for (uint8_t i = 0; i < len; ++i)
+    spiWrite((reg & 0x7f) == RF22_REG_7F_FIFO_ACCESS ? reg : reg + i, src[i]);
+}
+
+void RF22::setModeIdle() {
+  if (this->_mode != RF22_MODE_IDLE) {
+    spiWrite(RF22_REG_07_OPERATING_MODE1, this->_idleMode);
+    this->_mode = RF22_MODE_IDLE;
+  }
+}
+
+void RF22::setModeRx() {
+  if (this->_mode != RF22_MODE_RX) {
+    spiWrite(RF22_REG_07_OPERATING_MODE1, this->_idleMode | RF22_RXON);
+    this->_mode = RF22_MODE_RX;
+  }
+}
+
+void RF22::setModeTx() {
+  if (this->_mode != RF22_MODE_TX) {
+    spiWrite(RF22_REG_07_OPERATING_MODE1, this->_idleMode | RF22_TXON);
+    this->_mode = RF22_MODE_TX;
+  }
+}
+
+void RF22::resetFifos() {
+  spiWrite(RF22_REG_08_OPERATING_MODE2, RF22_FFCLRRX | RF22_FFCLRTX);
+  spiWrite(RF22_REG_08_OPERATING_MODE2, 0);
+}
+
+void RF22::resetRxFifo() {
+  spiWrite(RF22_REG_08_OPERATING_MODE2, RF22_FFCLRRX);
+  spiWrite(RF22_REG_08_OPERATING_MODE2, 0);
+}
+
+void RF22::resetTxFifo() {
+  spiWrite(RF22_REG_08_OPERATING_MODE2, RF22_FFCLRTX);
+  spiWrite(RF22_REG_08_OPERATING_MODE2, 0);
+}
+
+bool RF22::irqPending() const {
+  return (this->status[0] & this->regs[RF22_REG_05_INTERRUPT_ENABLE1])
+      || (this->status[1] & this->regs[RF22_REG_06_INTERRUPT_ENABLE2]);
+}
+
+/* The interrupt line goes low when an enabled status bit is set and
+ * none was pending, the handler runs on that edge */
+void RF22::raise(uint8_t status1, uint8_t status2) {
+  bool pending = irqPending();
+  this->status[0] |= status1;
+  this->status[1] |= status2;
+  if (!pending && irqPending()) {
+    this->interrupts++;
+    handleInterrupt();
+  }
+}
+
+/* Returns true when this ended the packet */
+bool RF22::rxByte(uint8_t b) {
+  uint8_t events = 0;
+  bool end = false;
+  if (this->rx_fifo.size() < RF22_FIFO_SIZE) {
+    this->rx_fifo.push_back(b);
+  } else {
+    this->rx_fifo_overflow = true;
+    events |= RF22_IFFERROR;
+  }
+  if (this->rx_fifo.size() > this->rx_fifo_max)
+    this->rx_fifo_max = this->rx_fifo.size();
+  this->rx_count++;
+
+  /* Only on reaching the threshold, not for every byte above it */
+  if (this->rx_fifo.size() == this->regs[RF22_REG_7E_RX_FIFO_CONTROL])
+    events |= RF22_IRXFFAFULL;
+
+  /* With a fixed packet length, the packet handler stops at that
+   * length and the radio leaves RX mode */
+  if ((this->regs[RF22_REG_30_DATA_ACCESS_CONTROL] & RF22_ENPACRX)
+      && this->rx_count >= this->regs[RF22_REG_3E_PACKET_LENGTH]) {
+    events |= RF22_IPKVALID;
+    this->regs[RF22_REG_07_OPERATING_MODE1] &= ~RF22_RXON;
+    end = true;
+  }
+  raise(events, 0);
+  return end;
+}
+
+bool RF22::airReceive(const uint8_t *frame, uint8_t len, uint8_t rssi) {
+  if (!receiving())
+    return false;
+
+  this->rx_count = 0;
+  this->regs[RF22_REG_26_RSSI] = rssi;
+  raise(0, RF22_ISWDET);
+
+  /* The packet handler keeps going until the packet length, so noise
+   * follows a frame shorter than that. Once the packet ends, the rest
+   * of the frame is lost, even when the handler starts receiving again
+   * right away (it waits for the next sync word). */
+  for (uint16_t i = 0; i < 256 && receiving(); ++i)
+    if (rxByte(i < len ? frame[i] : rand()))
+      break;
+  return true;
+}
+
+void RF22::finishTx() {
+  if (!transmitting())
+    return;
+  this->regs[RF22_REG_07_OPERATING_MODE1] &= ~RF22_TXON;
+  this->tx_fifo.clear();
+  raise(RF22_IPKSENT, 0);
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
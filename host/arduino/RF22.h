@@ -0,0 +1,185 @@
+#ifndef __HOST_RF22_H
+#define __HOST_RF22_H
+
+/* Host stand-in for the RF22 library, with a simulated radio behind
+ * its register interface, so MaxRF22 (which drives the radio through
+ * registers and its own interrupt handler) can run on the host.
+ *
+ * The simulation covers what MaxRF22 uses: the RX and TX FIFOs, the
+ * RX FIFO almost full threshold, the packet handler with a fixed
+ * packet length, the interrupt status and enable registers and the
+ * operating mode. The interrupt line works like the real one: the
+ * handler is called when an enabled status bit gets set while none
+ * was pending, so a handler that doesn't read the status stops getting
+ * interrupts. Everything happens synchronously, from airReceive() and
+ * finishTx(). */
+
+#include <stdint.h>
+#include <vector>
+
+#include "Arduino.h"
+
+/* The largest the library allows */
+#define RF22_MAX_MESSAGE_LEN 255
+
+#define RF22_FIFO_SIZE 64
+
+#define RF22_REG_02_DEVICE_STATUS               0x02
+#define RF22_REG_03_INTERRUPT_STATUS1           0x03
+#define RF22_REG_04_INTERRUPT_STATUS2           0x04
+#define RF22_REG_05_INTERRUPT_ENABLE1           0x05
+#define RF22_REG_06_INTERRUPT_ENABLE2           0x06
+#define RF22_REG_07_OPERATING_MODE1             0x07
+#define RF22_REG_08_OPERATING_MODE2             0x08
+#define RF22_REG_26_RSSI                        0x26
+#define RF22_REG_30_DATA_ACCESS_CONTROL         0x30
+#define RF22_REG_32_HEADER_CONTROL1             0x32
+#define RF22_REG_33_HEADER_CONTROL2             0x33
+#define RF22_REG_34_PREAMBLE_LENGTH             0x34
+#define RF22_REG_35_PREAMBLE_DETECTION_CONTROL1 0x35
+#define RF22_REG_36_SYNC_WORD3                  0x36
+#define RF22_REG_3E_PACKET_LENGTH               0x3e
+#define RF22_REG_4B_RECEIVED_PACKET_LENGTH      0x4b
+#define RF22_REG_7C_TX_FIFO_CONTROL1            0x7c
+#define RF22_REG_7D_TX_FIFO_CONTROL2            0x7d
+#define RF22_REG_7E_RX_FIFO_CONTROL             0x7e
+#define RF22_REG_7F_FIFO_ACCESS                 0x7f
+
+/* RF22_REG_03_INTERRUPT_STATUS1 */
+#define RF22_IFFERROR   0x80
+#define RF22_ITXFFAFULL 0x40
+#define RF22_ITXFFAEM   0x20
+#define RF22_IRXFFAFULL 0x10
+#define RF22_IEXT       0x08
+#define RF22_IPKSENT    0x04
+#define RF22_IPKVALID   0x02
+#define RF22_ICRCERROR  0x01
+
+/* RF22_REG_04_INTERRUPT_STATUS2 */
+#define RF22_ISWDET     0x80
+#define RF22_IPREAVAL   0x40
+
+/* RF22_REG_05_INTERRUPT_ENABLE1 */
+#define RF22_ENFFERR    0x80
+#define RF22_ENTXFFAFULL 0x40
+#define RF22_ENTXFFAEM  0x20
+#define RF22_ENRXFFAFULL 0x10
+#define RF22_ENEXT      0x08
+#define RF22_ENPKSENT   0x04
+#define RF22_ENPKVALID  0x02
+#define RF22_ENCRCERROR 0x01
+
+/* RF22_REG_06_INTERRUPT_ENABLE2 */
+#define RF22_ENSWDET    0x80
+#define RF22_ENPREAVAL  0x40
+
+/* RF22_REG_07_OPERATING_MODE1 */
+#define RF22_TXON       0x08
+#define RF22_RXON       0x04
+#define RF22_XTON       0x01
+
+/* RF22_REG_08_OPERATING_MODE2 */
+#define RF22_FFCLRRX    0x02
+#define RF22_FFCLRTX    0x01
+
+/* RF22_REG_30_DATA_ACCESS_CONTROL */
+#define RF22_ENPACRX    0x80
+#define RF22_LSBFRST    0x40
+#define RF22_MSBFRST    0x00
+#define RF22_ENPACTX    0x08
+
+/* RF22_REG_32_HEADER_CONTROL1 */
+#define RF22_BCEN_NONE  0x00
+#define RF22_HDCH_NONE  0x00
+
+/* RF22_REG_33_HEADER_CONTROL2 */
+#define RF22_HDLEN_0    0x00
+#define RF22_FIXPKLEN   0x08
+#define RF22_SYNCLEN_4  0x06
+
+/* RF22_REG_71_MODULATION_CONTROL2 */
+#define RF22_DTMOD_FIFO 0x20
+#define RF22_MODTYP_FSK 0x02
+
+#define RF22_MODE_IDLE  0x00
+#define RF22_MODE_RX    0x01
+#define RF22_MODE_TX    0x02
+
+class RF22 {
+public:
+  typedef struct {
+    uint8_t reg_1c, reg_1f, reg_20, reg_21, reg_22, reg_23, reg_24, reg_25;
+    uint8_t reg_2c, reg_2d, reg_2e, reg_58, reg_69, reg_6e, reg_6f, reg_70;
+    uint8_t reg_71, reg_72;
+  } ModemConfig;
+
+  RF22(uint8_t slaveSelectPin = SS, uint8_t interrupt = 0);
+
+  boolean init();
+  void setModemRegisters(const ModemConfig *config);
+  boolean setFrequency(float centre, float afcPullInRange = 0.05);
+  void setSyncWords(const uint8_t *syncWords, uint8_t len);
+
+  uint8_t spiRead(uint8_t reg);
+  void spiWrite(uint8_t reg, uint8_t val);
+  void spiBurstRead(uint8_t reg, uint8_t *dest, uint8_t len);
+  void spiBurstWrite(uint8_t reg, const uint8_t *src, uint8_t len);
+
+  void setModeIdle();
+  void setModeRx();
+  void setModeTx();
+  uint8_t mode() { return _mode; }
+
+  void resetFifos();
+  void resetRxFifo();
+  void resetTxFifo();
+
+  /* Host only: the simulated radio */
+
+  /**
+   * A frame (as sent, so whitened and with length byte and CRC) goes
+   * by on the air with the given RSSI. When the radio is receiving, it
+   * detects the sync word and takes in the bytes one at a time,
+   * raising interrupts as it goes. When the packet length set is more
+   * than the frame, noise follows until it is reached. Returns false
+   * when the radio was not receiving, so it missed the frame.
+   */
+  bool airReceive(const uint8_t *frame, uint8_t len, uint8_t rssi);
+
+  /* Is the radio sending? The frame is in sent until finishTx() */
+  bool transmitting() const { return regs[RF22_REG_07_OPERATING_MODE1] & RF22_TXON; }
+  bool receiving() const { return regs[RF22_REG_07_OPERATING_MODE1] & RF22_RXON; }
+
+  /* The frame being sent leaves the radio, it signals IPKSENT */
+  void finishTx();
+
+  /* The bytes of the last frame sent */
+  std::vector<uint8_t> sent;
+  /* Most bytes ever in the RX FIFO, and whether it overflowed */
+  uint8_t rx_fifo_max;
+  bool rx_fifo_overflow;
+  /* Interrupt handler calls */
+  unsigned long interrupts;
+
+protected:
+  virtual void handleInterrupt() {}
+
+  volatile uint8_t _mode;
+  uint8_t _idleMode;
+
+private:
+  bool irqPending() const;
+  void raise(uint8_t status1, uint8_t status2);
+  bool rxByte(uint8_t b);
+
+  uint8_t regs[128];
+  uint8_t status[2];
+  std::vector<uint8_t> rx_fifo;
+  std::vector<uint8_t> tx_fifo;
+  /* Bytes of the current packet received */
+  uint16_t rx_count;
+};
+
+#endif // __HOST_RF22_H
+
+/* vim: set sw=2 sts=2 expandtab: */
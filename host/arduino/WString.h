@@ -0,0 +1,12 @@
+#ifndef __HOST_WSTRING_H
+#define __HOST_WSTRING_H
+
+/* Host stand-in for the Arduino core WString.h. Only the flash string
+ * helper is provided, since the sketch doesn't use String. On the host
+ * there is no separate flash address space, so F() is a plain cast. */
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+#endif // __HOST_WSTRING_H
+
+/* vim: set sw=2 sts=2 expandtab: */
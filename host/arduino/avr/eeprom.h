@@ -0,0 +1,24 @@
+#ifndef __HOST_EEPROM_H
+#define __HOST_EEPROM_H
+
+/* Host stand-in for avr-libc's eeprom.h, with the 1024 bytes of EEPROM
+ * of the ATmega328 in memory. Like a new chip, it starts out erased
+ * (all 0xff). Writes are done right away. */
+
+#include <stdint.h>
+
+extern uint8_t host_eeprom[1024];
+
+static inline uint8_t eeprom_read_byte(const uint8_t *addr) {
+  return host_eeprom[(uintptr_t)addr % sizeof(host_eeprom)];
+}
+
+static inline void eeprom_write_byte(uint8_t *addr, uint8_t value) {
+  host_eeprom[(uintptr_t)addr % sizeof(host_eeprom)] = value;
+}
+
+static inline bool eeprom_is_ready() { return true; }
+
+#endif // __HOST_EEPROM_H
+
+/* vim: set sw=2 sts=2 expandtab: */
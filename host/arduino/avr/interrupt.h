@@ -0,0 +1,13 @@
+#ifndef __HOST_INTERRUPT_H
+#define __HOST_INTERRUPT_H
+
+/* Host stand-in for avr-libc's interrupt.h. Interrupts only happen
+ * synchronously on the host (see RF22.h), so there is nothing to
+ * disable. */
+
+static inline void cli() {}
+static inline void sei() {}
+
+#endif // __HOST_INTERRUPT_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,24 @@
+#ifndef __HOST_PGMSPACE_H
+#define __HOST_PGMSPACE_H
+
+/* Host stand-in for avr-libc's pgmspace.h. The host has a single
+ * address space, so "program memory" reads are plain reads. */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr) (*(void * const *)(addr))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+
+#endif // __HOST_PGMSPACE_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,16 @@
+#ifndef __HOST_SLEEP_H
+#define __HOST_SLEEP_H
+
+/* Host stand-in for avr-libc's sleep.h. Sleeping returns right away,
+ * as if an interrupt woke the MCU up. */
+
+#define SLEEP_MODE_IDLE 0
+
+static inline void set_sleep_mode(uint8_t) {}
+static inline void sleep_enable() {}
+static inline void sleep_disable() {}
+static inline void sleep_cpu() {}
+
+#endif // __HOST_SLEEP_H
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,14 @@
+#ifndef __HOST_ATOMIC_H
+#define __HOST_ATOMIC_H
+
+/* Host stand-in for avr-libc's atomic.h. Interrupts only happen
+ * synchronously on the host, so the block just runs once. */
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 0
+
+#define ATOMIC_BLOCK(type) for (int __atomic_once = 1; __atomic_once; __atomic_once = 0)
+
+#endif // __HOST_ATOMIC_H
+
+/* vim: set sw=2 sts=2 expandtab: */
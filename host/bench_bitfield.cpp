@@ -0,0 +1,298 @@
+/*
+ * Compare field extraction with the runtime getBits() against the
+ * compile-time BitField extractors, and check that the BitField based
+ * parser gives the same results as the hand-written extraction it
+ * replaced, for the built-in corpus and for random messages.
+ *
+ * Usage: bench_bitfield [-n iterations]
+ *
+ * Exits with an error when a message parses differently.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Bench.h"
+#include "BitField.h"
+#include "Pn9.h"
+#include "Util.h"
+#include "MaxRFProto.h"
+
+/* All parsed fields of a message, zero when not present */
+struct Fields {
+  uint8_t seqnum, flags, type, group_id;
+  uint32_t addr_from, addr_to;
+  uint8_t set_temp, mode, dst, locked, battery_low, valve_pos, display_mode;
+  uint16_t actual_temp;
+  uint8_t has_until, year, month, day, time;
+};
+
+static void reference_until(const uint8_t *buf, Fields *f) {
+  f->has_until = true;
+  f->year = buf[1] & 0x3f;
+  f->month = ((buf[0] & 0xE0) >> 4) | (buf[1] >> 7);
+  f->day = buf[0] & 0x1f;
+  f->time = buf[2] & 0x3f;
+}
+
+/* The hand-written extraction from before BitField was used. Returns
+ * false for invalid messages. */
+static bool reference_parse(const uint8_t *buf, size_t len, bool from_radiator, Fields *f) {
+  memset(f, 0, sizeof(*f));
+  if (len < 10)
+    return false;
+
+  f->seqnum = buf[0];
+  f->flags = buf[1];
+  f->type = buf[2];
+  f->addr_from = getBits(buf + 3, 0, RF_ADDR_SIZE);
+  f->addr_to = getBits(buf + 6, 0, RF_ADDR_SIZE);
+  f->group_id = buf[9];
+  buf += 10;
+  len -= 10;
+
+  switch ((MessageType)f->type) {
+    case MessageType::SET_TEMPERATURE:
+      if (len < 1)
+        return false;
+      f->set_temp = buf[0] & 0x3f;
+      f->mode = (buf[0] >> 6) & 0x3;
+      if (len >= 4)
+        reference_until(buf + 1, f);
+      return true;
+    case MessageType::WALL_THERMOSTAT_STATE:
+      if (len < 2)
+        return false;
+      f->set_temp = buf[0] & 0x7f;
+      f->actual_temp = ((buf[0] & 0x80) << 1) |  buf[1];
+      return true;
+    case MessageType::THERMOSTAT_STATE:
+      if (len < 3)
+        return false;
+      f->mode = buf[0] & 0x3;
+      f->dst = (buf[0] >> 2) & 0x1;
+      f->locked = (buf[0] >> 5) & 0x1;
+      f->battery_low = (buf[0] >> 7) & 0x1;
+      f->valve_pos = buf[1];
+      f->set_temp = buf[2];
+      if ((Mode)f->mode != Mode::TEMPORARY && len >= 5)
+        f->actual_temp = ((buf[3] & 0x1) << 8) + buf[4];
+      if ((Mode)f->mode == Mode::TEMPORARY && len >= 6)
+        reference_until(buf + 3, f);
+      return true;
+    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE:
+      if (len < 1)
+        return false;
+      f->display_mode = (buf[0] >> 2) & 0x1;
+      return true;
+    case MessageType::ACK:
+      if (len < 4)
+        return false;
+      if (from_radiator) {
+        f->mode = buf[1] & 0x3;
+        f->dst = (buf[1] >> 2) & 0x1;
+        f->locked = (buf[1] >> 5) & 0x1;
+        f->battery_low = (buf[1] >> 7) & 0x1;
+        f->valve_pos = buf[2];
+        f->set_temp = buf[3];
+        if ((Mode)f->mode == Mode::TEMPORARY && len >= 7)
+          reference_until(buf + 4, f);
+      }
+      return true;
+    default:
+      return true;
+  }
+}
+
+static void until_fields(bool has_until, const UntilTime &until, Fields *f) {
+  if (!has_until)
+    return;
+  f->has_until = true;
+  f->year = until.year;
+  f->month = until.month;
+  f->day = until.day;
+  f->time = until.time;
+}
+
+/* Collect the fields from a message parsed by MaxRFMessage::parse */
+static void parsed_fields(const MaxRFMessage *m, Fields *f) {
+  memset(f, 0, sizeof(*f));
+  f->seqnum = m->seqnum;
+  f->flags = m->flags;
+  f->type = (uint8_t)m->type;
+  f->addr_from = m->addr_from;
+  f->addr_to = m->addr_to;
+  f->group_id = m->group_id;
+
+  switch (m->type) {
+    case MessageType::SET_TEMPERATURE: {
+      const SetTemperatureMessage *s = (const SetTemperatureMessage *)m;
+      f->set_temp = s->set_temp;
+      f->mode = (uint8_t)s->mode;
+      until_fields(s->has_until, s->until, f);
+      break;
+    }
+    case MessageType::WALL_THERMOSTAT_STATE: {
+      const WallThermostatStateMessage *s = (const WallThermostatStateMessage *)m;
+      f->set_temp = s->set_temp;
+      f->actual_temp = s->actual_temp;
+      break;
+    }
+    case MessageType::THERMOSTAT_STATE: {
+      const ThermostatStateMessage *s = (const ThermostatStateMessage *)m;
+      f->mode = (uint8_t)s->mode;
+      f->dst = s->dst;
+      f->locked = s->locked;
+      f->battery_low = s->battery_low;
+      f->valve_pos = s->valve_pos;
+      f->set_temp = s->set_temp;
+      f->actual_temp = s->actual_temp;
+      until_fields(s->has_until, s->until, f);
+      break;
+    }
+    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: {
+      const SetDisplayActualTemperatureMessage *s = (const SetDisplayActualTemperatureMessage *)m;
+      f->display_mode = (uint8_t)s->display_mode;
+      break;
+    }
+    case MessageType::ACK: {
+      const AckMessage *s = (const AckMessage *)m;
+      if (m->from && m->from->type == DeviceType::RADIATOR) {
+        f->mode = (uint8_t)s->mode;
+        f->dst = s->dst;
+        f->locked = s->locked;
+        f->battery_low = s->battery_low;
+        f->valve_pos = s->valve_pos;
+        f->set_temp = s->set_temp;
+        until_fields(s->has_until, s->until, f);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+/* Parse msg both ways and compare. Returns false on a difference. */
+static bool check(const uint8_t *msg, size_t len) {
+  static MaxRFMessageBuffer storage;
+  MaxRFMessage *m = MaxRFMessage::parse(msg, len, &storage);
+  bool from_radiator = m && m->from && m->from->type == DeviceType::RADIATOR;
+
+  Fields expected, got;
+  bool valid = reference_parse(msg, len, from_radiator, &expected);
+  if (m)
+    parsed_fields(m, &got);
+
+  bool ok = (valid == (m != NULL)) && (!m || !memcmp(&expected, &got, sizeof(got)));
+  if (!ok) {
+    fprintf(stderr, "Parse differs (reference %s, parser %s) for:",
+            valid ? "valid" : "invalid", m ? "valid" : "invalid");
+    for (size_t i = 0; i < len; ++i)
+      fprintf(stderr, " %02X", msg[i]);
+    fprintf(stderr, "\n");
+  }
+
+  if (m)
+    m->~MaxRFMessage();
+  return ok;
+}
+
+static const MessageType fuzz_types[] = {
+  MessageType::SET_TEMPERATURE, MessageType::WALL_THERMOSTAT_STATE,
+  MessageType::THERMOSTAT_STATE, MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE,
+  MessageType::ACK, MessageType::PAIR_PING,
+};
+
+/* Keep results alive, so the compiler doesn't optimize the work away */
+static volatile uint32_t sink;
+
+int main(int argc, char **argv) {
+  unsigned long iterations = 10000000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': iterations = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  /* Built-in corpus, dewhitened and without length byte and CRC */
+  unsigned checked = 0;
+  std::vector<Frame> frames = builtin_corpus();
+  for (size_t i = 0; i < frames.size(); ++i) {
+    Frame f = frames[i];
+    xor_pn9(f.data, f.len);
+    if (!check(f.data + 1, f.len - 3))
+      return 1;
+    checked++;
+  }
+
+  /* Random messages of every type and length, from random devices.
+   * Some addresses repeat, so Acks from known radiators are covered
+   * as well. */
+  srand(1);
+  for (unsigned i = 0; i < 200000; ++i) {
+    uint8_t msg[20];
+    size_t len = rand() % sizeof(msg);
+    for (size_t j = 0; j < sizeof(msg); ++j)
+      msg[j] = rand();
+    msg[2] = (uint8_t)fuzz_types[rand() % lengthof(fuzz_types)];
+    msg[3] = msg[4] = 0;
+    msg[5] = 1 + rand() % 8;
+    if (!check(msg, len))
+      return 1;
+    checked++;
+  }
+  printf("%u messages parse identically\n", checked);
+
+  /* Time extracting the header fields both ways */
+  uint8_t hdr[10];
+  for (size_t j = 0; j < sizeof(hdr); ++j)
+    hdr[j] = rand();
+
+  typedef BitField<3, 0, RF_ADDR_SIZE, uint32_t> AddrFrom;
+  typedef BitField<6, 0, RF_ADDR_SIZE, uint32_t> AddrTo;
+
+  uint64_t start = now_ns();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    hdr[3] = i;
+    sink = getBits(hdr + 3, 0, RF_ADDR_SIZE) + getBits(hdr + 6, 0, RF_ADDR_SIZE);
+  }
+  uint64_t getbits_ns = now_ns() - start;
+
+  start = now_ns();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    hdr[3] = i;
+    sink = AddrFrom::get(hdr) + AddrTo::get(hdr);
+  }
+  uint64_t bitfield_ns = now_ns() - start;
+
+  /* Time parsing whole messages, to see what it adds up to */
+  std::vector<Frame> msgs = frames;
+  for (size_t i = 0; i < msgs.size(); ++i)
+    xor_pn9(msgs[i].data, msgs[i].len);
+
+  static MaxRFMessageBuffer storage;
+  start = now_ns();
+  for (unsigned long i = 0; i < iterations; ++i) {
+    Frame &f = msgs[i % msgs.size()];
+    MaxRFMessage *m = MaxRFMessage::parse(f.data + 1, f.len - 3, &storage);
+    if (m) {
+      sink = m->addr_from;
+      m->~MaxRFMessage();
+    }
+  }
+  uint64_t parse_ns = now_ns() - start;
+
+  printf("2 addresses (24 bits): getBits %.2f ns, BitField %.2f ns\n",
+         (double)getbits_ns / iterations, (double)bitfield_ns / iterations);
+  printf("MaxRFMessage::parse: %.2f ns per message\n", (double)parse_ns / iterations);
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
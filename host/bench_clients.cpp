@@ -0,0 +1,333 @@
+/*
+ * Check that ClientServer hands every TCP client only the output it
+ * subscribed to, that a slow client loses whole lines without holding
+ * up the others, that commands are dispatched and measure the cost of
+ * routing output to several clients. Uses mock EthernetServer and
+ * EthernetClient classes.
+ *
+ * Usage: bench_clients [-n lines]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <deque>
+
+#include <TStreaming.h>
+
+#include "Bench.h"
+#include "Commands.h"
+#include "Output.h"
+#include "ClientServer.h"
+#include "Util.h"
+
+/* One side of a connection, shared by all copies of a MockClient */
+struct MockConnection {
+  MockConnection() : room(2048), connected(true), stopped(false) {}
+
+  std::string received; /* Written by the sketch */
+  std::deque<char> input; /* To be read by the sketch */
+  int room; /* Reported by availableForWrite() */
+  bool connected;
+  bool stopped;
+};
+
+class MockClient : public Print {
+public:
+  MockClient() : conn(NULL) {}
+  MockClient(MockConnection *conn) : conn(conn) {}
+
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t *buf, size_t size) {
+    if (conn)
+      conn->received.append((const char*)buf, size);
+    return size;
+  }
+  virtual int availableForWrite() { return conn ? conn->room : 0; }
+
+  int available() { return conn ? conn->input.size() : 0; }
+  int read() {
+    if (!available())
+      return -1;
+    char c = conn->input.front();
+    conn->input.pop_front();
+    return c;
+  }
+  uint8_t connected() { return conn && conn->connected; }
+  void stop() { if (conn) conn->stopped = true; conn = NULL; }
+  explicit operator bool() { return conn != NULL; }
+
+private:
+  MockConnection *conn;
+};
+
+class MockServer {
+public:
+  void begin() {}
+  MockClient accept() {
+    if (pending.empty())
+      return MockClient();
+    MockConnection *c = pending.front();
+    pending.pop_front();
+    return MockClient(c);
+  }
+
+  std::deque<MockConnection*> pending;
+};
+
+static bool contains(const std::string &s, const char *what) {
+  return s.find(what) != std::string::npos;
+}
+
+/* Does s consist of complete lines, each starting with prefix? */
+static bool complete_lines(const std::string &s, const char *prefix) {
+  size_t pos = 0;
+  while (pos < s.size()) {
+    size_t end = s.find("\r\n", pos);
+    if (end == std::string::npos || s.compare(pos, strlen(prefix), prefix) != 0)
+      return false;
+    pos = end + 2;
+  }
+  return true;
+}
+
+static std::string last_args;
+
+static void command_echo(char *args, CommandContext &ctx) {
+  last_args = args;
+  ctx.reply << F("OK") << "\r\n";
+}
+
+/* A reply longer than the client's buffer */
+static void command_lines(char *args, CommandContext &ctx) {
+  for (int i = 0; i < 10; ++i)
+    ctx.reply << F("reply line ") << i << "\r\n";
+  ctx.reply << F("OK") << "\r\n";
+}
+
+const char cmd_sub[] PROGMEM = "sub";
+const char cmd_filter[] PROGMEM = "filter";
+const char cmd_echo[] PROGMEM = "echo";
+const char cmd_echo_args[] PROGMEM = "<text>";
+const char cmd_lines[] PROGMEM = "lines";
+const char no_help[] PROGMEM = "";
+
+const Command commands[] PROGMEM = {
+  {cmd_sub, NULL, no_help, command_sub},
+  {cmd_filter, NULL, no_help, command_filter},
+  {cmd_echo, cmd_echo_args, no_help, command_echo},
+  {cmd_lines, NULL, no_help, command_lines},
+};
+
+static void handle_line(char *line, Print &reply, OutputFilter *filter) {
+  CommandContext ctx = {reply, filter};
+  run_command(commands, lengthof(commands), line, ctx);
+}
+
+static void send(MockConnection *c, const char *line) {
+  while (*line)
+    c->input.push_back(*line++);
+}
+
+typedef ClientServer<MockServer, MockClient, 3, 64> Clients;
+
+/* Print one line of every kind, as loop() would */
+static void print_all(OutputRouter &output, Clients &clients) {
+  Print &p = output;
+  output.select(OUTPUT_RAW, 0x123456, 0x000001);
+  p << F("raw 123456") << "\r\n";
+  output.select(OUTPUT_MESSAGES, 0x654321, 0x000001);
+  p << F("message 654321") << "\r\n";
+  output.select(OUTPUT_STATUS, 0x123456);
+  p << F("status 123456") << "\r\n";
+  output.select(OUTPUT_STATUS);
+  p << F("kettle") << "\r\n";
+  output.select(OUTPUT_TELEMETRY);
+  p << F("telemetry") << "\r\n";
+  clients.drain(1024);
+}
+
+static void test_routing() {
+  MockServer server;
+  OutputRouter output;
+  Clients clients(server, output, OverflowPolicy::DROP, OUTPUT_TEXT);
+  clients.begin();
+
+  MockConnection a, b, c, d;
+  server.pending.push_back(&a);
+  server.pending.push_back(&b);
+  server.pending.push_back(&c);
+  server.pending.push_back(&d);
+  for (int i = 0; i < 4; ++i)
+    clients.poll(handle_line);
+
+  check(clients.count() == 3, "three clients accepted");
+  check(d.stopped && contains(d.received, "Too many clients"), "fourth client refused");
+
+  send(&b, "sub st\r\n");
+  send(&c, "filter 123456\n");
+  clients.poll(handle_line);
+  clients.drain(1024);
+  check(contains(b.received, "OK st"), "sub reply");
+  check(contains(c.received, "OK"), "filter reply");
+  a.received.clear(); b.received.clear(); c.received.clear();
+
+  print_all(output, clients);
+
+  check(contains(a.received, "raw") && contains(a.received, "message")
+        && contains(a.received, "status") && !contains(a.received, "telemetry"),
+        "default subscription gets all text");
+  check(!contains(b.received, "raw") && !contains(b.received, "message")
+        && contains(b.received, "status") && contains(b.received, "kettle")
+        && contains(b.received, "telemetry"), "sub st gets status and telemetry");
+  check(contains(c.received, "raw 123456") && !contains(c.received, "message 654321")
+        && contains(c.received, "status 123456") && contains(c.received, "kettle"),
+        "address filter");
+
+  send(&a, "echo  a b\r\n");
+  clients.poll(handle_line);
+  clients.poll(handle_line);
+  check(last_args == "a b", "command arguments");
+
+  send(&a, "x\n");
+  clients.poll(handle_line);
+  clients.drain(1024);
+  check(contains(a.received, "ERR unknown command"), "unknown command refused");
+
+  send(&c, "filter 1234567\n");
+  clients.poll(handle_line);
+  clients.drain(1024);
+  check(contains(c.received, "ERR invalid address"), "bad address refused");
+
+  send(&a, "sub q\n");
+  clients.poll(handle_line);
+  clients.drain(1024);
+  check(contains(a.received, "ERR unknown level"), "bad level refused");
+
+  /* A reply longer than the buffer arrives complete, even when the
+   * client has no room to take it without waiting */
+  a.received.clear();
+  a.room = 0;
+  send(&a, "lines\n");
+  clients.poll(handle_line);
+  a.room = 2048;
+  clients.drain(1024);
+  check(contains(a.received, "reply line 0\r\n") && contains(a.received, "reply line 9\r\nOK\r\n")
+        && a.received.size() == 10 * 14 + 4, "long reply complete");
+
+  /* Disconnect, the slot should be reused with a fresh filter */
+  b.connected = false;
+  clients.poll(handle_line);
+  check(clients.count() == 2, "disconnected client dropped");
+  MockConnection e;
+  server.pending.push_back(&e);
+  clients.poll(handle_line);
+  print_all(output, clients);
+  check(clients.count() == 3 && contains(e.received, "raw"), "slot reused");
+}
+
+/* A client that takes nothing loses whole lines, the others don't */
+static void test_slow_client() {
+  MockServer server;
+  OutputRouter output;
+  Clients clients(server, output, OverflowPolicy::DROP, OUTPUT_TEXT);
+  clients.begin();
+
+  MockConnection a, b;
+  server.pending.push_back(&a);
+  server.pending.push_back(&b);
+  clients.poll(handle_line);
+  clients.poll(handle_line);
+
+  a.room = 0;
+  Print &p = output;
+  output.select(OUTPUT_STATUS);
+  for (int i = 0; i < 20; ++i) {
+    p << F("status line ") << i << "\r\n";
+    clients.drain(1024);
+  }
+  a.room = 2048;
+  clients.drain(1024);
+  check(a.received.size() <= 64, "slow client output bounded by its buffer");
+  check(contains(a.received, "status line 0"), "slow client gets what fits");
+  check(complete_lines(a.received, "status line "), "slow client gets no partial lines");
+  check(contains(b.received, "status line 19\r\n"), "other client gets everything");
+
+  /* Once drained, whole lines fit again */
+  a.received.clear();
+  p << F("status line 20") << "\r\n";
+  clients.drain(1024);
+  check(a.received == "status line 20\r\n", "slow client recovers");
+
+  /* A line longer than the buffer is written straight through when
+   * the client has room, and dropped as a whole when it hasn't */
+  std::string long_line(100, 'x');
+  a.received.clear();
+  p << F("status ") << long_line.c_str() << "\r\n";
+  clients.drain(1024);
+  check(a.received == "status " + long_line + "\r\n", "long line written through");
+  a.received.clear();
+  a.room = 0;
+  p << F("status ") << long_line.c_str() << "\r\n";
+  p << F("status short") << "\r\n";
+  a.room = 2048;
+  clients.drain(1024);
+  check(a.received == "status short\r\n", "long line dropped as a whole");
+}
+
+int main(int argc, char **argv) {
+  unsigned long lines = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': lines = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n lines]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  test_routing();
+  test_slow_client();
+
+  /* Cost of printing a status line to three clients with different
+   * filters, compared to a single Print */
+  MockServer server;
+  OutputRouter output;
+  Clients clients(server, output, OverflowPolicy::DROP, OUTPUT_TEXT);
+  clients.begin();
+  MockConnection conns[3];
+  for (int i = 0; i < 3; ++i)
+    server.pending.push_back(&conns[i]);
+  for (int i = 0; i < 3; ++i)
+    clients.poll(handle_line);
+  send(&conns[1], "filter 123456\n");
+  send(&conns[2], "sub t\n");
+  clients.poll(handle_line);
+
+  CountingPrint single;
+  uint64_t start = now_ns();
+  for (unsigned long i = 0; i < lines; ++i)
+    single << F("UPDATE\t") << i << F("\t123456\t20.5\t21.0\t30%") << "\r\n";
+  uint64_t single_ns = now_ns() - start;
+
+  Print &p = output;
+  start = now_ns();
+  for (unsigned long i = 0; i < lines; ++i) {
+    output.select(OUTPUT_STATUS, 0x654321);
+    p << F("UPDATE\t") << i << F("\t654321\t20.5\t21.0\t30%") << "\r\n";
+    for (int j = 0; j < 3; ++j)
+      conns[j].received.clear();
+    clients.drain(1024);
+  }
+  uint64_t routed_ns = now_ns() - start;
+
+  printf("single print:    %.1f ns/line\n", (double)single_ns / lines);
+  printf("three clients:   %.1f ns/line\n", (double)routed_ns / lines);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,126 @@
+/*
+ * Compare the CRC implementations from Crc.cpp, and separate
+ * dewhitening and CRC passes against the fused xor_pn9_crc.
+ *
+ * Usage: bench_crc [-n iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Bench.h"
+#include "Crc.h"
+#include "Pn9.h"
+
+typedef uint16_t (*crc_func)(const uint8_t *buf, size_t len);
+
+struct CrcImpl {
+  const char *name;
+  crc_func func;
+};
+
+static const CrcImpl impls[] = {
+  {"bitwise", calc_crc_bitwise},
+  {"nibble", calc_crc_nibble},
+  {"byte", calc_crc_byte},
+};
+
+/* Frame lengths to test with: a short ack, the fixed packet length
+ * used by MaxRF22, the end of the PN9 table and the longest frame. */
+static const size_t lengths[] = {11, 20, PN9_TABLE_LEN, MAX_FRAME_LEN - 1};
+
+/* Keep results alive, so the compiler doesn't optimize the work away */
+static volatile uint16_t result;
+
+int main(int argc, char **argv) {
+  unsigned long iterations = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': iterations = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  uint8_t data[MAX_FRAME_LEN - 1];
+  srand(1);
+  for (size_t i = 0; i < sizeof(data); ++i)
+    data[i] = rand();
+
+  /* Check that all implementations agree before timing them */
+  for (size_t len = 0; len <= sizeof(data); ++len) {
+    uint16_t expected = calc_crc_bitwise(data, len);
+    for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i) {
+      if (impls[i].func(data, len) != expected) {
+        fprintf(stderr, "%s: wrong CRC for length %zu\n", impls[i].name, len);
+        return 1;
+      }
+    }
+
+    if (len < 2)
+      continue;
+    uint8_t separate[sizeof(data)], fused[sizeof(data)];
+    uint16_t fused_crc;
+    memcpy(separate, data, len);
+    memcpy(fused, data, len);
+    xor_pn9(separate, len);
+    if (xor_pn9_crc(fused, len, &fused_crc) < 0
+        || memcmp(separate, fused, len) != 0
+        || fused_crc != calc_crc(separate, len - 2)) {
+      fprintf(stderr, "xor_pn9_crc: wrong result for length %zu\n", len);
+      return 1;
+    }
+  }
+
+  printf("calc_crc uses %s\n\n", CRC_IMPL == CRC_BYTE ? "byte" :
+                                 CRC_IMPL == CRC_NIBBLE ? "nibble" : "bitwise");
+
+  printf("%-24s", "ns/frame");
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l)
+    printf(" %8zu B", lengths[l]);
+  printf("\n");
+
+  for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i) {
+    printf("%-24s", impls[i].name);
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+      uint64_t start = now_ns();
+      for (unsigned long n = 0; n < iterations; ++n) {
+        data[0] = n;
+        result = impls[i].func(data, lengths[l]);
+      }
+      printf(" %10.1f", (double)(now_ns() - start) / iterations);
+    }
+    printf("\n");
+  }
+
+  printf("%-24s", "xor_pn9 + calc_crc");
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+    uint64_t start = now_ns();
+    for (unsigned long n = 0; n < iterations; ++n) {
+      xor_pn9(data, lengths[l]);
+      result = calc_crc(data, lengths[l] - 2);
+    }
+    printf(" %10.1f", (double)(now_ns() - start) / iterations);
+  }
+  printf("\n");
+
+  printf("%-24s", "xor_pn9_crc");
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+    uint64_t start = now_ns();
+    for (unsigned long n = 0; n < iterations; ++n) {
+      uint16_t crc;
+      xor_pn9_crc(data, lengths[l], &crc);
+      result = crc;
+    }
+    printf(" %10.1f", (double)(now_ns() - start) / iterations);
+  }
+  printf("\n");
+
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,209 @@
+/*
+ * Compare DeviceTable lookups against the linear scan get_device()
+ * used before, at various table sizes, and check that eviction leaves
+ * thermostats alone until they go silent, and that forgetting a device
+ * keeps the others in order.
+ *
+ * Usage: bench_devices [-n lookups]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "Bench.h"
+#include "DeviceTable.h"
+
+/* The linear scan from the original get_device() */
+static Device *linear_get(Device *devices, size_t size, uint32_t addr, DeviceType type) {
+  for (size_t i = 0; i < size; ++i) {
+    /* The address is not in the list yet, assign this empty slot. */
+    if (devices[i].address == 0 && addr != 0) {
+      devices[i].address = addr;
+      devices[i].type = type;
+      devices[i].name = NULL;
+    }
+    /* Found it */
+    if (devices[i].address == addr)
+      return &devices[i];
+  }
+  /* Not found and no slots left */
+  return NULL;
+}
+
+/* Keep results alive, so the compiler doesn't optimize the work away */
+static Device * volatile result;
+
+static bool bench(uint16_t size, unsigned long lookups) {
+  std::vector<Device> table_devices(size), linear_devices(size);
+  std::vector<uint8_t> index(size);
+  DeviceTable table(table_devices.data(), index.data(), size, true);
+
+  /* Fill both tables with the same devices */
+  std::vector<uint32_t> addrs;
+  while (addrs.size() < size) {
+    uint32_t addr = random_addr();
+    if (table.find(addr))
+      continue;
+    /* Not thermostats, so they can be evicted */
+    table.get(addr, DeviceType::CUBE);
+    linear_get(linear_devices.data(), size, addr, DeviceType::CUBE);
+    addrs.push_back(addr);
+  }
+
+  /* Check that both find the same devices, including some unknown
+   * addresses */
+  for (size_t i = 0; i < 4096; ++i) {
+    uint32_t addr = (i % 8 == 7) ? random_addr() : addrs[rand() % addrs.size()];
+    Device *a = table.find(addr);
+    Device *b = linear_get(linear_devices.data(), size, addr, DeviceType::UNKNOWN);
+    if ((a == NULL) != (b == NULL) || (a && a->address != b->address)) {
+      fprintf(stderr, "%u devices: lookup of %06x differs\n", size, addr);
+      return false;
+    }
+  }
+
+  /* Time lookups of known devices, like for most messages */
+  std::vector<uint32_t> queries(4096);
+  for (size_t i = 0; i < queries.size(); ++i)
+    queries[i] = addrs[rand() % addrs.size()];
+
+  uint64_t start = now_ns();
+  for (unsigned long n = 0; n < lookups; ++n)
+    result = linear_get(linear_devices.data(), size, queries[n % queries.size()], DeviceType::UNKNOWN);
+  double linear_ns = (double)(now_ns() - start) / lookups;
+
+  start = now_ns();
+  for (unsigned long n = 0; n < lookups; ++n)
+    result = table.find(queries[n % queries.size()]);
+  double find_ns = (double)(now_ns() - start) / lookups;
+
+  start = now_ns();
+  for (unsigned long n = 0; n < lookups; ++n)
+    result = table.get(queries[n % queries.size()], DeviceType::UNKNOWN);
+  double get_ns = (double)(now_ns() - start) / lookups;
+
+  /* Time adding new devices to a full table, which evicts one each time */
+  unsigned long adds = lookups / 100;
+  start = now_ns();
+  for (unsigned long n = 0; n < adds; ++n) {
+    uint32_t addr;
+    do {
+      addr = random_addr();
+    } while (table.find(addr));
+    result = table.get(addr, DeviceType::UNKNOWN);
+  }
+  double evict_ns = (double)(now_ns() - start) / adds;
+
+  if (table.evictions != adds || table.count() != size) {
+    fprintf(stderr, "%u devices: expected %lu evictions, got %u\n", size, adds, table.evictions);
+    return false;
+  }
+
+  printf("%8u %12.1f %12.1f %12.1f %14.1f\n", size, linear_ns, find_ns, get_ns, evict_ns);
+  return true;
+}
+
+/* Thermostats keep their slot (and STATUS column), only other devices
+ * are evicted, and without those the table is full */
+static bool test_thermostats_kept() {
+  const uint16_t size = 4;
+  std::vector<Device> devices(size);
+  std::vector<uint8_t> index(size);
+  DeviceTable table(devices.data(), index.data(), size, true);
+  table.get(0x000001, DeviceType::RADIATOR);
+  table.get(0x000002, DeviceType::WALL);
+  table.get(0x000003, DeviceType::UNKNOWN);
+  table.get(0x000004, DeviceType::RADIATOR);
+
+  bool ok = table.get(0x000005, DeviceType::UNKNOWN) == &devices[2];
+  /* Once it turns out to be a thermostat too, nothing can go */
+  table.get(0x000005, DeviceType::RADIATOR);
+  ok = ok && !table.get(0x000006, DeviceType::UNKNOWN) && table.full == 1;
+  ok = ok && devices[0].address == 1 && devices[1].address == 2 && devices[3].address == 4;
+  if (!ok)
+    fprintf(stderr, "eviction of thermostats\n");
+  return ok;
+}
+
+/* A thermostat that went silent is evicted after all */
+static bool test_silent_thermostat() {
+  const uint16_t size = 3;
+  std::vector<Device> devices(size);
+  std::vector<uint8_t> index(size);
+  DeviceTable table(devices.data(), index.data(), size, true, 60);
+  set_simulated_time(1000);
+  table.get(0x000001, DeviceType::RADIATOR);
+  table.get(0x000002, DeviceType::WALL);
+  table.get(0x000003, DeviceType::RADIATOR);
+
+  /* The others keep reporting, the first one was removed */
+  set_simulated_time(59 * 60 * 1000000ULL);
+  table.get(0x000002, DeviceType::WALL);
+  table.get(0x000003, DeviceType::RADIATOR);
+  bool ok = !table.get(0x000004, DeviceType::RADIATOR);
+  set_simulated_time(61 * 60 * 1000000ULL);
+  ok = ok && table.get(0x000004, DeviceType::RADIATOR) == &devices[0];
+  ok = ok && !table.find(0x000001) && table.find(0x000002) == &devices[1];
+  /* The other two were seen two minutes ago */
+  ok = ok && !table.get(0x000005, DeviceType::RADIATOR) && table.evictions == 1;
+  if (!ok)
+    fprintf(stderr, "eviction of silent thermostats\n");
+  return ok;
+}
+
+/* Forgetting a device moves the ones after it up, still found by
+ * address, and frees a slot at the end */
+static bool test_forget() {
+  const uint16_t size = 4;
+  std::vector<Device> devices(size);
+  std::vector<uint8_t> index(size);
+  DeviceTable table(devices.data(), index.data(), size, false);
+  table.get(0x000040, DeviceType::RADIATOR);
+  table.get(0x000010, DeviceType::WALL);
+  table.get(0x000030, DeviceType::RADIATOR);
+  table.get(0x000020, DeviceType::CUBE);
+  devices[3].name = "cube";
+
+  bool ok = table.forget(0x000010) && !table.forget(0x000010) && table.count() == 3;
+  ok = ok && devices[0].address == 0x40 && devices[1].address == 0x30 &&
+       devices[2].address == 0x20 && devices[3].address == 0;
+  ok = ok && table.find(0x000040) == &devices[0] && table.find(0x000030) == &devices[1] &&
+       table.find(0x000020) == &devices[2] && !table.find(0x000010);
+  /* Configured devices stay */
+  ok = ok && !table.forget(0x000020) && table.count() == 3;
+  ok = ok && table.get(0x000050, DeviceType::WALL) == &devices[3] && table.find(0x000050);
+  if (!ok)
+    fprintf(stderr, "forgetting a device\n");
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  unsigned long lookups = 2000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': lookups = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n lookups]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  srand(1);
+  if (!test_thermostats_kept() || !test_silent_thermostat() || !test_forget())
+    return 1;
+  printf("%8s %12s %12s %12s %14s\n", "devices", "linear ns", "find ns", "get ns", "evict+add ns");
+  static const uint16_t sizes[] = {8, 64, 256};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); ++i)
+    if (!bench(sizes[i], lookups))
+      return 1;
+
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,181 @@
+/*
+ * Check AddressFilter against a std::set, check that frames the filter
+ * rejects are dropped (like loop() does, before parsing) without taking
+ * up a device slot, and time handling frames from other systems with
+ * and without the filter.
+ *
+ * Usage: bench_filter [-n frames]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <set>
+#include <vector>
+
+#include "Bench.h"
+#include "AddressFilter.h"
+#include "DeviceTable.h"
+#include "MaxRFProto.h"
+#include "Pn9.h"
+
+static void test_membership() {
+  uint32_t storage[16];
+  AddressFilter filter(storage, 16, 0);
+  std::set<uint32_t> ref;
+
+  check(!filter.active() && filter.check(1, 2, 0), "empty filter accepts all");
+  check(!filter.add(0), "broadcast can't be added");
+
+  for (unsigned i = 0; i < 100000; ++i) {
+    /* Small address range, so adds and removes hit */
+    uint32_t addr = 1 + rand() % 40;
+    if (rand() % 2) {
+      bool room = ref.size() < 16 || ref.count(addr);
+      check(filter.add(addr) == room, "add");
+      if (room)
+        ref.insert(addr);
+    } else {
+      check(filter.remove(addr) == (ref.count(addr) > 0), "remove");
+      ref.erase(addr);
+    }
+    uint32_t q = rand() % 42;
+    check(filter.contains(q) == (ref.count(q) > 0), "contains");
+  }
+
+  check(filter.count() == ref.size(), "count");
+  uint8_t i = 0;
+  for (std::set<uint32_t>::iterator it = ref.begin(); it != ref.end(); ++it)
+    check(filter.at(i++) == *it, "sorted");
+
+  filter.clear();
+  filter.add(0x00b825);
+  filter.rejected = 0;
+  check(filter.check(0x00b825, 0x123456, 0), "from allowed");
+  check(filter.check(0x123456, 0x00b825, 0), "to allowed");
+  check(!filter.check(0x123456, 0, 0), "foreign broadcast rejected");
+  check(!filter.check(0x123456, 0x654321, 5), "foreign group rejected");
+  filter.group_id = 5;
+  check(filter.check(0x123456, 0x654321, 5), "group allowed");
+  check(!filter.check(0x123456, 0x654321, 0), "group 0 is no group");
+  check(filter.rejected == 3, "rejected counted");
+
+  /* Denying the last address leaves the filter on */
+  filter.clear();
+  filter.add(0x00b825);
+  check(filter.remove(0x00b825) && filter.active(), "active after the last deny");
+  check(!filter.check(0x00b825, 0x123456, 0), "empty active filter rejects");
+  filter.clear();
+  check(!filter.active() && filter.check(0x123456, 0, 0), "inactive after clear");
+  uint32_t group_storage[1];
+  AddressFilter group_only(group_storage, 1, 7);
+  check(group_only.active() && group_only.check(1, 2, 7) && !group_only.check(1, 2, 0),
+        "group only");
+}
+
+/* Messages (header and payload) from the corpus */
+static std::vector<std::vector<uint8_t> > corpus_messages() {
+  std::vector<Frame> frames = builtin_corpus();
+  std::vector<std::vector<uint8_t> > msgs;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    Frame &f = frames[i];
+    xor_pn9(f.data, f.len);
+    msgs.push_back(std::vector<uint8_t>(f.data + 1, f.data + f.len - 2));
+  }
+  return msgs;
+}
+
+/* Make a message look like it is from another system */
+static void make_foreign(std::vector<uint8_t> &msg) {
+  HeaderLayout::addr_from::set(msg.data(), random_addr() | 0x800000);
+  HeaderLayout::addr_to::set(msg.data(), rand() % 2 ? random_addr() | 0x800000 : 0);
+  HeaderLayout::group_id::set(msg.data(), 0);
+}
+
+/* Filter and parse a message like loop(), returns whether it was
+ * accepted */
+static bool parse(std::vector<uint8_t> &msg) {
+  static MaxRFMessageBuffer storage;
+  const uint8_t *h = msg.data();
+  if (msg.size() >= HeaderLayout::LEN &&
+      !address_filter.check(HeaderLayout::addr_from::get(h), HeaderLayout::addr_to::get(h),
+                            HeaderLayout::group_id::get(h)))
+    return false;
+  MaxRFMessage *m = MaxRFMessage::parse(msg.data(), msg.size(), &storage);
+  if (!m)
+    return false;
+  m->~MaxRFMessage();
+  return true;
+}
+
+static double time_parse(std::vector<std::vector<uint8_t> > &msgs, unsigned long n) {
+  uint64_t start = now_ns();
+  for (unsigned long i = 0; i < n; ++i)
+    parse(msgs[i % msgs.size()]);
+  return (double)(now_ns() - start) / n;
+}
+
+static void test_parse(unsigned long n) {
+  std::vector<std::vector<uint8_t> > own = corpus_messages();
+  std::vector<std::vector<uint8_t> > foreign;
+  for (unsigned i = 0; i < 1000; ++i) {
+    foreign.push_back(own[i % own.size()]);
+    make_foreign(foreign.back());
+  }
+
+  /* Some corpus messages are invalid anyway */
+  address_filter.clear();
+  std::vector<bool> valid;
+  for (size_t i = 0; i < own.size(); ++i)
+    valid.push_back(parse(own[i]));
+
+  /* Allow the devices of our own system, up to the filter size */
+  for (size_t i = 0; i < own.size(); ++i) {
+    address_filter.add(HeaderLayout::addr_from::get(own[i].data()));
+    address_filter.add(HeaderLayout::addr_to::get(own[i].data()));
+  }
+  while (address_filter.count() < address_filter.size())
+    address_filter.add(random_addr() & 0x7fffff);
+
+  address_filter.rejected = 0;
+  for (size_t i = 0; i < own.size(); ++i)
+    check(parse(own[i]) == valid[i], "own message accepted");
+  check(address_filter.rejected == 0, "nothing of our own rejected");
+  uint16_t devices = device_table.count();
+  for (size_t i = 0; i < foreign.size(); ++i)
+    check(!parse(foreign[i]), "foreign message rejected");
+  check(address_filter.rejected == foreign.size(), "rejected counted");
+  check(device_table.count() == devices, "no device slots taken");
+
+  double filtered_ns = time_parse(foreign, n);
+  /* Without the filter, device slots are evicted and reused, which is
+   * part of the cost */
+  address_filter.clear();
+  double unfiltered_ns = time_parse(foreign, n);
+  printf("filter:          %u addresses\n", address_filter.size());
+  printf("foreign frame:   %.1f ns (filtered), %.1f ns (unfiltered)\n",
+         filtered_ns, unfiltered_ns);
+  printf("evictions:       %u\n", device_table.evictions);
+}
+
+int main(int argc, char **argv) {
+  unsigned long n = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': n = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n frames]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  srand(1);
+  test_membership();
+  test_parse(n);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,212 @@
+/*
+ * Check that HistoryRing returns exactly the newest samples it was
+ * given, within its fixed size, and report how many samples (and hours
+ * at the sketch's HISTORY_INTERVAL) fit in it for typical traces.
+ *
+ * Traces are generated for a radiator and a wall thermostat, or read
+ * from a file of STATUS lines as printed by the sketch (the columns of
+ * the first device, or the one given with -d), like
+ * fixtures/status.txt. A trace from a file should take less room
+ * compressed than it would as plain samples, which is checked.
+ *
+ * Usage: bench_history [-d device] [status file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Bench.h"
+#include "History.h"
+#include "MaxRFProto.h"
+
+const unsigned long INTERVAL = 5 * 60 * 1000UL;
+const unsigned DAYS = 3;
+const unsigned SAMPLES = DAYS * 24 * 60 * 60 * 1000UL / INTERVAL;
+
+typedef std::vector<HistorySample> Trace;
+
+static HistorySample sample(uint16_t actual, uint8_t set, uint8_t valve) {
+  HistorySample s = {actual, set, valve};
+  return s;
+}
+
+/*
+ * A room heated to 21° during the day and 17° at night. The actual
+ * temperature creeps towards the set temperature (the radiator reports
+ * it with some jitter), the valve opens in proportion to the
+ * difference. A wall thermostat reports no valve position.
+ */
+static Trace room_trace(bool radiator, unsigned seed) {
+  Trace t;
+  srand(seed);
+  double temp = 18.0;
+  for (unsigned i = 0; i < SAMPLES; ++i) {
+    unsigned hour = i * INTERVAL / (60 * 60 * 1000UL) % 24;
+    uint8_t set = (hour >= 7 && hour < 23) ? 42 : 34;
+    double diff = set / 2.0 - temp;
+    double valve = diff > 0 ? diff * 40 : 0;
+    if (valve > 100)
+      valve = 100;
+    temp += valve / 2000 - 0.01 + (rand() % 3 - 1) * 0.02;
+    uint16_t actual = (uint16_t)(temp * 10);
+    if (radiator)
+      t.push_back(sample(actual, set, (uint8_t)valve));
+    else
+      t.push_back(sample(actual, set, VALVE_UNKNOWN));
+  }
+  return t;
+}
+
+/* Noise, the worst case for the compression */
+static Trace random_trace(unsigned seed) {
+  Trace t;
+  srand(seed);
+  for (unsigned i = 0; i < SAMPLES; ++i)
+    t.push_back(sample(rand() % 2 ? ACTUAL_TEMP_UNKNOWN : rand() % 400,
+                       rand() % 64, rand() % 8 ? rand() % 101 : VALVE_UNKNOWN));
+  return t;
+}
+
+/* Parse a value as printed in a STATUS line */
+static bool parse_value(const char *str, unsigned scale, unsigned unknown, unsigned *value) {
+  if (!strcmp(str, "NA")) {
+    *value = unknown;
+    return true;
+  }
+  char *end;
+  double v = strtod(str, &end);
+  if (end == str)
+    return false;
+  *value = (unsigned)(v * scale + 0.5);
+  return true;
+}
+
+/* Read the columns of one device from STATUS lines, resampled to
+ * INTERVAL */
+static bool load_status(const char *filename, unsigned device, Trace *t) {
+  FILE *f = fopen(filename, "r");
+  if (!f)
+    return false;
+
+  char line[1024];
+  unsigned long next = 0;
+  bool have_first = false;
+  HistorySample state = {};
+  while (fgets(line, sizeof(line), f)) {
+    std::vector<char*> cols;
+    for (char *c = strtok(line, "\t\r\n"); c; c = strtok(NULL, "\t\r\n"))
+      cols.push_back(c);
+    if (cols.size() < 2 + 3 * (device + 1) || strcmp(cols[0], "STATUS"))
+      continue;
+
+    unsigned long time = strtoul(cols[1], NULL, 10);
+    unsigned actual, set, valve;
+    char **c = &cols[2 + 3 * device];
+    if (!parse_value(c[0], 10, ACTUAL_TEMP_UNKNOWN, &actual) ||
+        !parse_value(c[1], 2, SET_TEMP_UNKNOWN, &set) ||
+        !parse_value(c[2], 1, VALVE_UNKNOWN, &valve))
+      continue;
+
+    if (!have_first) {
+      next = time;
+      have_first = true;
+    }
+    /* Samples taken before this line see the previous state, like
+     * the sketch would */
+    for (; next < time; next += INTERVAL)
+      t->push_back(state);
+    state = sample(actual, set, valve);
+  }
+  fclose(f);
+  return true;
+}
+
+/*
+ * Feed a trace into a ring, checking after every sample that it still
+ * holds the newest samples in order. Returns the number of samples it
+ * held at the end.
+ */
+template <uint8_t SIZE>
+static unsigned run(const Trace &trace) {
+  HistoryRing<SIZE> ring;
+  memset(&ring, 0, sizeof(ring));
+  for (size_t i = 0; i < trace.size(); ++i) {
+    ring.add(trace[i]);
+    check(ring.bytes() <= SIZE, "within size");
+
+    /* Checking everything every time is slow, so only now and then */
+    if (i % 37 && i != trace.size() - 1)
+      continue;
+    HistoryCursor c = {};
+    size_t n = 0;
+    size_t first = i + 1 - ring.samples();
+    while (ring.next(c)) {
+      if (!(c.sample == trace[first + n])) {
+        check(false, "samples match");
+        break;
+      }
+      ++n;
+    }
+    check(n == ring.samples(), "sample count");
+  }
+  return ring.samples();
+}
+
+template <uint8_t SIZE>
+static void report(const char *name, const Trace &trace, bool compresses) {
+  unsigned samples = run<SIZE>(trace);
+  if (compresses && samples < trace.size())
+    check(samples * sizeof(HistorySample) > sizeof(HistoryRing<SIZE>), "compressed");
+  printf("%-10s %3u bytes: %5u samples, %5.1f hours, %4.1fx smaller\n",
+         name, (unsigned)sizeof(HistoryRing<SIZE>), samples,
+         (double)samples * INTERVAL / (60 * 60 * 1000UL),
+         (double)samples * sizeof(HistorySample) / sizeof(HistoryRing<SIZE>));
+}
+
+static void report_all(const char *name, const Trace &trace, bool compresses = false) {
+  report<16>(name, trace, compresses);
+  report<32>(name, trace, compresses);
+  report<64>(name, trace, compresses);
+  report<255>(name, trace, compresses);
+}
+
+int main(int argc, char **argv) {
+  unsigned device = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:")) != -1) {
+    switch (opt) {
+      case 'd': device = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-d device] [status file]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  /* Empty and all zero are the same thing */
+  HistoryRing<8> empty;
+  memset(&empty, 0, sizeof(empty));
+  HistoryCursor c = {};
+  check(empty.samples() == 0 && !empty.next(c), "zeroed ring is empty");
+
+  if (optind < argc) {
+    Trace t;
+    if (!load_status(argv[optind], device, &t) || t.empty()) {
+      fprintf(stderr, "No STATUS lines for device %u in %s\n", device, argv[optind]);
+      return 1;
+    }
+    report_all("recorded", t, true);
+  } else {
+    Trace stable(SAMPLES, sample(205, 42, 0));
+    report_all("stable", stable);
+    report_all("radiator", room_trace(true, 1));
+    report_all("wall", room_trace(false, 2));
+    report_all("random", random_trace(3));
+  }
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
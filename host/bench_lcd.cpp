@@ -0,0 +1,191 @@
+/*
+ * Compare redrawing the LCD from scratch for every update (clear and
+ * print everything, as updateLcd() used to) against drawing through an
+ * LcdBuffer, which sends only the changes, by counting the bytes sent
+ * to a mock LCD. Also checks that both leave the same text on the
+ * display.
+ *
+ * Usage: bench_lcd [-n updates] [-d devices]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <TStreaming.h>
+
+#include "Bench.h"
+#include "Util.h"
+#include "LcdBuffer.h"
+#include "MaxRFProto.h"
+
+const uint8_t COLS = 20;
+const uint8_t ROWS = 4;
+
+/* Rough cost of a byte sent to a LiquidCrystal_I2C display at 100kHz:
+ * two nibbles of three I2C writes each. Clearing takes an extra 2ms. */
+const unsigned US_PER_BYTE = 1200;
+const unsigned US_PER_CLEAR = 2000;
+
+/**
+ * Stands in for LiquidCrystal_I2C, counting what is sent to it and
+ * keeping the resulting display contents.
+ */
+class MockLcd : public Print {
+public:
+  MockLcd() : data(0), commands(0), clears(0) { clear(); }
+
+  void clear() {
+    memset(screen, ' ', sizeof(screen));
+    col = row = 0;
+    commands++;
+    clears++;
+  }
+
+  void home() {
+    col = row = 0;
+    commands++;
+  }
+
+  void setCursor(uint8_t c, uint8_t r) {
+    col = c;
+    row = r;
+    commands++;
+  }
+
+  virtual size_t write(uint8_t c) {
+    data++;
+    if (row < ROWS && col < COLS)
+      screen[row][col++] = c;
+    return 1;
+  }
+
+  uint64_t bytes() const { return data + commands; }
+  uint64_t us() const { return bytes() * US_PER_BYTE + clears * US_PER_CLEAR; }
+
+  uint8_t screen[ROWS][COLS];
+  uint8_t col, row;
+  uint64_t data, commands, clears;
+};
+
+/* Draw the display contents like updateLcd() in the sketch */
+template <typename LCD>
+static void draw(LCD &lcd, bool kettle_status) {
+  int row = ROWS - 1;
+  lcd.clear();
+  /* The top row shows the kettle */
+  for (size_t i = 0; i < lengthof(devices) && row >= 1; ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
+
+    lcd.setCursor(0, row--);
+
+    if (d->name)
+      lcd << d->name;
+    else
+      lcd << V<HexBits<16>>(d->address);
+
+    lcd << " " << V<ActualTemp>(d->actual_temp)
+        << "/" << V<SetTemp>(d->set_temp);
+    if (d->type == DeviceType::RADIATOR)
+      lcd << " " << V<ValvePos>(d->data.radiator.valve_pos);
+  }
+
+  lcd.home();
+  lcd << F("Kettle: ") << (kettle_status ? F("On") : F("Off"));
+}
+
+static const char *names[] = {"up  ", NULL, "down", "wall"};
+
+static void setup_devices(unsigned num) {
+  memset(devices, 0, sizeof(devices));
+  for (unsigned i = 0; i < num; ++i) {
+    Device *d = &devices[i];
+    d->address = 0x010000 + i * 0x1111;
+    d->name = names[i % lengthof(names)];
+    d->type = (i % 4 == 3) ? DeviceType::WALL : DeviceType::RADIATOR;
+    d->set_temp = 40;
+    d->actual_temp = 200;
+    d->data.radiator.valve_pos = 0;
+  }
+}
+
+/* Change one field of one device, like a received packet would */
+static void random_update(unsigned num, bool *kettle_status) {
+  Device *d = &devices[rand() % num];
+  switch (rand() % 4) {
+    case 0:
+      d->set_temp = 30 + rand() % 15;
+      break;
+    case 1:
+      d->actual_temp += rand() % 5 - 2;
+      break;
+    case 2:
+      if (d->type == DeviceType::RADIATOR)
+        d->data.radiator.valve_pos = rand() % 65;
+      break;
+    case 3:
+      *kettle_status = !*kettle_status;
+      break;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long updates = 10000;
+  unsigned num = 3;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+    switch (opt) {
+      case 'n': updates = strtoul(optarg, NULL, 0); break;
+      case 'd': num = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n updates] [-d devices]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (num < 1 || num > lengthof(devices) || updates < 1) {
+    fprintf(stderr, "Need 1 to %zu devices and at least one update\n", lengthof(devices));
+    return 1;
+  }
+
+  srand(1);
+  setup_devices(num);
+
+  MockLcd full, diffed;
+  LcdBuffer<MockLcd, COLS, ROWS> buf(diffed);
+  bool kettle_status = false;
+  uint64_t max_full = 0, max_diffed = 0;
+
+  for (unsigned long i = 0; i < updates; ++i) {
+    random_update(num, &kettle_status);
+
+    uint64_t before = full.bytes();
+    draw(full, kettle_status);
+    if (full.bytes() - before > max_full)
+      max_full = full.bytes() - before;
+
+    before = diffed.bytes();
+    draw(buf, kettle_status);
+    buf.flush();
+    if (diffed.bytes() - before > max_diffed)
+      max_diffed = diffed.bytes() - before;
+
+    if (memcmp(full.screen, diffed.screen, sizeof(full.screen))) {
+      fprintf(stderr, "Display contents differ after update %lu\n", i);
+      return 1;
+    }
+  }
+
+  printf("%lu updates, %u devices, ~%u us per byte sent\n", updates, num, US_PER_BYTE);
+  printf("%-8s %10s %10s %10s %10s\n", "redraw", "bytes/upd", "max bytes", "cmds/upd", "ms/upd");
+  printf("%-8s %10.1f %10llu %10.1f %10.2f\n", "full",
+         (double)full.bytes() / updates, (unsigned long long)max_full,
+         (double)full.commands / updates, full.us() / 1000.0 / updates);
+  printf("%-8s %10.1f %10llu %10.1f %10.2f\n", "diffed",
+         (double)diffed.bytes() / updates, (unsigned long long)max_diffed,
+         (double)diffed.commands / updates, diffed.us() / 1000.0 / updates);
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
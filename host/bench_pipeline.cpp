@@ -0,0 +1,141 @@
+/*
+ * Replay raw frames through the receive pipeline of the sketch and
+ * report throughput and time spent per stage. Frames are received by
+ * MaxRF22 from the simulated radio (see arduino/RF22.h), so they are
+ * dewhitened and checked in place by its interrupt handler, and then
+ * go through FrameHandler, like in loop() in Max.ino. The stages are
+ * timed by LoopStats, like "stats" on the board shows them.
+ *
+ * Usage: bench_pipeline [-n iterations] [-r copies] [-v] [corpus file]
+ *   -r  receive every frame this many times in a row, like a device
+ *       retransmitting it (the copies should be caught as duplicates)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <TStreaming.h>
+
+#include "Bench.h"
+#include "FrameHandler.h"
+#include "LoopStats.h"
+#include "MaxRF22.h"
+#include "Output.h"
+
+const uint8_t RSSI = 0x5a;
+
+/**
+ * Receive a single frame and handle it like loop() does, as if received
+ * at time now (in ms).
+ */
+static void process(MaxRF22 &rf, FrameHandler &handler, LoopStats &stats,
+                    const Frame &f, unsigned long now) {
+  MaxRFFrame frame;
+  stats.start();
+  rf.airReceive(f.data, f.len, RSSI);
+  if (!rf.recvFrame(&frame))
+    return;
+  frame.time = now;
+  stats.done(STAGE_RECV);
+  handler.handle(&frame);
+}
+
+int main(int argc, char **argv) {
+  unsigned long iterations = 100000;
+  unsigned long copies = 1;
+  bool verbose = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:r:v")) != -1) {
+    switch (opt) {
+      case 'n': iterations = strtoul(optarg, NULL, 0); break;
+      case 'r': copies = strtoul(optarg, NULL, 0); break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations] [-r copies] [-v] [corpus file]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<Frame> frames;
+  if (optind < argc) {
+    if (!load_corpus(argv[optind], &frames)) {
+      perror(argv[optind]);
+      return 1;
+    }
+  } else {
+    frames = builtin_corpus();
+  }
+
+  if (frames.empty()) {
+    fprintf(stderr, "No frames to replay\n");
+    return 1;
+  }
+
+  if (copies < 1) {
+    fprintf(stderr, "Need at least one copy\n");
+    return 1;
+  }
+
+  MaxRF22 rf;
+  rf.init();
+
+  /* All text output, like the serial port gets by default */
+  StdoutPrint out;
+  CountingPrint sink;
+  OutputFilter out_filter = {0, 0};
+  OutputFilter sink_filter = {0, 0};
+  OutputRouter output;
+  output.add(&out, &out_filter);
+  output.add(&sink, &sink_filter);
+
+  LoopStats stats;
+  FrameHandler handler(output, stats);
+
+  /* The corpus is replayed over and over, so pretend that every round
+   * happens after the duplicate window expired. The copies of a frame
+   * are received within the window. */
+  unsigned long now = 0;
+
+  if (verbose) {
+    out_filter.levels = OUTPUT_TEXT;
+    for (size_t i = 0; i < frames.size(); ++i)
+      for (unsigned long k = 0; k < copies; ++k)
+        process(rf, handler, stats, frames[i], now);
+    out_filter.levels = 0;
+    now += DUPLICATE_WINDOW;
+  }
+
+  sink_filter.levels = OUTPUT_TEXT;
+  stats.reset();
+  handler.duplicates.duplicates = 0;
+  rf.resetRxStats();
+  uint64_t start = now_ns();
+  for (unsigned long i = 0; i < iterations; ++i, now += DUPLICATE_WINDOW)
+    for (size_t j = 0; j < frames.size(); ++j)
+      for (unsigned long k = 0; k < copies; ++k)
+        process(rf, handler, stats, frames[j], now);
+  uint64_t total_ns = now_ns() - start;
+
+  printf("corpus:          %zu frames\n", frames.size());
+  printf("frames:          %lu (%u dropped)\n", (unsigned long)stats.frames, rf.rxOverflows());
+  printf("invalid length:  %lu\n", (unsigned long)stats.invalid_length);
+  printf("crc errors:      %lu\n", (unsigned long)stats.crc_errors);
+  printf("parse failures:  %lu\n", (unsigned long)stats.parse_failures);
+  printf("duplicates:      %lu\n", (unsigned long)handler.duplicates.duplicates);
+  printf("output bytes:    %.1f per frame\n", (double)sink.count / stats.frames);
+  printf("throughput:      %.0f frames/sec (%.1f ns/frame)\n",
+         stats.frames * 1e9 / total_ns, (double)total_ns / stats.frames);
+
+  /* LoopStats counts whole microseconds, which averages out over many
+   * frames. recv includes the simulated radio. */
+  printf("\n%-18s %12s\n", "stage", "ns/frame");
+  for (int i = STAGE_RECV; i < STAGE_KETTLE; ++i)
+    printf("%-18s %12.1f\n", (const char*)LoopStats::stage_to_str((Stage)i),
+           stats.timing[i].total * 1000.0 / stats.frames);
+
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
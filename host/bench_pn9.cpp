@@ -0,0 +1,157 @@
+/*
+ * Check the PN9 implementations against a bit-at-a-time reference
+ * generator (like the python snippet in Pn9.cpp) and compare their
+ * speed: the table-only xor_pn9 from before (limited to PN9_TABLE_LEN
+ * bytes), xor_pn9 with its table prefix and LFSR continuation, the LFSR
+ * alone and the host-only word-at-a-time variant.
+ *
+ * Usage: bench_pn9 [-n iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Bench.h"
+#include "Pn9.h"
+#include "Pn9Wide.h"
+
+/* Clock the LFSR one bit at a time */
+static void reference_pn9(uint8_t *out, size_t len) {
+  uint16_t state = PN9_INIT;
+  for (size_t i = 0; i < len; ++i) {
+    out[i] = state & 0xff;
+    for (int j = 0; j < 8; ++j)
+      state = (state >> 1) | (((state & 1) ^ ((state >> 5) & 1)) << 8);
+  }
+}
+
+/* xor_pn9 as it was, using only the table */
+static void table_pn9(uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; ++i)
+    buf[i] ^= pgm_read_byte(&pn9_table[i]);
+}
+
+/* The LFSR, without the table */
+static void lfsr_pn9(uint8_t *buf, size_t len) {
+  uint16_t state = PN9_INIT;
+  for (size_t i = 0; i < len; ++i) {
+    buf[i] ^= state;
+    state = pn9_next(state);
+  }
+}
+
+static void xor_pn9_void(uint8_t *buf, size_t len) {
+  xor_pn9(buf, len);
+}
+
+/* Generate the sequence by whitening zeroes */
+static bool check(const char *name, void (*func)(uint8_t *, size_t),
+                  const uint8_t *expected, size_t len) {
+  uint8_t buf[2 * PN9_PERIOD];
+  for (size_t l = 0; l <= len; ++l) {
+    memset(buf, 0, l);
+    func(buf, l);
+    if (memcmp(buf, expected, l)) {
+      fprintf(stderr, "%s: wrong sequence for length %zu\n", name, l);
+      return false;
+    }
+  }
+  return true;
+}
+
+static const struct {
+  const char *name;
+  void (*func)(uint8_t *, size_t);
+  /* Longest frame supported */
+  size_t max_len;
+} impls[] = {
+  {"table only (old)", table_pn9, PN9_TABLE_LEN},
+  {"xor_pn9", xor_pn9_void, 2 * PN9_PERIOD},
+  {"lfsr only", lfsr_pn9, 2 * PN9_PERIOD},
+  {"xor_pn9_wide", xor_pn9_wide, 2 * PN9_PERIOD},
+};
+
+static const size_t lengths[] = {11, 20, PN9_TABLE_LEN, MAX_FRAME_LEN - 1};
+
+/* Keep results alive, so the compiler doesn't optimize the work away */
+static volatile uint8_t result;
+
+int main(int argc, char **argv) {
+  unsigned long iterations = 1000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': iterations = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  /* Two periods, to check wrapping around as well */
+  uint8_t expected[2 * PN9_PERIOD];
+  reference_pn9(expected, sizeof(expected));
+
+  for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i)
+    if (!check(impls[i].name, impls[i].func, expected, impls[i].max_len))
+      return 1;
+
+  /* The state where the table ends */
+  uint16_t state = PN9_INIT;
+  for (size_t i = 0; i < PN9_TABLE_LEN; ++i)
+    state = pn9_next(state);
+  if (state != PN9_TABLE_END_STATE) {
+    fprintf(stderr, "PN9_TABLE_END_STATE should be 0x%03x\n", state);
+    return 1;
+  }
+
+  /* Pn9::next, also when mixed with apply */
+  Pn9 pn9;
+  uint8_t buf[MAX_FRAME_LEN];
+  memset(buf, 0, sizeof(buf));
+  for (size_t i = 0; i < sizeof(buf); ) {
+    if (i % 3) {
+      buf[i] = pn9.next();
+      i++;
+    } else {
+      size_t n = i % 7 + 1;
+      if (n > sizeof(buf) - i)
+        n = sizeof(buf) - i;
+      pn9.apply(buf + i, n);
+      i += n;
+    }
+  }
+  if (memcmp(buf, expected, sizeof(buf))) {
+    fprintf(stderr, "Pn9: wrong sequence\n");
+    return 1;
+  }
+  printf("All implementations match the reference sequence\n\n");
+
+  printf("%-24s", "ns/frame");
+  for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l)
+    printf(" %8zu B", lengths[l]);
+  printf("\n");
+
+  for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i) {
+    printf("%-24s", impls[i].name);
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(*lengths); ++l) {
+      size_t len = lengths[l];
+      if (len > impls[i].max_len) {
+        printf(" %10s", "-");
+        continue;
+      }
+      uint64_t start = now_ns();
+      for (unsigned long n = 0; n < iterations; ++n) {
+        impls[i].func(buf, len);
+        result = buf[len - 1];
+      }
+      printf(" %10.1f", (double)(now_ns() - start) / iterations);
+    }
+    printf("\n");
+  }
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,179 @@
+/*
+ * Check the message_types table against the switch statements it
+ * replaced (for every possible type byte), and time looking up a type
+ * both ways.
+ *
+ * Usage: bench_registry [-n lookups]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <typeinfo>
+
+#include "Bench.h"
+#include "MaxRFProto.h"
+
+/* The switches from the original MaxRFProto.cpp */
+static const char *old_type_to_str(MessageType type) {
+  switch(type) {
+    case MessageType::PAIR_PING:                      return "PairPing";
+    case MessageType::PAIR_PONG:                      return "PairPong";
+    case MessageType::ACK:                            return "Ack";
+    case MessageType::TIME_INFORMATION:               return "TimeInformation";
+    case MessageType::CONFIG_WEEK_PROFILE:            return "ConfigWeekProfile";
+    case MessageType::CONFIG_TEMPERATURES:            return "ConfigTemperatures";
+    case MessageType::CONFIG_VALVE:                   return "ConfigValve";
+    case MessageType::ADD_LINK_PARTNER:               return "AddLinkPartner";
+    case MessageType::REMOVE_LINK_PARTNER:            return "RemoveLinkPartner";
+    case MessageType::SET_GROUP_ID:                   return "SetGroupId";
+    case MessageType::REMOVE_GROUP_ID:                return "RemoveGroupId";
+    case MessageType::SHUTTER_CONTACT_STATE:          return "ShutterContactState";
+    case MessageType::SET_TEMPERATURE:                return "SetTemperature";
+    case MessageType::WALL_THERMOSTAT_STATE:          return "WallThermostatState";
+    case MessageType::SET_COMFORT_TEMPERATURE:        return "SetComfortTemperature";
+    case MessageType::SET_ECO_TEMPERATURE:            return "SetEcoTemperature";
+    case MessageType::PUSH_BUTTON_STATE:              return "PushButtonState";
+    case MessageType::THERMOSTAT_STATE:               return "ThermostatState";
+    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: return "SetDisplayActualTemperature";
+    case MessageType::WAKE_UP:                        return "WakeUp";
+    case MessageType::RESET:                          return "Reset";
+    default:                             return "Unknown";
+  }
+}
+
+static DeviceType old_sender_type(MessageType type) {
+  switch(type) {
+    case MessageType::WALL_THERMOSTAT_STATE:          return DeviceType::WALL;
+    case MessageType::THERMOSTAT_STATE:               return DeviceType::RADIATOR;
+    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: return DeviceType::CUBE;
+    default:                             return DeviceType::UNKNOWN;
+  }
+}
+
+static const std::type_info &old_class(MessageType type) {
+  switch(type) {
+    case MessageType::SET_TEMPERATURE:                return typeid(SetTemperatureMessage);
+    case MessageType::WALL_THERMOSTAT_STATE:          return typeid(WallThermostatStateMessage);
+    case MessageType::THERMOSTAT_STATE:               return typeid(ThermostatStateMessage);
+    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: return typeid(SetDisplayActualTemperatureMessage);
+    case MessageType::ACK:                            return typeid(AckMessage);
+    default:                             return typeid(UnknownMessage);
+  }
+}
+
+/* The payload length checks from the original parse_payload methods */
+static uint8_t old_min_payload_len(MessageType type) {
+  switch(type) {
+    case MessageType::SET_TEMPERATURE:                return 1;
+    case MessageType::WALL_THERMOSTAT_STATE:          return 2;
+    case MessageType::THERMOSTAT_STATE:               return 3;
+    case MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE: return 1;
+    case MessageType::ACK:                            return 4;
+    default:                             return 0;
+  }
+}
+
+static void check(bool ok, const char *what, unsigned type) {
+  if (!ok) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s (type %02x)", what, type);
+    check(false, buf);
+  }
+}
+
+/* Parse a message of the given type with a zeroed payload */
+static MaxRFMessage *parse(MessageType type, size_t payload_len, MaxRFMessageBuffer *storage) {
+  uint8_t buf[HeaderLayout::LEN + 16] = {0};
+  HeaderLayout::type::set(buf, type);
+  return MaxRFMessage::parse(buf, HeaderLayout::LEN + payload_len, storage);
+}
+
+static void test_table() {
+  for (uint8_t i = 0; i < message_types_count; ++i)
+    check(message_type_index[(uint8_t)message_types[i].type] == i + 1, "indexed", (unsigned)message_types[i].type);
+  for (uint8_t i = 1; i < message_types_count; ++i)
+    check(message_types[i - 1].type < message_types[i].type, "table sorted", (unsigned)message_types[i].type);
+
+  MaxRFMessageBuffer storage;
+  for (unsigned t = 0; t < 256; ++t) {
+    MessageType type = (MessageType)t;
+    check(strcmp((const char*)MaxRFMessage::type_to_str(type), old_type_to_str(type)) == 0, "name", t);
+
+    MessageTypeInfo info;
+    bool known = find_message_type(type, &info);
+    check(known == (strcmp(old_type_to_str(type), "Unknown") != 0), "known", t);
+    if (known)
+      check(info.sender == old_sender_type(type), "sender type", t);
+
+    uint8_t min = old_min_payload_len(type);
+    if (min)
+      check(parse(type, min - 1, &storage) == NULL, "short payload rejected", t);
+    MaxRFMessage *m = parse(type, min, &storage);
+    check(m != NULL, "payload accepted", t);
+    if (m) {
+      check(typeid(*m) == old_class(type), "class", t);
+      m->~MaxRFMessage();
+    }
+  }
+}
+
+/* Keep results alive, so the compiler doesn't optimize the work away */
+static volatile uintptr_t result;
+
+static void bench(unsigned long n) {
+  /* Mostly the common state messages, like on the air */
+  static const MessageType types[] = {
+    MessageType::THERMOSTAT_STATE, MessageType::WALL_THERMOSTAT_STATE,
+    MessageType::ACK, MessageType::SET_TEMPERATURE,
+    MessageType::THERMOSTAT_STATE, MessageType::TIME_INFORMATION,
+    MessageType::ACK, MessageType::WAKE_UP,
+  };
+
+  uint64_t start = now_ns();
+  for (unsigned long i = 0; i < n; ++i) {
+    MessageType type = types[i % lengthof(types)];
+    result = (uintptr_t)old_type_to_str(type) + (uintptr_t)old_sender_type(type)
+           + old_min_payload_len(type) + (uintptr_t)&old_class(type);
+  }
+  double switch_ns = (double)(now_ns() - start) / n;
+
+  start = now_ns();
+  for (unsigned long i = 0; i < n; ++i) {
+    MessageTypeInfo info;
+    if (find_message_type(types[i % lengthof(types)], &info))
+      result = (uintptr_t)info.name + (uintptr_t)info.sender
+             + info.min_payload_len + (uintptr_t)info.construct;
+  }
+  double table_ns = (double)(now_ns() - start) / n;
+
+  size_t names = 0;
+  for (uint8_t i = 0; i < message_types_count; ++i)
+    names += strlen(message_types[i].name) + 1;
+
+  printf("types:           %u\n", message_types_count);
+  printf("table:           %zu bytes + %zu bytes of names + %zu bytes of index (host sizes)\n",
+         sizeof(MessageTypeInfo) * message_types_count, names, sizeof(message_type_index));
+  printf("lookup:          %.1f ns (switches), %.1f ns (table)\n", switch_ns, table_ns);
+}
+
+int main(int argc, char **argv) {
+  unsigned long n = 10000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': n = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n lookups]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  test_table();
+  bench(n);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,217 @@
+/*
+ * Check the receive state machine in MaxRF22 (the interrupt handler,
+ * startRx and setRxLength) against the simulated radio in
+ * arduino/RF22.cpp: frames of every length come through intact, the
+ * RX FIFO never overflows, CRC errors and garbled length bytes are
+ * caught, a full queue drops new frames (and counts them) without
+ * touching the queued ones, and reception resumes after sending.
+ * Also measures the time spent in the interrupt handler per frame.
+ *
+ * Usage: bench_rx [-n frames]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Bench.h"
+#include "Crc.h"
+#include "MaxRF22.h"
+#include "MaxRFProto.h"
+#include "Pn9.h"
+
+const uint8_t RSSI = 0x5a;
+
+/* A frame with a random message of len bytes (headers and payload) */
+static Frame random_frame(size_t len) {
+  uint8_t msg[MAX_FRAME_LEN];
+  for (size_t i = 0; i < len; ++i)
+    msg[i] = rand();
+  return make_frame(msg, len);
+}
+
+/* Did the frame come through as sent (dewhitened)? */
+static bool same(const MaxRFFrame &got, const Frame &sent) {
+  Frame f = sent;
+  xor_pn9(f.data, f.len);
+  return got.len == f.len && !memcmp(got.data, f.data, f.len);
+}
+
+static void test_lengths() {
+  MaxRF22 rf;
+  check(rf.init() && rf.receiving(), "receiving after init");
+
+  /* Up to the longest frame that fits in MaxRFFrame */
+  for (size_t len = 0; len + 3 <= sizeof(MaxRFFrame::data); ++len) {
+    Frame f = random_frame(len);
+    check(rf.airReceive(f.data, f.len, RSSI), "frame received");
+
+    MaxRFFrame got;
+    check(rf.recvFrame(&got), "frame queued");
+    check(same(got, f), "frame intact");
+    check(got.crc_ok, "CRC ok");
+    check(got.rssi == RSSI, "RSSI taken");
+    check(!rf.recvFrame(&got), "queued once");
+    check(rf.receiving(), "receiving again");
+  }
+  check(!rf.rx_fifo_overflow, "RX FIFO never overflows");
+  check(rf.rxOverflows() == 0, "no frames dropped");
+  printf("Most bytes in the RX FIFO: %d of %d\n", rf.rx_fifo_max, RF22_FIFO_SIZE);
+}
+
+static void test_errors() {
+  MaxRF22 rf;
+  rf.init();
+  MaxRFFrame got;
+
+  /* A flipped bit in the payload */
+  Frame f = random_frame(20);
+  f.data[10] ^= 0x04;
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && !got.crc_ok, "CRC error caught");
+
+  /* A length byte that says more than was sent: noise follows */
+  f = random_frame(20);
+  f.data[0] ^= 0x08;
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && !got.crc_ok, "long length byte caught");
+  check(got.len == (uint8_t)(f.data[0] ^ pn9_table[0]) + 1, "packet length from length byte");
+
+  /* One that says more than any message type, cut off */
+  f = random_frame(20);
+  f.data[0] ^= 0x80;
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && !got.crc_ok, "overlong length byte caught");
+  check(got.len == RF_MAX_FRAME_LEN, "cut off at RF_MAX_FRAME_LEN");
+
+  /* A real frame that is too long */
+  f = random_frame(RF_MAX_FRAME_LEN);
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && !got.crc_ok && got.len == RF_MAX_FRAME_LEN, "too long frame cut off");
+
+  /* One that says less, the rest is lost */
+  f = random_frame(20);
+  f.data[0] ^= 0x04;
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && !got.crc_ok, "short length byte caught");
+
+  /* The shortest is kept too, loop() reports it */
+  f = random_frame(0);
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && got.len == 3, "shortest frame");
+
+  /* Still in step after all that */
+  f = random_frame(30);
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && same(got, f) && got.crc_ok, "frame after errors");
+  check(!rf.rx_fifo_overflow, "RX FIFO never overflows on errors");
+}
+
+static void test_queue_full() {
+  MaxRF22 rf;
+  rf.init();
+
+  std::vector<Frame> frames;
+  for (int i = 0; i < MAX_RF_RX_QUEUE + 2; ++i) {
+    frames.push_back(random_frame(10 + i));
+    rf.airReceive(frames.back().data, frames.back().len, RSSI);
+  }
+  check(rf.rxOverflows() == 2, "overflows counted");
+  check(rf.rxQueueMax() == MAX_RF_RX_QUEUE, "queue max");
+
+  MaxRFFrame got;
+  for (int i = 0; i < MAX_RF_RX_QUEUE; ++i)
+    check(rf.recvFrame(&got) && same(got, frames[i]) && got.crc_ok, "queued frames intact");
+  check(!rf.recvFrame(&got), "dropped frames not queued");
+
+  /* Room again */
+  Frame f = random_frame(12);
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && same(got, f), "received once there is room");
+}
+
+static void test_tx() {
+  MaxRF22 rf;
+  rf.init();
+
+  uint8_t payload[1] = {0};
+  uint8_t buf[HeaderLayout::LEN + sizeof(payload) + 3];
+  uint8_t len = build_frame(buf, 1, 0, MessageType::SET_TEMPERATURE,
+                            0x00b825, 0x04c8dd, 0, payload, sizeof(payload));
+  check(rf.sendFrame(buf, len, false), "send started");
+  check(rf.transmitting() && !rf.receiving() && rf.txBusy(), "sending");
+  check(rf.sent.size() == len && !memcmp(rf.sent.data(), buf, len), "frame sent as built");
+  check(!rf.sendFrame(buf, len, false), "one frame at a time");
+
+  Frame f = random_frame(10);
+  check(!rf.airReceive(f.data, f.len, RSSI), "deaf while sending");
+
+  rf.finishTx();
+  check(!rf.txBusy() && rf.receiving(), "receiving after sending");
+  MaxRFFrame got;
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && same(got, f) && got.crc_ok, "frame after sending");
+  check(rf.txTimeouts() == 0, "no timeout when sent");
+
+  /* The radio never reports the frame sent */
+  unsigned long start = millis();
+  check(rf.sendFrame(buf, len, true), "burst started");
+  set_simulated_time((start + rf.airtime(len, true)) * 1000UL);
+  check(rf.txBusy() && !rf.receiving(), "sending for its airtime");
+  set_simulated_time((start + rf.airtime(len, true) + 20) * 1000UL);
+  check(!rf.txBusy() && rf.receiving(), "receiving after the deadline");
+  check(rf.txTimeouts() == 1, "timeout counted");
+  rf.airReceive(f.data, f.len, RSSI);
+  check(rf.recvFrame(&got) && same(got, f) && got.crc_ok, "frame after the deadline");
+  /* A late interrupt changes nothing */
+  rf.finishTx();
+  check(rf.receiving(), "still receiving");
+  set_simulated_time(0);
+}
+
+static void bench(unsigned long count) {
+  MaxRF22 rf;
+  rf.init();
+  std::vector<Frame> corpus = builtin_corpus();
+
+  MaxRFFrame got;
+  unsigned long bytes = 0;
+  uint64_t start = now_ns();
+  for (unsigned long i = 0; i < count; ++i) {
+    const Frame &f = corpus[i % corpus.size()];
+    rf.airReceive(f.data, f.len, RSSI);
+    rf.recvFrame(&got);
+    bytes += f.len;
+  }
+  uint64_t ns = now_ns() - start;
+
+  /* Includes the simulated radio, so an upper bound */
+  printf("%lu frames: %.0f ns/frame, %.1f ns/byte, %.1f interrupts/frame\n",
+         count, (double)ns / count, (double)ns / bytes,
+         (double)rf.interrupts / count);
+}
+
+int main(int argc, char **argv) {
+  unsigned long count = 100000;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': count = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n frames]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  srand(1);
+  test_lengths();
+  test_errors();
+  test_queue_full();
+  test_tx();
+  bench(count);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
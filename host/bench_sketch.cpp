@@ -0,0 +1,172 @@
+/*
+ * Run the sketch itself (Max.ino, with the configuration in Max.h) on
+ * the host: setup(), then loop() while frames arrive at the simulated
+ * radio from arduino/RF22.cpp and commands arrive over serial. Checks
+ * that every frame is handled and shows up in the output, and that the
+ * commands reply. Also measures the time loop() takes per frame.
+ *
+ * Usage: bench_sketch [-n frames] [-v]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "Max.h"
+#include "MaxRF22.h"
+
+/* From Max.ino */
+void setup();
+void loop();
+extern MaxRF22 rf;
+
+const uint8_t RSSI = 0x5a;
+/* Time between frames, in ms */
+const unsigned long FRAME_INTERVAL = 1000;
+
+static unsigned long now_ms = 0;
+
+/* Run loop() until the sketch has nothing left to do */
+static void run() {
+  for (int i = 0; i < 16; ++i)
+    loop();
+}
+
+static void advance(unsigned long ms) {
+  now_ms += ms;
+  set_simulated_time(now_ms * 1000);
+}
+
+/* Send a command over serial, returns the reply */
+static std::string command(const char *line) {
+  Serial.output.clear();
+  Serial.input += line;
+  Serial.input += "\r\n";
+  run();
+  return Serial.output;
+}
+
+static bool contains(const std::string &s, const char *what) {
+  return s.find(what) != std::string::npos;
+}
+
+/* Number of lines in s that start with start */
+static unsigned count_lines(const std::string &s, const char *start) {
+  std::istringstream in(s);
+  std::string line;
+  unsigned n = 0;
+  while (std::getline(in, line))
+    n += !line.compare(0, strlen(start), start);
+  return n;
+}
+
+#ifdef HISTORY_BYTES
+/* Page through the history of a device that sent state in the corpus */
+static void test_history() {
+  /* The corpus only took seconds, so let some samples be taken */
+  const unsigned SAMPLES = HISTORY_PAGE + 5;
+  for (unsigned i = 0; i < SAMPLES; ++i) {
+    advance(HISTORY_INTERVAL);
+    run();
+  }
+
+  std::string reply = command("history 04c8dd");
+  unsigned samples = 0, used = 0, size = 0, next = 0;
+  const char *ok = strstr(reply.c_str(), "OK ");
+  check(ok && sscanf(ok, "OK %u %u/%u %u", &samples, &used, &size, &next) == 4,
+        "history reply");
+  check(samples >= SAMPLES && size == HISTORY_BYTES, "history samples");
+  check(count_lines(reply, "HISTORY\t") == HISTORY_PAGE && next == HISTORY_PAGE,
+        "history first page");
+
+  char cmd[32];
+  snprintf(cmd, sizeof(cmd), "history 04c8dd %u", next);
+  reply = command(cmd);
+  ok = strstr(reply.c_str(), "OK ");
+  check(ok && sscanf(ok, "OK %*u %*u/%*u %u", &next) == 1, "history page reply");
+  check(count_lines(reply, "HISTORY\t") == samples - HISTORY_PAGE && next == samples,
+        "history last page");
+
+  check(contains(command("history 04c8dd x"), "ERR use"), "history offset checked");
+  check(contains(command("history 123456"), "ERR unknown device"), "history of unknown device");
+}
+#endif // HISTORY_BYTES
+
+int main(int argc, char **argv) {
+  unsigned long count = 20000;
+  bool verbose = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:v")) != -1) {
+    switch (opt) {
+      case 'n': count = strtoul(optarg, NULL, 0); break;
+      case 'v': verbose = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-n frames] [-v]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  advance(1);
+  setup();
+  run();
+  if (verbose)
+    fputs(Serial.output.c_str(), stdout);
+  check(contains(Serial.output, "RF init OK"), "radio initialized");
+  check(contains(Serial.output, "Initialized"), "setup done");
+  check(rf.receiving(), "receiving after setup");
+
+  /* Every frame of the corpus is handled and decoded */
+  std::vector<Frame> corpus = builtin_corpus();
+  Serial.output.clear();
+  for (size_t i = 0; i < corpus.size(); ++i) {
+    advance(FRAME_INTERVAL);
+    check(rf.airReceive(corpus[i].data, corpus[i].len, RSSI), "radio receiving");
+    run();
+  }
+  if (verbose)
+    fputs(Serial.output.c_str(), stdout);
+  check(contains(Serial.output, "Received"), "frames dumped");
+  check(!contains(Serial.output, "CRC error"), "no CRC errors");
+  check(contains(Serial.output, "UPDATE\t"), "status updates");
+
+  std::string reply = command("list");
+  check(contains(reply, "DEVICE\t") && contains(reply, "OK 3/"), "list reply");
+  reply = command("stats");
+  if (verbose)
+    fputs(reply.c_str(), stdout);
+  check(contains(reply, "overflows: 0"), "no frames dropped");
+  check(contains(reply, "Frames: 12,"), "stats reply");
+  reply = command("snapshot");
+  check(contains(reply, "STATUS\t"), "snapshot reply");
+  check(reply.size() >= 4 && !reply.compare(reply.size() - 4, 4, "OK\r\n"), "snapshot ends with OK");
+  reply = command("stats reset");
+  check(contains(reply, "OK"), "stats reset");
+  #ifdef HISTORY_BYTES
+  test_history();
+  #endif // HISTORY_BYTES
+  check(contains(command("forget 04c8dd"), "OK 2/"), "forget reply");
+  check(contains(command("forget 04c8dd"), "ERR unknown device"), "forgotten device gone");
+
+  /* Time loop() over many frames, output to serial kept short */
+  command("sub s");
+  uint64_t ns = 0;
+  for (unsigned long i = 0; i < count; ++i) {
+    const Frame &f = corpus[i % corpus.size()];
+    advance(FRAME_INTERVAL);
+    rf.airReceive(f.data, f.len, RSSI);
+    uint64_t start = now_ns();
+    run();
+    ns += now_ns() - start;
+    Serial.output.clear();
+  }
+  check(rf.rxOverflows() == 0, "no frames dropped while timing");
+  printf("%lu frames: %.0f ns of loop() per frame\n", count, (double)ns / count);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
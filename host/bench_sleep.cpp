@@ -0,0 +1,195 @@
+/*
+ * Run a simulated loop() with the Sleeper against a mock MCU, clock and
+ * radio: frames arrive at random times (some of them right while the
+ * sleeper checks for pending work), and each is handled after the loop
+ * wakes up. Checks that no frame is missed or left waiting for a later
+ * wakeup, reports the wakeup latency and the time spent asleep.
+ *
+ * The mock sleeps either like idle mode (the millis() timer wakes it
+ * every 1024 us) or without any timer, so only the frame interrupts
+ * wake it up, which shows a missed wakeup as a frame that waits for the
+ * next one.
+ *
+ * Usage: bench_sleep [-f frames per minute] [-m minutes]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "Bench.h"
+#include "Sleeper.h"
+
+/* Time it takes to handle a frame, in us */
+const unsigned long HANDLE_US = 2000;
+/* Time a loop() iteration takes without anything to do, in us */
+const unsigned long LOOP_US = 30;
+/* Wake up and interrupt entry, in us */
+const unsigned long WAKEUP_US = 5;
+
+/**
+ * Stands in for the MCU and the radio. Frames "arrive" (their
+ * interrupt fires) at the times in arrivals, which then queues them,
+ * unless interrupts are disabled at the time, in which case the
+ * interrupt fires as soon as they are enabled again.
+ */
+class MockMcu {
+public:
+  MockMcu(unsigned long tick_us) : now(0), tick_us(tick_us), enabled(true),
+    next_arrival(0) {}
+
+  void noInterrupts() {
+    check(this->enabled, "interrupts disabled twice");
+    this->enabled = false;
+  }
+
+  void interrupts() {
+    this->enabled = true;
+    fire();
+  }
+
+  void sleep() {
+    check(!this->enabled, "sleep() called with interrupts enabled");
+    this->enabled = true;
+    /* An interrupt that became pending while disabled wakes us up
+     * right away, like on the AVR */
+    if (fire())
+      return;
+    check(this->queue.empty(), "sleeping with a frame waiting");
+
+    unsigned long wake = this->next_arrival < this->arrivals.size()
+                       ? this->arrivals[this->next_arrival] : (unsigned long)-1;
+    if (this->tick_us) {
+      unsigned long tick = (this->now / this->tick_us + 1) * this->tick_us;
+      if (tick < wake)
+        wake = tick;
+    }
+    check(wake != (unsigned long)-1, "sleeping forever");
+    if (wake > this->now)
+      this->now = wake;
+    this->now += WAKEUP_US;
+    fire();
+  }
+
+  unsigned long micros() { return this->now; }
+  unsigned long millis() { return this->now / 1000; }
+
+  /* Run interrupts for the frames that arrived, when enabled */
+  bool fire() {
+    bool fired = false;
+    while (this->enabled && this->next_arrival < this->arrivals.size() &&
+           this->arrivals[this->next_arrival] <= this->now) {
+      this->queue.push_back(this->arrivals[this->next_arrival++]);
+      fired = true;
+    }
+    return fired;
+  }
+
+  unsigned long now;
+  unsigned long tick_us;
+  bool enabled;
+  std::vector<unsigned long> arrivals;
+  size_t next_arrival;
+  /* Arrival times of the frames received but not handled yet */
+  std::vector<unsigned long> queue;
+};
+
+static MockMcu *mcu;
+
+/* Like workPending() in the sketch. Takes a little time, during which
+ * a frame may arrive, to exercise the race with the sleep. */
+static bool pending() {
+  check(!mcu->enabled, "pending() called with interrupts enabled");
+  bool res = !mcu->queue.empty();
+  mcu->now += 2;
+  return res;
+}
+
+static void run(unsigned long tick_us, unsigned per_minute, unsigned minutes) {
+  MockMcu m(tick_us);
+  mcu = &m;
+  Sleeper<MockMcu> sleeper(m);
+  unsigned long end = minutes * 60 * 1000000UL;
+
+  /* Random arrivals, plus some that land right while pending() runs */
+  srand(1);
+  unsigned long mean = 60 * 1000000UL / per_minute;
+  for (unsigned long t = rand() % mean; t < end; t += 1 + rand() % (2 * mean))
+    m.arrivals.push_back(t);
+  for (unsigned i = 0; i < per_minute * minutes / 10; ++i)
+    m.arrivals.push_back(rand() % end);
+  std::sort(m.arrivals.begin(), m.arrivals.end());
+
+  std::vector<unsigned long> latency;
+  while (m.next_arrival < m.arrivals.size() || !m.queue.empty()) {
+    sleeper.sleep(pending);
+
+    /* Handle one frame per loop(), like the sketch */
+    m.noInterrupts();
+    unsigned long arrival = 0;
+    bool got = !m.queue.empty();
+    if (got) {
+      arrival = m.queue.front();
+      m.queue.erase(m.queue.begin());
+    }
+    m.interrupts();
+
+    if (got) {
+      latency.push_back(m.now - arrival);
+      m.now += HANDLE_US;
+    } else {
+      m.now += LOOP_US;
+    }
+    m.fire();
+  }
+
+  check(latency.size() == m.arrivals.size(), "every frame handled");
+  /* Frames are handled in the order they arrive. One that arrives
+   * while the loop is idle is handled right after the wakeup (or the
+   * loop iteration running at the time). */
+  for (size_t i = 1; i < latency.size(); ++i)
+    if (m.arrivals[i] - m.arrivals[i - 1] > 2 * HANDLE_US)
+      check(latency[i] <= LOOP_US + WAKEUP_US + 2, "wakeup latency");
+  std::sort(latency.begin(), latency.end());
+  unsigned long max = latency.back();
+
+  unsigned long total_ms = m.now / 1000;
+  printf("%-15s %u frames/min, %u min\n",
+         tick_us ? "idle mode:" : "no timer:", per_minute, minutes);
+  printf("  frames:        %zu\n", latency.size());
+  printf("  latency:       median %lu us, 99%% %lu us, max %lu us\n",
+         latency[latency.size() / 2], latency[latency.size() * 99 / 100], max);
+  printf("  asleep:        %u of %lu ms (%.2f%%), %u sleeps\n",
+         sleeper.asleep_ms, total_ms, 100.0 * sleeper.asleep_ms / total_ms,
+         sleeper.sleeps);
+}
+
+int main(int argc, char **argv) {
+  unsigned per_minute = 20;
+  unsigned minutes = 60;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "f:m:")) != -1) {
+    switch (opt) {
+      case 'f': per_minute = strtoul(optarg, NULL, 0); break;
+      case 'm': minutes = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-f frames per minute] [-m minutes]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (!per_minute || !minutes) {
+    fprintf(stderr, "Need at least one frame per minute and one minute\n");
+    return 1;
+  }
+
+  run(1024, per_minute, minutes);
+  run(0, per_minute, minutes);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
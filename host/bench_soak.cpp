@@ -0,0 +1,160 @@
+/*
+ * Soak test for the receive path: run millions of frames through
+ * dewhitening, CRC checking, parsing, printing and updateState, and
+ * check that memory usage stays constant. Heap allocations are counted
+ * by replacing the global operator new and delete.
+ *
+ * Usage: bench_soak [-n frames] [corpus file]
+ *
+ * Exits with an error when the heap was used, or when the resident set
+ * size grew after the first checkpoint.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+
+#include <TStreaming.h>
+
+#include "Bench.h"
+#include "Pn9.h"
+#include "MaxRFProto.h"
+
+static unsigned long long allocations;
+static long long live_bytes;
+
+void *operator new(size_t size) {
+  /* Store the size in front of the block, to track live bytes */
+  size_t *p = (size_t *)malloc(size + sizeof(size_t));
+  if (!p)
+    throw std::bad_alloc();
+  *p = size;
+  allocations++;
+  live_bytes += size;
+  return p + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (!ptr)
+    return;
+  size_t *p = (size_t *)ptr - 1;
+  live_bytes -= *p;
+  free(p);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+  operator delete(ptr);
+}
+
+/* Resident set size in kB */
+static long rss_kb() {
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(f);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* Receive a single frame, like loop() does */
+static void process(const Frame &frame, Print &p, MaxRFMessageBuffer *storage) {
+  uint8_t buf[MAX_FRAME_LEN];
+  uint8_t len = frame.len;
+  uint16_t crc;
+
+  memcpy(buf, frame.data, len);
+  if (len < 3 || xor_pn9_crc(buf, len, &crc) < 0)
+    return;
+  if (buf[len - 1] != (crc & 0xff) || buf[len - 2] != (crc >> 8))
+    return;
+
+  MaxRFMessage *rfm = MaxRFMessage::parse(buf + 1, len - 3, storage);
+  if (rfm) {
+    p << *rfm;
+    rfm->updateState();
+    rfm->~MaxRFMessage();
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned long total = 5000000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': total = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n frames] [corpus file]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<Frame> frames;
+  if (optind < argc) {
+    if (!load_corpus(argv[optind], &frames)) {
+      perror(argv[optind]);
+      return 1;
+    }
+  } else {
+    frames = builtin_corpus();
+  }
+
+  if (frames.empty()) {
+    fprintf(stderr, "No frames to replay\n");
+    return 1;
+  }
+
+  static MaxRFMessageBuffer storage;
+  CountingPrint sink;
+  unsigned long checkpoint = total / 10 ? total / 10 : 1;
+  bool ok = true;
+  bool rss_grew = false;
+
+  printf("parsing into MaxRFMessageBuffer (%zu bytes)\n", sizeof(storage));
+  printf("%12s %12s %12s %10s\n", "frames", "allocations", "live bytes", "rss kB");
+
+  /* Run a few frames first, so one-time allocations (e.g. by stdio)
+   * are not counted */
+  for (size_t i = 0; i < frames.size(); ++i)
+    process(frames[i], sink, &storage);
+  unsigned long long start_allocations = allocations;
+  long long start_live_bytes = live_bytes;
+  /* The first checkpoint still faults in code and stdio pages, so the
+   * resident set size is compared against that */
+  long start_rss = 0;
+
+  for (unsigned long n = 1; n <= total; ++n) {
+    process(frames[n % frames.size()], sink, &storage);
+
+    if (n % checkpoint == 0) {
+      long rss = rss_kb();
+      printf("%12lu %12llu %12lld %10ld\n", n, allocations - start_allocations,
+             live_bytes - start_live_bytes, rss);
+      if (!start_rss)
+        start_rss = rss_kb();
+      else if (rss > start_rss)
+        rss_grew = true;
+    }
+  }
+
+  if (allocations != start_allocations) {
+    printf("FAIL: heap was used while parsing\n");
+    ok = false;
+  }
+  if (live_bytes != start_live_bytes) {
+    printf("FAIL: %lld bytes leaked\n", live_bytes - start_live_bytes);
+    ok = false;
+  }
+  if (rss_grew) {
+    printf("FAIL: resident set size grew from %ld kB\n", start_rss);
+    ok = false;
+  }
+  if (ok)
+    printf("OK: memory usage constant\n");
+  return ok ? 0 : 1;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,341 @@
+/*
+ * Check DeviceStore against a mock EEPROM: the newest snapshot restores
+ * the devices and their state (and the address filter), a reset in the middle of writing a
+ * snapshot restores the one before it, and bytes are only written when
+ * the EEPROM is ready, so poll() never waits, and records that did not
+ * change (unused ones included) are not written again. Then run it for
+ * a while with devices changing state and report the bytes written per
+ * snapshot and how long the most worn EEPROM cell lasts at that rate.
+ *
+ * Usage: bench_store [-d days] [-r resets]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "Bench.h"
+#include "AddressFilter.h"
+#include "DeviceStore.h"
+#include "DeviceTable.h"
+
+const uint16_t EEPROM_SIZE = 1024;
+/* Time it takes to write a byte, in us */
+const unsigned long WRITE_US = 3300;
+/* Writes an EEPROM cell survives */
+const unsigned long ENDURANCE = 100000;
+
+static unsigned long now_us;
+
+static void advance(unsigned long us) {
+  now_us += us;
+  set_simulated_time(now_us);
+}
+
+class MockEeprom {
+public:
+  MockEeprom() : busy_until(0), reads(0) {
+    memset(this->data, 0xff, sizeof(this->data));
+    memset(this->writes, 0, sizeof(this->writes));
+  }
+
+  uint8_t read(uint16_t addr) {
+    check(addr < EEPROM_SIZE, "read within the EEPROM");
+    this->reads++;
+    return this->data[addr % EEPROM_SIZE];
+  }
+
+  bool ready() { return now_us >= this->busy_until; }
+
+  void write(uint16_t addr, uint8_t value) {
+    check(addr < EEPROM_SIZE, "write within the EEPROM");
+    check(ready(), "write only when ready");
+    this->data[addr % EEPROM_SIZE] = value;
+    this->writes[addr % EEPROM_SIZE]++;
+    this->busy_until = now_us + WRITE_US;
+  }
+
+  unsigned long maxWrites() const {
+    unsigned long max = 0;
+    for (uint16_t i = 0; i < EEPROM_SIZE; ++i)
+      if (this->writes[i] > max)
+        max = this->writes[i];
+    return max;
+  }
+
+  uint8_t data[EEPROM_SIZE];
+  unsigned long writes[EEPROM_SIZE];
+  unsigned long busy_until;
+  unsigned long reads;
+};
+
+/* The state of the sketch that survives a reset only through EEPROM */
+struct Boot {
+  Boot(MockEeprom &eeprom, unsigned long interval)
+    : devices(MAX_DEVICES), index(MAX_DEVICES),
+      table(devices.data(), index.data(), MAX_DEVICES, true),
+      addrs(ADDRESS_FILTER_SIZE), filter(addrs.data(), ADDRESS_FILTER_SIZE, 0),
+      store(eeprom, table, devices.data(), MAX_DEVICES, 0, EEPROM_SIZE, interval, &filter) {}
+
+  std::vector<Device> devices;
+  std::vector<uint8_t> index;
+  DeviceTable table;
+  std::vector<uint32_t> addrs;
+  AddressFilter filter;
+  DeviceStore<MockEeprom> store;
+};
+
+/* What a snapshot should restore */
+struct Rec {
+  uint32_t addr;
+  DeviceType type;
+  uint8_t set_temp;
+  uint16_t actual_temp;
+  uint8_t valve_pos;
+};
+
+/* The address filter, as a snapshot should restore it: whether it is
+ * active, its group and the allowed addresses */
+struct FilterState {
+  bool active;
+  uint8_t group_id;
+  std::vector<uint32_t> addrs;
+};
+
+static FilterState filter_state(const AddressFilter &f) {
+  FilterState s = {f.active(), f.group_id, std::vector<uint32_t>()};
+  for (uint8_t i = 0; i < f.count(); ++i)
+    s.addrs.push_back(f.at(i));
+  return s;
+}
+
+static bool same_filter(const FilterState &a, const FilterState &b) {
+  return a.active == b.active && a.group_id == b.group_id && a.addrs == b.addrs;
+}
+
+/* Like the allow and deny commands */
+static void change_filter(AddressFilter &f) {
+  switch (rand() % 8) {
+    case 0: f.clear(); break;
+    case 1: f.allowOnly(rand() % 2 ? rand() % 256 : 0); break;
+    case 2: case 3:
+      if (f.count()) {
+        f.remove(f.at(rand() % f.count()));
+        break;
+      }
+      /* Fall through */
+    default: f.add(random_addr()); break;
+  }
+}
+
+static std::vector<Rec> snapshot(Boot &b) {
+  std::vector<Rec> recs;
+  for (uint16_t i = 0; i < b.table.count(); ++i) {
+    Device &d = b.devices[i];
+    Rec r = {d.address, d.type, d.set_temp, d.actual_temp, d.data.radiator.valve_pos};
+    recs.push_back(r);
+  }
+  return recs;
+}
+
+static bool matches(Boot &b, const std::vector<Rec> &recs) {
+  if (b.table.count() != recs.size())
+    return false;
+  for (size_t i = 0; i < recs.size(); ++i) {
+    const Rec &r = recs[i];
+    Device *d = b.table.find(r.addr);
+    if (!d || d->type != r.type || d->set_temp != r.set_temp || d->actual_temp != r.actual_temp)
+      return false;
+    if (r.type == DeviceType::RADIATOR && d->data.radiator.valve_pos != r.valve_pos)
+      return false;
+  }
+  return true;
+}
+
+static void add_devices(Boot &b, unsigned n) {
+  for (unsigned i = 0; i < n; ++i) {
+    DeviceType type = i % 4 ? DeviceType::RADIATOR : DeviceType::WALL;
+    Device *d = b.table.get((rand() & 0xffffff) | 1, type);
+    d->set_temp = 40;
+    d->actual_temp = 200;
+    if (type == DeviceType::RADIATOR)
+      d->data.radiator.valve_pos = 0;
+  }
+}
+
+/* A device reports a change */
+static void change(Boot &b) {
+  Device *d = b.table.get(b.devices[rand() % b.table.count()].address, DeviceType::UNKNOWN);
+  d->actual_temp += rand() % 3 - 1;
+  if (rand() % 8 == 0)
+    d->set_temp = 34 + rand() % 10;
+  if (d->type == DeviceType::RADIATOR)
+    d->data.radiator.valve_pos = rand() % 101;
+}
+
+/* Reset at random points while writing, each time restoring into a
+ * fresh device table and carrying on from there */
+static void test_resets(unsigned resets) {
+  MockEeprom eeprom;
+  Boot *b = new Boot(eeprom, (unsigned long)-1);
+  check(b->store.restore() == 0, "nothing to restore from an empty EEPROM");
+  add_devices(*b, MAX_DEVICES - 2);
+
+  std::vector<Rec> last_good;
+  /* A fresh filter, until a snapshot is complete */
+  FilterState good_filter = filter_state(b->filter);
+  unsigned completed = 0;
+  for (unsigned i = 0; i < resets; ++i) {
+    for (unsigned j = rand() % 4; j > 0; --j)
+      change(*b);
+    if (rand() % 4 == 0)
+      change_filter(b->filter);
+    std::vector<Rec> recs = snapshot(*b);
+    FilterState filter = filter_state(b->filter);
+
+    b->store.save();
+    /* A snapshot takes up to a write per byte */
+    unsigned long polls = rand() % (EEPROM_SIZE / b->store.slots() * 2);
+    for (unsigned long p = 0; p < polls && b->store.busy(); ++p) {
+      advance(1000);
+      b->store.poll(now_us / 1000);
+    }
+    if (!b->store.busy()) {
+      last_good = recs;
+      good_filter = filter;
+      completed++;
+    }
+
+    /* Reset */
+    advance(WRITE_US);
+    delete b;
+    b = new Boot(eeprom, (unsigned long)-1);
+    check(b->store.restore() == last_good.size(), "restored count");
+    check(matches(*b, last_good), "restored the newest complete snapshot");
+    check(same_filter(filter_state(b->filter), good_filter), "restored the address filter");
+    if (last_good.empty())
+      add_devices(*b, MAX_DEVICES - 2);
+  }
+  delete b;
+  printf("resets:          %u, %u after a complete snapshot\n", resets, completed);
+}
+
+/* Ages carry over a reset */
+static void test_age() {
+  MockEeprom eeprom;
+  Boot *b = new Boot(eeprom, (unsigned long)-1);
+  add_devices(*b, 1);
+  advance(90 * 60 * 1000000UL);
+  b->store.save();
+  while (b->store.busy()) {
+    advance(1000);
+    b->store.poll(now_us / 1000);
+  }
+  delete b;
+
+  b = new Boot(eeprom, (unsigned long)-1);
+  b->store.restore();
+  advance(5 * 60 * 1000000UL);
+  check(DeviceStore<MockEeprom>::age(&b->devices[0], millis()) == 95, "age restored");
+  b->table.get(b->devices[0].address, DeviceType::UNKNOWN);
+  check(DeviceStore<MockEeprom>::age(&b->devices[0], millis()) == 0, "age reset when seen");
+  delete b;
+}
+
+/* With the table partly used and nothing changing, a snapshot only
+ * writes its seqnum and crc, also in the records of unused slots */
+static void test_unused() {
+  MockEeprom eeprom;
+  Boot b(eeprom, (unsigned long)-1);
+  add_devices(b, 2);
+  for (unsigned i = 0; i < 3 * b.store.slots(); ++i) {
+    /* Seen again, so their age stays 0 */
+    advance(10 * 60 * 1000000UL);
+    for (uint16_t j = 0; j < b.table.count(); ++j)
+      b.table.get(b.devices[j].address, DeviceType::UNKNOWN);
+    uint32_t before = b.store.written;
+    b.store.save();
+    while (b.store.busy()) {
+      advance(WRITE_US);
+      b.store.poll(now_us / 1000);
+    }
+    if (i >= b.store.slots())
+      check(b.store.written - before <= 4, "unchanged records not written again");
+  }
+}
+
+/* Run with the sketch's interval, a device changing every minute */
+static void test_wear(unsigned days) {
+  MockEeprom eeprom;
+  Boot b(eeprom, PERSIST_INTERVAL);
+  add_devices(b, MAX_DEVICES);
+
+  unsigned long end = now_us + days * 24 * 60 * 60 * 1000000UL;
+  unsigned long next_change = now_us;
+  unsigned long start = 0;
+  while (now_us < end) {
+    if (now_us >= next_change) {
+      change(b);
+      next_change += 60 * 1000000UL;
+    }
+    bool was_busy = b.store.busy();
+    b.store.poll(now_us / 1000);
+    if (!was_busy && b.store.busy())
+      start = now_us;
+    if (was_busy && !b.store.busy())
+      check(now_us - start < PERSIST_INTERVAL * 1000, "snapshot done within the interval");
+    /* Poll often while writing, like loop() does */
+    advance(b.store.busy() ? 1000 : 1000000);
+  }
+
+  unsigned long max = eeprom.maxWrites();
+  double per_day = (double)max / days;
+  printf("snapshots:       %u in %u days, %u slots of %u bytes\n", b.store.snapshots, days,
+         b.store.slots(), b.store.slotLen());
+  printf("bytes written:   %.1f per snapshot (%.1f unchanged)\n",
+         (double)b.store.written / b.store.snapshots,
+         (double)b.store.unchanged / b.store.snapshots);
+  printf("most worn cell:  %lu writes, %.1f per day, lasts %.1f years\n",
+         max, per_day, ENDURANCE / per_day / 365);
+
+  MockEeprom restored = eeprom;
+  Boot r(restored, PERSIST_INTERVAL);
+  restored.reads = 0;
+  r.store.restore();
+  printf("restore:         %lu bytes read\n", restored.reads);
+}
+
+int main(int argc, char **argv) {
+  unsigned days = 30;
+  unsigned resets = 2000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "d:r:")) != -1) {
+    switch (opt) {
+      case 'd': days = strtoul(optarg, NULL, 0); break;
+      case 'r': resets = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-d days] [-r resets]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (!days) {
+    fprintf(stderr, "Need at least one day\n");
+    return 1;
+  }
+
+  srand(1);
+  set_simulated_time(now_us);
+  test_resets(resets);
+  test_age();
+  test_unused();
+  test_wear(days);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,163 @@
+/*
+ * Check that FrameDecoder, fed a frame in chunks like the radio
+ * interrupt handler does, gives the same bytes and CRC verdict as
+ * xor_pn9_crc() on the complete frame. Also times the work done per
+ * chunk, and what is left to do after the last byte arrived (the
+ * latency the main loop sees), for both approaches.
+ *
+ * Usage: bench_stream [-n rounds] [corpus file]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "Bench.h"
+#include "FrameDecoder.h"
+#include "MaxRF22.h"
+#include "Pn9.h"
+
+/* Chunk size the interrupt handler reads, after the length byte */
+const uint8_t RX_CHUNK = MaxRF22::RX_CHUNK;
+
+/* Decode a whole frame in one go, like the main loop used to */
+static bool decode_whole(uint8_t *buf, uint8_t len) {
+  uint16_t crc;
+  if (len < 3 || xor_pn9_crc(buf, len, &crc) < 0)
+    return false;
+  return buf[len - 2] == (crc >> 8) && buf[len - 1] == (crc & 0xff);
+}
+
+/* Feed a frame to a decoder in chunks of random size */
+static bool decode_random_chunks(FrameDecoder &d, uint8_t *buf, uint8_t len) {
+  d.start(buf);
+  while (d.length() < len) {
+    uint8_t n = 1 + rand() % 20;
+    if (n > len - d.length())
+      n = len - d.length();
+    d.feed(n);
+  }
+  return d.crcOk();
+}
+
+/* Compare both decoders on a frame */
+static void compare(const Frame &f) {
+  uint8_t whole[MAX_FRAME_LEN], stream[MAX_FRAME_LEN];
+  memcpy(whole, f.data, f.len);
+  memcpy(stream, f.data, f.len);
+
+  FrameDecoder d;
+  bool whole_ok = decode_whole(whole, f.len);
+  bool stream_ok = decode_random_chunks(d, stream, f.len);
+
+  /* Frames that short are not dewhitened by xor_pn9_crc */
+  if (f.len >= 3)
+    check(memcmp(whole, stream, f.len) == 0, "same dewhitened bytes");
+  /* The length byte must match as well, which xor_pn9_crc doesn't
+   * check */
+  bool len_ok = f.len >= 1 && whole[0] == f.len - 1;
+  check(stream_ok == (whole_ok && len_ok), "same CRC verdict");
+  if (f.len >= 1 + HeaderLayout::LEN)
+    check(d.headerComplete(), "header complete");
+}
+
+/*
+ * Time decoding a frame as the interrupt handler does it (length byte,
+ * then RX_CHUNK sized chunks, then the rest) against decoding it all
+ * at once after it arrived.
+ */
+static void time_frame(const Frame &f, unsigned rounds,
+                       uint64_t *chunk_ns, uint64_t *chunks,
+                       uint64_t *last_ns, uint64_t *whole_ns) {
+  uint8_t buf[MAX_FRAME_LEN];
+  FrameDecoder d;
+
+  for (unsigned r = 0; r < rounds; ++r) {
+    memcpy(buf, f.data, f.len);
+    d.start(buf);
+    uint64_t t = now_ns();
+    d.feed(1);
+    while (f.len - d.length() > RX_CHUNK) {
+      d.feed(RX_CHUNK);
+      ++*chunks;
+    }
+    uint64_t t_last = now_ns();
+    *chunk_ns += t_last - t;
+    /* The last bytes arrive with the packet valid interrupt */
+    d.feed(f.len - d.length());
+    volatile bool ok = d.crcOk();
+    (void)ok;
+    *last_ns += now_ns() - t_last;
+
+    memcpy(buf, f.data, f.len);
+    t = now_ns();
+    volatile bool whole_ok = decode_whole(buf, f.len);
+    (void)whole_ok;
+    *whole_ns += now_ns() - t;
+  }
+}
+
+int main(int argc, char **argv) {
+  unsigned rounds = 100000;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:")) != -1) {
+    switch (opt) {
+      case 'n': rounds = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n rounds] [corpus file]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<Frame> frames;
+  if (optind < argc) {
+    if (!load_corpus(argv[optind], &frames)) {
+      fprintf(stderr, "Failed to load %s\n", argv[optind]);
+      return 1;
+    }
+  } else {
+    frames = builtin_corpus();
+  }
+
+  srand(1);
+  for (size_t i = 0; i < frames.size(); ++i)
+    compare(frames[i]);
+
+  /* Corrupted frames: flipped bits, wrong length bytes and frames of
+   * every length, including ones longer than the sketch receives */
+  for (unsigned i = 0; i < 10000; ++i) {
+    Frame f = frames[i % frames.size()];
+    if (i % 3 == 0)
+      f.data[rand() % f.len] ^= 1 << (rand() % 8);
+    else if (i % 3 == 1)
+      f.data[0] ^= 1 + rand() % 255;
+    if (i % 5 == 0) {
+      f.len = 1 + rand() % (MAX_FRAME_LEN - 1);
+      for (unsigned j = 0; j < f.len; ++j)
+        f.data[j] = rand();
+    }
+    compare(f);
+  }
+
+  uint64_t chunk_ns = 0, chunks = 0, last_ns = 0, whole_ns = 0;
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    time_frame(frames[i], rounds, &chunk_ns, &chunks, &last_ns, &whole_ns);
+    bytes += (uint64_t)frames[i].len * rounds;
+  }
+  uint64_t total = (uint64_t)frames.size() * rounds;
+
+  printf("frames:          %zu x %u rounds\n", frames.size(), rounds);
+  printf("per chunk:       %.1f ns (%u bytes)\n",
+         chunks ? (double)chunk_ns / chunks : 0.0, RX_CHUNK);
+  printf("after last byte: %.1f ns per frame (streaming)\n", (double)last_ns / total);
+  printf("after last byte: %.1f ns per frame (whole frame)\n", (double)whole_ns / total);
+  printf("total:           %.2f ns/byte (streaming), %.2f ns/byte (whole frame)\n",
+         (double)(chunk_ns + last_ns) / bytes, (double)whole_ns / bytes);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,227 @@
+/*
+ * Compare the binary telemetry frames against the STATUS text line
+ * they replace: bytes on the wire and time to produce them. Also runs
+ * the frames through TelemetryDecoder, to check it reproduces the
+ * STATUS lines, both from a clean stream and one with corrupted bytes.
+ *
+ * Usage: bench_telemetry [-n updates] [-d devices] [-k keyframe interval]
+ *
+ * Exits with an error when a decoded STATUS line does not match.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <TStreaming.h>
+
+#include "Bench.h"
+#include "Util.h"
+#include "Telemetry.h"
+#include "TelemetryDecoder.h"
+
+/* Print that collects the output in a string */
+class StringPrint : public Print {
+public:
+  virtual size_t write(uint8_t c) { str += (char)c; return 1; }
+  virtual size_t write(const uint8_t *buf, size_t size) { str.append((const char *)buf, size); return size; }
+
+  std::string str;
+};
+
+/* The STATUS line, as printed by printStatus() in the sketch */
+static void print_status_line(Print &p, unsigned long time, bool kettle_status) {
+  p << "STATUS\t" << time << "\t";
+  for (size_t i = 0; i < lengthof(devices); ++i) {
+    Device *d = &devices[i];
+    if (!d->address) break;
+    if (d->type != DeviceType::RADIATOR && d->type != DeviceType::WALL) continue;
+
+    p << V<ActualTemp>(d->actual_temp) << "\t" << V<SetTemp>(d->set_temp) << "\t";
+    if (d->type == DeviceType::RADIATOR)
+      p << V<ValvePos>(d->data.radiator.valve_pos);
+    else
+      p << "NA";
+    p << "\t";
+  }
+  p << (kettle_status ? "1" : "0") << endl;
+}
+
+/* Strip the time column, which is taken at slightly different moments */
+static std::string without_time(const std::string &line) {
+  size_t first = line.find('\t');
+  size_t second = line.find('\t', first + 1);
+  return line.substr(0, first) + line.substr(second);
+}
+
+static void setup_devices(unsigned num) {
+  memset(devices, 0, sizeof(devices));
+  for (unsigned i = 0; i < num; ++i) {
+    Device *d = &devices[i];
+    d->address = 0x010000 + i * 0x1111;
+    /* Mix in some devices not shown in the STATUS line */
+    d->type = (i % 5 == 4) ? DeviceType::WALL : (i % 7 == 6) ? DeviceType::CUBE : DeviceType::RADIATOR;
+    d->set_temp = 40;
+    d->actual_temp = ACTUAL_TEMP_UNKNOWN;
+    d->data.radiator.valve_pos = VALVE_UNKNOWN;
+  }
+}
+
+/* Change one field of one device, like a received packet would */
+static void random_update(unsigned num, bool *kettle_status) {
+  Device *d = &devices[rand() % num];
+  switch (rand() % 4) {
+    case 0:
+      d->set_temp = 30 + rand() % 15;
+      break;
+    case 1:
+      if (d->actual_temp == ACTUAL_TEMP_UNKNOWN)
+        d->actual_temp = 200;
+      d->actual_temp += rand() % 5 - 2;
+      break;
+    case 2:
+      if (d->type == DeviceType::RADIATOR)
+        d->data.radiator.valve_pos = rand() % 65;
+      break;
+    case 3:
+      if (rand() % 8 == 0)
+        *kettle_status = !*kettle_status;
+      break;
+  }
+}
+
+/* A frame in the mixed stream, and the STATUS line it should decode to */
+struct Expected {
+  size_t end;
+  std::string status;
+};
+
+/* Decode stream and check that every frame applied matches what was
+ * expected at that offset. Returns the number of frames applied, or -1
+ * on a mismatch. */
+static long check_decode(const std::vector<uint8_t> &stream, const std::vector<Expected> &expected,
+                         TelemetryDecoder *decoder) {
+  size_t next = 0;
+  long applied = 0;
+  for (size_t i = 0; i < stream.size(); ++i) {
+    if (!decoder->feed(stream[i]))
+      continue;
+
+    while (next < expected.size() && expected[next].end < i + 1)
+      ++next;
+    if (next == expected.size() || expected[next].end != i + 1) {
+      fprintf(stderr, "Frame decoded at offset %zu, where none was sent\n", i + 1);
+      return -1;
+    }
+
+    StringPrint s;
+    decoder->printStatus(s);
+    if (without_time(s.str) != without_time(expected[next].status)) {
+      fprintf(stderr, "Mismatch at offset %zu:\n  expected: %s  decoded:  %s",
+              i + 1, expected[next].status.c_str(), s.str.c_str());
+      return -1;
+    }
+    applied++;
+  }
+  return applied;
+}
+
+int main(int argc, char **argv) {
+  unsigned long updates = 100000;
+  unsigned num = 8;
+  unsigned keyframe_interval = 100;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:d:k:")) != -1) {
+    switch (opt) {
+      case 'n': updates = strtoul(optarg, NULL, 0); break;
+      case 'd': num = strtoul(optarg, NULL, 0); break;
+      case 'k': keyframe_interval = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n updates] [-d devices] [-k keyframe interval]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (num < 1 || num > lengthof(devices) || keyframe_interval < 1) {
+    fprintf(stderr, "Need 1 to %zu devices and a keyframe interval of at least 1\n", lengthof(devices));
+    return 1;
+  }
+
+  srand(1);
+  setup_devices(num);
+
+  /* Build a stream like the sketch would send: the text STATUS line,
+   * followed by the frame with the same changes */
+  static TelemetryEncoder encoder;
+  std::vector<uint8_t> stream;
+  std::vector<Expected> expected;
+  uint64_t text_bytes = 0, binary_bytes = 0, frames = 0;
+  uint64_t text_ns = 0, binary_ns = 0;
+  bool kettle_status = false;
+
+  for (unsigned long i = 0; i < updates; ++i) {
+    random_update(num, &kettle_status);
+    if (i % keyframe_interval == 0)
+      encoder.requestKeyframe();
+
+    StringPrint text;
+    uint64_t start = now_ns();
+    print_status_line(text, millis(), kettle_status);
+    text_ns += now_ns() - start;
+
+    StringPrint binary;
+    start = now_ns();
+    encoder.update(binary, kettle_status);
+    binary_ns += now_ns() - start;
+
+    text_bytes += text.str.size();
+    binary_bytes += binary.str.size();
+    stream.insert(stream.end(), text.str.begin(), text.str.end());
+    if (binary.str.size()) {
+      stream.insert(stream.end(), binary.str.begin(), binary.str.end());
+      expected.push_back({stream.size(), text.str});
+      frames++;
+    }
+  }
+
+  printf("%lu updates, %u devices, keyframe every %u updates\n", updates, num, keyframe_interval);
+  printf("%-10s %12s %10s %10s\n", "format", "bytes", "bytes/upd", "ns/upd");
+  printf("%-10s %12llu %10.1f %10.0f\n", "text", (unsigned long long)text_bytes,
+         (double)text_bytes / updates, (double)text_ns / updates);
+  printf("%-10s %12llu %10.1f %10.0f\n", "telemetry", (unsigned long long)binary_bytes,
+         (double)binary_bytes / updates, (double)binary_ns / updates);
+
+  /* Clean stream: every frame should be applied */
+  static TelemetryDecoder clean;
+  uint64_t start = now_ns();
+  long applied = check_decode(stream, expected, &clean);
+  uint64_t decode_ns = now_ns() - start;
+  if (applied < 0)
+    return 1;
+  printf("decode: %.1f ns/byte, %ld/%llu frames, %u junk bytes\n",
+         (double)decode_ns / stream.size(), applied, (unsigned long long)frames, clean.junk);
+  if ((uint64_t)applied != frames || clean.invalid || clean.gaps) {
+    fprintf(stderr, "Clean stream did not decode completely\n");
+    return 1;
+  }
+
+  /* Corrupt about one in 1000 bytes: the decoder should never produce
+   * a wrong STATUS line, and pick up again at the next keyframe */
+  std::vector<uint8_t> corrupt = stream;
+  for (size_t i = 0; i < corrupt.size(); ++i)
+    if (rand() % 1000 == 0)
+      corrupt[i] ^= 1 << (rand() % 8);
+
+  static TelemetryDecoder noisy;
+  applied = check_decode(corrupt, expected, &noisy);
+  if (applied < 0)
+    return 1;
+  printf("corrupted: %ld/%llu frames applied, %u invalid, %u gaps, %u skipped\n",
+         applied, (unsigned long long)frames, noisy.invalid, noisy.gaps, noisy.skipped);
+
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
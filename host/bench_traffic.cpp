@@ -0,0 +1,894 @@
+/*
+ * Generate the radio traffic of a MAX! installation and feed it through
+ * the receive pipeline of the sketch, on a simulated clock, to see how
+ * it holds up under load.
+ *
+ * Each cube has its wall thermostats, radiators, a shutter contact and
+ * an eco button. Devices pair with their cube at the start, then send
+ * their state every few minutes. The cube sets temperatures and the
+ * time now and then. At one point the first cube pushes its
+ * configuration to all of its devices, which is the peak load: a
+ * command and an ack every few hundred ms, for minutes. Halfway, a
+ * device is removed, and a new one replaces it a few minutes later.
+ * Between them, these send every message type in message_types[]. All
+ * frames are built with build_frame(), so they are whitened and have a
+ * correct CRC.
+ *
+ * Senders listen before talking, so frames never overlap on the air.
+ * Devices ack the commands of their cube. The cube resends a command
+ * when it misses the ack, and the Arduino misses frames at the same
+ * rate.
+ *
+ * The frames arrive at the simulated radio (see arduino/RF22.h), so
+ * MaxRF22 receives them into its queue, or drops them when it is full.
+ * The sketch itself (Max.ino, with the configuration from Max.h) runs
+ * on the simulated clock: loop() is called to take each frame from the
+ * queue. On the board, that takes a fixed CPU time, plus the time spent
+ * waiting for room in the serial output buffer, which drains at the
+ * serial baud rate.
+ *
+ * Reports dropped frames, how full the device table got (and how many
+ * messages found no room in it), when the replacement got the slot of
+ * the removed device and the latency from the end of a frame on the air
+ * until loop() is done with it. Each node numbers its
+ * messages like a real device, so the frames LinkStats estimates lost
+ * from gaps in those numbers can be checked against the messages that
+ * really went missing.
+ *
+ * Usage: bench_traffic [-c cubes] [-w walls] [-r radiators] [-m minutes]
+ *                      [-p push at seconds] [-l loss percent]
+ *                      [-u cpu us per frame] [-b baud] [-o levels] [-a]
+ *                      [-s serial output file] [-f]
+ *   -w, -r  devices per cube, by default as many as fit in the device
+ *           table (with the cube, a shutter contact and a button)
+ *   -p      0 to skip the configuration push
+ *   -b      0 for output that never waits
+ *   -o      serial output levels, like the "sub" command (default rms)
+ *   -a      only allow the first cube and its devices in address_filter
+ *   -s      save what the sketch printed to serial, with -o s this
+ *           records STATUS lines for bench_history
+ *   -f      send "forget" for the removed device, like a user would,
+ *           instead of waiting for it to be evicted
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <deque>
+#include <queue>
+#include <set>
+#include <vector>
+
+#include <TStreaming.h>
+
+#include "Bench.h"
+#include "AddressFilter.h"
+#include "DeviceTable.h"
+#include "FrameHandler.h"
+#include "LoopStats.h"
+#include "MaxRF22.h"
+#include "MaxRFProto.h"
+#include "Output.h"
+
+/* From Max.ino */
+void setup();
+void loop();
+extern MaxRF22 rf;
+extern LoopStats loop_stats;
+extern FrameHandler frame_handler;
+extern BufferedPrint<SERIAL_OUTPUT_BUFFER> serial_out;
+extern OutputFilter serial_filter;
+
+const uint8_t RSSI = 0x5a;
+
+const unsigned long MS = 1000;
+const unsigned long SECOND = 1000 * MS;
+const unsigned long MINUTE = 60 * SECOND;
+
+/* Devices send their state this often, give or take JITTER */
+const unsigned long STATE_INTERVAL = 3 * MINUTE;
+const unsigned long SENSOR_INTERVAL = 10 * MINUTE;
+const unsigned long SET_TEMP_INTERVAL = 5 * MINUTE;
+const unsigned long JITTER = 30 * SECOND;
+const unsigned long TIME_INTERVAL = 60 * MINUTE;
+/* A device acks a command this long after it */
+const unsigned long ACK_MIN = 20 * MS, ACK_MAX = 300 * MS;
+/* The cube resends a command when no ack arrived this long after it */
+const unsigned long ACK_TIMEOUT = 500 * MS;
+const uint8_t RETRIES = 3;
+/* After a message, a device keeps listening for a while, so the next
+ * command to it needs no long preamble */
+const unsigned long AWAKE = 3 * SECOND;
+/* The replacement of the removed device joins this long after it */
+const unsigned long REPLACE_AFTER = 5 * MINUTE;
+
+const size_t BROADCAST = (size_t)-1;
+const size_t NONE = (size_t)-1;
+
+/* A message a node wants to send */
+struct Tx {
+  /* When it wants to send, in us */
+  unsigned long time;
+  /* Keeps messages for the same time in order */
+  unsigned long order;
+  size_t from;
+  size_t to;
+  MessageType type;
+  uint8_t flags;
+  uint8_t seqnum;
+  /* Counts the messages of its sender, like seqnum but without
+   * wrapping */
+  unsigned long msg;
+  /* A command from a cube, which is acked */
+  bool command;
+  /* The command went through the cube's queue already */
+  bool queued;
+  uint8_t tries;
+  /* The node sends its state again after its interval */
+  bool periodic;
+  uint8_t payload_len;
+  uint8_t payload[32];
+
+  /* For std::priority_queue, which puts the largest first */
+  bool operator<(const Tx &other) const {
+    if (this->time != other.time)
+      return this->time > other.time;
+    return this->order > other.order;
+  }
+};
+
+enum class Kind : uint8_t {CUBE, WALL, RADIATOR, SHUTTER, BUTTON};
+
+struct Node {
+  Kind kind;
+  uint32_t addr;
+  /* Index of its cube */
+  size_t cube;
+  uint8_t seqnum;
+  unsigned long messages;
+  /* Which of its messages loop() handled, by Tx::msg */
+  std::vector<bool> handled;
+  /* It lost its slot in the device table after it had one */
+  bool lost_slot;
+  bool removed;
+  /* When it pairs with its cube, in us */
+  unsigned long joins;
+  unsigned long awake_until;
+  uint8_t set_temp;
+  uint16_t actual_temp;
+  uint8_t valve_pos;
+  /* Cubes only: commands waiting for the current one to be acked */
+  std::deque<Tx> commands;
+  Tx current;
+  /* End of the current command on the air */
+  unsigned long sent_at;
+  bool busy;
+};
+
+/* A frame in the radio's queue, which loop() has yet to take */
+struct Arrival {
+  /* End of the frame on the air, in us */
+  unsigned long time;
+  /* Sent by and to */
+  size_t from, to;
+  unsigned long msg;
+  MessageType type;
+};
+
+struct Stats {
+  unsigned long sent[256];
+  unsigned long frames, resent, lost, dropped, handled;
+  unsigned long crc_errors, parse_failures, duplicates, rejected, no_slot;
+  /* Frames LinkStats estimates lost, and messages that really went
+   * missing between the first and last one handled of each sender */
+  unsigned long link_lost, missing;
+  unsigned long airtime_ms, output_bytes, serial_wait_us;
+  uint8_t max_queue;
+  uint16_t max_devices;
+  /* When the removed device was reset and the replacement got a slot,
+   * in us */
+  unsigned long removed_at, replaced_at;
+};
+
+static unsigned long random_between(unsigned long min, unsigned long max) {
+  return min + (unsigned long)rand() % (max - min + 1);
+}
+
+static unsigned long jitter(unsigned long interval) {
+  return random_between(interval - JITTER, interval + JITTER);
+}
+
+class Simulation {
+public:
+  Simulation(unsigned loss, unsigned long cpu_us, unsigned long baud);
+
+  void populate(unsigned cubes, unsigned walls, unsigned radiators);
+  void schedule(unsigned long end, unsigned long push_at);
+  void run(unsigned long end);
+  void report(unsigned long end);
+
+  std::vector<Node> nodes;
+  Stats stats;
+  /* Joins later to replace the removed device, or NONE */
+  size_t replacement;
+  /* Send "forget" over serial a minute after the device was removed
+   * (after its last ack) */
+  bool forget;
+
+private:
+  Tx message(size_t from, size_t to, MessageType type, unsigned long time);
+  void command(size_t cube, size_t to, MessageType type, unsigned long time,
+               const uint8_t *payload, uint8_t len);
+  void push(Tx &tx);
+  void pushConfig(size_t cube, unsigned long time);
+  void sendNext(size_t cube, unsigned long time);
+  void state(size_t node, unsigned long time);
+  void transmit(Tx &tx);
+  void acked(size_t cube, unsigned long time);
+  void receive(const uint8_t *frame, uint8_t len, unsigned long time, const Tx &tx);
+  void advance(unsigned long time);
+  void handle(const Arrival &a, unsigned long start);
+
+  unsigned loss;
+  unsigned long cpu_us;
+  /* Time to write a byte to serial, 0 for no limit */
+  double byte_us;
+
+  std::priority_queue<Tx> pending;
+  unsigned long order;
+  unsigned long air_free;
+
+  std::deque<Arrival> arrivals;
+  unsigned long loop_free;
+  /* Bytes in the serial output buffer at serial_time */
+  double serial_backlog;
+  unsigned long serial_time;
+
+  unsigned long push_start, push_end;
+  /* End of the frame on the air and latency of each frame handled */
+  std::vector<std::pair<unsigned long, unsigned long> > latency;
+};
+
+Simulation::Simulation(unsigned loss, unsigned long cpu_us, unsigned long baud)
+  : replacement(NONE), forget(false), loss(loss), cpu_us(cpu_us), order(0), air_free(0),
+    loop_free(0), serial_backlog(0), serial_time(0), push_start(0),
+    push_end(0) {
+  this->byte_us = baud ? 10.0 * SECOND / baud : 0;
+  memset(&this->stats, 0, sizeof(this->stats));
+}
+
+void Simulation::populate(unsigned cubes, unsigned walls, unsigned radiators) {
+  std::set<uint32_t> used;
+  for (unsigned c = 0; c < cubes; ++c) {
+    size_t cube = this->nodes.size();
+    for (unsigned i = 0; i < 3 + walls + radiators; ++i) {
+      Node n = Node();
+      if (i == 0)
+        n.kind = Kind::CUBE;
+      else if (i == 1)
+        n.kind = Kind::SHUTTER;
+      else if (i == 2)
+        n.kind = Kind::BUTTON;
+      else if (i < 3 + walls)
+        n.kind = Kind::WALL;
+      else
+        n.kind = Kind::RADIATOR;
+
+      do {
+        n.addr = (rand() & 0xffffff) | 1;
+      } while (used.count(n.addr));
+      used.insert(n.addr);
+      n.cube = cube;
+      n.set_temp = 40;
+      n.actual_temp = 195 + rand() % 20;
+      n.valve_pos = rand() % 30;
+      this->nodes.push_back(n);
+    }
+  }
+
+  /* A new device of the same kind as the last one, which replaces it
+   * (see schedule()) */
+  if (this->nodes.back().kind != Kind::CUBE) {
+    Node n = this->nodes.back();
+    do {
+      n.addr = (rand() & 0xffffff) | 1;
+    } while (used.count(n.addr));
+    this->replacement = this->nodes.size();
+    this->nodes.push_back(n);
+  }
+}
+
+Tx Simulation::message(size_t from, size_t to, MessageType type, unsigned long time) {
+  Tx tx = Tx();
+  tx.time = time;
+  tx.from = from;
+  tx.to = to;
+  tx.type = type;
+  return tx;
+}
+
+void Simulation::push(Tx &tx) {
+  tx.order = this->order++;
+  this->pending.push(tx);
+}
+
+/* A command from a cube, queued at time and sent once the commands
+ * before it are acked */
+void Simulation::command(size_t cube, size_t to, MessageType type, unsigned long time,
+                         const uint8_t *payload, uint8_t len) {
+  Tx tx = message(cube, to, type, time);
+  tx.command = true;
+  if (len)
+    memcpy(tx.payload, payload, len);
+  tx.payload_len = len;
+  push(tx);
+}
+
+void Simulation::sendNext(size_t cube, unsigned long time) {
+  Node &c = this->nodes[cube];
+  /* Removed devices don't get anything anymore */
+  while (!c.commands.empty() && this->nodes[c.commands.front().to].removed)
+    c.commands.pop_front();
+  if (c.busy || c.commands.empty())
+    return;
+  Tx tx = c.commands.front();
+  c.commands.pop_front();
+  tx.time = time;
+  tx.seqnum = c.seqnum++;
+  tx.msg = c.messages++;
+  c.current = tx;
+  c.busy = true;
+  push(tx);
+}
+
+/* The configuration the cube sends to each device when it is added or
+ * changed in the software */
+void Simulation::pushConfig(size_t cube, unsigned long time) {
+  static const uint8_t temperatures[] = {0x2b, 0x22, 0x28, 0x3c, 0x0a, 0x00, 0x00};
+  static const uint8_t valve[] = {0x64, 0x00, 0x0c, 0x0f, 0x00, 0x00};
+  /* Day and 13 switch points */
+  uint8_t week[27] = {0};
+  for (uint8_t i = 1; i < sizeof(week); i += 2) {
+    week[i] = 0x40;
+    week[i + 1] = 0x20 + i;
+  }
+
+  for (size_t i = cube + 1; i < this->nodes.size() && this->nodes[i].cube == cube; ++i) {
+    Node &n = this->nodes[i];
+    if ((n.kind != Kind::WALL && n.kind != Kind::RADIATOR) || n.joins > time)
+      continue;
+
+    command(cube, i, MessageType::WAKE_UP, time, (const uint8_t*)"\x3f", 1);
+    for (uint8_t day = 0; day < 7; ++day) {
+      week[0] = day;
+      command(cube, i, MessageType::CONFIG_WEEK_PROFILE, time, week, sizeof(week));
+    }
+    command(cube, i, MessageType::CONFIG_TEMPERATURES, time, temperatures, sizeof(temperatures));
+    if (n.kind == Kind::RADIATOR)
+      command(cube, i, MessageType::CONFIG_VALVE, time, valve, sizeof(valve));
+    command(cube, i, MessageType::SET_GROUP_ID, time, (const uint8_t*)"\x01", 1);
+
+    /* Link to the device before it */
+    Node &partner = this->nodes[i - 1];
+    uint8_t link[4] = {(uint8_t)(partner.addr >> 16), (uint8_t)(partner.addr >> 8),
+                       (uint8_t)partner.addr, (uint8_t)partner.kind};
+    command(cube, i, MessageType::ADD_LINK_PARTNER, time, link, sizeof(link));
+    command(cube, i, MessageType::SET_COMFORT_TEMPERATURE, time, NULL, 0);
+    command(cube, i, MessageType::SET_ECO_TEMPERATURE, time, NULL, 0);
+    if (n.kind == Kind::WALL)
+      command(cube, i, MessageType::SET_DISPLAY_ACTUAL_TEMPERATURE, time, (const uint8_t*)"\x04", 1);
+    command(cube, i, MessageType::SET_TEMPERATURE, time, (const uint8_t*)"\x28", 1);
+  }
+}
+
+/* Send the state of a device, and again after its interval */
+void Simulation::state(size_t node, unsigned long time) {
+  Node &n = this->nodes[node];
+  Tx tx = message(node, BROADCAST, MessageType::THERMOSTAT_STATE, time);
+  tx.flags = 0x04;
+  tx.periodic = true;
+
+  switch (n.kind) {
+    case Kind::RADIATOR:
+      /* The valve follows the difference with the set temperature */
+      n.actual_temp += rand() % 3 - 1;
+      if (n.actual_temp < n.set_temp * 5 && n.valve_pos < 96)
+        n.valve_pos += rand() % 5;
+      else if (n.valve_pos >= 4)
+        n.valve_pos -= rand() % 5;
+      tx.payload[0] = 0x18; /* auto, dst */
+      tx.payload[1] = n.valve_pos;
+      tx.payload[2] = n.set_temp;
+      tx.payload[3] = n.actual_temp >> 8;
+      tx.payload[4] = n.actual_temp;
+      tx.payload_len = 5;
+      break;
+    case Kind::WALL:
+      n.actual_temp += rand() % 3 - 1;
+      tx.type = MessageType::WALL_THERMOSTAT_STATE;
+      tx.payload[0] = n.set_temp | (n.actual_temp >> 8) << 7;
+      tx.payload[1] = n.actual_temp;
+      tx.payload_len = 2;
+      break;
+    case Kind::SHUTTER:
+      tx.type = MessageType::SHUTTER_CONTACT_STATE;
+      tx.payload[0] = rand() % 2 ? 0x12 : 0x10;
+      tx.payload_len = 1;
+      break;
+    case Kind::BUTTON:
+      tx.type = MessageType::PUSH_BUTTON_STATE;
+      tx.payload[0] = 0x50;
+      tx.payload[1] = rand() % 2;
+      tx.payload_len = 2;
+      break;
+    case Kind::CUBE:
+      return;
+  }
+  push(tx);
+}
+
+void Simulation::schedule(unsigned long end, unsigned long push_at) {
+  static const uint8_t time_info[] = {0x0d, 0x0c, 0x1e, 0x05, 0x2a};
+
+  /* The last device of the last cube is removed halfway */
+  size_t last = this->nodes.size() - 1;
+  if (this->replacement != NONE) {
+    this->nodes[this->replacement].joins = end / 2 + REPLACE_AFTER;
+    last = this->replacement - 1;
+  }
+
+  for (size_t i = 0; i < this->nodes.size(); ++i) {
+    Node &n = this->nodes[i];
+    if (n.kind == Kind::CUBE) {
+      /* Set a temperature on one of its thermostats now and then */
+      std::vector<size_t> thermostats;
+      for (size_t j = i + 1; j < this->nodes.size() && this->nodes[j].cube == i; ++j)
+        if ((this->nodes[j].kind == Kind::WALL || this->nodes[j].kind == Kind::RADIATOR) &&
+            !this->nodes[j].joins)
+          thermostats.push_back(j);
+      if (thermostats.empty())
+        continue;
+      for (unsigned long t = jitter(SET_TEMP_INTERVAL); t < end; t += jitter(SET_TEMP_INTERVAL)) {
+        uint8_t set_temp = 34 + rand() % 10;
+        command(i, thermostats[rand() % thermostats.size()], MessageType::SET_TEMPERATURE,
+                t, &set_temp, 1);
+      }
+      continue;
+    }
+
+    /* Pairing: firmware version, device type, test result and serial */
+    uint8_t pairing[] = {0x10, (uint8_t)n.kind, 0x00, 'N', 'E', 'Q', '0', '1', '2', '3', '4', '5', '6'};
+    Tx ping = message(i, BROADCAST, MessageType::PAIR_PING,
+                      n.joins + random_between(0, 10 * SECOND));
+    memcpy(ping.payload, pairing, sizeof(pairing));
+    ping.payload_len = sizeof(pairing);
+    push(ping);
+
+    state(i, n.joins + random_between(15 * SECOND, 15 * SECOND + STATE_INTERVAL));
+
+    if (n.kind == Kind::WALL || n.kind == Kind::RADIATOR)
+      for (unsigned long t = n.joins + random_between(20 * SECOND, TIME_INTERVAL); t < end;
+           t += TIME_INTERVAL)
+        command(n.cube, i, MessageType::TIME_INFORMATION, t, time_info, sizeof(time_info));
+  }
+
+  if (push_at && push_at < end) {
+    pushConfig(0, push_at);
+    this->push_start = push_at;
+  }
+
+  if (this->nodes[last].kind != Kind::CUBE) {
+    Node &partner = this->nodes[last - 1];
+    uint8_t link[4] = {(uint8_t)(partner.addr >> 16), (uint8_t)(partner.addr >> 8),
+                       (uint8_t)partner.addr, (uint8_t)partner.kind};
+    size_t cube = this->nodes[last].cube;
+    command(cube, last, MessageType::REMOVE_LINK_PARTNER, end / 2, link, sizeof(link));
+    command(cube, last, MessageType::REMOVE_GROUP_ID, end / 2, NULL, 0);
+    command(cube, last, MessageType::RESET, end / 2, NULL, 0);
+  }
+}
+
+/* The current command of the cube was acked */
+void Simulation::acked(size_t cube, unsigned long time) {
+  Node &c = this->nodes[cube];
+  c.busy = false;
+  if (c.current.type == MessageType::RESET) {
+    Node &n = this->nodes[c.current.to];
+    n.removed = true;
+    this->stats.removed_at = time;
+  }
+  if (cube == 0 && this->push_start && !this->push_end && c.commands.empty())
+    this->push_end = time;
+  sendNext(cube, time + random_between(10 * MS, 50 * MS));
+}
+
+void Simulation::transmit(Tx &tx) {
+  Node &from = this->nodes[tx.from];
+  if (from.removed)
+    return;
+  /* Commands are numbered when the cube sends them the first time,
+   * replies have the seqnum of the message they answer */
+  if (!tx.command && tx.type != MessageType::ACK && tx.type != MessageType::PAIR_PONG) {
+    tx.seqnum = from.seqnum++;
+    tx.msg = from.messages++;
+  }
+
+  uint8_t buf[MAX_FRAME_LEN];
+  uint32_t to = tx.to == BROADCAST ? 0 : this->nodes[tx.to].addr;
+  uint8_t len = build_frame(buf, tx.seqnum, tx.flags, tx.type, from.addr, to, 0,
+                            tx.payload, tx.payload_len);
+
+  /* Listen before talk, with a random backoff when the air is busy */
+  unsigned long start = tx.time;
+  if (start < this->air_free)
+    start = this->air_free + random_between(0, 10 * MS);
+  /* Battery powered devices need a long preamble to wake up */
+  bool burst = tx.command && start >= this->nodes[tx.to].awake_until;
+  uint16_t airtime = frame_airtime(len, burst ? RF_BURST_PREAMBLE_NIBBLES : RF_PREAMBLE_NIBBLES);
+  unsigned long end = start + airtime * MS;
+  this->air_free = end;
+
+  this->stats.frames++;
+  this->stats.sent[(uint8_t)tx.type]++;
+  this->stats.airtime_ms += airtime;
+  if (tx.tries)
+    this->stats.resent++;
+  receive(buf, len, end, tx);
+
+  if (tx.to != BROADCAST)
+    this->nodes[tx.to].awake_until = end + AWAKE;
+
+  if (tx.command) {
+    from.sent_at = end;
+    Node &n = this->nodes[tx.to];
+    if (tx.type == MessageType::SET_TEMPERATURE)
+      n.set_temp = tx.payload[0] & 0x3f;
+    Tx ack = message(tx.to, tx.from, MessageType::ACK, end + random_between(ACK_MIN, ACK_MAX));
+    ack.flags = 0x02;
+    ack.seqnum = tx.seqnum;
+    /* Radiators include their state, other devices are padded to the
+     * length the parser wants */
+    ack.payload[0] = n.kind == Kind::RADIATOR ? 0x01 : 0x00;
+    ack.payload[1] = 0x19;
+    ack.payload[2] = n.valve_pos;
+    ack.payload[3] = n.set_temp;
+    ack.payload_len = 4;
+    push(ack);
+  } else if (tx.type == MessageType::ACK) {
+    Node &cube = this->nodes[tx.to];
+    if ((unsigned)rand() % 100 < this->loss && cube.current.tries < RETRIES) {
+      /* The cube missed the ack, so it sends the command again */
+      cube.current.tries++;
+      cube.current.time = cube.sent_at + ACK_TIMEOUT;
+      push(cube.current);
+    } else {
+      acked(tx.to, end);
+    }
+  } else if (tx.type == MessageType::PAIR_PING) {
+    Tx pong = message(from.cube, tx.from, MessageType::PAIR_PONG, end + 50 * MS);
+    pong.seqnum = tx.seqnum;
+    pong.payload_len = 1;
+    push(pong);
+  }
+
+  if (tx.periodic)
+    state(tx.from, end + jitter(from.kind == Kind::SHUTTER || from.kind == Kind::BUTTON
+                                ? SENSOR_INTERVAL : STATE_INTERVAL));
+}
+
+/* A frame was received by the radio, whose interrupt handler decodes
+ * it into its queue */
+void Simulation::receive(const uint8_t *frame, uint8_t len, unsigned long time, const Tx &tx) {
+  if ((unsigned)rand() % 100 < this->loss) {
+    this->stats.lost++;
+    return;
+  }
+
+  advance(time);
+  set_simulated_time(time);
+  uint16_t overflows = rf.rxOverflows();
+  rf.airReceive(frame, len, RSSI);
+  if (rf.rxOverflows() != overflows)
+    return;
+
+  Arrival a = {time, tx.from, tx.to, tx.msg, tx.type};
+  this->arrivals.push_back(a);
+}
+
+/* Let loop() handle the frames it gets to before time */
+void Simulation::advance(unsigned long time) {
+  while (!this->arrivals.empty()) {
+    unsigned long start = std::max(this->loop_free, this->arrivals.front().time);
+    if (start > time)
+      break;
+    Arrival a = this->arrivals.front();
+    this->arrivals.pop_front();
+    handle(a, start);
+  }
+}
+
+/* Frames loop() did not (fully) handle */
+static uint32_t not_handled() {
+  return loop_stats.invalid_length + loop_stats.crc_errors + loop_stats.parse_failures
+         + frame_handler.duplicates.duplicates + address_filter.rejected;
+}
+
+/* Run loop(), which takes the oldest frame from the radio's queue */
+void Simulation::handle(const Arrival &a, unsigned long start) {
+  set_simulated_time(start);
+  /* A device that had a slot but is not in the table now was evicted.
+   * Its LinkStats start over when this message adds it again. */
+  Node &from = this->nodes[a.from];
+  if (!from.handled.empty() && !device_table.find(from.addr))
+    from.lost_slot = true;
+  if (a.to != BROADCAST && !this->nodes[a.to].handled.empty() &&
+      !device_table.find(this->nodes[a.to].addr))
+    this->nodes[a.to].lost_slot = true;
+  if (this->forget && this->stats.removed_at && start >= this->stats.removed_at + MINUTE) {
+    char line[32];
+    snprintf(line, sizeof(line), "forget %06x\r\n", this->nodes[this->replacement - 1].addr);
+    Serial.input += line;
+    this->forget = false;
+  }
+  uint32_t frames = loop_stats.frames;
+  uint32_t skipped = not_handled();
+  uint32_t queued = serial_out.queued;
+  loop();
+  uint32_t bytes = serial_out.queued - queued;
+  check(loop_stats.frames == frames + 1, "loop() takes a frame");
+
+  if (not_handled() == skipped) {
+    /* The parser looks up (or adds) both devices in the table */
+    bool slot = device_table.find(from.addr);
+    if (!slot || (a.to != BROADCAST && !device_table.find(this->nodes[a.to].addr)))
+      this->stats.no_slot++;
+    /* LinkStats only sees the messages of devices in the table */
+    if (a.type != MessageType::ACK && a.type != MessageType::PAIR_PONG && slot) {
+      if (from.handled.size() <= a.msg)
+        from.handled.resize(a.msg + 1);
+      from.handled[a.msg] = true;
+    }
+  }
+  if (this->replacement != NONE && !this->stats.replaced_at &&
+      device_table.find(this->nodes[this->replacement].addr))
+    this->stats.replaced_at = start;
+  if (device_table.count() > this->stats.max_devices)
+    this->stats.max_devices = device_table.count();
+
+  /* Output goes into the serial buffer, waiting when it is full */
+  unsigned long t = start + this->cpu_us;
+  unsigned long wait = 0;
+  if (this->byte_us) {
+    this->serial_backlog -= (t - this->serial_time) / this->byte_us;
+    if (this->serial_backlog < 0)
+      this->serial_backlog = 0;
+    double over = this->serial_backlog + bytes - SERIAL_OUTPUT_BUFFER;
+    if (over > 0)
+      wait = over * this->byte_us;
+    this->serial_backlog = std::min(this->serial_backlog + bytes, (double)SERIAL_OUTPUT_BUFFER);
+    this->serial_time = t + wait;
+  }
+  this->loop_free = t + wait;
+  this->stats.output_bytes += bytes;
+  this->stats.serial_wait_us += wait;
+  this->latency.push_back(std::make_pair(a.time, this->loop_free - a.time));
+}
+
+void Simulation::run(unsigned long end) {
+  while (!this->pending.empty()) {
+    Tx tx = this->pending.top();
+    this->pending.pop();
+    if (tx.time >= end)
+      break;
+    if (tx.command && !tx.queued) {
+      tx.queued = true;
+      this->nodes[tx.from].commands.push_back(tx);
+      sendNext(tx.from, tx.time);
+      continue;
+    }
+    transmit(tx);
+  }
+  /* Handle whatever is still queued */
+  advance((unsigned long)-1);
+  if (this->push_start && !this->push_end)
+    this->push_end = end;
+}
+
+static void print_latency(const char *name, std::vector<unsigned long> &l) {
+  if (l.empty())
+    return;
+  std::sort(l.begin(), l.end());
+  printf("%-16s %zu frames, median %.1f, 90%% %.1f, 99%% %.1f, max %.1f ms\n",
+         name, l.size(), l[l.size() / 2] / 1000.0, l[l.size() * 9 / 10] / 1000.0,
+         l[l.size() * 99 / 100] / 1000.0, l.back() / 1000.0);
+}
+
+void Simulation::report(unsigned long end) {
+  unsigned counts[5] = {0};
+  for (size_t i = 0; i < this->nodes.size(); ++i)
+    if (i != this->replacement)
+      counts[(uint8_t)this->nodes[i].kind]++;
+
+  printf("population:      %u cubes, %u walls, %u radiators, %u shutters, %u buttons%s\n",
+         counts[(uint8_t)Kind::CUBE], counts[(uint8_t)Kind::WALL],
+         counts[(uint8_t)Kind::RADIATOR], counts[(uint8_t)Kind::SHUTTER],
+         counts[(uint8_t)Kind::BUTTON], this->replacement != NONE ? ", 1 replacement" : "");
+  printf("simulated:       %lu min, air busy %.1f%%\n", end / MINUTE,
+         100.0 * this->stats.airtime_ms * MS / end);
+  printf("frames sent:     %lu (%lu resent)\n", this->stats.frames, this->stats.resent);
+  printf("lost on air:     %lu\n", this->stats.lost);
+  printf("dropped:         %lu (rx queue full, at most %u of %u used)\n",
+         this->stats.dropped, this->stats.max_queue, MAX_RF_RX_QUEUE);
+  printf("handled:         %lu (%lu duplicates, %lu rejected by address)\n",
+         this->stats.handled, this->stats.duplicates, this->stats.rejected);
+  printf("device table:    at most %u of %u used, %u evictions, full %u times,\n"
+         "                 %lu messages without a slot\n",
+         this->stats.max_devices, device_table.size(), device_table.evictions,
+         device_table.full, this->stats.no_slot);
+  if (this->stats.replaced_at)
+    printf("replacement:     got a slot %.1f min after the removal\n",
+           (this->stats.replaced_at - this->stats.removed_at) / (double)MINUTE);
+  else if (this->replacement != NONE && this->nodes[this->replacement].joins < end)
+    printf("replacement:     no slot\n");
+  /* Messages LinkStats can notice missing: those between two that
+   * arrived */
+  std::vector<uint16_t> jitters;
+  for (size_t i = 0; i < this->nodes.size(); ++i) {
+    const std::vector<bool> &h = this->nodes[i].handled;
+    size_t first = std::find(h.begin(), h.end(), true) - h.begin();
+    for (size_t m = first; m < h.size(); ++m)
+      this->stats.missing += !h[m];
+    Device *d = device_table.find(this->nodes[i].addr);
+    if (d && d->link.interval)
+      jitters.push_back(d->link.jitter);
+  }
+  std::sort(jitters.begin(), jitters.end());
+  printf("seqnum gaps:     %lu frames estimated lost, %lu missing\n",
+         this->stats.link_lost, this->stats.missing);
+  if (!jitters.empty())
+    printf("jitter:          median %.1f s, max %.1f s over %zu devices\n",
+           jitters[jitters.size() / 2] / 1000.0, jitters.back() / 1000.0, jitters.size());
+  printf("output:          %.1f bytes per frame, %.1f s waiting for serial\n",
+         (double)this->stats.output_bytes / std::max(this->stats.handled, 1UL),
+         this->stats.serial_wait_us / (double)SECOND);
+
+  std::vector<unsigned long> all, push;
+  for (size_t i = 0; i < this->latency.size(); ++i) {
+    all.push_back(this->latency[i].second);
+    if (this->latency[i].first >= this->push_start && this->latency[i].first < this->push_end)
+      push.push_back(this->latency[i].second);
+  }
+  print_latency("latency:", all);
+  if (this->push_start)
+    printf("config push:     %.1f s\n", (this->push_end - this->push_start) / (double)SECOND);
+  print_latency("during push:", push);
+
+  printf("\n%-32s %8s\n", "message type", "sent");
+  for (unsigned t = 0; t < 256; ++t) {
+    MessageTypeInfo info;
+    if (find_message_type((MessageType)t, &info))
+      printf("%-32s %8lu\n", (const char*)info.name, this->stats.sent[t]);
+  }
+}
+
+int main(int argc, char **argv) {
+  /* With the shutter contact and the button, the cube's devices fill
+   * the device table */
+  unsigned cubes = 1, walls = 2, radiators = MAX_DEVICES > 5 ? MAX_DEVICES - 5 : 1;
+  unsigned long minutes = 180, push_at = 60;
+  unsigned loss = 2;
+  unsigned long cpu_us = 2000, baud = 115200;
+  uint8_t levels = OUTPUT_RAW | OUTPUT_MESSAGES | OUTPUT_STATUS;
+  bool allow = false;
+  const char *serial_file = NULL;
+  bool forget = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:w:r:m:p:l:u:b:o:as:f")) != -1) {
+    switch (opt) {
+      case 'c': cubes = strtoul(optarg, NULL, 0); break;
+      case 'w': walls = strtoul(optarg, NULL, 0); break;
+      case 'r': radiators = strtoul(optarg, NULL, 0); break;
+      case 'm': minutes = strtoul(optarg, NULL, 0); break;
+      case 'p': push_at = strtoul(optarg, NULL, 0); break;
+      case 'l': loss = strtoul(optarg, NULL, 0); break;
+      case 'u': cpu_us = strtoul(optarg, NULL, 0); break;
+      case 'b': baud = strtoul(optarg, NULL, 0); break;
+      case 'o':
+        if (!parse_output_levels(optarg, &levels)) {
+          fprintf(stderr, "Invalid output levels: %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'a': allow = true; break;
+      case 's': serial_file = optarg; break;
+      case 'f': forget = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-c cubes] [-w walls] [-r radiators] [-m minutes]\n"
+                        "       [-p push at seconds] [-l loss percent]\n"
+                        "       [-u cpu us per frame] [-b baud] [-o levels] [-a]\n"
+                        "       [-s serial output file] [-f]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (!cubes || !minutes || loss >= 100) {
+    fprintf(stderr, "Need at least one cube, one minute and less than 100%% loss\n");
+    return 1;
+  }
+
+  srand(1);
+  set_simulated_time(0);
+  setup();
+  serial_filter.levels = levels;
+
+  Simulation sim(loss, cpu_us, baud);
+  sim.forget = forget;
+  sim.populate(cubes, walls, radiators);
+
+  address_filter.clear();
+  if (allow)
+    for (size_t i = 0; i < sim.nodes.size() && sim.nodes[i].cube == 0; ++i)
+      address_filter.add(sim.nodes[i].addr);
+
+  unsigned long end = minutes * MINUTE;
+  sim.schedule(end, push_at * SECOND);
+  sim.run(end);
+
+  Stats &s = sim.stats;
+  s.handled = loop_stats.frames;
+  s.crc_errors = loop_stats.crc_errors;
+  s.parse_failures = loop_stats.parse_failures;
+  s.duplicates = frame_handler.duplicates.duplicates;
+  s.rejected = address_filter.rejected;
+  s.link_lost = loop_stats.lost;
+  s.dropped = rf.rxOverflows();
+  s.max_queue = rf.rxQueueMax();
+  sim.report(end);
+
+  if (serial_file) {
+    FILE *f = fopen(serial_file, "w");
+    if (!f || fwrite(Serial.output.data(), 1, Serial.output.size(), f) != Serial.output.size()) {
+      perror(serial_file);
+      return 1;
+    }
+    fclose(f);
+  }
+
+  check(s.handled + s.dropped + s.lost == s.frames, "every frame accounted for");
+  check(s.crc_errors == 0, "generated frames have a correct CRC");
+  check(s.parse_failures == 0, "generated frames parse");
+  /* A device that lost its slot in the table starts counting again */
+  bool slots_kept = true;
+  for (size_t i = 0; i < sim.nodes.size(); ++i)
+    slots_kept = slots_kept && !sim.nodes[i].lost_slot;
+  if (slots_kept)
+    check(s.link_lost == s.missing, "lost frames estimated from seqnum gaps");
+  /* Once the removed device is forgotten or evicted, its replacement
+   * gets a slot with its next state message */
+  #ifdef EVICT_SILENT_MINUTES
+  unsigned thermostats = 0;
+  for (size_t i = 0; i < sim.nodes.size(); ++i)
+    thermostats += i != sim.replacement &&
+                   (sim.nodes[i].kind == Kind::WALL || sim.nodes[i].kind == Kind::RADIATOR);
+  unsigned long slot_free = s.removed_at + (forget ? 0 : EVICT_SILENT_MINUTES * MINUTE);
+  if (s.removed_at && thermostats <= MAX_DEVICES && slot_free + STATE_INTERVAL + JITTER < end &&
+      sim.nodes[sim.replacement].joins + STATE_INTERVAL + JITTER < end)
+    check(s.replaced_at, "the replacement got a slot");
+  #endif // EVICT_SILENT_MINUTES
+  /* With a bit of everything, every message type is sent */
+  if (walls && radiators && push_at && push_at * SECOND < end) {
+    for (unsigned t = 0; t < 256; ++t) {
+      MessageTypeInfo info;
+      if (find_message_type((MessageType)t, &info) && !s.sent[t]) {
+        fprintf(stderr, "Type 0x%02x not sent\n", t);
+        check(false, "every message type sent");
+      }
+    }
+  }
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,278 @@
+/*
+ * Check the transmit path against a mock radio: frames built by
+ * build_frame() decode to the same message, messages are resent until
+ * acked (also by an ack that is too short to parse, or that arrives
+ * while a resend waits for the duty cycle budget), and the airtime in any hour stays within the duty cycle limit,
+ * also when more is queued than the limit allows.
+ *
+ * Usage: bench_tx [-h hours] [-l loss percent]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <TStreaming.h>
+
+#include "Bench.h"
+#include "Crc.h"
+#include "Pn9.h"
+#include "MaxRFProto.h"
+#include "MaxRFSender.h"
+
+const uint32_t OWN_ADDRESS = 0x00b825;
+const uint8_t RETRIES = 3;
+const uint16_t ACK_TIMEOUT = 500;
+const uint16_t DUTY_LIMIT = 36000;
+const unsigned long HOUR = 60 * 60 * 1000UL;
+
+/**
+ * Stands in for MaxRF22: records what was sent and when, and is busy
+ * for the airtime of each frame.
+ */
+class MockRadio {
+public:
+  struct Sent {
+    unsigned long time;
+    uint16_t airtime;
+    bool burst;
+    std::vector<uint8_t> data;
+  };
+
+  MockRadio() : now(0), busy_until(0) {}
+
+  bool sendFrame(const uint8_t *buf, uint8_t len, bool burst) {
+    if (txBusy())
+      return false;
+    Sent s;
+    s.time = now;
+    s.airtime = airtime(len, burst);
+    s.burst = burst;
+    s.data.assign(buf, buf + len);
+    sent.push_back(s);
+    busy_until = now + s.airtime;
+    return true;
+  }
+
+  bool txBusy() { return (long)(now - busy_until) < 0; }
+
+  uint16_t airtime(uint8_t len, bool burst) {
+    return frame_airtime(len, burst ? RF_BURST_PREAMBLE_NIBBLES : RF_PREAMBLE_NIBBLES);
+  }
+
+  unsigned long now;
+  unsigned long busy_until;
+  std::vector<Sent> sent;
+};
+
+typedef MaxRFSender<MockRadio, 4> Sender;
+
+/* Dewhiten a sent frame and check its length byte and CRC. Returns the
+ * header and payload in msg. */
+static bool decode(const MockRadio::Sent &s, std::vector<uint8_t> *msg) {
+  std::vector<uint8_t> buf = s.data;
+  uint16_t crc;
+  if (buf.size() < 3 || xor_pn9_crc(buf.data(), buf.size(), &crc) < 0)
+    return false;
+  size_t len = buf.size();
+  if (buf[0] != len - 1 || buf[len - 2] != (crc >> 8) || buf[len - 1] != (crc & 0xff))
+    return false;
+  msg->assign(buf.begin() + 1, buf.end() - 2);
+  return true;
+}
+
+static void test_build_frame() {
+  MockRadio radio;
+  Sender sender(radio, OWN_ADDRESS, DUTY_LIMIT, RETRIES, ACK_TIMEOUT);
+
+  uint8_t payload[SetTemperatureMessage::PAYLOAD_LEN];
+  SetTemperatureMessage::build_payload(payload, 43, Mode::MANUAL);
+  check(sender.send(MessageType::SET_TEMPERATURE, 0x04c8dd, payload, sizeof(payload), true), "queued");
+  sender.poll(radio.now);
+  check(radio.sent.size() == 1 && radio.sent[0].burst, "sent as burst");
+
+  std::vector<uint8_t> msg;
+  check(decode(radio.sent[0], &msg), "length and CRC");
+
+  MaxRFMessageBuffer storage;
+  MaxRFMessage *m = MaxRFMessage::parse(msg.data(), msg.size(), &storage);
+  check(m && m->type == MessageType::SET_TEMPERATURE, "parses");
+  if (m) {
+    SetTemperatureMessage *st = (SetTemperatureMessage*)m;
+    check(m->addr_from == OWN_ADDRESS && m->addr_to == 0x04c8dd, "addresses");
+    check(st->set_temp == 43 && st->mode == Mode::MANUAL, "payload");
+    m->~MaxRFMessage();
+  }
+
+  /* Setting fields leaves the bits around them alone */
+  uint8_t buf[4] = {0xff, 0xff, 0xff, 0xff};
+  BitField<1, 3, 10, uint16_t>::set(buf, 0);
+  check(buf[0] == 0xff && buf[1] == 0xe0 && buf[2] == 0x07 && buf[3] == 0xff, "BitField::set mask");
+  BitField<1, 3, 10, uint16_t>::set(buf, 0x2a5);
+  check((BitField<1, 3, 10, uint16_t>::get(buf)) == 0x2a5, "BitField::set value");
+}
+
+/* Run until the sender is idle or until the given time */
+static void run(Sender &sender, MockRadio &radio, unsigned long until) {
+  while (!sender.idle() && radio.now < until) {
+    sender.poll(radio.now);
+    radio.now++;
+  }
+}
+
+static void test_retries() {
+  MockRadio radio;
+  Sender sender(radio, OWN_ADDRESS, DUTY_LIMIT, RETRIES, ACK_TIMEOUT);
+  uint8_t payload[1] = {0};
+
+  /* Never acked */
+  sender.send(MessageType::SET_TEMPERATURE, 0x04c8dd, payload, 1, false);
+  run(sender, radio, 60000);
+  check(sender.idle(), "gives up");
+  check(radio.sent.size() == RETRIES + 1, "sent retries + 1 times");
+  check(sender.failed == 1 && sender.retried == RETRIES, "counted as failed");
+  for (size_t i = 1; i < radio.sent.size(); ++i)
+    check(radio.sent[i].time - radio.sent[i - 1].time >= ACK_TIMEOUT, "waits for the ack");
+  for (size_t i = 1; i < radio.sent.size(); ++i)
+    check(radio.sent[i].data == radio.sent[0].data, "resent unchanged");
+
+  /* Acked after the second try */
+  radio.sent.clear();
+  sender.send(MessageType::SET_TEMPERATURE, 0x04c8dd, payload, 1, false);
+  while (radio.sent.size() < 2) {
+    sender.poll(radio.now);
+    radio.now++;
+  }
+  std::vector<uint8_t> msg;
+  decode(radio.sent[1], &msg);
+  sender.ackReceived(0x123456, HeaderLayout::seqnum::get(msg.data()));
+  sender.ackReceived(0x04c8dd, HeaderLayout::seqnum::get(msg.data()) + 1);
+  run(sender, radio, radio.now + ACK_TIMEOUT / 2);
+  sender.ackReceived(0x04c8dd, HeaderLayout::seqnum::get(msg.data()));
+  run(sender, radio, radio.now + 60000);
+  check(radio.sent.size() == 2 && sender.acked == 1, "ack stops retries");
+
+  /* A wall thermostat acks with a single payload byte, which is too
+   * short to parse, but the header is enough */
+  radio.sent.clear();
+  sender.send(MessageType::SET_TEMPERATURE, 0x04c8dd, payload, 1, false);
+  run(sender, radio, radio.now + ACK_TIMEOUT / 2);
+  decode(radio.sent[0], &msg);
+  uint8_t ack[MAX_FRAME_LEN];
+  uint8_t ack_payload[1] = {0x00};
+  uint8_t len = build_frame(ack, HeaderLayout::seqnum::get(msg.data()), 0x00, MessageType::ACK,
+                            0x04c8dd, OWN_ADDRESS, 0, ack_payload, sizeof(ack_payload));
+  xor_pn9(ack, len);
+  MaxRFMessageBuffer storage;
+  check(!MaxRFMessage::parse(ack + 1, len - 3, &storage), "short ack doesn't parse");
+  sender.messageReceived(ack + 1, len - 3);
+  run(sender, radio, radio.now + 60000);
+  check(radio.sent.size() == 1 && sender.acked == 2, "short ack stops retries");
+
+  /* The ack arrives after the timeout, while the resend waits for the
+   * duty cycle budget */
+  MockRadio radio2;
+  uint16_t airtime = radio2.airtime(radio.sent[0].data.size(), false);
+  Sender tight(radio2, OWN_ADDRESS, airtime, RETRIES, ACK_TIMEOUT);
+  tight.send(MessageType::SET_TEMPERATURE, 0x04c8dd, payload, 1, false);
+  run(tight, radio2, ACK_TIMEOUT * 2);
+  check(radio2.sent.size() == 1 && tight.deferred == 1, "resend waits for the budget");
+  decode(radio2.sent[0], &msg);
+  tight.ackReceived(0x04c8dd, HeaderLayout::seqnum::get(msg.data()));
+  check(tight.idle() && tight.acked == 1, "late ack accepted");
+  run(tight, radio2, HOUR * 2);
+  check(radio2.sent.size() == 1, "not resent after a late ack");
+
+  /* Broadcasts are not acked */
+  radio.sent.clear();
+  sender.send(MessageType::TIME_INFORMATION, 0, payload, 1, false);
+  run(sender, radio, radio.now + 60000);
+  check(radio.sent.size() == 1, "broadcast sent once");
+}
+
+/*
+ * Keep the queue full of burst messages, with loss_pct of them not
+ * acked, and check that no hour ever has more airtime than allowed.
+ */
+static void test_duty_cycle(unsigned long hours, unsigned loss_pct) {
+  MockRadio radio;
+  Sender sender(radio, OWN_ADDRESS, DUTY_LIMIT, RETRIES, ACK_TIMEOUT);
+  uint8_t payload[1] = {0};
+  size_t acked_upto = 0;
+  unsigned long end = hours * HOUR;
+
+  srand(1);
+  uint64_t start = now_ns();
+  while (radio.now < end) {
+    while (sender.send(MessageType::SET_TEMPERATURE, 0x04c8dd, payload, 1, true))
+      ;
+    sender.poll(radio.now);
+
+    /* Ack the new transmissions once they are sent */
+    if (acked_upto < radio.sent.size() && !radio.txBusy()) {
+      std::vector<uint8_t> msg;
+      decode(radio.sent[acked_upto], &msg);
+      if ((unsigned)(rand() % 100) >= loss_pct)
+        sender.ackReceived(0x04c8dd, HeaderLayout::seqnum::get(msg.data()));
+      acked_upto = radio.sent.size();
+    }
+    radio.now += 10;
+  }
+  uint64_t total_ns = now_ns() - start;
+
+  /* Sliding window over all transmissions */
+  uint32_t max_hour = 0;
+  uint32_t window = 0;
+  size_t first = 0;
+  uint64_t total_airtime = 0;
+  for (size_t i = 0; i < radio.sent.size(); ++i) {
+    window += radio.sent[i].airtime;
+    total_airtime += radio.sent[i].airtime;
+    while (radio.sent[i].time - radio.sent[first].time >= HOUR)
+      window -= radio.sent[first++].airtime;
+    if (window > max_hour)
+      max_hour = window;
+  }
+
+  check(max_hour <= DUTY_LIMIT, "airtime per hour within the limit");
+  check(sender.deferred > 0, "duty cycle limit reached");
+
+  printf("duty cycle:      %lu hours, %u%% loss\n", hours, loss_pct);
+  printf("transmissions:   %zu (%u retries, %u acked, %u failed)\n",
+         radio.sent.size(), sender.retried, sender.acked, sender.failed);
+  printf("burst airtime:   %u ms\n", radio.airtime(radio.sent[0].data.size(), true));
+  printf("max per hour:    %u ms of %u ms\n", max_hour, DUTY_LIMIT);
+  printf("average use:     %.1f%% of the limit\n",
+         100.0 * total_airtime / ((double)hours * DUTY_LIMIT));
+  printf("simulation:      %.1f ns per poll\n", (double)total_ns / (end / 10));
+}
+
+int main(int argc, char **argv) {
+  unsigned long hours = 5;
+  unsigned loss_pct = 20;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "h:l:")) != -1) {
+    switch (opt) {
+      case 'h': hours = strtoul(optarg, NULL, 0); break;
+      case 'l': loss_pct = strtoul(optarg, NULL, 0); break;
+      default:
+        fprintf(stderr, "Usage: %s [-h hours] [-l loss percent]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (hours < 1) {
+    fprintf(stderr, "Need at least one hour\n");
+    return 1;
+  }
+
+  test_build_frame();
+  test_retries();
+  test_duty_cycle(hours, loss_pct);
+
+  return check_result();
+}
+
+/* vim: set sw=2 sts=2 expandtab: */
@@ -0,0 +1,54 @@
+/*
+ * Convert the binary telemetry stream from the sketch (see Telemetry.h)
+ * back into STATUS lines. Anything else in the stream, such as the
+ * normal text output, is skipped.
+ *
+ * Usage: telemetry_decode [-s] [file]
+ *   -s  print decoder statistics to stderr at the end
+ *
+ * Reads from stdin when no file is given, so it can be used as:
+ *
+ *   nc arduino 1234 | telemetry_decode
+ */
+#include <stdio.h>
+#include <unistd.h>
+
+#include "Bench.h"
+#include "TelemetryDecoder.h"
+
+int main(int argc, char **argv) {
+  bool stats = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "s")) != -1) {
+    switch (opt) {
+      case 's': stats = true; break;
+      default:
+        fprintf(stderr, "Usage: %s [-s] [file]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  FILE *in = stdin;
+  if (optind < argc && !(in = fopen(argv[optind], "rb"))) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  static TelemetryDecoder decoder;
+  StdoutPrint out;
+  int c;
+  while ((c = getc(in)) != EOF) {
+    if (decoder.feed(c)) {
+      decoder.printStatus(out);
+      fflush(stdout);
+    }
+  }
+
+  if (stats)
+    fprintf(stderr, "frames: %u (%u keyframes), invalid: %u, gaps: %u, skipped: %u, junk bytes: %u\n",
+            decoder.frames, decoder.keyframes, decoder.invalid, decoder.gaps,
+            decoder.skipped, decoder.junk);
+  return 0;
+}
+
+/* vim: set sw=2 sts=2 expandtab: */